@@ -0,0 +1,619 @@
+/*
+ * bench_elastic.c — micro-benchmarks for the Elastic Hash Table
+ *
+ * Build:  gcc -O2 -pthread -o bench_elastic bench_elastic.c elastic_hash_table.c -lm
+ * Run:    ./bench_elastic [n_keys]
+ *
+ * Keys are generated up front so the timings cover table work only.
+ */
+
+#include "elastic_hash_table.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                            */
+/* ------------------------------------------------------------------ */
+
+#define KEY_LEN 24
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static char* make_keys(size_t n, const char* prefix)
+{
+    char* keys = (char*)malloc(n * KEY_LEN);
+    if (!keys) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        snprintf(keys + i * KEY_LEN, KEY_LEN, "%s%zu", prefix, i);
+    return keys;
+}
+
+/*  Hardware cache-miss counter for the calling thread, or -1 with errno
+ *  set where perf events are unavailable (non-Linux, containers,
+ *  perf_event_paranoid; see README). */
+static int miss_counter_open(void)
+{
+#if defined(__linux__)
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.type           = PERF_TYPE_HW_CACHE;
+    pe.size           = sizeof(pe);
+    pe.config         = PERF_COUNT_HW_CACHE_L1D
+                      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    pe.exclude_kernel = 1;
+    pe.exclude_hv     = 1;
+    return (int)syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static long long miss_counter_read(int fd)
+{
+    long long v = 0;
+#if defined(__linux__)
+    if (fd >= 0 && read(fd, &v, sizeof(v)) != (ssize_t)sizeof(v)) v = 0;
+#else
+    (void)fd;
+#endif
+    return v;
+}
+
+/* Bytes currently allocated from the heap, where glibc can tell us */
+static long long heap_bytes(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+    return (long long)(mi.uordblks + mi.hblkhd);   /* + mmap()ed blocks */
+#else
+    return -1;
+#endif
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Mean lookup time over all keys, plus p99 from per-call timings */
+static void time_lookups(ElasticHashTable* t, const char* keys, size_t n,
+                         double* mean_out, double* p99_out)
+{
+    const void* v;
+    size_t      len;
+    size_t      found = 0;
+
+    double t0 = now_ns();
+    for (size_t i = 0; i < n; ++i)
+        found += (size_t)eht_get(t, keys + i * KEY_LEN, &v, &len);
+    *mean_out = (now_ns() - t0) / (double)n;
+
+    double* lat = (double*)malloc(n * sizeof(double));
+    if (!lat) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i) {
+        double s = now_ns();
+        found += (size_t)eht_get(t, keys + i * KEY_LEN, &v, &len);
+        lat[i] = now_ns() - s;
+    }
+    qsort(lat, n, sizeof(double), cmp_double);
+    *p99_out = lat[(n * 99) / 100];
+    free(lat);
+
+    if (found == (size_t)-1) puts("");   /* keep the loops live */
+}
+
+/* ------------------------------------------------------------------ */
+/* Robin Hood vs. the no-reordering default                           */
+/* ------------------------------------------------------------------ */
+
+static void bench_reordering(const char* hits, const char* misses, size_t n)
+{
+    static const double loads[] = { 0.50, 0.75, 0.89 };
+    static const struct { const char* name; unsigned flags; } modes[] = {
+        { "default",    0                   },
+        { "robin-hood", EHT_FLAG_ROBIN_HOOD },
+    };
+
+    printf("%-11s %5s | %9s | %9s %9s | %9s %9s\n",
+           "mode", "load", "insert", "hit", "hit p99", "miss", "miss p99");
+    for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); ++l) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+            size_t cap = (size_t)((double)n / loads[l]) + 1;
+            ElasticHashTable* t = eht_create_ex(cap, modes[m].flags);
+            if (!t) { perror("eht_create_ex"); exit(1); }
+
+            double t0 = now_ns();
+            for (size_t i = 0; i < n; ++i)
+                eht_insert(t, hits + i * KEY_LEN, &i, sizeof(i));
+            double ins = (now_ns() - t0) / (double)n;
+
+            double hit, hit99, miss, miss99;
+            time_lookups(t, hits,   n, &hit,  &hit99);
+            time_lookups(t, misses, n, &miss, &miss99);
+
+            printf("%-11s %5.2f | %6.0f ns | %6.0f ns %6.0f ns "
+                   "| %6.0f ns %6.0f ns\n",
+                   modes[m].name, loads[l], ins, hit, hit99, miss, miss99);
+            eht_destroy(t);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Level hints: levels a miss probes, against the levels in use that  */
+/* an unhinted miss would probe                                       */
+/* ------------------------------------------------------------------ */
+
+static void bench_hints(const char* hits, const char* misses, size_t n)
+{
+    static const double loads[] = { 0.75, 0.89 };
+    static const struct { const char* name; unsigned flags; } modes[] = {
+        { "default",    0                   },
+        { "robin-hood", EHT_FLAG_ROBIN_HOOD },
+        { "adaptive",   EHT_FLAG_ADAPTIVE   },
+    };
+
+    printf("%-11s %5s | %7s | %11s %11s | %9s\n",
+           "mode", "load", "in use", "miss levels", "miss probes", "miss");
+    for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); ++l) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+            size_t cap = (size_t)((double)n / loads[l]) + 1;
+            ElasticHashTable* t = eht_create_ex(cap, modes[m].flags);
+            if (!t) { perror("eht_create_ex"); exit(1); }
+            for (size_t i = 0; i < n; ++i)
+                eht_insert(t, hits + i * KEY_LEN, &i, sizeof(i));
+
+            size_t        nl   = eht_num_levels(t), used = 0;
+            EHTLevelInfo* info = (EHTLevelInfo*)malloc(nl * sizeof *info);
+            if (!info) { perror("malloc"); exit(1); }
+            eht_level_stats(t, info, nl);
+            for (size_t i = 0; i < nl; ++i) used += info[i].count > 0;
+            free(info);
+
+            size_t levels = 0, probes = 0;
+            for (size_t i = 0; i < n; ++i) {
+                size_t lv;
+                probes += eht_lookup_probes(t, misses + i * KEY_LEN, &lv);
+                levels += lv;
+            }
+            double miss, miss99;
+            time_lookups(t, misses, n, &miss, &miss99);
+
+            printf("%-11s %5.2f | %7zu | %11.2f %11.1f | %6.0f ns\n",
+                   modes[m].name, loads[l], used, (double)levels / (double)n,
+                   (double)probes / (double)n, miss);
+            eht_destroy(t);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Iteration over a sparse, post-delete table                         */
+/* ------------------------------------------------------------------ */
+
+static void bench_iteration(const char* hits, size_t n)
+{
+    ElasticHashTable* t = eht_create(n * 4);
+    if (!t) { perror("eht_create"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        eht_insert(t, hits + i * KEY_LEN, &i, sizeof(i));
+    for (size_t i = 0; i < n; ++i)
+        if (i % 8) eht_delete(t, hits + i * KEY_LEN);
+
+    const char* k;
+    const void* v;
+    size_t      len, seen = 0;
+    int         rounds = 20;
+
+    double t0 = now_ns();
+    for (int r = 0; r < rounds; ++r) {
+        EHTIterator* it = eht_iter_create(t);
+        while (eht_iter_next(it, &k, &v, &len)) ++seen;
+        eht_iter_destroy(it);
+    }
+    double per_pass = (now_ns() - t0) / rounds;
+
+    printf("iterate %zu live of %zu slots: %.2f ms/pass, %.1f ns/slot\n",
+           seen / (size_t)rounds, eht_capacity(t), per_pass / 1e6,
+           per_pass / (double)eht_capacity(t));
+    eht_destroy(t);
+}
+
+/* ------------------------------------------------------------------ */
+/* Cache misses per lookup on a table larger than the caches          */
+/* ------------------------------------------------------------------ */
+
+static void bench_cache_misses(const char* hits, const char* misses, size_t n,
+                               const char* mode, unsigned flags)
+{
+    ElasticHashTable* t = eht_create_ex(n + n / 4, flags);
+    if (!t) { perror("eht_create_ex"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        eht_insert(t, hits + i * KEY_LEN, &i, sizeof(i));
+
+    /* Visit keys in a scattered order so consecutive lookups share
+     * no cache lines by construction */
+    size_t* order = (size_t*)malloc(n * sizeof(size_t));
+    if (!order) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        order[i] = (i * 2654435761u) % n;
+
+    int         fd  = miss_counter_open();
+    const char* why = fd < 0 ? strerror(errno) : NULL;
+    const char* sets[2]  = { hits, misses };
+    const char* names[2] = { "hit", "miss" };
+    for (int k = 0; k < 2; ++k) {
+        const void* v;
+        size_t      len, found = 0;
+        long long   m0 = miss_counter_read(fd);
+        double      t0 = now_ns();
+        for (size_t i = 0; i < n; ++i)
+            found += (size_t)eht_get(t, sets[k] + order[i] * KEY_LEN, &v, &len);
+        double      ns = (now_ns() - t0) / (double)n;
+        long long   m  = miss_counter_read(fd) - m0;
+
+        if (fd >= 0)
+            printf("%-8s %-4s lookups: %6.0f ns, %5.2f L1D misses/lookup\n",
+                   mode, names[k], ns, (double)m / (double)n);
+        else
+            printf("%-8s %-4s lookups: %6.0f ns, L1D misses n/a "
+                   "(perf_event_open: %s)\n", mode, names[k], ns, why);
+        if (found == (size_t)-1) puts("");
+    }
+#if defined(__linux__)
+    if (fd >= 0) close(fd);
+#endif
+    free(order);
+    eht_destroy(t);
+}
+
+/* ------------------------------------------------------------------ */
+/* Pipelined lookups: eht_prefetch issued a few keys ahead            */
+/* ------------------------------------------------------------------ */
+
+#define PIPELINE_AHEAD 8
+
+static void bench_pipelined(const char* hits, size_t n)
+{
+    ElasticHashTable* t = eht_create(n + n / 4);
+    if (!t) { perror("eht_create"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        eht_insert(t, hits + i * KEY_LEN, &i, sizeof(i));
+
+    const char** keys = (const char**)malloc(n * sizeof(char*));
+    if (!keys) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        keys[i] = hits + ((i * 2654435761u) % n) * KEY_LEN;
+
+    uint64_t    tokens[PIPELINE_AHEAD];
+    const void* v;
+    size_t      len, found = 0;
+
+    double t0 = now_ns();
+    for (size_t i = 0; i < PIPELINE_AHEAD && i < n; ++i)
+        tokens[i] = eht_prefetch(t, keys[i]);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t tok = tokens[i % PIPELINE_AHEAD];
+        if (i + PIPELINE_AHEAD < n)
+            tokens[i % PIPELINE_AHEAD] = eht_prefetch(t, keys[i + PIPELINE_AHEAD]);
+        found += (size_t)eht_get_hashed(t, keys[i], tok, &v, &len);
+    }
+    double piped = (now_ns() - t0) / (double)n;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; ++i)
+        found += (size_t)eht_get(t, keys[i], &v, &len);
+    double plain = (now_ns() - t0) / (double)n;
+
+    printf("hit lookups: %.0f ns plain, %.0f ns pipelined %d ahead\n",
+           plain, piped, PIPELINE_AHEAD);
+    if (found == (size_t)-1) puts("");
+    free(keys);
+    eht_destroy(t);
+}
+
+/* ------------------------------------------------------------------ */
+/* Batch hashing and lookups                                          */
+/* ------------------------------------------------------------------ */
+
+static void bench_batch(const char* hits, size_t n)
+{
+    ElasticHashTable* t = eht_create(n + n / 4);
+    if (!t) { perror("eht_create"); exit(1); }
+
+    const char** keys   = (const char**)malloc(n * sizeof(char*));
+    const void** vals   = (const void**)malloc(n * sizeof(void*));
+    size_t*      lens   = (size_t*)malloc(n * sizeof(size_t));
+    int*         found  = (int*)malloc(n * sizeof(int));
+    uint64_t*    hashes = (uint64_t*)malloc(n * sizeof(uint64_t));
+    if (!keys || !vals || !lens || !found || !hashes) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = hits + i * KEY_LEN;
+        vals[i] = &keys[i];
+        lens[i] = sizeof(char*);
+    }
+    eht_insert_many(t, keys, n, vals, lens);
+
+    uint64_t sink = 0;
+    double t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) sink ^= eht_hash(keys[i]);
+    double one = (now_ns() - t0) / (double)n;
+
+    t0 = now_ns();
+    eht_hash_many(keys, n, hashes);
+    double many = (now_ns() - t0) / (double)n;
+
+    size_t got = 0;
+    t0 = now_ns();
+    for (size_t i = 0; i < n; ++i)
+        got += (size_t)eht_get(t, keys[i], &vals[i], &lens[i]);
+    double get1 = (now_ns() - t0) / (double)n;
+
+    t0 = now_ns();
+    got += eht_get_many(t, keys, n, vals, lens, found);
+    double getn = (now_ns() - t0) / (double)n;
+
+    printf("hash: %.1f ns/key eht_hash, %.1f ns/key eht_hash_many\n", one, many);
+    printf("get:  %.0f ns/key eht_get,  %.0f ns/key eht_get_many\n", get1, getn);
+    if (got == (size_t)-1 || (sink ^ hashes[0]) == 1) puts("");
+
+    free(keys); free(vals); free(lens); free(found); free(hashes);
+    eht_destroy(t);
+}
+
+/* ------------------------------------------------------------------ */
+/* Hash functions: throughput by key length, and bucket uniformity    */
+/* ------------------------------------------------------------------ */
+
+#define CHI_BITS 16
+
+/*  chi-squared / degrees of freedom of the hashes' top or bottom
+ *  CHI_BITS bits over 2^CHI_BITS buckets; about 1.0 when uniform */
+static double chi_per_df(const uint64_t* h, size_t n, int high)
+{
+    size_t  nb     = (size_t)1 << CHI_BITS;
+    size_t* counts = (size_t*)calloc(nb, sizeof(size_t));
+    if (!counts) { perror("calloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        counts[high ? h[i] >> (64 - CHI_BITS) : h[i] & (nb - 1)]++;
+    double expect = (double)n / (double)nb, chi = 0;
+    for (size_t b = 0; b < nb; ++b) {
+        double d = (double)counts[b] - expect;
+        chi += d * d / expect;
+    }
+    free(counts);
+    return chi / (double)(nb - 1);
+}
+
+static void bench_hash_functions(const char* hits, size_t n)
+{
+    static const struct { const char* name; EHTHashKind kind; } hashes[] = {
+        { "fnv1a",  EHT_HASH_FNV1A  },
+        { "wyhash", EHT_HASH_WYHASH },
+        { "crc32c", EHT_HASH_CRC32C },
+    };
+    static const size_t lens[] = { 8, 16, 32, 64, 256 };
+    enum { NLEN = sizeof(lens) / sizeof(lens[0]), NKEYS = 4096 };
+
+    /* NKEYS random keys of each length */
+    char* buf = (char*)malloc(NKEYS * 257);
+    if (!buf) { perror("malloc"); exit(1); }
+    uint64_t* h = (uint64_t*)malloc(n * sizeof(uint64_t));
+    if (!h) { perror("malloc"); exit(1); }
+
+    printf("%-7s", "hash");
+    for (size_t l = 0; l < NLEN; ++l) printf(" %6zu B", lens[l]);
+    printf(" | chi2/df low  high\n");
+
+    for (size_t f = 0; f < sizeof(hashes) / sizeof(hashes[0]); ++f) {
+        ElasticHashTable* t = eht_create_with_hash(0, 0, hashes[f].kind,
+                                                   NULL, NULL);
+        if (!t) { perror("eht_create_with_hash"); exit(1); }
+        printf("%-7s", hashes[f].name);
+
+        uint64_t sink = 0;
+        for (size_t l = 0; l < NLEN; ++l) {
+            srand(1);
+            for (size_t i = 0; i < NKEYS; ++i) {
+                char* k = buf + i * 257;
+                for (size_t j = 0; j < lens[l]; ++j) k[j] = (char)('!' + rand() % 90);
+                k[lens[l]] = '\0';
+            }
+            double best = 1e300;     /* best round: this is a tight loop */
+            for (int r = 0; r < 20; ++r) {
+                double t0 = now_ns();
+                for (size_t i = 0; i < NKEYS; ++i)
+                    sink ^= eht_table_hash(t, buf + i * 257);
+                double dt = now_ns() - t0;
+                if (dt < best) best = dt;
+            }
+            printf(" %5.1f ns", best / (double)NKEYS);
+        }
+
+        /* Sequential "key:N" keys are the hard case for weak low bits */
+        for (size_t i = 0; i < n; ++i)
+            h[i] = eht_table_hash(t, hits + i * KEY_LEN);
+        printf(" |       %5.2f %5.2f\n", chi_per_df(h, n, 0), chi_per_df(h, n, 1));
+        if (sink == 1) puts("");
+        eht_destroy(t);
+    }
+    free(h);
+    free(buf);
+}
+
+/* ------------------------------------------------------------------ */
+/* Freezing: eht_freeze and eht_freeze_perfect on a churned table     */
+/* ------------------------------------------------------------------ */
+
+static void bench_freeze(const char* hits, const char* misses, size_t n)
+{
+    long long h0 = heap_bytes();
+    ElasticHashTable* t = eht_create_ex(n + n / 4, 0);
+    if (!t) { perror("eht_create_ex"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        eht_insert(t, hits + i * KEY_LEN, &i, sizeof(i));
+    for (size_t i = 0; i < n; i += 8)     /* leave some tombstones */
+        eht_delete(t, hits + i * KEY_LEN);
+
+    static const char* names[3] = { "mutable", "frozen", "perfect" };
+    for (int stage = 0; stage < 3; ++stage) {
+        if (stage > 0) {
+            double t0 = now_ns();
+            int    rc = stage == 1 ? eht_freeze(t) : eht_freeze_perfect(t);
+            if (rc < 0) { perror("eht_freeze"); exit(1); }
+            printf("%s: %.1f ms\n",
+                   stage == 1 ? "eht_freeze" : "eht_freeze_perfect",
+                   (now_ns() - t0) / 1e6);
+        }
+        double hit, hit99, miss, miss99;
+        time_lookups(t, hits,   n, &hit,  &hit99);
+        time_lookups(t, misses, n, &miss, &miss99);
+        long long mem = heap_bytes();
+        printf("%-7s %7zu slots | hit %5.0f ns p99 %5.0f | miss %5.0f ns "
+               "p99 %5.0f | ",
+               names[stage], eht_capacity(t), hit, hit99, miss, miss99);
+        if (mem >= 0 && h0 >= 0)
+            printf("%.1f heap bytes/key", (double)(mem - h0) / (double)eht_len(t));
+        else
+            printf("heap n/a");
+        if (stage == 2)
+            printf(", index %.2f bits/key",
+                   8.0 * (double)eht_perfect_index_bytes(t) / (double)eht_len(t));
+        printf("\n");
+    }
+    eht_destroy(t);
+}
+
+/* ------------------------------------------------------------------ */
+/* Hash join against a lookup loop                                    */
+/* ------------------------------------------------------------------ */
+
+static unsigned cpu_count(void)
+{
+#if defined(__linux__)
+    long c = sysconf(_SC_NPROCESSORS_ONLN);
+    return c > 0 ? (unsigned)c : 1;
+#else
+    return 4;
+#endif
+}
+
+/*  A primary-key / foreign-key join: n unique build keys, 4n probe rows
+ *  of which 3 in 4 match.  The baseline inserts each build row into a
+ *  default table and calls eht_get for each probe row. */
+static void bench_join(const char* hits, const char* misses, size_t n)
+{
+    size_t       np    = 4 * n;
+    const char** build = (const char**)malloc(n * sizeof(char*));
+    const char** probe = (const char**)malloc(np * sizeof(char*));
+    size_t*      bout  = (size_t*)malloc(np * sizeof(size_t));
+    size_t*      pout  = (size_t*)malloc(np * sizeof(size_t));
+    if (!build || !probe || !bout || !pout) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i) build[i] = hits + i * KEY_LEN;
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < np; ++i) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        probe[i] = (x & 3 ? hits : misses) + (size_t)((x >> 8) % n) * KEY_LEN;
+    }
+
+    double t0 = now_ns();
+    ElasticHashTable* t = eht_create(16);
+    if (!t) { perror("eht_create"); exit(1); }
+    for (size_t i = 0; i < n; ++i)
+        eht_insert(t, build[i], &i, sizeof(i));
+    double t1 = now_ns();
+    size_t m = 0;
+    for (size_t i = 0; i < np; ++i) {
+        const void* v;
+        size_t      len;
+        if (eht_get(t, probe[i], &v, &len)) {
+            memcpy(&bout[m], v, sizeof(size_t));
+            pout[m++] = i;
+        }
+    }
+    double t2 = now_ns();
+    printf("%-16s build %6.1f ms | probe %6.1f ms | %zu pairs\n",
+           "insert + eht_get", (t1 - t0) / 1e6, (t2 - t1) / 1e6, m);
+    eht_destroy(t);
+
+    unsigned cpus = cpu_count();
+    for (unsigned threads = 1; ; threads = cpus) {
+        EHTJoinPairs out = { 0 };
+        t0 = now_ns();
+        EHTJoin* j = eht_join_build(build, n, threads);
+        if (!j) { perror("eht_join_build"); exit(1); }
+        t1 = now_ns();
+        if (eht_join_probe(j, probe, np, threads, &out) < 0) {
+            perror("eht_join_probe");
+            exit(1);
+        }
+        t2 = now_ns();
+        char name[32];
+        snprintf(name, sizeof name, "eht_join x%u", threads);
+        printf("%-16s build %6.1f ms | probe %6.1f ms | %zu pairs\n",
+               name, (t1 - t0) / 1e6, (t2 - t1) / 1e6, out.n);
+        eht_join_pairs_free(&out);
+        eht_join_destroy(j);
+        if (threads == cpus) break;
+    }
+
+    free(build); free(probe); free(bout); free(pout);
+}
+
+/* ------------------------------------------------------------------ */
+/* Main                                                               */
+/* ------------------------------------------------------------------ */
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 200000;
+    if (n == 0) n = 200000;
+
+    char* hits   = make_keys(n, "key:");
+    char* misses = make_keys(n, "miss:");
+
+    printf("Elastic Hash Table benchmarks — %zu keys\n\n", n);
+    bench_reordering(hits, misses, n);
+    printf("\n");
+    bench_hints(hits, misses, n);
+    printf("\n");
+    bench_iteration(hits, n);
+    printf("\n");
+    bench_cache_misses(hits, misses, n, "default",  0);
+    bench_cache_misses(hits, misses, n, "prefetch", EHT_FLAG_PREFETCH);
+    printf("\n");
+    bench_pipelined(hits, n);
+    printf("\n");
+    bench_batch(hits, n);
+    printf("\n");
+    bench_hash_functions(hits, n);
+    printf("\n");
+    bench_freeze(hits, misses, n);
+    printf("\n");
+    bench_join(hits, misses, n);
+
+    free(hits);
+    free(misses);
+    return 0;
+}
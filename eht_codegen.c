@@ -0,0 +1,120 @@
+/*
+ * eht_codegen.c — compiles key/value files into a static table
+ *
+ * Build:  gcc -O2 -o eht_codegen eht_codegen.c elastic_hash_table.c -lm
+ * Run:    ./eht_codegen [-n name] [-H fnv1a|wyhash|crc32c] [-z] [-o out.c]
+ *                       file...
+ *
+ * Each input line is `key<TAB>value`; a line without a tab maps the key
+ * to an empty value, and a key seen again (in the same or a later file)
+ * takes the later value.  With -z every value is stored with a trailing
+ * NUL so it can be used as a C string.  The output defines
+ * `const EHTStaticTable name` (default `eht_table`) for eht_static_get;
+ * link it with elastic_hash_table.c.
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* getline */
+
+#include "elastic_hash_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+static void usage(void)
+{
+    fputs("usage: eht_codegen [-n name] [-H fnv1a|wyhash|crc32c] [-z]"
+          " [-o out.c] file...\n", stderr);
+    exit(2);
+}
+
+static int load(ElasticHashTable* t, const char* path, int nul)
+{
+    FILE* f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char*  line = NULL;
+    size_t cap  = 0;
+    ssize_t len;
+    int    rc   = 0;
+    while ((len = getline(&line, &cap, f)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0) continue;
+        char* value = memchr(line, '\t', (size_t)len);
+        size_t vlen = 0;
+        if (value) {
+            *value++ = '\0';
+            vlen = (size_t)(line + len - value);
+        } else {
+            value = line + len;
+        }
+        if (eht_insert(t, line, value, vlen + (nul ? 1 : 0)) != 0) {
+            fprintf(stderr, "%s: out of memory\n", path);
+            rc = -1;
+            break;
+        }
+    }
+    free(line);
+    if (f != stdin) fclose(f);
+    return rc;
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = "eht_table";
+    const char* out  = NULL;
+    EHTHashKind kind = EHT_HASH_FNV1A;
+    int         nul  = 0;
+    int         i    = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (!strcmp(argv[i], "-z")) {
+            nul = 1;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            name = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            out = argv[++i];
+        } else if (!strcmp(argv[i], "-H") && i + 1 < argc) {
+            const char* h = argv[++i];
+            if (!strcmp(h, "fnv1a"))       kind = EHT_HASH_FNV1A;
+            else if (!strcmp(h, "wyhash")) kind = EHT_HASH_WYHASH;
+            else if (!strcmp(h, "crc32c")) kind = EHT_HASH_CRC32C;
+            else usage();
+        } else {
+            usage();
+        }
+    }
+    if (i == argc) usage();
+
+    ElasticHashTable* t = eht_create_with_hash(1024, 0, kind, NULL, NULL);
+    if (!t) {
+        fputs("eht_codegen: out of memory\n", stderr);
+        return 1;
+    }
+    for (; i < argc; ++i) {
+        if (load(t, argv[i], nul) < 0) {
+            eht_destroy(t);
+            return 1;
+        }
+    }
+
+    char path[4096];
+    if (!out) {
+        snprintf(path, sizeof path, "%s.c", name);
+        out = path;
+    }
+    size_t n = eht_len(t);
+    if (eht_write_c(t, out, name) < 0) {
+        fprintf(stderr, "eht_codegen: cannot write %s\n", out);
+        eht_destroy(t);
+        return 1;
+    }
+    fprintf(stderr, "%s: %zu keys, %zu index bytes\n", out, n,
+            eht_perfect_index_bytes(t));
+    eht_destroy(t);
+    return 0;
+}
@@ -0,0 +1,511 @@
+/*
+ * eht_loadgen.c — load generator for eht_server (binary protocol, RESP
+ *                 or memcached)
+ *
+ * Build:  gcc -O2 -pthread -o eht_loadgen eht_loadgen.c
+ * Run:    ./eht_loadgen [-h host] [-p port | -u path] [-c conns]
+ *                       [-n requests] [-P pipeline] [-k keys] [-d bytes]
+ *                       [-r get_ratio] [-b mget_batch] [-l] [-R | -M]
+ *
+ * Each connection runs in its own thread and keeps -P requests in
+ * flight: it sends a batch, then reads the batch's responses, timing
+ * the round trip.  Requests are GETs with probability -r (default 0.9)
+ * and SETs otherwise, over -k keys "key:N" with -d byte values; with
+ * -b N > 1 each GET becomes an MGET of N keys.  -l first SETs every key
+ * once so GETs hit.  -R speaks RESP instead (GET/SET/MGET), so the same
+ * run can be pointed at eht_server -r or at Redis itself; -M likewise
+ * speaks the memcached text protocol (get/set, multi-key get) for
+ * eht_server -a or memcached.  The summary is one line of key=value
+ * pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+enum { BIN_GET = 1, BIN_SET, BIN_DEL, BIN_MGET, BIN_LEN, BIN_PING };
+enum { ST_OK = 0, ST_MISS, ST_ERR };
+
+static const char* g_host    = "127.0.0.1";
+static int         g_port    = 7070;
+static const char* g_upath   = NULL;
+static long        g_conns   = 4;
+static long        g_total   = 200000;
+static long        g_pipe    = 16;
+static long        g_keys    = 100000;
+static long        g_vsize   = 32;
+static double      g_ratio   = 0.9;
+static long        g_batch   = 1;
+static int         g_load    = 0;
+static int         g_resp    = 0;
+static int         g_mc      = 0;
+
+/* Clients load, then meet here so the timed run starts together */
+static pthread_barrier_t g_start;
+
+/* Round-trip latencies: 64 power-of-two buckets of nanoseconds */
+#define NBUCKETS 64
+
+typedef struct {
+    pthread_t th;
+    int       id;
+    long      requests;
+    long      done, hits, misses, errors;
+    uint64_t  hist[NBUCKETS];
+} Client;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v;         p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int connect_server(void)
+{
+    int fd;
+    if (g_upath) {
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof sa);
+        sa.sun_family = AF_UNIX;
+        snprintf(sa.sun_path, sizeof sa.sun_path, "%s", g_upath);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr*)&sa, sizeof sa) < 0)
+            return -1;
+    } else {
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof sa);
+        sa.sin_family = AF_INET;
+        sa.sin_port   = htons((uint16_t)g_port);
+        if (inet_pton(AF_INET, g_host, &sa.sin_addr) != 1) return -1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr*)&sa, sizeof sa) < 0)
+            return -1;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    }
+    return fd;
+}
+
+static int send_all(int fd, const uint8_t* p, size_t n)
+{
+    while (n) {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+/* Buffered reads: RESP replies are line-oriented */
+typedef struct {
+    int      fd;
+    uint8_t* buf;
+    size_t   a, b, cap;   /* unread bytes are buf[a..b) */
+} Reader;
+
+static int rd_fill(Reader* r)
+{
+    if (r->a == r->b) r->a = r->b = 0;
+    if (r->b == r->cap) {
+        if (r->a) {
+            memmove(r->buf, r->buf + r->a, r->b - r->a);
+            r->b -= r->a;
+            r->a  = 0;
+        } else {
+            r->cap  = r->cap ? r->cap * 2 : 65536;
+            r->buf  = (uint8_t*)realloc(r->buf, r->cap);
+            if (!r->buf) return -1;
+        }
+    }
+    for (;;) {
+        ssize_t k = recv(r->fd, r->buf + r->b, r->cap - r->b, 0);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        r->b += (size_t)k;
+        return 0;
+    }
+}
+
+/*  Points *p at the next n bytes, reading as needed. */
+static int rd_take(Reader* r, size_t n, const uint8_t** p)
+{
+    while (r->b - r->a < n)
+        if (rd_fill(r) < 0) return -1;
+    *p    = r->buf + r->a;
+    r->a += n;
+    return 0;
+}
+
+/*  Next CRLF-terminated line, without the CRLF. */
+static int rd_line(Reader* r, const char** line, size_t* n)
+{
+    size_t scanned = r->a;
+    for (;;) {
+        uint8_t* nl = (uint8_t*)memchr(r->buf + scanned, '\n', r->b - scanned);
+        if (nl) {
+            *line = (const char*)r->buf + r->a;
+            *n    = (size_t)(nl - (r->buf + r->a)) - 1;
+            r->a  = (size_t)(nl - r->buf) + 1;
+            return 0;
+        }
+        size_t off = r->b - r->a;
+        if (rd_fill(r) < 0) return -1;
+        scanned = r->a + off;
+    }
+}
+
+/* xorshift64*, one stream per client */
+static uint64_t rnd(uint64_t* s)
+{
+    *s ^= *s >> 12; *s ^= *s << 25; *s ^= *s >> 27;
+    return *s * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+static size_t add_key(uint8_t* p, long k)
+{
+    return (size_t)sprintf((char*)p, "key:%ld", k);
+}
+
+/*  RESP bulk string holding key k or value v. */
+static size_t add_bulk(uint8_t* p, long k, const uint8_t* v, size_t vn)
+{
+    char tmp[32];
+    if (!v) {
+        vn = add_key((uint8_t*)tmp, k);
+        v  = (const uint8_t*)tmp;
+    }
+    size_t h = (size_t)sprintf((char*)p, "$%zu\r\n", vn);
+    memcpy(p + h, v, vn);
+    memcpy(p + h + vn, "\r\n", 2);
+    return h + vn + 2;
+}
+
+/*  Appends one request to buf and returns its length; *op is set to the
+ *  operation.  op < 0 picks one and key < 0 a random key. */
+static size_t make_request(uint8_t* buf, uint64_t* rs, int op, long key,
+                           const uint8_t* value, uint8_t* op_out)
+{
+    if (op < 0)
+        op = (double)(rnd(rs) >> 11) / 9007199254740992.0 < g_ratio
+           ? (g_batch > 1 ? BIN_MGET : BIN_GET) : BIN_SET;
+    if (key < 0) key = (long)(rnd(rs) % (uint64_t)g_keys);
+    *op_out = (uint8_t)op;
+
+    if (g_mc) {
+        uint8_t* p = buf;
+        if (op == BIN_GET || op == BIN_MGET) {
+            p += sprintf((char*)p, "get key:%ld", key);
+            for (long i = 1; op == BIN_MGET && i < g_batch; ++i)
+                p += sprintf((char*)p, " key:%ld", (long)(rnd(rs) % (uint64_t)g_keys));
+            p += sprintf((char*)p, "\r\n");
+        } else {
+            p += sprintf((char*)p, "set key:%ld 0 0 %ld\r\n", key, g_vsize);
+            memcpy(p, value, (size_t)g_vsize);
+            memcpy(p + g_vsize, "\r\n", 2);
+            p += g_vsize + 2;
+        }
+        return (size_t)(p - buf);
+    }
+
+    if (g_resp) {
+        uint8_t* p = buf;
+        if (op == BIN_GET) {
+            p += sprintf((char*)p, "*2\r\n$3\r\nGET\r\n");
+            p += add_bulk(p, key, NULL, 0);
+        } else if (op == BIN_MGET) {
+            p += sprintf((char*)p, "*%ld\r\n$4\r\nMGET\r\n", g_batch + 1);
+            for (long i = 0; i < g_batch; ++i)
+                p += add_bulk(p, i ? (long)(rnd(rs) % (uint64_t)g_keys) : key,
+                              NULL, 0);
+        } else {
+            p += sprintf((char*)p, "*3\r\n$3\r\nSET\r\n");
+            p += add_bulk(p, key, NULL, 0);
+            p += add_bulk(p, 0, value, (size_t)g_vsize);
+        }
+        return (size_t)(p - buf);
+    }
+
+    uint8_t* p = buf + 5;
+    if (op == BIN_GET) {
+        p += add_key(p, key);
+    } else if (op == BIN_MGET) {
+        for (long i = 0; i < g_batch; ++i) {
+            size_t kl = add_key(p + 4, i ? (long)(rnd(rs) % (uint64_t)g_keys)
+                                         : key);
+            put_u32(p, (uint32_t)kl);
+            p += 4 + kl;
+        }
+    } else {
+        size_t kl = add_key(p + 4, key);
+        put_u32(p, (uint32_t)kl);
+        p += 4 + kl;
+        memcpy(p, value, (size_t)g_vsize);
+        p += g_vsize;
+    }
+    buf[4] = (uint8_t)op;
+    put_u32(buf, (uint32_t)(p - buf - 4));
+    return (size_t)(p - buf);
+}
+
+/*  Reads one RESP value, tallying bulk strings as hits and nulls as
+ *  misses when count is set. */
+static int read_resp(Client* c, Reader* r, int count)
+{
+    const char*    line;
+    const uint8_t* skip;
+    size_t         n;
+    if (rd_line(r, &line, &n) < 0 || n == 0) return -1;
+    long long v = atoll(line + 1);
+    switch (line[0]) {
+    case '-':
+        c->errors++;
+        return 0;
+    case '_':
+        if (count) c->misses++;
+        return 0;
+    case '$':
+        if (v < 0) {
+            if (count) c->misses++;
+            return 0;
+        }
+        if (count) c->hits++;
+        return rd_take(r, (size_t)v + 2, &skip);
+    case '*':
+        for (long long i = 0; i < v; ++i)
+            if (read_resp(c, r, count) < 0) return -1;
+        return 0;
+    default:   /* + : */
+        return 0;
+    }
+}
+
+/*  Reads one memcached reply: a storage status line, or VALUE blocks
+ *  up to END, tallying keys asked for but not returned as misses. */
+static int read_mc(Client* c, Reader* r, int op)
+{
+    const char*    line;
+    const uint8_t* skip;
+    size_t         n;
+    long           got = 0;
+    for (;;) {
+        if (rd_line(r, &line, &n) < 0) return -1;
+        if (n >= 6 && !memcmp(line, "VALUE ", 6)) {
+            const char* sp = (const char*)memrchr(line, ' ', n);
+            if (rd_take(r, (size_t)atol(sp + 1) + 2, &skip) < 0) return -1;
+            c->hits++;
+            ++got;
+        } else if (n == 3 && !memcmp(line, "END", 3)) {
+            c->misses += (op == BIN_MGET ? g_batch : 1) - got;
+            return 0;
+        } else {
+            if (n != 6 || memcmp(line, "STORED", 6)) c->errors++;
+            return 0;
+        }
+    }
+}
+
+/*  Reads one response to op and tallies it. */
+static int read_response(Client* c, Reader* r, int op)
+{
+    if (g_resp) return read_resp(c, r, op != BIN_SET);
+    if (g_mc)   return read_mc(c, r, op);
+
+    const uint8_t* h;
+    const uint8_t* body;
+    if (rd_take(r, 5, &h) < 0) return -1;
+    uint32_t len    = get_u32(h);
+    int      status = h[4];
+    if (len == 0 || rd_take(r, len - 1, &body) < 0) return -1;
+    if (status == ST_ERR) {
+        c->errors++;
+    } else if (status == ST_MISS) {
+        c->misses++;
+    } else if (op == BIN_MGET) {
+        /* Walk the per-key lengths */
+        size_t off = 0;
+        while (off + 4 <= len - 1) {
+            uint32_t vl = get_u32(body + off);
+            off += 4;
+            if (vl == 0xFFFFFFFFu) {
+                c->misses++;
+            } else {
+                c->hits++;
+                off += vl;
+            }
+        }
+    } else if (op == BIN_GET) {
+        c->hits++;
+    }
+    return 0;
+}
+
+static void* client_main(void* arg)
+{
+    Client* c  = (Client*)arg;
+    int     fd = connect_server();
+    if (fd < 0) {
+        perror("eht_loadgen: connect");
+        c->errors = c->requests ? c->requests : 1;
+        pthread_barrier_wait(&g_start);
+        return NULL;
+    }
+    uint64_t rs    = UINT64_C(0x9E3779B97F4A7C15) * (uint64_t)(c->id + 1);
+    size_t   per   = 64 + (size_t)g_vsize + (size_t)g_batch * 48;
+    uint8_t* out   = (uint8_t*)malloc(per * (size_t)g_pipe);
+    uint8_t* value = (uint8_t*)malloc((size_t)g_vsize + 1);
+    uint8_t* ops   = (uint8_t*)malloc((size_t)g_pipe);
+    Reader   r     = { fd, NULL, 0, 0, 0 };
+    memset(value, 'v', (size_t)g_vsize);
+
+    if (g_load) {
+        /* Each client loads its own slice of the key space */
+        long lo = g_keys * c->id / g_conns, hi = g_keys * (c->id + 1) / g_conns;
+        for (long k = lo; k < hi;) {
+            size_t n = 0;
+            long   m = 0;
+            for (; m < g_pipe && k < hi; ++m, ++k)
+                n += make_request(out + n, &rs, BIN_SET, k, value, &ops[m]);
+            if (send_all(fd, out, n) < 0) goto load_fail;
+            for (long i = 0; i < m; ++i) {
+                Client scratch = { 0 };
+                if (read_response(&scratch, &r, BIN_SET) < 0) goto load_fail;
+                c->errors += scratch.errors;
+            }
+        }
+    }
+    pthread_barrier_wait(&g_start);
+
+    while (c->done < c->requests) {
+        long   m = c->requests - c->done < g_pipe ? c->requests - c->done
+                                                   : g_pipe;
+        size_t n = 0;
+        for (long i = 0; i < m; ++i)
+            n += make_request(out + n, &rs, -1, -1, value, &ops[i]);
+        double t0 = now_ns();
+        if (send_all(fd, out, n) < 0) goto fail;
+        for (long i = 0; i < m; ++i)
+            if (read_response(c, &r, ops[i]) < 0) goto fail;
+        uint64_t ns = (uint64_t)(now_ns() - t0);
+        int      b  = 0;
+        while (b < NBUCKETS - 1 && (UINT64_C(1) << (b + 1)) <= ns) ++b;
+        c->hist[b]++;
+        c->done += m;
+    }
+    goto done;
+load_fail:
+    pthread_barrier_wait(&g_start);
+fail:
+    fprintf(stderr, "eht_loadgen: connection %d lost\n", c->id);
+    c->errors += c->requests - c->done;
+done:
+    close(fd);
+    free(out);
+    free(value);
+    free(ops);
+    free(r.buf);
+    return NULL;
+}
+
+/*  Upper edge of the bucket holding quantile q, in microseconds. */
+static double percentile(const uint64_t* hist, double q)
+{
+    uint64_t total = 0, seen = 0;
+    for (int b = 0; b < NBUCKETS; ++b) total += hist[b];
+    for (int b = 0; b < NBUCKETS; ++b) {
+        seen += hist[b];
+        if (total && (double)seen >= q * (double)total)
+            return (double)(UINT64_C(1) << (b + 1)) / 1e3;
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    fputs("usage: eht_loadgen [-h host] [-p port | -u path] [-c conns]"
+          " [-n requests]\n"
+          "                   [-P pipeline] [-k keys] [-d bytes]"
+          " [-r get_ratio] [-b mget_batch] [-l] [-R | -M]\n", stderr);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:u:c:n:P:k:d:r:b:lRM")) != -1) {
+        switch (opt) {
+        case 'h': g_host  = optarg;          break;
+        case 'p': g_port  = atoi(optarg);    break;
+        case 'u': g_upath = optarg;          break;
+        case 'c': g_conns = atol(optarg);    break;
+        case 'n': g_total = atol(optarg);    break;
+        case 'P': g_pipe  = atol(optarg);    break;
+        case 'k': g_keys  = atol(optarg);    break;
+        case 'd': g_vsize = atol(optarg);    break;
+        case 'r': g_ratio = atof(optarg);    break;
+        case 'b': g_batch = atol(optarg);    break;
+        case 'l': g_load  = 1;               break;
+        case 'R': g_resp  = 1;               break;
+        case 'M': g_mc    = 1;               break;
+        default:  usage();
+        }
+    }
+    if (optind != argc || g_conns < 1 || g_pipe < 1 || g_keys < 1 ||
+        g_vsize < 0 || g_batch < 1 || g_total < 0 || (g_resp && g_mc)) usage();
+
+    Client* cs = (Client*)calloc((size_t)g_conns, sizeof(Client));
+    pthread_barrier_init(&g_start, NULL, (unsigned)g_conns + 1);
+    for (long i = 0; i < g_conns; ++i) {
+        cs[i].id       = (int)i;
+        cs[i].requests = g_total / g_conns + (i < g_total % g_conns);
+        pthread_create(&cs[i].th, NULL, client_main, &cs[i]);
+    }
+    pthread_barrier_wait(&g_start);
+    double t0 = now_ns();
+    uint64_t hist[NBUCKETS] = { 0 };
+    long     done = 0, hits = 0, misses = 0, errors = 0;
+    for (long i = 0; i < g_conns; ++i) {
+        pthread_join(cs[i].th, NULL);
+        done   += cs[i].done;
+        hits   += cs[i].hits;
+        misses += cs[i].misses;
+        errors += cs[i].errors;
+        for (int b = 0; b < NBUCKETS; ++b) hist[b] += cs[i].hist[b];
+    }
+    double secs = (now_ns() - t0) / 1e9;
+    printf("requests=%ld seconds=%.3f ops_per_sec=%.0f hits=%ld misses=%ld"
+           " errors=%ld batch_p50_us=%.1f batch_p99_us=%.1f"
+           " batch_p999_us=%.1f\n",
+           done, secs, secs > 0 ? (double)done / secs : 0.0, hits, misses,
+           errors, percentile(hist, 0.50), percentile(hist, 0.99),
+           percentile(hist, 0.999));
+    free(cs);
+    pthread_barrier_destroy(&g_start);
+    return errors ? 1 : 0;
+}
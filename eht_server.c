@@ -0,0 +1,3807 @@
+/*
+ * eht_server.c — network server sharing one Elastic Hash Table
+ *
+ * Build:  gcc -O2 -pthread -o eht_server eht_server.c elastic_hash_table.c -lm
+ * Run:    ./eht_server [-p port] [-b addr] [-u path] [-r port] [-R path]
+ *                      [-a port] [-A path] [-t threads] [-S shards]
+ *                      [-c capacity] [-m megabytes] [-l port] [-L path]
+ *                      [-o host:port] [-O path] [-M port]
+ *
+ * Listens on TCP (default 127.0.0.1:7070) and/or a Unix socket (-u)
+ * for the binary protocol below, with -r / -R for RESP and with -a / -A
+ * for the memcached protocol.
+ * Every thread runs its own epoll loop; connections are spread across
+ * the loops by the kernel (EPOLLEXCLUSIVE on a shared listening
+ * socket).  The table is split into shards by key hash, each an
+ * ElasticHashTable behind its own mutex, so loops only contend when
+ * they touch the same shard.  Values live in per-shard slab pages with
+ * memcached-style expiry and LRU eviction; -m caps their memory.
+ * With -l / -L the server is a primary that streams its changes to
+ * replicas, and with -o / -O it is a read-only replica of one (see
+ * Replication below).  -M serves Prometheus metrics over HTTP: the
+ * tables' levels, probe lengths and rebuild pauses, the store's
+ * counters and per-command latency histograms.  Linux only.
+ *
+ * Binary protocol.  All integers are little-endian.  A client may send
+ * any number of requests without waiting (pipelining); responses come
+ * back in request order.
+ *
+ *   request:   u32 len | u8 op | body[len - 1]
+ *   response:  u32 len | u8 status | body[len - 1]
+ *
+ *   op 1 GET   body = key                   OK value | MISS
+ *   op 2 SET   body = u32 klen key value    OK
+ *   op 3 DEL   body = key                   OK | MISS
+ *   op 4 MGET  body = (u32 klen key)*       OK (u32 vlen value)*, with
+ *                                           vlen 0xFFFFFFFF for a miss
+ *   op 5 LEN   body = empty                 OK u64 count
+ *   op 6 PING  body = anything              OK body
+ *
+ *   status 0 OK, 1 MISS, 2 ERR (body = message).  Keys may not contain
+ *   NUL bytes.  A request longer than 64 MiB closes the connection.
+ *
+ * RESP.  RESP2 by default, RESP3 after HELLO 3; multibulk and inline
+ * commands, pipelined.  GET, SET [NX|XX] [GET], DEL, EXISTS, MGET,
+ * MSET, INCR/DECR/INCRBY/DECRBY, SCAN [MATCH] [COUNT], DBSIZE, INFO
+ * (with per-level table statistics and replication state), TTL,
+ * EXPIRE, REPLICAOF NO ONE, plus PING, ECHO, HELLO, SELECT 0 and QUIT.
+ * SET takes EX/PX/EXAT/PXAT/KEEPTTL; expiry has one-second resolution.
+ *
+ * Memcached.  The text protocol's get, gets, gat, gats, set, add,
+ * replace, append, prepend, cas, delete, incr, decr, touch, flush_all,
+ * stats, version, verbosity and quit, and the meta commands mg, ms, md,
+ * ma and mn.  All protocols share one keyspace; values stored over
+ * the binary protocol or RESP have flags 0.
+ */
+
+#define _GNU_SOURCE
+
+#include "elastic_hash_table.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ------------------------------------------------------------------ */
+/* Buffers                                                            */
+/* ------------------------------------------------------------------ */
+
+#define MAX_FRAME   (64u << 20)
+#define MAX_VALUE   MAX_FRAME    /* largest item value, however it was built */
+#define READ_CHUNK  (64u << 10)
+#define OUT_HIGH    (4u << 20)   /* stop reading while this much is unsent */
+
+typedef struct {
+    uint8_t* data;
+    size_t   len, cap;
+} Buf;
+
+static void* xrealloc(void* p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) {
+        fputs("eht_server: out of memory\n", stderr);
+        abort();
+    }
+    return p;
+}
+
+static uint8_t* buf_reserve(Buf* b, size_t extra)
+{
+    if (b->len + extra > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + extra) cap *= 2;
+        b->data = (uint8_t*)xrealloc(b->data, cap);
+        b->cap  = cap;
+    }
+    return b->data + b->len;
+}
+
+static void buf_append(Buf* b, const void* p, size_t n)
+{
+    if (!n) return;
+    memcpy(buf_reserve(b, n), p, n);
+    b->len += n;
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v;         p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u64(uint8_t* p, uint64_t v)
+{
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_u64(const uint8_t* p)
+{
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static void buf_u32(Buf* b, uint32_t v)
+{
+    put_u32(buf_reserve(b, 4), v);
+    b->len += 4;
+}
+
+static void buf_free(Buf* b)
+{
+    free(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+/* ------------------------------------------------------------------ */
+/* Store: items and slabs                                             */
+/* ------------------------------------------------------------------ */
+
+/*  Every value lives in an Item that also carries its key, expiry and
+ *  memcached flags; the shard tables map keys to Item pointers.  Items
+ *  are chunks of 64 KiB slab pages, in size classes growing by 1.25
+ *  from 64 bytes to a whole page; larger ones are allocated alone.
+ *  Each shard owns its pages and keeps, per class, a free list and an
+ *  LRU list under the shard lock.  -m caps pages plus large items: when
+ *  a class needs a chunk past the cap, expired items at its LRU tail
+ *  are reclaimed first and the least recently used one is evicted
+ *  next.  A class with nothing to evict takes a page from another
+ *  class, evicting what the page holds (memcached's slab reassignment,
+ *  done inline), and failing that has another shard release one.
+ *  Expired items are otherwise dropped when a lookup meets them. */
+
+#define SLAB_PAGE      (64u << 10)
+#define SLAB_MAX       40        /* bound on classes, plus one for large */
+#define LRU_BUMP_SECS  60        /* a hit moves an item up this often    */
+#define LRU_RECLAIM    5         /* tail items checked for expiry        */
+#define SLAB_FREE      0xFF      /* Item.cls of a free chunk             */
+
+typedef struct Item {
+    struct Item* prev;       /* LRU: towards the head, most recent     */
+    struct Item* next;       /* LRU: towards the tail; free list       */
+    uint64_t     cas;
+    uint32_t     exptime;    /* server clock; 0 never                  */
+    uint32_t     atime;      /* last LRU bump                          */
+    uint32_t     flags;      /* memcached client flags                 */
+    uint32_t     klen, vlen;
+    uint8_t      cls;
+    char         data[];     /* key, NUL, value                        */
+} Item;
+
+typedef struct {
+    Item* free;
+    Item* head;
+    Item* tail;
+} SlabClass;
+
+typedef struct {
+    uint64_t items, ttl_items, total_items, bytes;
+    uint64_t hits, misses, evictions, expired;
+} StoreStats;
+
+typedef struct {
+    pthread_mutex_t   lock;
+    ElasticHashTable* table;     /* key -> Item*                        */
+    SlabClass         cls[SLAB_MAX + 1];
+    uint8_t**         pages;
+    uint8_t*          page_cls;  /* class each page is carved for       */
+    size_t            npages;
+    size_t            hand;      /* next page to consider moving        */
+    uint64_t          cas;       /* last CAS value handed out           */
+    StoreStats        st;        /* items is left to eht_len            */
+    Buf               log;       /* replication records not yet drained */
+} Shard;
+
+static Shard*   g_shards;
+static unsigned g_nshards;       /* power of two                         */
+static size_t   g_class_size[SLAB_MAX];
+static unsigned g_nclasses;      /* slab classes; index g_nclasses is large */
+static size_t   g_mem_limit;     /* bytes; 0 is unlimited                */
+static size_t   g_mem_used;      /* pages plus large items (atomic)      */
+static uint32_t g_now;           /* server clock, seconds (atomic)       */
+static time_t   g_epoch;         /* Unix time at which g_now was 0       */
+static int      g_repl_on;       /* replicas attached: log changes (atomic) */
+static int      g_repl_poked;    /* g_repl_wake written since the last drain (atomic) */
+static int      g_repl_wake = -1; /* eventfd of the replication thread   */
+
+static uint32_t now_secs(void)
+{
+    return __atomic_load_n(&g_now, __ATOMIC_RELAXED);
+}
+
+/*  Ticks g_now from the monotonic clock; main calls it every second.
+ *  The clock starts at 2 so that exptime 1 is always in the past. */
+static void clock_tick(void)
+{
+    static struct timespec t0;
+    struct timespec        t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    if (!t0.tv_sec && !t0.tv_nsec) {
+        t0      = t;
+        g_epoch = time(NULL) - 2;
+    }
+    __atomic_store_n(&g_now, (uint32_t)(t.tv_sec - t0.tv_sec) + 2,
+                     __ATOMIC_RELAXED);
+}
+
+static int mem_take(size_t n)
+{
+    size_t used = __atomic_add_fetch(&g_mem_used, n, __ATOMIC_RELAXED);
+    if (g_mem_limit && used > g_mem_limit) {
+        __atomic_sub_fetch(&g_mem_used, n, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+static void mem_give(size_t n)
+{
+    __atomic_sub_fetch(&g_mem_used, n, __ATOMIC_RELAXED);
+}
+
+static void slab_init(void)
+{
+    size_t sz = 64;
+    for (g_nclasses = 0; sz < SLAB_PAGE / 2; sz = (sz * 5 / 4 + 7) & ~(size_t)7)
+        g_class_size[g_nclasses++] = sz;
+    g_class_size[g_nclasses++] = SLAB_PAGE;
+}
+
+static size_t item_size(size_t klen, size_t vlen)
+{
+    return sizeof(Item) + klen + 1 + vlen;
+}
+
+/*  The class for an item of size bytes; g_nclasses is large. */
+static unsigned slab_class(size_t size)
+{
+    unsigned k = 0;
+    while (k < g_nclasses && g_class_size[k] < size) ++k;
+    return k;
+}
+
+static const char* item_value(const Item* it)
+{
+    return it->data + it->klen + 1;
+}
+
+static int item_expired(const Item* it, uint32_t now)
+{
+    return it->exptime && it->exptime <= now;
+}
+
+static void lru_unlink(SlabClass* sc, Item* it)
+{
+    if (it->prev) it->prev->next = it->next;
+    else          sc->head = it->next;
+    if (it->next) it->next->prev = it->prev;
+    else          sc->tail = it->prev;
+}
+
+static void lru_push(SlabClass* sc, Item* it)
+{
+    it->prev = NULL;
+    it->next = sc->head;
+    if (sc->head) sc->head->prev = it;
+    else          sc->tail = it;
+    sc->head = it;
+}
+
+/*  Replication records (format in the Replication section) carry the
+ *  state a change leaves its key in. */
+enum { REPL_END, REPL_SET, REPL_DEL, REPL_TOUCH, REPL_PING };
+
+static uint32_t unix_exptime(uint32_t exptime)
+{
+    return exptime ? (uint32_t)(g_epoch + exptime) : 0;
+}
+
+static void repl_record(Buf* b, int op, const Item* it)
+{
+    size_t   hd = op == REPL_SET ? 12 : op == REPL_TOUCH ? 4 : 0;
+    size_t   n  = hd + it->klen + (op == REPL_SET ? it->vlen : 0);
+    uint8_t* p  = buf_reserve(b, 5 + n);
+    p[0] = (uint8_t)op;
+    put_u32(p + 1, (uint32_t)n);
+    if (op == REPL_SET) {
+        put_u32(p + 5, it->flags);
+        put_u32(p + 9, unix_exptime(it->exptime));
+        put_u32(p + 13, it->klen);
+    } else if (op == REPL_TOUCH) {
+        put_u32(p + 5, unix_exptime(it->exptime));
+    }
+    memcpy(p + 5 + hd, it->data, it->klen);
+    if (op == REPL_SET) memcpy(p + 5 + hd + it->klen, item_value(it), it->vlen);
+    b->len += 5 + n;
+}
+
+/*  Logs a change to it while replicas are attached; the first record
+ *  since the last drain wakes the replication thread. */
+static void repl_log(Shard* s, int op, const Item* it)
+{
+    if (!__atomic_load_n(&g_repl_on, __ATOMIC_RELAXED)) return;
+    int was_empty = s->log.len == 0;
+    repl_record(&s->log, op, it);
+    if (was_empty && !__atomic_load_n(&g_repl_poked, __ATOMIC_RELAXED) &&
+        !__atomic_exchange_n(&g_repl_poked, 1, __ATOMIC_ACQ_REL)) {
+        uint64_t one = 1;
+        if (write(g_repl_wake, &one, sizeof one) < 0) perror("eht_server: repl wake");
+    }
+}
+
+/*  Returns it's memory: to its class's free list, or to the system. */
+static void item_free(Shard* s, Item* it)
+{
+    if (it->cls == g_nclasses) {
+        mem_give(item_size(it->klen, it->vlen));
+        free(it);
+        return;
+    }
+    SlabClass* sc = &s->cls[it->cls];
+    it->cls  = SLAB_FREE;
+    it->next = sc->free;
+    sc->free = it;
+}
+
+/*  Removes a linked item from the table and its LRU list and frees it. */
+static void item_unlink(Shard* s, Item* it, uint64_t h)
+{
+    repl_log(s, REPL_DEL, it);
+    eht_delete_with_hash(s->table, it->data, h);
+    lru_unlink(&s->cls[it->cls], it);
+    s->st.bytes     -= item_size(it->klen, it->vlen);
+    s->st.ttl_items -= it->exptime != 0;
+    item_free(s, it);
+}
+
+static void slab_carve(Shard* s, size_t p, unsigned k)
+{
+    s->page_cls[p] = (uint8_t)k;
+    for (size_t off = 0; off + g_class_size[k] <= SLAB_PAGE; off += g_class_size[k]) {
+        Item* it = (Item*)(s->pages[p] + off);
+        it->cls  = SLAB_FREE;
+        it->next = s->cls[k].free;
+        s->cls[k].free = it;
+    }
+}
+
+/*  Adds a page for class k, within the memory cap. */
+static int slab_grow(Shard* s, unsigned k)
+{
+    if (mem_take(SLAB_PAGE) < 0) return -1;
+    uint8_t* page = (uint8_t*)malloc(SLAB_PAGE);
+    if (!page) {
+        mem_give(SLAB_PAGE);
+        return -1;
+    }
+    if (!(s->npages & (s->npages - 1))) {
+        size_t cap = s->npages ? s->npages * 2 : 1;
+        s->pages    = (uint8_t**)xrealloc(s->pages, cap * sizeof(uint8_t*));
+        s->page_cls = (uint8_t*)xrealloc(s->page_cls, cap);
+    }
+    s->pages[s->npages] = page;
+    slab_carve(s, s->npages++, k);
+    return 0;
+}
+
+/*  Empties a page of some class other than k, evicting its items, and
+ *  carves it for k; for the large class the page is released instead.
+ *  Pages are taken in turn, skipping the one holding keep.  Returns -1
+ *  if there is none to take. */
+static int slab_move(Shard* s, unsigned k, const Item* keep)
+{
+    for (size_t tries = 0; tries < s->npages; ++tries) {
+        size_t   p    = s->hand++ % s->npages;
+        unsigned j    = s->page_cls[p];
+        uint8_t* page = s->pages[p];
+        if (j == k || ((const uint8_t*)keep >= page &&
+                       (const uint8_t*)keep < page + SLAB_PAGE)) continue;
+        for (size_t off = 0; off + g_class_size[j] <= SLAB_PAGE; off += g_class_size[j]) {
+            Item* it = (Item*)(page + off);
+            if (it->cls == SLAB_FREE) continue;
+            item_unlink(s, it, eht_hash(it->data));
+            s->st.evictions++;
+        }
+        /* Every chunk is free now: take them off j's free list */
+        for (Item** pp = &s->cls[j].free; *pp;) {
+            if ((uint8_t*)*pp >= page && (uint8_t*)*pp < page + SLAB_PAGE)
+                *pp = (*pp)->next;
+            else
+                pp = &(*pp)->next;
+        }
+        if (k < g_nclasses) {
+            slab_carve(s, p, k);
+        } else {
+            free(page);
+            mem_give(SLAB_PAGE);
+            s->pages[p]    = s->pages[--s->npages];
+            s->page_cls[p] = s->page_cls[s->npages];
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/*  Has another shard release a page, or a large item, towards the cap
+ *  when the caller's shard (whose lock it holds) has nothing left to
+ *  give.  Other shards are only try-locked, so this cannot deadlock. */
+static int mem_steal(Shard* self)
+{
+    for (unsigned i = 1; i < g_nshards; ++i) {
+        Shard* o = &g_shards[((unsigned)(self - g_shards) + i) & (g_nshards - 1)];
+        if (pthread_mutex_trylock(&o->lock)) continue;
+        int rc = slab_move(o, g_nclasses, NULL);
+        if (rc < 0 && o->cls[g_nclasses].tail) {
+            Item* it = o->cls[g_nclasses].tail;
+            item_unlink(o, it, eht_hash(it->data));
+            o->st.evictions++;
+            rc = 0;
+        }
+        pthread_mutex_unlock(&o->lock);
+        if (rc == 0) return 0;
+    }
+    return -1;
+}
+
+/*  Evicts the least recently used item of sc other than keep. */
+static int lru_evict(Shard* s, SlabClass* sc, const Item* keep)
+{
+    Item* it = sc->tail == keep ? keep->prev : sc->tail;
+    if (!it) return -1;
+    item_unlink(s, it, eht_hash(it->data));
+    s->st.evictions++;
+    return 0;
+}
+
+/*  An unlinked chunk of at least size bytes, or NULL when memory is
+ *  exhausted and nothing can be evicted.  keep, the item the caller is
+ *  about to replace, survives. */
+static Item* item_alloc(Shard* s, size_t size, const Item* keep)
+{
+    unsigned   k   = slab_class(size);
+    SlabClass* sc  = &s->cls[k];
+    uint32_t   now = now_secs();
+
+    Item* it = sc->tail;
+    for (int i = 0; it && i < LRU_RECLAIM; ++i) {
+        Item* prev = it->prev;
+        if (it != keep && item_expired(it, now)) {
+            item_unlink(s, it, eht_hash(it->data));
+            s->st.expired++;
+        }
+        it = prev;
+    }
+    if (k == g_nclasses) {
+        if (g_mem_limit && size > g_mem_limit) return NULL;
+        while (mem_take(size) < 0) {
+            if (lru_evict(s, sc, keep) < 0 && slab_move(s, k, keep) < 0 &&
+                mem_steal(s) < 0)
+                return NULL;
+        }
+        if (!(it = (Item*)malloc(size))) {
+            mem_give(size);
+            return NULL;
+        }
+    } else {
+        if (!sc->free && slab_grow(s, k) < 0 && lru_evict(s, sc, keep) < 0 &&
+            slab_move(s, k, keep) < 0 && mem_steal(s) == 0)
+            slab_grow(s, k);
+        if (!(it = sc->free)) return NULL;
+        sc->free = it->next;
+    }
+    it->cls = (uint8_t)k;
+    return it;
+}
+
+/*  key's live item, or NULL; an expired one is unlinked on the way.  A
+ *  hit moves the item to the head of its LRU list, at most once per
+ *  LRU_BUMP_SECS so hot items are not relinked on every read. */
+static Item* item_get(Shard* s, const char* key, uint64_t h)
+{
+    const void* v;
+    size_t      n;
+    Item*       it;
+    if (!eht_get_with_hash(s->table, key, h, &v, &n)) return NULL;
+    memcpy(&it, v, sizeof it);
+    uint32_t now = now_secs();
+    if (item_expired(it, now)) {
+        item_unlink(s, it, h);
+        s->st.expired++;
+        return NULL;
+    }
+    if (now - it->atime >= LRU_BUMP_SECS) {
+        lru_unlink(&s->cls[it->cls], it);
+        lru_push(&s->cls[it->cls], it);
+        it->atime = now;
+    }
+    return it;
+}
+
+static void item_fill(Item* it, uint64_t cas, const char* key, size_t kl,
+                      const void* v, size_t n, uint32_t flags, uint32_t exptime)
+{
+    it->cas     = cas;
+    it->exptime = exptime;
+    it->atime   = now_secs();
+    it->flags   = flags;
+    it->klen    = (uint32_t)kl;
+    it->vlen    = (uint32_t)n;
+    memcpy(it->data, key, kl + 1);
+    if (n) memcpy(it->data + kl + 1, v, n);
+}
+
+/*  Stores key -> v[0..n) with client flags and an expiry, replacing
+ *  old, key's item from item_get (or NULL), and giving the new item a
+ *  fresh CAS value.  Returns the item, or NULL (old kept) when memory
+ *  runs out or n is over MAX_VALUE.  v must not point into an item of
+ *  this shard. */
+static Item* item_put(Shard* s, const char* key, uint64_t h, Item* old,
+                      const void* v, size_t n, uint32_t flags, uint32_t exptime)
+{
+    if (n > MAX_VALUE) return NULL;
+    size_t   kl   = strlen(key);
+    size_t   size = item_size(kl, n);
+    unsigned k    = slab_class(size);
+    s->st.total_items++;
+    s->st.bytes     += size;
+    s->st.ttl_items += exptime != 0;
+
+    /* A value that fits old's chunk is rewritten there: the table keeps
+     * pointing at it, so an overwrite costs no second lookup. */
+    if (old && old->cls == k &&
+        (k < g_nclasses || item_size(old->klen, old->vlen) == size)) {
+        s->st.bytes     -= item_size(old->klen, old->vlen);
+        s->st.ttl_items -= old->exptime != 0;
+        item_fill(old, ++s->cas, key, kl, v, n, flags, exptime);
+        repl_log(s, REPL_SET, old);
+        return old;   /* item_get has done the LRU bump */
+    }
+
+    Item* it = item_alloc(s, size, old);
+    if (!it || eht_insert_with_hash(s->table, key, h, &it, sizeof it) < 0) {
+        if (it) item_free(s, it);
+        s->st.total_items--;
+        s->st.bytes     -= size;
+        s->st.ttl_items -= exptime != 0;
+        return NULL;
+    }
+    item_fill(it, ++s->cas, key, kl, v, n, flags, exptime);
+    if (old) {
+        lru_unlink(&s->cls[old->cls], old);
+        s->st.bytes     -= item_size(old->klen, old->vlen);
+        s->st.ttl_items -= old->exptime != 0;
+        item_free(s, old);
+    }
+    lru_push(&s->cls[k], it);
+    repl_log(s, REPL_SET, it);
+    return it;
+}
+
+static void item_touch(Shard* s, Item* it, uint32_t exptime)
+{
+    s->st.ttl_items += (exptime != 0) - (it->exptime != 0);
+    it->exptime = exptime;
+    repl_log(s, REPL_TOUCH, it);
+}
+
+/* ------------------------------------------------------------------ */
+/* Store: the sharded table                                           */
+/* ------------------------------------------------------------------ */
+
+/* Shards take middle bits of a multiplied hash: the tables use the top
+ * bits for tags and FNV's low bits are weak. */
+static Shard* shard_of(uint64_t h)
+{
+    uint64_t m = h * UINT64_C(0xD6E8FEB86659FD93);
+    return &g_shards[(m >> 32) & (g_nshards - 1)];
+}
+
+static int store_init(unsigned nshards, size_t capacity)
+{
+    slab_init();
+    clock_tick();
+    g_nshards = nshards;
+    g_shards  = (Shard*)calloc(nshards, sizeof(Shard));
+    if (!g_shards) return -1;
+    size_t per = capacity / nshards > 64 ? capacity / nshards : 64;
+    for (unsigned i = 0; i < nshards; ++i) {
+        pthread_mutex_init(&g_shards[i].lock, NULL);
+        g_shards[i].table = eht_create_ex(per, EHT_FLAG_COMPACT | EHT_FLAG_PREFETCH);
+        if (!g_shards[i].table) return -1;
+    }
+    return 0;
+}
+
+static void store_destroy(void)
+{
+    for (unsigned i = 0; i < g_nshards; ++i) {
+        Shard* s = &g_shards[i];
+        for (Item* it = s->cls[g_nclasses].head; it;) {
+            Item* next = it->next;
+            free(it);
+            it = next;
+        }
+        for (size_t p = 0; p < s->npages; ++p) free(s->pages[p]);
+        free(s->pages);
+        free(s->page_cls);
+        buf_free(&s->log);
+        eht_destroy(s->table);
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(g_shards);
+}
+
+/*  Appends key's value to out; returns 1, or 0 (out untouched). */
+static int store_get(const char* key, uint64_t h, Buf* out)
+{
+    Shard* s = shard_of(h);
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_get(s, key, h);
+    if (it) {
+        buf_append(out, item_value(it), it->vlen);
+        s->st.hits++;
+    } else {
+        s->st.misses++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return it != NULL;
+}
+
+static int store_set(const char* key, uint64_t h, const void* v, size_t n)
+{
+    Shard* s = shard_of(h);
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_put(s, key, h, item_get(s, key, h), v, n, 0, 0);
+    pthread_mutex_unlock(&s->lock);
+    return it ? 0 : -1;
+}
+
+static int store_has(const char* key, uint64_t h)
+{
+    Shard* s = shard_of(h);
+    pthread_mutex_lock(&s->lock);
+    int found = item_get(s, key, h) != NULL;
+    pthread_mutex_unlock(&s->lock);
+    return found;
+}
+
+static int store_del(const char* key, uint64_t h)
+{
+    Shard* s = shard_of(h);
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_get(s, key, h);
+    if (it) item_unlink(s, it, h);
+    pthread_mutex_unlock(&s->lock);
+    return it != NULL;
+}
+
+/*  Entries in the tables, counting expired items not yet reclaimed. */
+static uint64_t store_len(void)
+{
+    uint64_t n = 0;
+    for (unsigned i = 0; i < g_nshards; ++i) {
+        pthread_mutex_lock(&g_shards[i].lock);
+        n += eht_len(g_shards[i].table);
+        pthread_mutex_unlock(&g_shards[i].lock);
+    }
+    return n;
+}
+
+static void store_stats(StoreStats* st)
+{
+    memset(st, 0, sizeof(*st));
+    for (unsigned i = 0; i < g_nshards; ++i) {
+        Shard* s = &g_shards[i];
+        pthread_mutex_lock(&s->lock);
+        st->items       += eht_len(s->table);
+        st->ttl_items   += s->st.ttl_items;
+        st->total_items += s->st.total_items;
+        st->bytes       += s->st.bytes;
+        st->hits        += s->st.hits;
+        st->misses      += s->st.misses;
+        st->evictions   += s->st.evictions;
+        st->expired     += s->st.expired;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/*  Drops every item (delay 0), or has every item expire by now + delay. */
+static void store_flush(uint32_t delay)
+{
+    uint32_t when = now_secs() + delay;
+    for (unsigned i = 0; i < g_nshards; ++i) {
+        Shard* s = &g_shards[i];
+        pthread_mutex_lock(&s->lock);
+        for (unsigned k = 0; k <= g_nclasses; ++k) {
+            for (Item* it = s->cls[k].head; it;) {
+                Item* next = it->next;
+                if (!delay)
+                    item_unlink(s, it, eht_hash(it->data));
+                else if (!it->exptime || it->exptime > when)
+                    item_touch(s, it, when);
+                it = next;
+            }
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Event loops and connections                                        */
+/* ------------------------------------------------------------------ */
+
+enum { EV_LISTEN, EV_CONN, EV_WAKE };
+enum { PROTO_BIN, PROTO_RESP, PROTO_MC };
+
+typedef struct {
+    int kind;
+    int fd;
+    int proto;          /* listeners: what their connections speak  */
+} EvSource;
+
+/*  A multi-key operation: keys hashed together and visited shard by
+ *  shard, so each shard lock is taken once. */
+typedef struct {
+    size_t       n;
+    const char** keys;
+    uint64_t*    hashes;
+    uint32_t*    order;    /* key indices grouped by shard, stable    */
+    int*         found;
+    size_t*      voff;     /* MGET: value offsets into Worker.vals    */
+    size_t*      vlen;     /* MGET: value lengths; MSET: input lengths */
+    const void** vin;      /* MSET: input values                      */
+    uint32_t*    flags;    /* MGET: memcached client flags            */
+    uint64_t*    cas;      /* MGET: CAS values                        */
+} Batch;
+
+#define CMD_SLOTS   32   /* command names per protocol, g_cmd_names  */
+#define LAT_BUCKETS 22   /* latency: <= 1 us << i for i < 21, +Inf    */
+
+typedef struct {
+    pthread_t th;
+    int       ep;
+    Buf       keys;     /* NUL-terminated key copies                */
+    Buf       scratch;  /* Batch arrays, RESP argument vectors      */
+    Buf       vals;     /* MGET values, staged replies              */
+    Buf       args;     /* RESP: the current command's Arg vector   */
+    Batch     batch;
+    /* -M: command latencies by protocol and command, written by this
+     * loop only and read by the metrics thread (atomic) */
+    uint64_t  lat[3][CMD_SLOTS][LAT_BUCKETS];
+    uint64_t  lat_ns[3][CMD_SLOTS];
+} Worker;
+
+typedef struct {
+    EvSource src;
+    Worker*  w;
+    Buf      in;
+    size_t   in_off;    /* parsed prefix of in                      */
+    Buf      out;
+    size_t   out_off;   /* sent prefix of out                       */
+    int      reading;   /* EPOLLIN armed                            */
+    int      writing;   /* EPOLLOUT armed                           */
+    int      resp3;     /* RESP: HELLO 3 seen                       */
+    int      closing;   /* close once out is sent                   */
+} Conn;
+
+#define MAX_LISTEN 6
+
+static EvSource g_listen[MAX_LISTEN];
+static int      g_nlisten;
+static EvSource g_wake;
+static long     g_clients;   /* open connections (atomic)           */
+static int      g_readonly;  /* a replica: clients may not write (atomic) */
+static int      g_metrics;   /* -M given: time every command        */
+
+static void conn_close(Conn* c)
+{
+    epoll_ctl(c->w->ep, EPOLL_CTL_DEL, c->src.fd, NULL);
+    close(c->src.fd);
+    buf_free(&c->in);
+    buf_free(&c->out);
+    free(c);
+    __atomic_fetch_sub(&g_clients, 1, __ATOMIC_RELAXED);
+}
+
+static void conn_arm(Conn* c)
+{
+    int reading = c->out.len - c->out_off < OUT_HIGH && !c->closing;
+    int writing = c->out_off < c->out.len;
+    if (reading == c->reading && writing == c->writing) return;
+    struct epoll_event ev;
+    ev.events   = (reading ? EPOLLIN : 0) | (writing ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(c->w->ep, EPOLL_CTL_MOD, c->src.fd, &ev);
+    c->reading = reading;
+    c->writing = writing;
+}
+
+/*  Sends what it can of c->out.  Returns -1 if the peer is gone. */
+static int conn_flush(Conn* c)
+{
+    while (c->out_off < c->out.len) {
+        ssize_t n = send(c->src.fd, c->out.data + c->out_off,
+                         c->out.len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        c->out_off += (size_t)n;
+    }
+    if (c->out_off == c->out.len) c->out.len = c->out_off = 0;
+    return 0;
+}
+
+/*  Drops the parsed prefix of c->in once it is worth the move. */
+static void conn_consumed(Conn* c)
+{
+    if (c->in_off == c->in.len) {
+        c->in.len = c->in_off = 0;
+    } else if (c->in_off > c->in.cap / 2) {
+        memmove(c->in.data, c->in.data + c->in_off, c->in.len - c->in_off);
+        c->in.len -= c->in_off;
+        c->in_off  = 0;
+    }
+}
+
+/*  A NUL-terminated copy of key in the worker's key buffer, or NULL if
+ *  the key holds a NUL byte.  Appends; callers reset w->keys per
+ *  request. */
+static const char* key_copy(Worker* w, const uint8_t* k, size_t n)
+{
+    if (memchr(k, 0, n)) return NULL;
+    uint8_t* p = buf_reserve(&w->keys, n + 1);
+    memcpy(p, k, n);
+    p[n] = 0;
+    w->keys.len += n + 1;
+    return (const char*)p;
+}
+
+/* ------------------------------------------------------------------ */
+/* Store: batches                                                     */
+/* ------------------------------------------------------------------ */
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+/*  Sets up w->batch over the n keys copied back to back into w->keys:
+ *  hashes them with eht_hash_many and orders them by shard. */
+static Batch* batch_begin(Worker* w, size_t n)
+{
+    size_t sz[10] = {
+        n * sizeof(char*), n * sizeof(uint64_t), n * sizeof(uint32_t),
+        n * sizeof(int), n * sizeof(size_t), n * sizeof(size_t),
+        n * sizeof(void*), n * sizeof(uint32_t), n * sizeof(uint64_t),
+        (g_nshards + 1) * sizeof(uint32_t),
+    };
+    size_t total = 0;
+    for (int i = 0; i < 10; ++i) total += align8(sz[i]);
+    w->scratch.len = 0;
+    uint8_t* p = buf_reserve(&w->scratch, total);
+    void*    part[10];
+    for (int i = 0; i < 10; ++i) {
+        part[i] = p;
+        p += align8(sz[i]);
+    }
+    Batch* b  = &w->batch;
+    b->n      = n;
+    b->keys   = (const char**)part[0];
+    b->hashes = (uint64_t*)part[1];
+    b->order  = (uint32_t*)part[2];
+    b->found  = (int*)part[3];
+    b->voff   = (size_t*)part[4];
+    b->vlen   = (size_t*)part[5];
+    b->vin    = (const void**)part[6];
+    b->flags  = (uint32_t*)part[7];
+    b->cas    = (uint64_t*)part[8];
+    uint32_t* counts = (uint32_t*)part[9];
+
+    const char* k = (const char*)w->keys.data;
+    for (size_t i = 0; i < n; ++i) {
+        b->keys[i] = k;
+        k += strlen(k) + 1;
+    }
+    eht_hash_many(b->keys, n, b->hashes);
+
+    memset(counts, 0, (g_nshards + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < n; ++i)
+        counts[shard_of(b->hashes[i]) - g_shards + 1]++;
+    for (unsigned s = 0; s < g_nshards; ++s) counts[s + 1] += counts[s];
+    for (size_t i = 0; i < n; ++i)
+        b->order[counts[shard_of(b->hashes[i]) - g_shards]++] = (uint32_t)i;
+    return b;
+}
+
+/*  Looks up every key of b: found[i], and the value at
+ *  w->vals.data + voff[i] with length vlen[i], flags[i] and cas[i].
+ *  Values are copied out under the shard lock; w->vals is reset
+ *  first. */
+static void store_mget(Worker* w, Batch* b)
+{
+    w->vals.len = 0;
+    for (size_t j = 0; j < b->n;) {
+        Shard* s = shard_of(b->hashes[b->order[j]]);
+        pthread_mutex_lock(&s->lock);
+        for (; j < b->n && shard_of(b->hashes[b->order[j]]) == s; ++j) {
+            size_t i  = b->order[j];
+            Item*  it = item_get(s, b->keys[i], b->hashes[i]);
+            b->found[i] = it != NULL;
+            b->voff[i]  = w->vals.len;
+            b->vlen[i]  = 0;
+            if (!it) {
+                s->st.misses++;
+                continue;
+            }
+            s->st.hits++;
+            b->vlen[i]  = it->vlen;
+            b->flags[i] = it->flags;
+            b->cas[i]   = it->cas;
+            buf_append(&w->vals, item_value(it), it->vlen);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/*  Stores vin[i] / vlen[i] under every key of b; a repeated key keeps
+ *  its last value.  Returns 0, or -1 if an insert ran out of memory
+ *  (later pairs of that shard are skipped). */
+static int store_mset(Batch* b)
+{
+    int rc = 0;
+    for (size_t j = 0; j < b->n;) {
+        Shard* s = shard_of(b->hashes[b->order[j]]);
+        pthread_mutex_lock(&s->lock);
+        for (; j < b->n && shard_of(b->hashes[b->order[j]]) == s; ++j) {
+            size_t i = b->order[j];
+            if (rc == 0 &&
+                !item_put(s, b->keys[i], b->hashes[i],
+                          item_get(s, b->keys[i], b->hashes[i]),
+                          b->vin[i], b->vlen[i], 0, 0)) rc = -1;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Replication                                                        */
+/* ------------------------------------------------------------------ */
+
+/*  Asynchronous log shipping.  A primary (-l / -L) runs a replication
+ *  thread that accepts replicas; a replica (-o / -O) runs one that
+ *  connects to its primary, sends REPL_HELLO and applies the stream it
+ *  gets back:
+ *
+ *    stream:   "EHTSNAP1" | u64 offset | SET record* | END record | record*
+ *    record:   u8 op | u32 len | body[len]
+ *
+ *    op 0 END     body empty: the snapshot is complete
+ *    op 1 SET     u32 flags | u32 exptime | u32 klen | key | value
+ *    op 2 DEL     key
+ *    op 3 TOUCH   u32 exptime | key
+ *    op 4 PING    u64 the primary's wall clock in ms, once a second
+ *
+ *  Integers are little-endian; exptime is a Unix time, 0 for never.  The
+ *  snapshot holds every live item when the replica attached, and the
+ *  records after it are the log from offset on: each one's bytes
+ *  advance the offset.  The replica acknowledges with a u64 offset
+ *  whenever it has applied more, and the primary's offset minus that is
+ *  the replica's lag.
+ *
+ *  Records carry the state a change left its key in rather than the
+ *  command that made it (an INCR ships as a SET of the result, an
+ *  eviction or expiry as a DEL), so applying one twice does no harm.
+ *  That lets the snapshot be copied a shard at a time while writes go
+ *  on: the log is replayed from before the first shard was copied.
+ *  Writers append records to their shard's log under the shard lock they
+ *  already hold, and only while a replica is attached; this thread
+ *  drains the logs into one backlog that all replicas are sent from, so
+ *  changes to one key arrive in order but changes to keys in different
+ *  shards may not arrive in the order they were made.  A
+ *  replica more than REPL_BACKLOG behind is dropped, and a replica that
+ *  reconnects always resyncs in full.  Replicas refuse writes until
+ *  REPLICAOF NO ONE. */
+
+#define REPL_MAGIC    "EHTSNAP1"
+#define REPL_HELLO    "EHTREPL1"
+#define REPL_BACKLOG  (256u << 20)   /* unsent log before a replica is dropped */
+#define REPL_TIMEOUT  5000           /* ms without data before a replica reconnects */
+/* The longest record: a SET whose key is a whole RESP bulk string and
+ * whose value is as long as an item's may be */
+#define REPL_MAX_RECORD (12 + (size_t)MAX_FRAME + MAX_VALUE)
+
+enum { LINK_DOWN, LINK_SYNC, LINK_UP };
+
+typedef struct Replica {
+    EvSource        src;
+    struct Replica* next;
+    int             ready;     /* REPL_HELLO received, snapshot queued   */
+    int             online;    /* snapshot sent                          */
+    int             writing;   /* EPOLLOUT armed                         */
+    Buf             out;       /* the snapshot, sent before the log      */
+    size_t          out_off;
+    uint64_t        off;       /* next log offset to send                */
+    uint64_t        ack;       /* log offset the replica has applied     */
+    uint64_t        ack_ms;    /* when it said so                        */
+    uint8_t         in[8];     /* REPL_HELLO, or an ack, so far          */
+    size_t          in_n;
+    char            name[64];  /* peer address, for INFO                 */
+} Replica;
+
+static struct {
+    pthread_mutex_t lock;      /* replicas' state as INFO shows it       */
+    int             stop;      /* atomic                                 */
+
+    /* Primary: the replication thread owns everything but what lock guards */
+    pthread_t       primary_th;
+    int             ep;
+    EvSource        listen, wake;
+    Replica*        replicas;
+    unsigned        nready;
+    Buf             backlog;   /* the log from offset base on            */
+    uint64_t        base;
+    uint64_t        offset;    /* base + backlog.len, for INFO (atomic)  */
+
+    /* Replica */
+    pthread_t       replica_th;
+    const char*     spec;      /* -o host:port, or the -O path           */
+    const char*     primary;   /* host, or the path                      */
+    int             port;      /* -o port; 0 for a Unix socket           */
+    struct sockaddr_storage sa;
+    socklen_t       salen;
+    int             detach;    /* REPLICAOF NO ONE (atomic)              */
+    int             link;      /* LINK_* (atomic)                        */
+    uint64_t        applied;   /* log offset applied (atomic)            */
+    uint64_t        io_ms;     /* last data from the primary (atomic)    */
+    uint64_t        lag_ms;    /* age of the last PING applied (atomic)  */
+} g_repl = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t wall_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (uint64_t)t.tv_sec * 1000 + (uint64_t)t.tv_nsec / 1000000;
+}
+
+static int repl_is_replica(void)
+{
+    return g_repl.primary && !__atomic_load_n(&g_repl.detach, __ATOMIC_RELAXED);
+}
+
+/*  Moves every shard's log to the backlog, or drops it when no replica
+ *  is attached. */
+static void repl_drain(void)
+{
+    if (!g_repl.nready && !__atomic_load_n(&g_repl_on, __ATOMIC_RELAXED)) return;
+    __atomic_store_n(&g_repl_poked, 0, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i < g_nshards; ++i) {
+        Shard* s = &g_shards[i];
+        pthread_mutex_lock(&s->lock);
+        if (g_repl.nready) buf_append(&g_repl.backlog, s->log.data, s->log.len);
+        s->log.len = 0;
+        pthread_mutex_unlock(&s->lock);
+    }
+    __atomic_store_n(&g_repl.offset, g_repl.base + g_repl.backlog.len,
+                     __ATOMIC_RELAXED);
+}
+
+static void repl_ping(void)
+{
+    uint8_t rec[13] = { REPL_PING };
+    put_u32(rec + 1, 8);
+    put_u64(rec + 5, wall_ms());
+    buf_append(&g_repl.backlog, rec, sizeof rec);
+}
+
+/*  Queues the snapshot for r and attaches it at the current offset. */
+static void repl_sync(Replica* r)
+{
+    __atomic_store_n(&g_repl_on, 1, __ATOMIC_RELAXED);
+    repl_drain();
+    uint64_t off = g_repl.base + g_repl.backlog.len;
+    uint8_t  head[16];
+    memcpy(head, REPL_MAGIC, 8);
+    put_u64(head + 8, off);
+    buf_append(&r->out, head, sizeof head);
+
+    uint32_t now = now_secs();
+    for (unsigned i = 0; i < g_nshards; ++i) {
+        Shard* s = &g_shards[i];
+        pthread_mutex_lock(&s->lock);
+        for (unsigned k = 0; k <= g_nclasses; ++k)
+            for (const Item* it = s->cls[k].head; it; it = it->next)
+                if (!item_expired(it, now)) repl_record(&r->out, REPL_SET, it);
+        pthread_mutex_unlock(&s->lock);
+    }
+    uint8_t end[5] = { REPL_END };
+    buf_append(&r->out, end, sizeof end);
+
+    pthread_mutex_lock(&g_repl.lock);
+    r->ready  = 1;
+    r->off    = r->ack = off;
+    r->ack_ms = wall_ms();
+    g_repl.nready++;
+    pthread_mutex_unlock(&g_repl.lock);
+    fprintf(stderr, "eht_server: replica %s syncing, %zu bytes\n",
+            r->name, r->out.len);
+}
+
+static void repl_drop(Replica* r, const char* why)
+{
+    pthread_mutex_lock(&g_repl.lock);
+    for (Replica** pp = &g_repl.replicas; *pp; pp = &(*pp)->next) {
+        if (*pp == r) {
+            *pp = r->next;
+            break;
+        }
+    }
+    if (r->ready && --g_repl.nready == 0)
+        __atomic_store_n(&g_repl_on, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_repl.lock);
+    if (why) fprintf(stderr, "eht_server: replica %s %s\n", r->name, why);
+    epoll_ctl(g_repl.ep, EPOLL_CTL_DEL, r->src.fd, NULL);
+    close(r->src.fd);
+    buf_free(&r->out);
+    free(r);
+}
+
+static void repl_arm(Replica* r, int writing)
+{
+    if (writing == r->writing) return;
+    struct epoll_event ev;
+    ev.events   = EPOLLIN | (writing ? EPOLLOUT : 0);
+    ev.data.ptr = r;
+    epoll_ctl(g_repl.ep, EPOLL_CTL_MOD, r->src.fd, &ev);
+    r->writing = writing;
+}
+
+/*  Sends r its snapshot, then the backlog from r->off.  Returns -1 if
+ *  the replica is gone. */
+static int repl_send(Replica* r)
+{
+    uint64_t end = g_repl.base + g_repl.backlog.len;
+    for (;;) {
+        const uint8_t* p;
+        size_t         n;
+        if (r->out_off < r->out.len) {
+            p = r->out.data + r->out_off;
+            n = r->out.len - r->out_off;
+        } else if (r->off < end) {
+            p = g_repl.backlog.data + (r->off - g_repl.base);
+            n = (size_t)(end - r->off);
+        } else {
+            break;
+        }
+        ssize_t k = send(r->src.fd, p, n, MSG_NOSIGNAL);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        if (r->out_off < r->out.len) r->out_off += (size_t)k;
+        else                         r->off     += (uint64_t)k;
+    }
+    if (r->out.len && r->out_off == r->out.len) {
+        buf_free(&r->out);
+        r->out_off = 0;
+        pthread_mutex_lock(&g_repl.lock);
+        r->online = 1;
+        pthread_mutex_unlock(&g_repl.lock);
+    }
+    repl_arm(r, r->out_off < r->out.len || r->off < end);
+    return 0;
+}
+
+/*  Drops the backlog every replica has been sent, and replicas too far
+ *  behind to catch up. */
+static void repl_trim(void)
+{
+    uint64_t end = g_repl.base + g_repl.backlog.len, low = end;
+    for (Replica *r = g_repl.replicas, *next; r; r = next) {
+        next = r->next;
+        if (!r->ready) continue;
+        if (end - r->off > REPL_BACKLOG) repl_drop(r, "dropped: too far behind");
+        else if (r->off < low)           low = r->off;
+    }
+    size_t done = (size_t)(low - g_repl.base);
+    if (done == g_repl.backlog.len) {
+        g_repl.backlog.len = 0;
+        g_repl.base        = end;
+    } else if (done > g_repl.backlog.cap / 2) {
+        memmove(g_repl.backlog.data, g_repl.backlog.data + done,
+                g_repl.backlog.len - done);
+        g_repl.backlog.len -= done;
+        g_repl.base         = low;
+    }
+}
+
+static void repl_accept(void)
+{
+    for (;;) {
+        struct sockaddr_storage sa;
+        socklen_t               sl = sizeof sa;
+        int fd = accept4(g_repl.listen.fd, (struct sockaddr*)&sa, &sl,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        Replica* r = (Replica*)calloc(1, sizeof(*r));
+        if (!r) {
+            close(fd);
+            continue;
+        }
+        r->src = (EvSource){ EV_CONN, fd, 0 };
+        if (sa.ss_family == AF_INET) {
+            const struct sockaddr_in* in = (const struct sockaddr_in*)&sa;
+            char ip[INET_ADDRSTRLEN];
+            int  one = 1;
+            inet_ntop(AF_INET, &in->sin_addr, ip, sizeof ip);
+            snprintf(r->name, sizeof r->name, "%s:%d", ip, ntohs(in->sin_port));
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        } else {
+            snprintf(r->name, sizeof r->name, "unix:%d", fd);
+        }
+        struct epoll_event ev;
+        ev.events   = EPOLLIN;
+        ev.data.ptr = r;
+        if (epoll_ctl(g_repl.ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(r);
+            continue;
+        }
+        pthread_mutex_lock(&g_repl.lock);
+        r->next         = g_repl.replicas;
+        g_repl.replicas = r;
+        pthread_mutex_unlock(&g_repl.lock);
+    }
+}
+
+/*  Reads r's hello or acknowledgements.  Returns -1 once r is dropped. */
+static int repl_on_replica(Replica* r, uint32_t events)
+{
+    if (!(events & EPOLLIN)) return events & (EPOLLERR | EPOLLHUP) ? -1 : 0;
+    uint8_t buf[256];
+    ssize_t n = recv(r->src.fd, buf, sizeof buf, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) return -1;
+    for (ssize_t i = 0; i < n; ++i) {
+        r->in[r->in_n++] = buf[i];
+        if (r->in_n < sizeof r->in) continue;
+        r->in_n = 0;
+        if (r->ready) {
+            pthread_mutex_lock(&g_repl.lock);
+            r->ack    = get_u64(r->in);
+            r->ack_ms = wall_ms();
+            pthread_mutex_unlock(&g_repl.lock);
+        } else if (memcmp(r->in, REPL_HELLO, 8) == 0) {
+            repl_sync(r);
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void* repl_primary_main(void* arg)
+{
+    struct epoll_event evs[16];
+    uint64_t           pinged = 0;
+    (void)arg;
+    while (!__atomic_load_n(&g_repl.stop, __ATOMIC_RELAXED)) {
+        int n = epoll_wait(g_repl.ep, evs, 16, 100);
+        for (int i = 0; i < n; ++i) {
+            EvSource* src = (EvSource*)evs[i].data.ptr;
+            uint64_t  v;
+            if (src->kind == EV_LISTEN) {
+                repl_accept();
+            } else if (src->kind == EV_WAKE) {
+                if (read(src->fd, &v, sizeof v) < 0 && errno != EAGAIN)
+                    perror("eht_server: repl wake");
+            } else if (repl_on_replica((Replica*)src, evs[i].events) < 0) {
+                repl_drop((Replica*)src, "disconnected");
+            }
+        }
+        uint64_t now = wall_ms();
+        if (g_repl.nready && now - pinged >= 1000) {
+            repl_ping();
+            pinged = now;
+        }
+        repl_drain();
+        for (Replica *r = g_repl.replicas, *next; r; r = next) {
+            next = r->next;
+            if (r->ready && repl_send(r) < 0) repl_drop(r, "disconnected");
+        }
+        repl_trim();
+    }
+    while (g_repl.replicas) repl_drop(g_repl.replicas, NULL);
+    buf_free(&g_repl.backlog);
+    return NULL;
+}
+
+/*  Serves replicas on the listening socket fd from a thread of its own. */
+static int repl_start_primary(int fd)
+{
+    g_repl.listen = (EvSource){ EV_LISTEN, fd, 0 };
+    g_repl.wake   = (EvSource){ EV_WAKE, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), 0 };
+    g_repl.ep     = epoll_create1(EPOLL_CLOEXEC);
+    g_repl_wake   = g_repl.wake.fd;
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &g_repl.listen;
+    if (g_repl.ep < 0 || g_repl_wake < 0 ||
+        epoll_ctl(g_repl.ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+        return -1;
+    ev.data.ptr = &g_repl.wake;
+    epoll_ctl(g_repl.ep, EPOLL_CTL_ADD, g_repl_wake, &ev);
+    return pthread_create(&g_repl.primary_th, NULL, repl_primary_main, NULL) ? -1 : 0;
+}
+
+/*  Applies one record to the store.  Returns -1 if it is malformed. */
+static int repl_apply(Buf* keys, int op, const uint8_t* p, size_t n)
+{
+    uint32_t flags = 0, exptime = 0;
+    size_t   hd = 0, kl = n;
+    switch (op) {
+    case REPL_PING: {
+        if (n != 8) return -1;
+        uint64_t sent = get_u64(p), now = wall_ms();
+        __atomic_store_n(&g_repl.lag_ms, now > sent ? now - sent : 0,
+                         __ATOMIC_RELAXED);
+        return 0;
+    }
+    case REPL_SET:
+        if (n < 12 || (kl = get_u32(p + 8)) > n - 12) return -1;
+        flags   = get_u32(p);
+        exptime = get_u32(p + 4);
+        hd      = 12;
+        break;
+    case REPL_TOUCH:
+        if (n < 4) return -1;
+        exptime = get_u32(p);
+        hd      = 4;
+        kl      = n - 4;
+        break;
+    case REPL_DEL:
+        break;
+    default:
+        return -1;
+    }
+    if (memchr(p + hd, 0, kl)) return -1;
+    keys->len = 0;
+    buf_append(keys, p + hd, kl);
+    buf_append(keys, "", 1);
+    const char* key = (const char*)keys->data;
+    uint64_t    h   = eht_hash(key);
+    Shard*      s   = shard_of(h);
+
+    /* The primary's Unix expiry on this server's clock; past is a delete */
+    long long t    = exptime ? (long long)exptime - (long long)g_epoch : 0;
+    int       gone = exptime && t <= (long long)now_secs();
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_get(s, key, h);
+    if (op == REPL_DEL || gone) {
+        if (it) item_unlink(s, it, h);
+    } else if (op == REPL_TOUCH) {
+        if (it) item_touch(s, it, (uint32_t)t);
+    } else {
+        /* Out of memory here leaves the key missing, as an eviction would */
+        item_put(s, key, h, it, p + hd + kl, n - hd - kl, flags, (uint32_t)t);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+static int repl_quit(void)
+{
+    return __atomic_load_n(&g_repl.stop, __ATOMIC_RELAXED) ||
+           __atomic_load_n(&g_repl.detach, __ATOMIC_RELAXED);
+}
+
+/*  Syncs from the primary on fd, then applies its log, until the link
+ *  fails or the replica is stopped or promoted. */
+static void repl_link(int fd, Buf* in, Buf* keys)
+{
+    size_t   off   = 0;
+    int      state = LINK_DOWN;   /* until the stream's header arrives */
+    uint64_t applied = 0, acked = 0, heard = wall_ms();
+    in->len = 0;
+    if (send(fd, REPL_HELLO, 8, MSG_NOSIGNAL) != 8) return;
+    __atomic_store_n(&g_repl.link, LINK_SYNC, __ATOMIC_RELAXED);
+    while (!repl_quit()) {
+        ssize_t n = recv(fd, buf_reserve(in, READ_CHUNK), READ_CHUNK, 0);
+        if (n == 0) return;
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return;
+            if (wall_ms() - heard > REPL_TIMEOUT) return;
+            continue;
+        }
+        in->len += (size_t)n;
+        heard    = wall_ms();
+        __atomic_store_n(&g_repl.io_ms, heard, __ATOMIC_RELAXED);
+
+        for (;;) {
+            const uint8_t* p     = in->data + off;
+            size_t         avail = in->len - off;
+            if (state == LINK_DOWN) {
+                if (avail < 16) break;
+                if (memcmp(p, REPL_MAGIC, 8)) return;
+                applied = get_u64(p + 8);
+                store_flush(0);   /* a full resync replaces everything */
+                state = LINK_SYNC;
+                off  += 16;
+                continue;
+            }
+            if (avail < 5) break;
+            size_t len = get_u32(p + 1);
+            if (len > REPL_MAX_RECORD) return;
+            if (avail - 5 < len) break;
+            if (state == LINK_SYNC && p[0] == REPL_END) {
+                state = LINK_UP;
+                __atomic_store_n(&g_repl.link, LINK_UP, __ATOMIC_RELAXED);
+                fprintf(stderr, "eht_server: synced from primary %s\n", g_repl.spec);
+            } else if (state == LINK_SYNC) {
+                if (p[0] != REPL_SET || repl_apply(keys, p[0], p + 5, len) < 0) return;
+            } else {
+                if (repl_apply(keys, p[0], p + 5, len) < 0) return;
+                applied += 5 + len;
+            }
+            off += 5 + len;
+        }
+        if (off == in->len) {
+            in->len = off = 0;
+        } else if (off > in->cap / 2) {
+            memmove(in->data, in->data + off, in->len - off);
+            in->len -= off;
+            off      = 0;
+        }
+        __atomic_store_n(&g_repl.applied, applied, __ATOMIC_RELAXED);
+        if (state == LINK_UP && applied != acked) {
+            uint8_t ack[8];
+            put_u64(ack, applied);
+            if (send(fd, ack, sizeof ack, MSG_NOSIGNAL) != (ssize_t)sizeof ack) return;
+            acked = applied;
+        }
+    }
+}
+
+static void* repl_replica_main(void* arg)
+{
+    Buf in = { 0 }, keys = { 0 };
+    int failed = 0;
+    (void)arg;
+    while (!repl_quit()) {
+        int fd = socket(g_repl.sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&g_repl.sa, g_repl.salen) == 0) {
+            /* A receive timeout lets the thread notice stop and detach */
+            struct timeval tv  = { 0, 100000 };
+            int            one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+            if (g_repl.port) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            failed = 0;
+            repl_link(fd, &in, &keys);
+            __atomic_store_n(&g_repl.link, LINK_DOWN, __ATOMIC_RELAXED);
+            if (!repl_quit())
+                fprintf(stderr, "eht_server: lost primary %s\n", g_repl.spec);
+        } else if (!failed++) {
+            fprintf(stderr, "eht_server: primary %s unreachable, retrying\n",
+                    g_repl.spec);
+        }
+        if (fd >= 0) close(fd);
+        struct timespec wait = { 0, 100000000 };
+        for (int i = 0; i < 10 && !repl_quit(); ++i) nanosleep(&wait, NULL);
+    }
+    buf_free(&in);
+    buf_free(&keys);
+    return NULL;
+}
+
+/*  Replicates from spec, host:port or (path) a Unix socket path, and
+ *  makes the server read-only. */
+static int repl_start_replica(const char* spec, int path)
+{
+    memset(&g_repl.sa, 0, sizeof g_repl.sa);
+    g_repl.spec = spec;
+    if (path) {
+        struct sockaddr_un* sa = (struct sockaddr_un*)&g_repl.sa;
+        if (strlen(spec) >= sizeof sa->sun_path) return -1;
+        sa->sun_family = AF_UNIX;
+        strcpy(sa->sun_path, spec);
+        g_repl.salen   = sizeof(*sa);
+        g_repl.primary = spec;
+    } else {
+        struct sockaddr_in* sa    = (struct sockaddr_in*)&g_repl.sa;
+        const char*         colon = strrchr(spec, ':');
+        static char         host[INET_ADDRSTRLEN];
+        if (!colon || (size_t)(colon - spec) >= sizeof host) return -1;
+        memcpy(host, spec, (size_t)(colon - spec));
+        host[colon - spec] = 0;
+        g_repl.port = atoi(colon + 1);
+        if (g_repl.port <= 0 || g_repl.port > 65535 ||
+            inet_pton(AF_INET, host, &sa->sin_addr) != 1)
+            return -1;
+        sa->sin_family = AF_INET;
+        sa->sin_port   = htons((uint16_t)g_repl.port);
+        g_repl.salen   = sizeof(*sa);
+        g_repl.primary = host;
+    }
+    __atomic_store_n(&g_readonly, 1, __ATOMIC_RELAXED);
+    return pthread_create(&g_repl.replica_th, NULL, repl_replica_main, NULL) ? -1 : 0;
+}
+
+/*  Promotes a replica: it stops following its primary and takes writes. */
+static void repl_detach(void)
+{
+    __atomic_store_n(&g_repl.detach, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_readonly, 0, __ATOMIC_RELAXED);
+}
+
+static void repl_stop(void)
+{
+    __atomic_store_n(&g_repl.stop, 1, __ATOMIC_RELAXED);
+    if (g_repl_wake >= 0) {
+        pthread_join(g_repl.primary_th, NULL);
+        close(g_repl.ep);
+        close(g_repl.wake.fd);
+        close(g_repl.listen.fd);
+    }
+    if (g_repl.primary) pthread_join(g_repl.replica_th, NULL);
+}
+
+/*  Appends INFO's # Replication section, in Redis's terms. */
+static void repl_info(Buf* b)
+{
+    char line[256];
+#define INFO(...) buf_append(b, line, (size_t)snprintf(line, sizeof line, __VA_ARGS__))
+    uint64_t now = wall_ms();
+    if (repl_is_replica()) {
+        int link = __atomic_load_n(&g_repl.link, __ATOMIC_RELAXED);
+        INFO("# Replication\r\nrole:slave\r\nmaster_host:%.160s\r\n", g_repl.primary);
+        INFO("master_port:%d\r\nmaster_link_status:%s\r\n"
+             "master_last_io_seconds_ago:%lld\r\nmaster_sync_in_progress:%d\r\n",
+             g_repl.port, link == LINK_UP ? "up" : "down",
+             link == LINK_DOWN ? -1LL : (long long)(now -
+                 __atomic_load_n(&g_repl.io_ms, __ATOMIC_RELAXED)) / 1000,
+             link == LINK_SYNC);
+        INFO("slave_repl_offset:%llu\r\nslave_read_only:1\r\nslave_lag_ms:%llu\r\n",
+             (unsigned long long)__atomic_load_n(&g_repl.applied, __ATOMIC_RELAXED),
+             (unsigned long long)__atomic_load_n(&g_repl.lag_ms, __ATOMIC_RELAXED));
+    } else {
+        INFO("# Replication\r\nrole:master\r\n");
+    }
+    /* A replica with no replicas of its own reports the offset it follows */
+    uint64_t offset = g_repl_wake < 0 && g_repl.primary
+                    ? __atomic_load_n(&g_repl.applied, __ATOMIC_RELAXED)
+                    : __atomic_load_n(&g_repl.offset, __ATOMIC_RELAXED);
+    unsigned i      = 0;
+    pthread_mutex_lock(&g_repl.lock);
+    INFO("connected_slaves:%u\r\n", g_repl.nready);
+    for (const Replica* r = g_repl.replicas; r; r = r->next) {
+        if (!r->ready) continue;
+        INFO("slave%u:ip=%s,state=%s,offset=%llu,lag=%llu,lag_bytes=%llu\r\n",
+             i++, r->name, r->online ? "online" : "send_bulk",
+             (unsigned long long)r->ack,
+             (unsigned long long)(now > r->ack_ms ? now - r->ack_ms : 0) / 1000,
+             (unsigned long long)(offset > r->ack ? offset - r->ack : 0));
+    }
+    pthread_mutex_unlock(&g_repl.lock);
+    INFO("master_repl_offset:%llu\r\n\r\n", (unsigned long long)offset);
+#undef INFO
+}
+
+/* ------------------------------------------------------------------ */
+/* Command latency                                                    */
+/* ------------------------------------------------------------------ */
+
+/* What /metrics labels commands with.  Binary ops index their own row;
+ * text commands are looked up by name, and slot 0 takes the rest. */
+static const char* const g_cmd_names[3][CMD_SLOTS] = {
+    [PROTO_BIN]  = { "other", "get", "set", "del", "mget", "len", "ping" },
+    [PROTO_RESP] = { "other", "get", "set", "del", "unlink", "exists", "mget",
+                     "mset", "incr", "decr", "incrby", "decrby", "ttl",
+                     "expire", "scan", "dbsize", "info", "replicaof", "ping",
+                     "echo", "hello", "select", "command", "config", "client",
+                     "quit" },
+    [PROTO_MC]   = { "other", "get", "gets", "gat", "gats", "set", "add",
+                     "replace", "append", "prepend", "cas", "delete", "incr",
+                     "decr", "touch", "mg", "ms", "md", "ma", "mn", "stats",
+                     "flush_all", "version", "verbosity", "quit" },
+};
+
+static uint64_t mono_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+/*  Slot of the text command named p[0..n) in proto's row. */
+static unsigned cmd_slot(int proto, const void* p, size_t n)
+{
+    const char* const* names = g_cmd_names[proto];
+    for (unsigned i = 1; i < CMD_SLOTS && names[i]; ++i)
+        if (strlen(names[i]) == n && !strncasecmp(names[i], (const char*)p, n))
+            return i;
+    return 0;
+}
+
+/*  Start of a run of commands: 0, so nothing is timed, without -M. */
+static uint64_t lat_start(void)
+{
+    return g_metrics ? mono_ns() : 0;
+}
+
+/*  Counts a command that ran from t0 until now, and returns now: each
+ *  command in a pipelined run costs one clock read. */
+static uint64_t lat_done(Worker* w, int proto, unsigned cmd, uint64_t t0)
+{
+    if (!t0) return 0;
+    uint64_t now = mono_ns(), ns = now - t0;
+    unsigned b   = ns <= 1000 ? 0 : 64 - (unsigned)__builtin_clzll((ns - 1) / 1000);
+    if (b >= LAT_BUCKETS) b = LAT_BUCKETS - 1;
+    uint64_t* n = &w->lat[proto][cmd][b];
+    __atomic_store_n(n, __atomic_load_n(n, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    n = &w->lat_ns[proto][cmd];
+    __atomic_store_n(n, __atomic_load_n(n, __ATOMIC_RELAXED) + ns, __ATOMIC_RELAXED);
+    return now;
+}
+
+/* ------------------------------------------------------------------ */
+/* Binary protocol                                                    */
+/* ------------------------------------------------------------------ */
+
+enum { BIN_GET = 1, BIN_SET, BIN_DEL, BIN_MGET, BIN_LEN, BIN_PING };
+enum { ST_OK = 0, ST_MISS, ST_ERR };
+
+#define MGET_MISS 0xFFFFFFFFu
+
+static size_t reply_begin(Buf* out, int status)
+{
+    size_t at = out->len;
+    uint8_t* p = buf_reserve(out, 5);
+    p[4] = (uint8_t)status;
+    out->len += 5;
+    return at;
+}
+
+static void reply_end(Buf* out, size_t at)
+{
+    put_u32(out->data + at, (uint32_t)(out->len - at - 4));
+}
+
+static void reply(Buf* out, int status, const void* body, size_t n)
+{
+    size_t at = reply_begin(out, status);
+    buf_append(out, body, n);
+    reply_end(out, at);
+}
+
+static void reply_err(Buf* out, const char* msg)
+{
+    reply(out, ST_ERR, msg, strlen(msg));
+}
+
+static void bin_mget(Worker* w, Buf* out, const uint8_t* p, size_t len)
+{
+    size_t n = 0, off = 0;
+    while (off < len) {
+        if (len - off < 4) goto bad;
+        size_t kl = get_u32(p + off);
+        if (kl > len - off - 4) goto bad;
+        if (!key_copy(w, p + off + 4, kl)) goto bad;
+        off += 4 + kl;
+        ++n;
+    }
+    Batch* b = batch_begin(w, n);
+    store_mget(w, b);
+    size_t at = reply_begin(out, ST_OK);
+    for (size_t i = 0; i < n; ++i) {
+        buf_u32(out, b->found[i] ? (uint32_t)b->vlen[i] : MGET_MISS);
+        buf_append(out, w->vals.data + b->voff[i], b->vlen[i]);
+    }
+    reply_end(out, at);
+    return;
+bad:
+    reply_err(out, "malformed MGET");
+}
+
+static void bin_request(Worker* w, Buf* out, int op,
+                        const uint8_t* p, size_t len)
+{
+    const char* key;
+    w->keys.len = 0;
+    if ((op == BIN_SET || op == BIN_DEL) &&
+        __atomic_load_n(&g_readonly, __ATOMIC_RELAXED)) {
+        reply_err(out, "read-only replica");
+        return;
+    }
+    switch (op) {
+    case BIN_GET: {
+        if (!(key = key_copy(w, p, len))) break;
+        size_t at = reply_begin(out, ST_OK);
+        if (!store_get(key, eht_hash(key), out))
+            out->data[at + 4] = ST_MISS;
+        reply_end(out, at);
+        return;
+    }
+    case BIN_SET: {
+        if (len < 4) break;
+        size_t kl = get_u32(p);
+        if (kl > len - 4 || !(key = key_copy(w, p + 4, kl))) break;
+        if (store_set(key, eht_hash(key), p + 4 + kl, len - 4 - kl) < 0) {
+            reply_err(out, "out of memory");
+            return;
+        }
+        reply(out, ST_OK, NULL, 0);
+        return;
+    }
+    case BIN_DEL:
+        if (!(key = key_copy(w, p, len))) break;
+        reply(out, store_del(key, eht_hash(key)) ? ST_OK : ST_MISS, NULL, 0);
+        return;
+    case BIN_MGET:
+        bin_mget(w, out, p, len);
+        return;
+    case BIN_LEN: {
+        uint64_t n = store_len();
+        uint8_t  b[8];
+        put_u32(b, (uint32_t)n);
+        put_u32(b + 4, (uint32_t)(n >> 32));
+        reply(out, ST_OK, b, 8);
+        return;
+    }
+    case BIN_PING:
+        reply(out, ST_OK, p, len);
+        return;
+    default:
+        reply_err(out, "unknown op");
+        return;
+    }
+    reply_err(out, "malformed request");
+}
+
+/*  Handles every complete frame in c->in.  Returns -1 to close. */
+static int bin_process(Conn* c)
+{
+    uint64_t t0 = lat_start();
+    while (c->in.len - c->in_off >= 4) {
+        if (c->out.len - c->out_off >= OUT_HIGH) break;
+        const uint8_t* p   = c->in.data + c->in_off;
+        uint32_t       len = get_u32(p);
+        if (len == 0 || len > MAX_FRAME) return -1;
+        if (c->in.len - c->in_off - 4 < len) break;
+        bin_request(c->w, &c->out, p[4], p + 5, len - 1);
+        c->in_off += 4 + (size_t)len;
+        t0 = lat_done(c->w, PROTO_BIN, p[4] <= BIN_PING ? p[4] : 0, t0);
+    }
+    conn_consumed(c);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* RESP (Redis protocol)                                              */
+/* ------------------------------------------------------------------ */
+
+#define RESP_MAX_ARGS   (1 << 20)
+#define RESP_MAX_INLINE (64u << 10)
+#define SCAN_SHARD_BITS 12   /* cursor = position << 20 | epoch << 12 | shard */
+#define SCAN_EPOCH_BITS 8    /* the shard's rebuild count, mod 256    */
+
+typedef struct {
+    const uint8_t* p;
+    size_t         n;
+} Arg;
+
+static void resp_raw(Buf* out, const char* s)
+{
+    buf_append(out, s, strlen(s));
+}
+
+static void resp_head(Buf* out, char type, long long n)
+{
+    char h[32];
+    int  k = snprintf(h, sizeof h, "%c%lld\r\n", type, n);
+    buf_append(out, h, (size_t)k);
+}
+
+static void resp_bulk(Buf* out, const void* p, size_t n)
+{
+    resp_head(out, '$', (long long)n);
+    buf_append(out, p, n);
+    buf_append(out, "\r\n", 2);
+}
+
+static void resp_null(Conn* c)
+{
+    resp_raw(&c->out, c->resp3 ? "_\r\n" : "$-1\r\n");
+}
+
+static void resp_err(Buf* out, const char* msg)
+{
+    buf_append(out, "-", 1);
+    resp_raw(out, msg);
+    buf_append(out, "\r\n", 2);
+}
+
+static int arg_is(const Arg* a, const char* name)
+{
+    return a->n == strlen(name) && !strncasecmp((const char*)a->p, name, a->n);
+}
+
+/*  Parses a whole decimal long long (optional '-', no spaces). */
+static int arg_ll(const Arg* a, long long* out)
+{
+    char tmp[24];
+    if (a->n == 0 || a->n >= sizeof tmp) return -1;
+    memcpy(tmp, a->p, a->n);
+    tmp[a->n] = 0;
+    if (tmp[0] != '-' && (tmp[0] < '0' || tmp[0] > '9')) return -1;
+    char* end;
+    errno = 0;
+    *out = strtoll(tmp, &end, 10);
+    return *end || errno ? -1 : 0;
+}
+
+/*  Parses a whole unsigned decimal (a SCAN cursor). */
+static int arg_ull(const Arg* a, uint64_t* out)
+{
+    uint64_t v = 0;
+    if (a->n == 0 || a->n > 20) return -1;
+    for (size_t i = 0; i < a->n; ++i) {
+        unsigned d = (unsigned)(a->p[i] - '0');
+        if (d > 9 || v > (UINT64_MAX - d) / 10) return -1;
+        v = v * 10 + d;
+    }
+    *out = v;
+    return 0;
+}
+
+/*  Length of the pattern element at pat[0..pn), which is not '*', if it
+ *  matches c, else 0. */
+static size_t glob_one(const char* pat, size_t pn, char c)
+{
+    switch (*pat) {
+    case '?':
+        return 1;
+    case '[': {
+        size_t i   = 1;
+        int    neg = i < pn && pat[i] == '^', hit = 0;
+        if (neg) ++i;
+        while (i < pn && pat[i] != ']') {
+            if (pat[i] == '\\' && i + 1 < pn) {
+                ++i;
+                hit |= pat[i] == c;
+            } else if (i + 2 < pn && pat[i + 1] == '-' && pat[i + 2] != ']') {
+                char lo = pat[i], hi = pat[i + 2];
+                if (lo > hi) { char t = lo; lo = hi; hi = t; }
+                hit |= c >= lo && c <= hi;
+                i += 2;
+            } else {
+                hit |= pat[i] == c;
+            }
+            ++i;
+        }
+        if (hit == neg) return 0;
+        return i < pn ? i + 1 : pn;   /* an unclosed set runs to the end */
+    }
+    case '\\':
+        if (pn > 1) return pat[1] == c ? 2 : 0;
+        /* fall through */
+    default:
+        return *pat == c;
+    }
+}
+
+/*  Redis-style glob: * ? [set] [^set] [a-z] and \ escapes.  Only the
+ *  latest * is ever retried, one key byte further on each time, so a
+ *  match costs at most pattern length times key length steps however
+ *  many stars the pattern has. */
+static int glob_match(const char* pat, size_t pn, const char* s, size_t sn)
+{
+    size_t p = 0, i = 0, star = SIZE_MAX, from = 0;
+    while (i < sn) {
+        if (p < pn && pat[p] == '*') {
+            while (p < pn && pat[p] == '*') ++p;
+            if (p == pn) return 1;
+            star = p;
+            from = i;
+            continue;
+        }
+        size_t k = p < pn ? glob_one(pat + p, pn - p, s[i]) : 0;
+        if (k) {
+            p += k;
+            ++i;
+        } else if (star != SIZE_MAX) {
+            p = star;       /* the star takes one more byte */
+            i = ++from;
+        } else {
+            return 0;
+        }
+    }
+    while (p < pn && pat[p] == '*') ++p;
+    return p == pn;
+}
+
+/*  Copies args[from..] to w->keys as C strings.  Returns the count, or
+ *  -1 (after an error reply) if one holds a NUL byte. */
+static long resp_keys(Conn* c, const Arg* args, int from, int to, int step)
+{
+    long n = 0;
+    for (int i = from; i < to; i += step, ++n) {
+        if (!key_copy(c->w, args[i].p, args[i].n)) {
+            resp_err(&c->out, "ERR keys may not contain NUL bytes");
+            return -1;
+        }
+    }
+    return n;
+}
+
+/*  Server-clock expiry for SET's EX, PX, EXAT or PXAT option.  The
+ *  clock counts seconds, so milliseconds round up.  Returns -1 after an
+ *  error reply. */
+static int resp_expiry(Conn* c, const Arg* opt, const Arg* val, uint32_t* out)
+{
+    long long v;
+    if (arg_ll(val, &v) < 0) {
+        resp_err(&c->out, "ERR value is not an integer or out of range");
+        return -1;
+    }
+    if (v <= 0 || v > UINT32_MAX * 1000LL) {
+        resp_err(&c->out, "ERR invalid expire time in 'set' command");
+        return -1;
+    }
+    if (arg_is(opt, "PX") || arg_is(opt, "PXAT")) v = (v + 999) / 1000;
+    if (arg_is(opt, "EXAT") || arg_is(opt, "PXAT")) v -= (long long)g_epoch;
+    else                                            v += now_secs();
+    if (v > UINT32_MAX) {
+        resp_err(&c->out, "ERR invalid expire time in 'set' command");
+        return -1;
+    }
+    *out = v < 1 ? 1 : (uint32_t)v;   /* a past time: stored expired */
+    return 0;
+}
+
+/*  SET key value [NX|XX] [GET] [EX|PX|EXAT|PXAT t|KEEPTTL]: the
+ *  conditional forms run under the shard lock so they are atomic. */
+static void resp_set(Conn* c, const Arg* a, int argc)
+{
+    int      nx = 0, xx = 0, get = 0, keepttl = 0, expiry = 0;
+    uint32_t exptime = 0;
+    for (int i = 3; i < argc; ++i) {
+        if (arg_is(&a[i], "NX"))           nx = 1;
+        else if (arg_is(&a[i], "XX"))      xx = 1;
+        else if (arg_is(&a[i], "GET"))     get = 1;
+        else if (arg_is(&a[i], "KEEPTTL")) keepttl = 1;
+        else if ((arg_is(&a[i], "EX") || arg_is(&a[i], "PX") ||
+                  arg_is(&a[i], "EXAT") || arg_is(&a[i], "PXAT")) &&
+                 i + 1 < argc && !expiry) {
+            if (resp_expiry(c, &a[i], &a[i + 1], &exptime) < 0) return;
+            expiry = 1;
+            ++i;
+        } else {
+            resp_err(&c->out, "ERR syntax error");
+            return;
+        }
+    }
+    if ((nx && xx) || (keepttl && expiry)) {
+        resp_err(&c->out, "ERR syntax error");
+        return;
+    }
+    if (resp_keys(c, a, 1, 2, 1) < 0) return;
+    const char* key = (const char*)c->w->keys.data;
+    uint64_t    h   = eht_hash(key);
+    Shard*      s   = shard_of(h);
+
+    c->w->vals.len = 0;
+    pthread_mutex_lock(&s->lock);
+    Item* old = item_get(s, key, h);
+    int   had = old != NULL, rc = 0;
+    if (get && had) buf_append(&c->w->vals, item_value(old), old->vlen);
+    if (!(nx && had) && !(xx && !had)) {
+        if (keepttl && had) exptime = old->exptime;
+        rc = item_put(s, key, h, old, a[2].p, a[2].n, 0, exptime) ? 1 : -1;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (rc < 0)        resp_err(&c->out, "OOM out of memory");
+    else if (get && had) resp_bulk(&c->out, c->w->vals.data, c->w->vals.len);
+    else if (!get && rc) resp_raw(&c->out, "+OK\r\n");
+    else               resp_null(c);
+}
+
+/*  INCRBY and friends; the item keeps its expiry, as in Redis. */
+static void resp_incr(Conn* c, const Arg* a, long long delta)
+{
+    if (resp_keys(c, a, 1, 2, 1) < 0) return;
+    const char* key = (const char*)c->w->keys.data;
+    uint64_t    h   = eht_hash(key);
+    Shard*      s   = shard_of(h);
+    long long   cur = 0;
+    uint32_t    exptime = 0;
+    const char* err = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_get(s, key, h);
+    if (it) {
+        Arg old = { (const uint8_t*)item_value(it), it->vlen };
+        if (arg_ll(&old, &cur) < 0)
+            err = "ERR value is not an integer or out of range";
+        exptime = it->exptime;
+    }
+    if (!err && __builtin_add_overflow(cur, delta, &cur))
+        err = "ERR increment or decrement would overflow";
+    if (!err) {
+        char num[24];
+        int  k = snprintf(num, sizeof num, "%lld", cur);
+        if (!item_put(s, key, h, it, num, (size_t)k, 0, exptime))
+            err = "OOM out of memory";
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (err) resp_err(&c->out, err);
+    else     resp_head(&c->out, ':', cur);
+}
+
+/*  TTL key, or EXPIRE key seconds (which deletes the key when seconds
+ *  is not positive). */
+static void resp_ttl(Conn* c, const Arg* a, int expire)
+{
+    long long secs = 0, ttl = -2;
+    if (expire && (arg_ll(&a[2], &secs) < 0 || secs > UINT32_MAX / 2)) {
+        resp_err(&c->out, "ERR value is not an integer or out of range");
+        return;
+    }
+    if (resp_keys(c, a, 1, 2, 1) < 0) return;
+    const char* key = (const char*)c->w->keys.data;
+    uint64_t    h   = eht_hash(key);
+    Shard*      s   = shard_of(h);
+
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_get(s, key, h);
+    if (it && !expire) {
+        ttl = it->exptime ? (long long)it->exptime - now_secs() : -1;
+    } else if (it) {
+        ttl = 1;
+        if (secs > 0) item_touch(s, it, now_secs() + (uint32_t)secs);
+        else          item_unlink(s, it, h);
+    } else if (expire) {
+        ttl = 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+    resp_head(&c->out, ':', ttl);
+}
+
+/*  SCAN cursor [MATCH pattern] [COUNT n] [TYPE string].  The cursor
+ *  packs a shard number and the shard's rebuild count under an
+ *  eht_iter_cursor position, so each call resumes inside one shard;
+ *  COUNT bounds the entries visited.  A rebuild compacts the shard's
+ *  entry array, which can carry entries not yet returned back past a
+ *  position taken before it, so a shard rebuilt since the cursor was
+ *  made is walked again from its start: every key present for the
+ *  whole scan is returned, some maybe twice, as Redis allows. */
+static void resp_scan(Conn* c, const Arg* a, int argc)
+{
+    uint64_t   cur;
+    long long  count = 10;
+    const Arg* match = NULL;
+    if (arg_ull(&a[1], &cur) < 0) {
+        resp_err(&c->out, "ERR invalid cursor");
+        return;
+    }
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            resp_err(&c->out, "ERR syntax error");
+            return;
+        }
+        if (arg_is(&a[i], "MATCH")) {
+            match = &a[i + 1];
+        } else if (arg_is(&a[i], "COUNT")) {
+            if (arg_ll(&a[i + 1], &count) < 0 || count < 1) {
+                resp_err(&c->out, "ERR value is not an integer or out of range");
+                return;
+            }
+        } else if (arg_is(&a[i], "TYPE")) {
+            if (!arg_is(&a[i + 1], "string")) count = -1;  /* none match */
+        } else {
+            resp_err(&c->out, "ERR syntax error");
+            return;
+        }
+    }
+
+    unsigned shard = (unsigned)(cur & ((1u << SCAN_SHARD_BITS) - 1));
+    unsigned epoch = (unsigned)(cur >> SCAN_SHARD_BITS) & ((1u << SCAN_EPOCH_BITS) - 1);
+    uint64_t pos   = cur >> (SCAN_SHARD_BITS + SCAN_EPOCH_BITS);
+    long long seen = 0, found = 0;
+    Buf* keys = &c->w->vals;
+    keys->len = 0;
+    while (count > 0 && shard < g_nshards && seen < count) {
+        Shard* s = &g_shards[shard];
+        pthread_mutex_lock(&s->lock);
+        EHTRebuildStats rs;
+        eht_rebuild_stats(s->table, &rs);
+        if (pos && (rs.count & ((1u << SCAN_EPOCH_BITS) - 1)) != epoch) pos = 0;
+        epoch = (unsigned)rs.count & ((1u << SCAN_EPOCH_BITS) - 1);
+        EHTIterator* it = eht_iter_create(s->table);
+        if (!it) {
+            pthread_mutex_unlock(&s->lock);
+            resp_err(&c->out, "OOM out of memory");
+            return;
+        }
+        eht_iter_seek(it, pos);
+        const char* k;
+        const void* v;
+        size_t      n;
+        int         more = 0;
+        uint32_t    now  = now_secs();
+        while (seen < count && (more = eht_iter_next(it, &k, &v, &n))) {
+            size_t kl = strlen(k);
+            Item*  item;
+            memcpy(&item, v, sizeof item);
+            ++seen;
+            if (item_expired(item, now)) continue;
+            if (match && !glob_match((const char*)match->p, match->n, k, kl))
+                continue;
+            resp_bulk(keys, k, kl);
+            ++found;
+        }
+        /* Stopped on the count with entries maybe left: resume here */
+        if (more) {
+            pos = eht_iter_cursor(it);
+        } else {
+            ++shard;
+            pos = 0;
+        }
+        eht_iter_destroy(it);
+        pthread_mutex_unlock(&s->lock);
+    }
+    if (count < 0 || shard >= g_nshards) shard = 0, pos = 0;
+    if (!pos) epoch = 0;
+
+    char next[24];
+    int  k = snprintf(next, sizeof next, "%llu",
+                      (unsigned long long)(pos << (SCAN_SHARD_BITS + SCAN_EPOCH_BITS) |
+                                           (uint64_t)epoch << SCAN_SHARD_BITS | shard));
+    resp_head(&c->out, '*', 2);
+    resp_bulk(&c->out, next, (size_t)k);
+    resp_head(&c->out, '*', found);
+    buf_append(&c->out, keys->data, keys->len);
+}
+
+static void resp_info(Conn* c)
+{
+    Buf*       b = &c->w->vals;
+    char       line[256];
+    StoreStats st;
+    store_stats(&st);
+    b->len = 0;
+#define INFO(...) buf_append(b, line, (size_t)snprintf(line, sizeof line, __VA_ARGS__))
+    INFO("# Server\r\nredis_version:7.0.0\r\neht_server:1\r\n"
+         "redis_mode:standalone\r\narch_bits:%d\r\nprocess_id:%ld\r\n"
+         "uptime_in_seconds:%u\r\n\r\n",
+         (int)(sizeof(void*) * 8), (long)getpid(), now_secs() - 2);
+    INFO("# Clients\r\nconnected_clients:%ld\r\n\r\n",
+         __atomic_load_n(&g_clients, __ATOMIC_RELAXED));
+    INFO("# Memory\r\nused_memory:%zu\r\nmaxmemory:%zu\r\n"
+         "maxmemory_policy:allkeys-lru\r\n\r\n",
+         __atomic_load_n(&g_mem_used, __ATOMIC_RELAXED), g_mem_limit);
+    INFO("# Stats\r\nkeyspace_hits:%llu\r\nkeyspace_misses:%llu\r\n"
+         "evicted_keys:%llu\r\nexpired_keys:%llu\r\n\r\n",
+         (unsigned long long)st.hits, (unsigned long long)st.misses,
+         (unsigned long long)st.evictions, (unsigned long long)st.expired);
+    repl_info(b);
+    INFO("# Keyspace\r\ndb0:keys=%llu,expires=%llu,avg_ttl=0\r\n\r\n",
+         (unsigned long long)st.items, (unsigned long long)st.ttl_items);
+
+    /* Level statistics summed over shards, level by level */
+    enum { MAXL = 64 };
+    EHTLevelInfo li[MAXL];
+    size_t cap[MAXL] = { 0 }, cnt[MAXL] = { 0 }, tomb[MAXL] = { 0 }, nl = 0;
+    for (unsigned i = 0; i < g_nshards; ++i) {
+        pthread_mutex_lock(&g_shards[i].lock);
+        size_t k = eht_num_levels(g_shards[i].table);
+        if (k > MAXL) k = MAXL;
+        eht_level_stats(g_shards[i].table, li, k);
+        pthread_mutex_unlock(&g_shards[i].lock);
+        for (size_t l = 0; l < k; ++l) {
+            cap[l]  += li[l].capacity;
+            cnt[l]  += li[l].count;
+            tomb[l] += li[l].tombstones;
+        }
+        if (k > nl) nl = k;
+    }
+    INFO("# Elastic\r\nshards:%u\r\nlevels:%zu\r\n", g_nshards, nl);
+    for (size_t l = 0; l < nl; ++l)
+        INFO("level%zu:capacity=%zu,count=%zu,tombstones=%zu,load=%.3f\r\n",
+             l, cap[l], cnt[l], tomb[l],
+             cap[l] ? (double)cnt[l] / (double)cap[l] : 0.0);
+#undef INFO
+    resp_bulk(&c->out, b->data, b->len);
+}
+
+static void resp_hello(Conn* c, const Arg* a, int argc)
+{
+    if (argc >= 2) {
+        long long v;
+        if (arg_ll(&a[1], &v) < 0 || v < 2 || v > 3) {
+            resp_err(&c->out, "NOPROTO unsupported protocol version");
+            return;
+        }
+        c->resp3 = v == 3;
+    }
+    const char* const kv[] = {
+        "server", "eht_server", "version", "7.0.0", "mode", "standalone",
+        "role", repl_is_replica() ? "replica" : "master",
+    };
+    resp_head(&c->out, c->resp3 ? '%' : '*', c->resp3 ? 7 : 14);
+    for (int i = 0; i < 4; ++i) {
+        resp_bulk(&c->out, kv[2 * i], strlen(kv[2 * i]));
+        resp_bulk(&c->out, kv[2 * i + 1], strlen(kv[2 * i + 1]));
+    }
+    resp_bulk(&c->out, "proto", 5);
+    resp_head(&c->out, ':', c->resp3 ? 3 : 2);
+    resp_bulk(&c->out, "id", 2);
+    resp_head(&c->out, ':', c->src.fd);
+    resp_bulk(&c->out, "modules", 7);
+    resp_head(&c->out, '*', 0);
+}
+
+/*  Commands a replica refuses. */
+static int resp_is_write(const Arg* cmd)
+{
+    static const char* const writes[] = {
+        "SET", "DEL", "UNLINK", "MSET", "INCR", "DECR", "INCRBY", "DECRBY",
+        "EXPIRE",
+    };
+    for (size_t i = 0; i < sizeof writes / sizeof *writes; ++i)
+        if (arg_is(cmd, writes[i])) return 1;
+    return 0;
+}
+
+static void resp_command(Conn* c, const Arg* a, int argc)
+{
+    Worker* w = c->w;
+    Buf*    out = &c->out;
+    w->keys.len = 0;
+
+    if (__atomic_load_n(&g_readonly, __ATOMIC_RELAXED) && resp_is_write(&a[0])) {
+        resp_err(out, "READONLY You can't write against a read only replica.");
+        return;
+    }
+
+#define ARITY(name, n)                                                   \
+    if ((n) > 0 ? argc != (n) : argc < -(n)) {                           \
+        resp_err(out, "ERR wrong number of arguments for '" name "' command"); \
+        return;                                                          \
+    }
+
+    if (arg_is(&a[0], "GET")) {
+        ARITY("get", 2);
+        if (resp_keys(c, a, 1, 2, 1) < 0) return;
+        const char* key = (const char*)w->keys.data;
+        w->vals.len = 0;
+        if (store_get(key, eht_hash(key), &w->vals))
+            resp_bulk(out, w->vals.data, w->vals.len);
+        else
+            resp_null(c);
+    } else if (arg_is(&a[0], "SET")) {
+        ARITY("set", -3);
+        resp_set(c, a, argc);
+    } else if (arg_is(&a[0], "DEL") || arg_is(&a[0], "UNLINK")) {
+        ARITY("del", -2);
+        long n = resp_keys(c, a, 1, argc, 1), gone = 0;
+        if (n < 0) return;
+        const char* k = (const char*)w->keys.data;
+        for (long i = 0; i < n; ++i, k += strlen(k) + 1)
+            gone += store_del(k, eht_hash(k));
+        resp_head(out, ':', gone);
+    } else if (arg_is(&a[0], "EXISTS")) {
+        ARITY("exists", -2);
+        long n = resp_keys(c, a, 1, argc, 1), hits = 0;
+        if (n < 0) return;
+        const char* k = (const char*)w->keys.data;
+        for (long i = 0; i < n; ++i, k += strlen(k) + 1)
+            hits += store_has(k, eht_hash(k));
+        resp_head(out, ':', hits);
+    } else if (arg_is(&a[0], "MGET")) {
+        ARITY("mget", -2);
+        long n = resp_keys(c, a, 1, argc, 1);
+        if (n < 0) return;
+        Batch* b = batch_begin(w, (size_t)n);
+        store_mget(w, b);
+        resp_head(out, '*', n);
+        for (long i = 0; i < n; ++i) {
+            if (b->found[i]) resp_bulk(out, w->vals.data + b->voff[i], b->vlen[i]);
+            else             resp_null(c);
+        }
+    } else if (arg_is(&a[0], "MSET")) {
+        if (argc < 3 || argc % 2 == 0) {
+            resp_err(out, "ERR wrong number of arguments for 'mset' command");
+            return;
+        }
+        long n = resp_keys(c, a, 1, argc, 2);
+        if (n < 0) return;
+        Batch* b = batch_begin(w, (size_t)n);
+        for (long i = 0; i < n; ++i) {
+            b->vin[i]  = a[2 + 2 * i].p;
+            b->vlen[i] = a[2 + 2 * i].n;
+        }
+        if (store_mset(b) < 0) resp_err(out, "OOM out of memory");
+        else                   resp_raw(out, "+OK\r\n");
+    } else if (arg_is(&a[0], "INCR") || arg_is(&a[0], "DECR")) {
+        ARITY("incr", 2);
+        resp_incr(c, a, arg_is(&a[0], "INCR") ? 1 : -1);
+    } else if (arg_is(&a[0], "INCRBY") || arg_is(&a[0], "DECRBY")) {
+        ARITY("incrby", 3);
+        long long d;
+        if (arg_ll(&a[2], &d) < 0 || (arg_is(&a[0], "DECRBY") && d == LLONG_MIN)) {
+            resp_err(out, "ERR value is not an integer or out of range");
+            return;
+        }
+        resp_incr(c, a, arg_is(&a[0], "INCRBY") ? d : -d);
+    } else if (arg_is(&a[0], "TTL")) {
+        ARITY("ttl", 2);
+        resp_ttl(c, a, 0);
+    } else if (arg_is(&a[0], "EXPIRE")) {
+        ARITY("expire", 3);
+        resp_ttl(c, a, 1);
+    } else if (arg_is(&a[0], "SCAN")) {
+        ARITY("scan", -2);
+        resp_scan(c, a, argc);
+    } else if (arg_is(&a[0], "DBSIZE")) {
+        ARITY("dbsize", 1);
+        resp_head(out, ':', (long long)store_len());
+    } else if (arg_is(&a[0], "INFO")) {
+        resp_info(c);
+    } else if (arg_is(&a[0], "REPLICAOF") || arg_is(&a[0], "SLAVEOF")) {
+        ARITY("replicaof", 3);
+        if (!arg_is(&a[1], "NO") || !arg_is(&a[2], "ONE")) {
+            resp_err(out, "ERR only REPLICAOF NO ONE is supported");
+            return;
+        }
+        repl_detach();
+        resp_raw(out, "+OK\r\n");
+    } else if (arg_is(&a[0], "PING")) {
+        if (argc > 2) {
+            resp_err(out, "ERR wrong number of arguments for 'ping' command");
+            return;
+        }
+        if (argc == 2) resp_bulk(out, a[1].p, a[1].n);
+        else           resp_raw(out, "+PONG\r\n");
+    } else if (arg_is(&a[0], "ECHO")) {
+        ARITY("echo", 2);
+        resp_bulk(out, a[1].p, a[1].n);
+    } else if (arg_is(&a[0], "HELLO")) {
+        resp_hello(c, a, argc);
+    } else if (arg_is(&a[0], "SELECT")) {
+        ARITY("select", 2);
+        if (arg_is(&a[1], "0")) resp_raw(out, "+OK\r\n");
+        else resp_err(out, "ERR DB index is out of range");
+    } else if (arg_is(&a[0], "COMMAND") || arg_is(&a[0], "CONFIG")) {
+        /* Clients probe these on connect; an empty answer is accepted */
+        resp_raw(out, c->resp3 && arg_is(&a[0], "CONFIG") ? "%0\r\n" : "*0\r\n");
+    } else if (arg_is(&a[0], "CLIENT")) {
+        resp_raw(out, "+OK\r\n");
+    } else if (arg_is(&a[0], "QUIT")) {
+        resp_raw(out, "+OK\r\n");
+        c->closing = 1;
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof msg, "ERR unknown command '%.*s'",
+                 (int)(a[0].n < 32 ? a[0].n : 32), (const char*)a[0].p);
+        resp_err(out, msg);
+    }
+#undef ARITY
+}
+
+/*  Parses one command at p[0..n) into w->scratch as an Arg array.
+ *  Returns bytes consumed, 0 if incomplete, -1 on a protocol error
+ *  (after an error reply). */
+static long resp_parse(Conn* c, const uint8_t* p, size_t n, int* argc_out)
+{
+    Buf* args = &c->w->args;
+    args->len = 0;
+    const uint8_t* end = p + n;
+
+    if (*p != '*') {
+        /* Inline command: one line of space-separated words */
+        const uint8_t* nl = (const uint8_t*)memchr(p, '\n', n);
+        if (!nl) {
+            if (n > RESP_MAX_INLINE) goto too_big;
+            return 0;
+        }
+        const uint8_t* q = p;
+        const uint8_t* e = nl > p && nl[-1] == '\r' ? nl - 1 : nl;
+        int argc = 0;
+        while (q < e) {
+            while (q < e && (*q == ' ' || *q == '\t')) ++q;
+            const uint8_t* w0 = q;
+            while (q < e && *q != ' ' && *q != '\t') ++q;
+            if (q > w0) {
+                Arg a = { w0, (size_t)(q - w0) };
+                buf_append(args, &a, sizeof a);
+                ++argc;
+            }
+        }
+        *argc_out = argc;
+        return (long)(nl + 1 - p);
+    }
+
+    const uint8_t* q  = p + 1;
+    const uint8_t* nl = (const uint8_t*)memchr(q, '\n', (size_t)(end - q));
+    if (!nl) {
+        if (n <= 32) return 0;
+        resp_err(&c->out, "ERR Protocol error: invalid multibulk length");
+        return -1;
+    }
+    long long argc = 0;
+    for (; q < nl - 1; ++q) {
+        if (*q < '0' || *q > '9' || argc > RESP_MAX_ARGS) {
+            resp_err(&c->out, "ERR Protocol error: invalid multibulk length");
+            return -1;
+        }
+        argc = argc * 10 + (*q - '0');
+    }
+    if (nl[-1] != '\r' || argc > RESP_MAX_ARGS) {
+        resp_err(&c->out, "ERR Protocol error: invalid multibulk length");
+        return -1;
+    }
+    q = nl + 1;
+    for (long long i = 0; i < argc; ++i) {
+        if (q >= end) return 0;
+        if (*q != '$') {
+            resp_err(&c->out, "ERR Protocol error: expected '$'");
+            return -1;
+        }
+        nl = (const uint8_t*)memchr(q, '\n', (size_t)(end - q));
+        if (!nl) {
+            if (end - q <= 32) return 0;
+            resp_err(&c->out, "ERR Protocol error: invalid bulk length");
+            return -1;
+        }
+        long long len = 0;
+        for (++q; q < nl - 1; ++q) {
+            if (*q < '0' || *q > '9' || len > MAX_FRAME) break;
+            len = len * 10 + (*q - '0');
+        }
+        if (q != nl - 1 || nl[-1] != '\r' || len > MAX_FRAME) {
+            resp_err(&c->out, "ERR Protocol error: invalid bulk length");
+            return -1;
+        }
+        q = nl + 1;
+        if ((size_t)(end - q) < (size_t)len + 2) return 0;
+        if (q[len] != '\r' || q[len + 1] != '\n') {
+            resp_err(&c->out, "ERR Protocol error: bulk not followed by CRLF");
+            return -1;
+        }
+        Arg a = { q, (size_t)len };
+        buf_append(args, &a, sizeof a);
+        q += len + 2;
+    }
+    *argc_out = (int)argc;
+    return (long)(q - p);
+too_big:
+    resp_err(&c->out, "ERR Protocol error: too big inline request");
+    return -1;
+}
+
+static int resp_process(Conn* c)
+{
+    uint64_t t0 = lat_start();
+    while (c->in.len > c->in_off && !c->closing) {
+        if (c->out.len - c->out_off >= OUT_HIGH) break;
+        int  argc = 0;
+        long used = resp_parse(c, c->in.data + c->in_off,
+                               c->in.len - c->in_off, &argc);
+        if (used < 0) {
+            c->closing = 1;
+            break;
+        }
+        if (used == 0) break;
+        c->in_off += (size_t)used;
+        if (argc > 0) {
+            const Arg* a = (const Arg*)c->w->args.data;
+            resp_command(c, a, argc);
+            if (t0)
+                t0 = lat_done(c->w, PROTO_RESP, cmd_slot(PROTO_RESP, a[0].p, a[0].n), t0);
+        }
+    }
+    conn_consumed(c);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Memcached protocol                                                 */
+/* ------------------------------------------------------------------ */
+
+#define MC_KEY_MAX   250
+#define MC_MAX_LINE  (64u << 10)       /* multi-key gets make long lines */
+#define MC_MONTH     (60 * 60 * 24 * 30)
+
+enum { MC_SET, MC_ADD, MC_REPLACE, MC_APPEND, MC_PREPEND };
+enum { MC_STORED, MC_NOT_STORED, MC_EXISTS, MC_NOT_FOUND, MC_NOMEM,
+       MC_TOO_LARGE };
+
+/*  Options of a meta command, from its flag tokens. */
+typedef struct {
+    int      q, v;          /* quiet, return the value               */
+    int      mode;          /* M: mode character, 0 if not given     */
+    int      touch;         /* T given                               */
+    int      vivify;        /* N given                               */
+    uint32_t exptime;       /* T                                     */
+    uint32_t vivify_exp;    /* N                                     */
+    uint32_t flags;         /* F                                     */
+    uint64_t cas;           /* C; 0 if not given                     */
+    uint64_t initial;       /* J                                     */
+    uint64_t delta;         /* D, default 1                          */
+} Meta;
+
+static void mc_reply(Conn* c, int noreply, const char* s)
+{
+    if (!noreply) buf_append(&c->out, s, strlen(s));
+}
+
+static void mc_bad(Conn* c)
+{
+    mc_reply(c, 0, "CLIENT_ERROR bad command line format\r\n");
+}
+
+/*  A memcached exptime on the server clock: 0 never, up to 30 days
+ *  relative, beyond that a Unix time; negative means expired. */
+static uint32_t mc_exptime(long long t)
+{
+    if (t == 0) return 0;
+    if (t < 0)  return 1;
+    if (t > MC_MONTH) t -= (long long)g_epoch;
+    else              t += now_secs();
+    return t < 1 ? 1 : t > UINT32_MAX ? UINT32_MAX : (uint32_t)t;
+}
+
+static int mc_u32(const Arg* a, uint32_t* out)
+{
+    uint64_t v;
+    if (arg_ull(a, &v) < 0 || v > UINT32_MAX) return -1;
+    *out = (uint32_t)v;
+    return 0;
+}
+
+/*  A NUL-terminated copy of a key, or NULL after an error reply. */
+static const char* mc_key(Conn* c, const Arg* a)
+{
+    const char* k = a->n <= MC_KEY_MAX ? key_copy(c->w, a->p, a->n) : NULL;
+    if (!k) mc_bad(c);
+    return k;
+}
+
+/*  Runs a storage command under the key's shard lock.  A non-zero cas
+ *  makes it a compare-and-swap; *cas_out gets the new item's CAS. */
+static int mc_update(Worker* w, const char* key, int mode,
+                     const void* v, size_t n, uint32_t flags,
+                     uint32_t exptime, uint64_t cas, uint64_t* cas_out)
+{
+    uint64_t h = eht_hash(key);
+    Shard*   s = shard_of(h);
+    int      r = MC_STORED;
+
+    pthread_mutex_lock(&s->lock);
+    Item* old = item_get(s, key, h);
+    if (cas && !old)                                   r = MC_NOT_FOUND;
+    else if (cas && old->cas != cas)                   r = MC_EXISTS;
+    else if (mode == MC_ADD && old)                    r = MC_NOT_STORED;
+    else if (mode != MC_SET && mode != MC_ADD && !old) r = MC_NOT_STORED;
+    else if (n > MAX_VALUE)                            r = MC_TOO_LARGE;
+    else if ((mode == MC_APPEND || mode == MC_PREPEND) &&
+             old->vlen > MAX_VALUE - n)                r = MC_TOO_LARGE;
+    if (r == MC_STORED && (mode == MC_APPEND || mode == MC_PREPEND)) {
+        Buf* b = &w->vals;
+        b->len = 0;
+        if (mode == MC_PREPEND) buf_append(b, v, n);
+        buf_append(b, item_value(old), old->vlen);
+        if (mode == MC_APPEND) buf_append(b, v, n);
+        v       = b->data;
+        n       = b->len;
+        flags   = old->flags;
+        exptime = old->exptime;
+    }
+    if (r == MC_STORED) {
+        Item* it = item_put(s, key, h, old, v, n, flags, exptime);
+        if (!it)          r = MC_NOMEM;
+        else if (cas_out) *cas_out = it->cas;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return r;
+}
+
+/*  incr/decr on memcached's unsigned 64-bit counters: incr wraps, decr
+ *  stops at 0, and the item keeps its flags and expiry.  With m->vivify
+ *  a missing key starts at m->initial.  Returns an MC_ code, or -1 if
+ *  the value is not a number.  The result, as an item, goes to emit
+ *  while the lock is held. */
+static int mc_arith(Conn* c, const char* key, int incr, const Meta* m,
+                    void (*emit)(Conn*, const Item*, const void*),
+                    const void* ctx)
+{
+    uint64_t h = eht_hash(key);
+    Shard*   s = shard_of(h);
+    int      r = MC_STORED;
+
+    pthread_mutex_lock(&s->lock);
+    Item*    it = item_get(s, key, h);
+    uint64_t v  = m->initial;
+    uint32_t flags = 0, exptime = m->vivify_exp;
+    if (it && m->cas && it->cas != m->cas) {
+        r = MC_EXISTS;
+    } else if (it) {
+        Arg old = { (const uint8_t*)item_value(it), it->vlen };
+        if (arg_ull(&old, &v) < 0) r = -1;
+        else if (incr)             v += m->delta;
+        else                       v = v > m->delta ? v - m->delta : 0;
+        flags   = it->flags;
+        exptime = it->exptime;
+    } else if (!m->vivify) {
+        r = MC_NOT_FOUND;
+    }
+    if (r == MC_STORED) {
+        char num[24];
+        int  k = snprintf(num, sizeof num, "%llu", (unsigned long long)v);
+        if (m->touch) exptime = m->exptime;
+        if (!(it = item_put(s, key, h, it, num, (size_t)k, flags, exptime)))
+            r = MC_NOMEM;
+        else
+            emit(c, it, ctx);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return r;
+}
+
+/*  get/gets keys a[from..argc), through the batch path. */
+static void mc_get(Conn* c, const Arg* a, int from, int argc, int with_cas)
+{
+    Worker* w = c->w;
+    if (from == argc) {
+        mc_reply(c, 0, "ERROR\r\n");
+        return;
+    }
+    for (int i = from; i < argc; ++i)
+        if (!mc_key(c, &a[i])) return;
+    size_t n = (size_t)(argc - from);
+    Batch* b = batch_begin(w, n);
+    store_mget(w, b);
+    for (size_t i = 0; i < n; ++i) {
+        if (!b->found[i]) continue;
+        char head[MC_KEY_MAX + 80];
+        int  k = snprintf(head, sizeof head, "VALUE %s %u %zu", b->keys[i],
+                          b->flags[i], b->vlen[i]);
+        if (with_cas)
+            k += snprintf(head + k, sizeof head - (size_t)k, " %llu",
+                          (unsigned long long)b->cas[i]);
+        buf_append(&c->out, head, (size_t)k);
+        buf_append(&c->out, "\r\n", 2);
+        buf_append(&c->out, w->vals.data + b->voff[i], b->vlen[i]);
+        buf_append(&c->out, "\r\n", 2);
+    }
+    mc_reply(c, 0, "END\r\n");
+}
+
+/*  gat/gats exptime keys...: get and touch, one key at a time. */
+static void mc_gat(Conn* c, const Arg* a, int argc, int with_cas)
+{
+    long long t;
+    if (argc < 3 || arg_ll(&a[1], &t) < 0) {
+        mc_bad(c);
+        return;
+    }
+    uint32_t exptime = mc_exptime(t);
+    for (int i = 2; i < argc; ++i) {
+        c->w->keys.len = 0;
+        const char* key = mc_key(c, &a[i]);
+        if (!key) return;
+        uint64_t h = eht_hash(key);
+        Shard*   s = shard_of(h);
+        pthread_mutex_lock(&s->lock);
+        Item* it = item_get(s, key, h);
+        if (it) {
+            char head[MC_KEY_MAX + 80];
+            int  k = snprintf(head, sizeof head, "VALUE %s %u %u", key,
+                              it->flags, it->vlen);
+            if (with_cas)
+                k += snprintf(head + k, sizeof head - (size_t)k, " %llu",
+                              (unsigned long long)it->cas);
+            item_touch(s, it, exptime);
+            buf_append(&c->out, head, (size_t)k);
+            buf_append(&c->out, "\r\n", 2);
+            buf_append(&c->out, item_value(it), it->vlen);
+            buf_append(&c->out, "\r\n", 2);
+            s->st.hits++;
+        } else {
+            s->st.misses++;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    mc_reply(c, 0, "END\r\n");
+}
+
+/*  set/add/replace/append/prepend key flags exptime bytes [noreply],
+ *  and cas with a CAS value before noreply. */
+static void mc_store(Conn* c, int mode, int is_cas, const Arg* a, int argc,
+                     const uint8_t* data, size_t n)
+{
+    int       want = is_cas ? 6 : 5;
+    int       noreply = argc == want + 1 && arg_is(&a[want], "noreply");
+    uint32_t  flags;
+    long long t;
+    uint64_t  cas = 0;
+    if ((argc != want && !noreply) || mc_u32(&a[2], &flags) < 0 ||
+        arg_ll(&a[3], &t) < 0 || (is_cas && arg_ull(&a[5], &cas) < 0)) {
+        mc_bad(c);
+        return;
+    }
+    const char* key = mc_key(c, &a[1]);
+    if (!key) return;
+    if (is_cas && !cas) cas = UINT64_MAX;   /* never matches */
+    static const char* const res[] = {
+        "STORED\r\n", "NOT_STORED\r\n", "EXISTS\r\n", "NOT_FOUND\r\n",
+        "SERVER_ERROR out of memory storing object\r\n",
+        "SERVER_ERROR object too large for cache\r\n",
+    };
+    int r = mc_update(c->w, key, mode, data, n, flags, mc_exptime(t), cas, NULL);
+    mc_reply(c, noreply && r < MC_NOMEM, res[r]);
+}
+
+static void mc_delete(Conn* c, const Arg* a, int argc)
+{
+    int noreply = argc > 2 && arg_is(&a[argc - 1], "noreply");
+    int n       = argc - noreply;
+    /* "delete key 0" is an old form that memcached still accepts */
+    if (n < 2 || n > 3 || (n == 3 && !arg_is(&a[2], "0"))) {
+        mc_bad(c);
+        return;
+    }
+    const char* key = mc_key(c, &a[1]);
+    if (!key) return;
+    mc_reply(c, noreply, store_del(key, eht_hash(key)) ? "DELETED\r\n"
+                                                         : "NOT_FOUND\r\n");
+}
+
+static void mc_emit_number(Conn* c, const Item* it, const void* ctx)
+{
+    (void)ctx;
+    buf_append(&c->out, item_value(it), it->vlen);
+    buf_append(&c->out, "\r\n", 2);
+}
+
+static void mc_emit_nothing(Conn* c, const Item* it, const void* ctx)
+{
+    (void)c; (void)it; (void)ctx;
+}
+
+static void mc_incr(Conn* c, const Arg* a, int argc, int incr)
+{
+    int  noreply = argc == 4 && arg_is(&a[3], "noreply");
+    Meta m;
+    memset(&m, 0, sizeof m);
+    if ((argc != 3 && !noreply) || arg_ull(&a[2], &m.delta) < 0) {
+        mc_reply(c, 0, "CLIENT_ERROR invalid numeric delta argument\r\n");
+        return;
+    }
+    const char* key = mc_key(c, &a[1]);
+    if (!key) return;
+    int r = mc_arith(c, key, incr, &m,
+                     noreply ? mc_emit_nothing : mc_emit_number, NULL);
+    if (r < 0)
+        mc_reply(c, 0, "CLIENT_ERROR cannot increment or decrement "
+                       "non-numeric value\r\n");
+    else if (r == MC_NOT_FOUND)
+        mc_reply(c, noreply, "NOT_FOUND\r\n");
+    else if (r == MC_NOMEM)
+        mc_reply(c, 0, "SERVER_ERROR out of memory\r\n");
+}
+
+static void mc_touch(Conn* c, const Arg* a, int argc)
+{
+    int       noreply = argc == 4 && arg_is(&a[3], "noreply");
+    long long t;
+    if ((argc != 3 && !noreply) || arg_ll(&a[2], &t) < 0) {
+        mc_bad(c);
+        return;
+    }
+    const char* key = mc_key(c, &a[1]);
+    if (!key) return;
+    uint64_t h = eht_hash(key);
+    Shard*   s = shard_of(h);
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_get(s, key, h);
+    if (it) item_touch(s, it, mc_exptime(t));
+    pthread_mutex_unlock(&s->lock);
+    mc_reply(c, noreply, it ? "TOUCHED\r\n" : "NOT_FOUND\r\n");
+}
+
+static void mc_stats(Conn* c)
+{
+    StoreStats st;
+    Buf*       b = &c->out;
+    char       line[128];
+    store_stats(&st);
+#define STAT(...) buf_append(b, line, (size_t)snprintf(line, sizeof line, __VA_ARGS__))
+    STAT("STAT pid %ld\r\n", (long)getpid());
+    STAT("STAT uptime %u\r\n", now_secs() - 2);
+    STAT("STAT time %lld\r\n", (long long)(g_epoch + now_secs()));
+    STAT("STAT version 1.6.0\r\n");
+    STAT("STAT pointer_size %d\r\n", (int)(sizeof(void*) * 8));
+    STAT("STAT curr_connections %ld\r\n",
+         __atomic_load_n(&g_clients, __ATOMIC_RELAXED));
+    STAT("STAT cmd_get %llu\r\n", (unsigned long long)(st.hits + st.misses));
+    STAT("STAT get_hits %llu\r\n", (unsigned long long)st.hits);
+    STAT("STAT get_misses %llu\r\n", (unsigned long long)st.misses);
+    STAT("STAT curr_items %llu\r\n", (unsigned long long)st.items);
+    STAT("STAT total_items %llu\r\n", (unsigned long long)st.total_items);
+    STAT("STAT bytes %llu\r\n", (unsigned long long)st.bytes);
+    STAT("STAT limit_maxbytes %zu\r\n", g_mem_limit);
+    STAT("STAT total_malloced %zu\r\n",
+         __atomic_load_n(&g_mem_used, __ATOMIC_RELAXED));
+    STAT("STAT evictions %llu\r\n", (unsigned long long)st.evictions);
+    STAT("STAT reclaimed %llu\r\n", (unsigned long long)st.expired);
+#undef STAT
+    mc_reply(c, 0, "END\r\n");
+}
+
+/*  Parses meta flags a[from..argc) into m, allowing only those in
+ *  allowed.  Returns -1 after an error reply. */
+static int mc_meta_parse(Conn* c, const Arg* a, int from, int argc,
+                         const char* allowed, Meta* m)
+{
+    memset(m, 0, sizeof(*m));
+    m->delta = 1;
+    for (int i = from; i < argc; ++i) {
+        int       f   = a[i].p[0];
+        Arg       val = { a[i].p + 1, a[i].n - 1 };
+        long long t   = 0;
+        int       bad = 0;
+        if (!strchr(allowed, f)) {
+            mc_reply(c, 0, "CLIENT_ERROR invalid flag\r\n");
+            return -1;
+        }
+        switch (f) {
+        case 'q': m->q = 1; break;
+        case 'v': m->v = 1; break;
+        case 'M': bad = val.n != 1; m->mode = val.n ? val.p[0] : 0; break;
+        case 'F': bad = mc_u32(&val, &m->flags) < 0; break;
+        case 'C': bad = arg_ull(&val, &m->cas) < 0; break;
+        case 'J': bad = arg_ull(&val, &m->initial) < 0; break;
+        case 'D': bad = arg_ull(&val, &m->delta) < 0; break;
+        case 'T':
+        case 'N':
+            bad = arg_ll(&val, &t) < 0;
+            if (f == 'T') m->touch = 1, m->exptime = mc_exptime(t);
+            else          m->vivify = 1, m->vivify_exp = mc_exptime(t);
+            break;
+        case 'O': bad = val.n > 32; break;
+        default:  break;          /* return flags: c f k s t */
+        }
+        if (bad) {
+            mc_bad(c);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*  Appends the return flags requested in a[from..argc), in request
+ *  order; those about the item are skipped when it is NULL. */
+static void mc_meta_ret(Conn* c, const Arg* a, int from, int argc,
+                        const char* key, const Item* it)
+{
+    Buf* b = &c->out;
+    char num[32];
+    for (int i = from; i < argc; ++i) {
+        int k = 0;
+        switch (a[i].p[0]) {
+        case 'O':
+            buf_append(b, " ", 1);
+            buf_append(b, a[i].p, a[i].n);
+            break;
+        case 'k':
+            buf_append(b, " k", 2);
+            buf_append(b, key, strlen(key));
+            break;
+        case 'c':
+            if (it) k = snprintf(num, sizeof num, " c%llu",
+                                 (unsigned long long)it->cas);
+            break;
+        case 'f':
+            if (it) k = snprintf(num, sizeof num, " f%u", it->flags);
+            break;
+        case 's':
+            if (it) k = snprintf(num, sizeof num, " s%u", it->vlen);
+            break;
+        case 't':
+            if (it) k = snprintf(num, sizeof num, " t%lld",
+                                 it->exptime ? (long long)it->exptime - now_secs()
+                                             : -1LL);
+            break;
+        }
+        buf_append(b, num, (size_t)k);
+    }
+}
+
+/*  mg key flags*: VA/HD with the requested flags, or EN. */
+static void mc_meta_get(Conn* c, const Arg* a, int argc)
+{
+    Meta m;
+    if (argc < 2 || mc_meta_parse(c, a, 2, argc, "qvTOkcfst", &m) < 0) {
+        if (argc < 2) mc_bad(c);
+        return;
+    }
+    if (m.touch && __atomic_load_n(&g_readonly, __ATOMIC_RELAXED)) {
+        mc_reply(c, 0, "SERVER_ERROR read-only replica\r\n");
+        return;
+    }
+    const char* key = mc_key(c, &a[1]);
+    if (!key) return;
+    uint64_t h = eht_hash(key);
+    Shard*   s = shard_of(h);
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_get(s, key, h);
+    if (it) {
+        char head[32];
+        s->st.hits++;
+        if (m.touch) item_touch(s, it, m.exptime);
+        if (m.v) {
+            int k = snprintf(head, sizeof head, "VA %u", it->vlen);
+            buf_append(&c->out, head, (size_t)k);
+        } else {
+            buf_append(&c->out, "HD", 2);
+        }
+        mc_meta_ret(c, a, 2, argc, key, it);
+        buf_append(&c->out, "\r\n", 2);
+        if (m.v) {
+            buf_append(&c->out, item_value(it), it->vlen);
+            buf_append(&c->out, "\r\n", 2);
+        }
+    } else {
+        s->st.misses++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (!it) mc_reply(c, m.q, "EN\r\n");
+}
+
+/*  ms key datalen flags*: HD, NS, EX or NF. */
+static void mc_meta_set(Conn* c, const Arg* a, int argc,
+                        const uint8_t* data, size_t n)
+{
+    Meta m;
+    if (mc_meta_parse(c, a, 3, argc, "qFTCMOkc", &m) < 0) return;
+    int mode;
+    switch (m.mode) {
+    case 0: case 'S': case 's': mode = MC_SET;     break;
+    case 'E': case 'e':         mode = MC_ADD;     break;
+    case 'R': case 'r':         mode = MC_REPLACE; break;
+    case 'A': case 'a':         mode = MC_APPEND;  break;
+    case 'P': case 'p':         mode = MC_PREPEND; break;
+    default:
+        mc_bad(c);
+        return;
+    }
+    const char* key = mc_key(c, &a[1]);
+    if (!key) return;
+    uint64_t cas = 0;
+    Item     ret;
+    int r = mc_update(c->w, key, mode, data, n, m.flags, m.exptime, m.cas, &cas);
+    static const char* const res[] = { "HD", "NS", "EX", "NF" };
+    if (r == MC_NOMEM || r == MC_TOO_LARGE) {
+        mc_reply(c, 0, r == MC_NOMEM
+                       ? "SERVER_ERROR out of memory storing object\r\n"
+                       : "SERVER_ERROR object too large for cache\r\n");
+        return;
+    }
+    if (r == MC_STORED && m.q) return;
+    memset(&ret, 0, sizeof ret);
+    ret.cas = cas;
+    buf_append(&c->out, res[r], 2);
+    /* Only c, k and O can be asked of ms */
+    mc_meta_ret(c, a, 3, argc, key, r == MC_STORED ? &ret : NULL);
+    buf_append(&c->out, "\r\n", 2);
+}
+
+/*  md key flags*: HD, NF or EX. */
+static void mc_meta_delete(Conn* c, const Arg* a, int argc)
+{
+    Meta m;
+    if (argc < 2 || mc_meta_parse(c, a, 2, argc, "qCOk", &m) < 0) {
+        if (argc < 2) mc_bad(c);
+        return;
+    }
+    const char* key = mc_key(c, &a[1]);
+    if (!key) return;
+    uint64_t h = eht_hash(key);
+    Shard*   s = shard_of(h);
+    const char* r = "HD";
+    pthread_mutex_lock(&s->lock);
+    Item* it = item_get(s, key, h);
+    if (!it)                        r = "NF";
+    else if (m.cas && it->cas != m.cas) r = "EX";
+    else                            item_unlink(s, it, h);
+    pthread_mutex_unlock(&s->lock);
+    if (m.q && r[0] != 'E') return;
+    buf_append(&c->out, r, 2);
+    mc_meta_ret(c, a, 2, argc, key, NULL);
+    buf_append(&c->out, "\r\n", 2);
+}
+
+typedef struct {
+    const Arg*  a;
+    int         argc;
+    const char* key;
+    const Meta* m;
+} MetaArith;
+
+static void mc_emit_meta_arith(Conn* c, const Item* it, const void* ctx)
+{
+    const MetaArith* x = (const MetaArith*)ctx;
+    if (x->m->v) {
+        char head[32];
+        int  k = snprintf(head, sizeof head, "VA %u", it->vlen);
+        buf_append(&c->out, head, (size_t)k);
+    } else if (x->m->q) {
+        return;
+    } else {
+        buf_append(&c->out, "HD", 2);
+    }
+    mc_meta_ret(c, x->a, 2, x->argc, x->key, it);
+    buf_append(&c->out, "\r\n", 2);
+    if (x->m->v) {
+        buf_append(&c->out, item_value(it), it->vlen);
+        buf_append(&c->out, "\r\n", 2);
+    }
+}
+
+/*  ma key flags*: HD or VA with the new value; NF, NS or EX. */
+static void mc_meta_arith(Conn* c, const Arg* a, int argc)
+{
+    Meta m;
+    if (argc < 2 || mc_meta_parse(c, a, 2, argc, "qvNJDTMCOktc", &m) < 0) {
+        if (argc < 2) mc_bad(c);
+        return;
+    }
+    int incr = m.mode == 0 || m.mode == 'I' || m.mode == 'i' || m.mode == '+';
+    if (!incr && m.mode != 'D' && m.mode != 'd' && m.mode != '-') {
+        mc_bad(c);
+        return;
+    }
+    const char* key = mc_key(c, &a[1]);
+    if (!key) return;
+    MetaArith x = { a, argc, key, &m };
+    int r = mc_arith(c, key, incr, &m, mc_emit_meta_arith, &x);
+    const char* res = r == MC_NOT_FOUND ? "NF" : r == MC_EXISTS ? "EX" : NULL;
+    if (r < 0) {
+        mc_reply(c, 0, "CLIENT_ERROR cannot increment or decrement "
+                       "non-numeric value\r\n");
+    } else if (r == MC_NOMEM) {
+        mc_reply(c, 0, "SERVER_ERROR out of memory\r\n");
+    } else if (res && !(m.q && r == MC_NOT_FOUND)) {
+        buf_append(&c->out, res, 2);
+        mc_meta_ret(c, a, 2, argc, key, NULL);
+        buf_append(&c->out, "\r\n", 2);
+    }
+}
+
+static void mc_command(Conn* c, const Arg* a, int argc,
+                       const uint8_t* data, size_t n)
+{
+    static const char* const store_cmds[] = {
+        "set", "add", "replace", "append", "prepend",
+    };
+    static const char* const writes[] = {
+        "set", "add", "replace", "append", "prepend", "cas", "ms", "md",
+        "ma", "delete", "incr", "decr", "touch", "gat", "gats", "flush_all",
+    };
+    c->w->keys.len = 0;
+    for (size_t i = 0; i < sizeof writes / sizeof *writes; ++i) {
+        if (arg_is(&a[0], writes[i]) &&
+            __atomic_load_n(&g_readonly, __ATOMIC_RELAXED)) {
+            mc_reply(c, 0, "SERVER_ERROR read-only replica\r\n");
+            return;
+        }
+    }
+    for (int mode = MC_SET; mode <= MC_PREPEND; ++mode) {
+        if (arg_is(&a[0], store_cmds[mode])) {
+            mc_store(c, mode, 0, a, argc, data, n);
+            return;
+        }
+    }
+    if (arg_is(&a[0], "get"))        mc_get(c, a, 1, argc, 0);
+    else if (arg_is(&a[0], "gets"))  mc_get(c, a, 1, argc, 1);
+    else if (arg_is(&a[0], "cas"))   mc_store(c, MC_SET, 1, a, argc, data, n);
+    else if (arg_is(&a[0], "mg"))    mc_meta_get(c, a, argc);
+    else if (arg_is(&a[0], "ms"))    mc_meta_set(c, a, argc, data, n);
+    else if (arg_is(&a[0], "md"))    mc_meta_delete(c, a, argc);
+    else if (arg_is(&a[0], "ma"))    mc_meta_arith(c, a, argc);
+    else if (arg_is(&a[0], "mn"))    mc_reply(c, 0, "MN\r\n");
+    else if (arg_is(&a[0], "delete")) mc_delete(c, a, argc);
+    else if (arg_is(&a[0], "incr"))  mc_incr(c, a, argc, 1);
+    else if (arg_is(&a[0], "decr"))  mc_incr(c, a, argc, 0);
+    else if (arg_is(&a[0], "touch")) mc_touch(c, a, argc);
+    else if (arg_is(&a[0], "gat"))   mc_gat(c, a, argc, 0);
+    else if (arg_is(&a[0], "gats"))  mc_gat(c, a, argc, 1);
+    else if (arg_is(&a[0], "stats")) mc_stats(c);
+    else if (arg_is(&a[0], "flush_all")) {
+        int       noreply = argc > 1 && arg_is(&a[argc - 1], "noreply");
+        long long delay   = 0;
+        if (argc - noreply > 2 ||
+            (argc - noreply == 2 && (arg_ll(&a[1], &delay) < 0 || delay < 0 ||
+                                     delay > MC_MONTH))) {
+            mc_bad(c);
+            return;
+        }
+        store_flush((uint32_t)delay);
+        mc_reply(c, noreply, "OK\r\n");
+    } else if (arg_is(&a[0], "version")) {
+        mc_reply(c, 0, "VERSION 1.6.0\r\n");
+    } else if (arg_is(&a[0], "verbosity")) {
+        mc_reply(c, argc > 2 && arg_is(&a[argc - 1], "noreply"), "OK\r\n");
+    } else if (arg_is(&a[0], "quit")) {
+        c->closing = 1;
+    } else {
+        mc_reply(c, 0, "ERROR\r\n");
+    }
+}
+
+/*  Handles one command line, with its data block for the storage
+ *  commands.  Returns bytes consumed, 0 if incomplete, or -1 to close
+ *  (after an error reply): a bad length leaves no way to find the next
+ *  command. */
+static long mc_request(Conn* c, const uint8_t* p, size_t n)
+{
+    const uint8_t* nl = (const uint8_t*)memchr(p, '\n', n);
+    if (!nl) {
+        if (n <= MC_MAX_LINE) return 0;
+        mc_reply(c, 0, "CLIENT_ERROR line too long\r\n");
+        return -1;
+    }
+    const uint8_t* e    = nl > p && nl[-1] == '\r' ? nl - 1 : nl;
+    size_t         used = (size_t)(nl + 1 - p);
+    Buf*           args = &c->w->args;
+    int            argc = 0;
+    args->len = 0;
+    for (const uint8_t* q = p; q < e;) {
+        while (q < e && *q == ' ') ++q;
+        const uint8_t* w0 = q;
+        while (q < e && *q != ' ') ++q;
+        if (q > w0) {
+            Arg a = { w0, (size_t)(q - w0) };
+            buf_append(args, &a, sizeof a);
+            ++argc;
+        }
+    }
+    const Arg* a = (const Arg*)args->data;
+    if (argc == 0) {
+        mc_reply(c, 0, "ERROR\r\n");
+        return (long)used;
+    }
+
+    /* Storage commands carry <bytes> and then the data block */
+    int at = arg_is(&a[0], "ms") ? 2 : -1;
+    static const char* const with_data[] = {
+        "set", "add", "replace", "append", "prepend", "cas",
+    };
+    for (int i = 0; i < 6; ++i)
+        if (arg_is(&a[0], with_data[i])) at = 4;
+    const uint8_t* data = NULL;
+    uint64_t       dn   = 0;
+    if (at > 0) {
+        if (argc <= at || arg_ull(&a[at], &dn) < 0 || dn > MAX_FRAME) {
+            mc_bad(c);
+            return -1;
+        }
+        if (n - used < dn + 2) return 0;
+        data = p + used;
+        if (data[dn] != '\r' || data[dn + 1] != '\n') {
+            mc_reply(c, 0, "CLIENT_ERROR bad data chunk\r\n");
+            return -1;
+        }
+        used += dn + 2;
+    }
+    mc_command(c, a, argc, data, (size_t)dn);
+    return (long)used;
+}
+
+static int mc_process(Conn* c)
+{
+    uint64_t t0 = lat_start();
+    while (c->in.len > c->in_off && !c->closing) {
+        if (c->out.len - c->out_off >= OUT_HIGH) break;
+        long used = mc_request(c, c->in.data + c->in_off, c->in.len - c->in_off);
+        if (used < 0) {
+            c->closing = 1;
+            break;
+        }
+        if (used == 0) break;
+        c->in_off += (size_t)used;
+        if (t0) {
+            const Buf* args = &c->w->args;   /* mc_request's words */
+            const Arg* a    = (const Arg*)args->data;
+            unsigned   cmd  = args->len ? cmd_slot(PROTO_MC, a[0].p, a[0].n) : 0;
+            t0 = lat_done(c->w, PROTO_MC, cmd, t0);
+        }
+    }
+    conn_consumed(c);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Loop                                                               */
+/* ------------------------------------------------------------------ */
+
+static int conn_process(Conn* c)
+{
+    switch (c->src.proto) {
+    case PROTO_RESP: return resp_process(c);
+    case PROTO_MC:   return mc_process(c);
+    default:         return bin_process(c);
+    }
+}
+
+static void on_accept(Worker* w, const EvSource* l)
+{
+    for (;;) {
+        int fd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;  /* EAGAIN: another loop took it */
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        Conn* c = (Conn*)calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->src.kind  = EV_CONN;
+        c->src.fd    = fd;
+        c->src.proto = l->proto;
+        c->w         = w;
+        c->reading   = 1;
+        struct epoll_event ev;
+        ev.events   = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        __atomic_fetch_add(&g_clients, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void on_conn(Conn* c, uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN)) {
+        conn_close(c);
+        return;
+    }
+    if (events & EPOLLIN) {
+        ssize_t n = recv(c->src.fd, buf_reserve(&c->in, READ_CHUNK),
+                         READ_CHUNK, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            conn_close(c);
+            return;
+        }
+        if (n > 0) c->in.len += (size_t)n;
+    }
+    if (conn_process(c) < 0 || conn_flush(c) < 0) {
+        conn_close(c);
+        return;
+    }
+    /* Input held back by OUT_HIGH can be parsed now that some went out */
+    if (c->in.len > c->in_off && c->out_off == c->out.len) {
+        if (conn_process(c) < 0 || conn_flush(c) < 0) {
+            conn_close(c);
+            return;
+        }
+    }
+    if (c->closing && c->out_off == c->out.len) {
+        conn_close(c);
+        return;
+    }
+    conn_arm(c);
+}
+
+static void* worker_main(void* arg)
+{
+    Worker*            w = (Worker*)arg;
+    struct epoll_event evs[64];
+    for (;;) {
+        int n = epoll_wait(w->ep, evs, 64, -1);
+        for (int i = 0; i < n; ++i) {
+            EvSource* src = (EvSource*)evs[i].data.ptr;
+            if (src->kind == EV_WAKE) return NULL;
+            if (src->kind == EV_LISTEN) on_accept(w, src);
+            else on_conn((Conn*)src, evs[i].events);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Metrics endpoint                                                   */
+/* ------------------------------------------------------------------ */
+
+/* A thread of its own answers GET /metrics in the Prometheus text
+ * format, one connection at a time.  The loops only bump their latency
+ * counters; the table statistics are gathered here, shard by shard,
+ * under each shard's lock, and the probe-length walk a few thousand
+ * slots per lock at a time. */
+
+#define PROBE_MAX     256   /* eht_probe_histogram buckets             */
+#define PROBE_CHUNK   4096  /* slots walked per shard lock             */
+#define METRICS_REQ   4096  /* longest request head read               */
+
+static Worker*   g_workers;
+static long      g_nworkers;
+static int       g_metrics_fd = -1;
+static pthread_t g_metrics_th;
+
+static void metric_head(Buf* b, const char* name, const char* type,
+                        const char* help)
+{
+    char line[256];
+    buf_append(b, line, (size_t)snprintf(line, sizeof line,
+               "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type));
+}
+
+static void metrics_table(Buf* b)
+{
+    enum { MAXL = 64 };
+    EHTLevelInfo    li[MAXL];
+    EHTRebuildStats rs;
+    size_t   cap[MAXL] = { 0 }, cnt[MAXL] = { 0 }, tomb[MAXL] = { 0 }, nl = 0;
+    size_t   probes[PROBE_MAX] = { 0 };
+    uint64_t rebuilds = 0, rebuild_ns = 0, rebuild_max = 0;
+    for (unsigned i = 0; i < g_nshards; ++i) {
+        Shard* s = &g_shards[i];
+        pthread_mutex_lock(&s->lock);
+        size_t k = eht_num_levels(s->table);
+        if (k > MAXL) k = MAXL;
+        eht_level_stats(s->table, li, k);
+        eht_rebuild_stats(s->table, &rs);
+        /* The walk is O(entries); a piece per lock keeps pauses short */
+        uint64_t at = eht_probe_histogram_step(s->table, 0, PROBE_CHUNK,
+                                               probes, PROBE_MAX);
+        pthread_mutex_unlock(&s->lock);
+        while (at) {
+            pthread_mutex_lock(&s->lock);
+            at = eht_probe_histogram_step(s->table, at, PROBE_CHUNK,
+                                          probes, PROBE_MAX);
+            pthread_mutex_unlock(&s->lock);
+        }
+        for (size_t l = 0; l < k; ++l) {
+            cap[l]  += li[l].capacity;
+            cnt[l]  += li[l].count;
+            tomb[l] += li[l].tombstones;
+        }
+        if (k > nl) nl = k;
+        rebuilds   += rs.count;
+        rebuild_ns += rs.total_ns;
+        if (rs.max_ns > rebuild_max) rebuild_max = rs.max_ns;
+    }
+
+    char line[256];
+#define OUT(...) buf_append(b, line, (size_t)snprintf(line, sizeof line, __VA_ARGS__))
+    metric_head(b, "eht_shards", "gauge", "Tables the keyspace is split over.");
+    OUT("eht_shards %u\n", g_nshards);
+    metric_head(b, "eht_level_capacity", "gauge", "Slots per level, over all shards.");
+    for (size_t l = 0; l < nl; ++l) OUT("eht_level_capacity{level=\"%zu\"} %zu\n", l, cap[l]);
+    metric_head(b, "eht_level_count", "gauge", "Live entries per level.");
+    for (size_t l = 0; l < nl; ++l) OUT("eht_level_count{level=\"%zu\"} %zu\n", l, cnt[l]);
+    metric_head(b, "eht_level_tombstones", "gauge", "Tombstones per level.");
+    for (size_t l = 0; l < nl; ++l) OUT("eht_level_tombstones{level=\"%zu\"} %zu\n", l, tomb[l]);
+    metric_head(b, "eht_level_load", "gauge", "Live entries over slots, per level.");
+    for (size_t l = 0; l < nl; ++l)
+        OUT("eht_level_load{level=\"%zu\"} %.4f\n", l,
+            cap[l] ? (double)cnt[l] / (double)cap[l] : 0.0);
+
+    /* Power-of-two buckets; the last library bucket also holds longer
+     * runs, which _sum counts at PROBE_MAX */
+    metric_head(b, "eht_probe_length", "histogram",
+                "Probes a lookup of each live entry makes.");
+    uint64_t below = 0, sum = 0;
+    size_t   next  = 1;
+    for (size_t p = 0; p < PROBE_MAX; ++p) {
+        below += probes[p];
+        sum   += (uint64_t)(p + 1) * probes[p];
+        if (p + 1 == next && next < PROBE_MAX) {
+            OUT("eht_probe_length_bucket{le=\"%zu\"} %llu\n", next,
+                (unsigned long long)below);
+            next *= 2;
+        }
+    }
+    OUT("eht_probe_length_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)below);
+    OUT("eht_probe_length_sum %llu\neht_probe_length_count %llu\n",
+        (unsigned long long)sum, (unsigned long long)below);
+
+    metric_head(b, "eht_rebuilds_total", "counter",
+                "Table rebuilds: growth, purges, reseeds.");
+    OUT("eht_rebuilds_total %llu\n", (unsigned long long)rebuilds);
+    metric_head(b, "eht_rebuild_seconds_total", "counter",
+                "Time spent rebuilding, with the shard locked.");
+    OUT("eht_rebuild_seconds_total %.9f\n", (double)rebuild_ns / 1e9);
+    metric_head(b, "eht_rebuild_seconds_max", "gauge",
+                "Longest rebuild, the longest pause a shard has made.");
+    OUT("eht_rebuild_seconds_max %.9f\n", (double)rebuild_max / 1e9);
+#undef OUT
+}
+
+static void metrics_store(Buf* b)
+{
+    StoreStats st;
+    store_stats(&st);
+    char line[256];
+#define OUT(...) buf_append(b, line, (size_t)snprintf(line, sizeof line, __VA_ARGS__))
+    metric_head(b, "eht_items", "gauge", "Items stored, counting expired ones not yet reclaimed.");
+    OUT("eht_items %llu\n", (unsigned long long)st.items);
+    metric_head(b, "eht_memory_used_bytes", "gauge", "Slab pages and large items.");
+    OUT("eht_memory_used_bytes %zu\n", __atomic_load_n(&g_mem_used, __ATOMIC_RELAXED));
+    metric_head(b, "eht_memory_limit_bytes", "gauge", "The -m cap; 0 is none.");
+    OUT("eht_memory_limit_bytes %zu\n", g_mem_limit);
+    metric_head(b, "eht_keyspace_hits_total", "counter", "Lookups that found their key.");
+    OUT("eht_keyspace_hits_total %llu\n", (unsigned long long)st.hits);
+    metric_head(b, "eht_keyspace_misses_total", "counter", "Lookups that did not.");
+    OUT("eht_keyspace_misses_total %llu\n", (unsigned long long)st.misses);
+    metric_head(b, "eht_evicted_keys_total", "counter", "Items evicted for memory.");
+    OUT("eht_evicted_keys_total %llu\n", (unsigned long long)st.evictions);
+    metric_head(b, "eht_expired_keys_total", "counter", "Expired items reclaimed.");
+    OUT("eht_expired_keys_total %llu\n", (unsigned long long)st.expired);
+    metric_head(b, "eht_connected_clients", "gauge", "Open client connections.");
+    OUT("eht_connected_clients %ld\n", __atomic_load_n(&g_clients, __ATOMIC_RELAXED));
+    metric_head(b, "eht_uptime_seconds", "gauge", "Seconds since start.");
+    OUT("eht_uptime_seconds %u\n", now_secs() - 2);
+#undef OUT
+}
+
+/*  Latency histograms summed over the loops; commands never seen are
+ *  left out. */
+static void metrics_commands(Buf* b)
+{
+    static const char* const protos[] = { "binary", "resp", "memcached" };
+    char line[256];
+    metric_head(b, "eht_command_duration_seconds", "histogram",
+                "Time to execute a command, from parse to reply queued.");
+    for (int p = 0; p < 3; ++p) {
+        for (unsigned c = 0; c < CMD_SLOTS && g_cmd_names[p][c]; ++c) {
+            uint64_t n[LAT_BUCKETS] = { 0 }, ns = 0, total = 0;
+            for (long i = 0; i < g_nworkers; ++i) {
+                Worker* w = &g_workers[i];
+                for (int k = 0; k < LAT_BUCKETS; ++k)
+                    n[k] += __atomic_load_n(&w->lat[p][c][k], __ATOMIC_RELAXED);
+                ns += __atomic_load_n(&w->lat_ns[p][c], __ATOMIC_RELAXED);
+            }
+            for (int k = 0; k < LAT_BUCKETS; ++k) total += n[k];
+            if (!total) continue;
+
+            const char* cmd = g_cmd_names[p][c];
+            uint64_t    below = 0;
+            for (int k = 0; k < LAT_BUCKETS - 1; ++k) {
+                below += n[k];
+                buf_append(b, line, (size_t)snprintf(line, sizeof line,
+                    "eht_command_duration_seconds_bucket{proto=\"%s\",command=\"%s\","
+                    "le=\"%g\"} %llu\n", protos[p], cmd,
+                    1e-6 * (double)(1u << k), (unsigned long long)below));
+            }
+            buf_append(b, line, (size_t)snprintf(line, sizeof line,
+                "eht_command_duration_seconds_bucket{proto=\"%s\",command=\"%s\","
+                "le=\"+Inf\"} %llu\n", protos[p], cmd, (unsigned long long)total));
+            buf_append(b, line, (size_t)snprintf(line, sizeof line,
+                "eht_command_duration_seconds_sum{proto=\"%s\",command=\"%s\"} %.9f\n"
+                "eht_command_duration_seconds_count{proto=\"%s\",command=\"%s\"} %llu\n",
+                protos[p], cmd, (double)ns / 1e9, protos[p], cmd,
+                (unsigned long long)total));
+        }
+    }
+}
+
+static int send_all(int fd, const void* p, size_t n)
+{
+    while (n) {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p  = (const char*)p + k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+/*  Reads one request head from fd and answers it.  The socket times
+ *  out, so a stalled scraper holds the endpoint for a second at most. */
+static void metrics_serve(int fd, Buf* body)
+{
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+
+    char   req[METRICS_REQ + 1];
+    size_t n = 0;
+    while (n < METRICS_REQ) {
+        ssize_t k = recv(fd, req + n, METRICS_REQ - n, 0);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return;
+        n += (size_t)k;
+        req[n] = 0;
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+    }
+    req[n] = 0;
+
+    const char* status = "200 OK";
+    int         head   = !strncmp(req, "HEAD ", 5);
+    const char* path   = head ? req + 5 : !strncmp(req, "GET ", 4) ? req + 4 : NULL;
+    size_t      plen   = path ? strcspn(path, " ?\r\n") : 0;
+    body->len = 0;
+    if (!path) {
+        status = "405 Method Not Allowed";
+        buf_append(body, "GET only\n", 9);
+    } else if (plen == 8 && !memcmp(path, "/metrics", 8)) {
+        metrics_table(body);
+        metrics_store(body);
+        metrics_commands(body);
+    } else {
+        status = "404 Not Found";
+        buf_append(body, "try /metrics\n", 13);
+    }
+
+    char hdr[256];
+    int  hn = snprintf(hdr, sizeof hdr,
+                       "HTTP/1.1 %s\r\n"
+                       "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                       "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                       status, body->len);
+    if (send_all(fd, hdr, (size_t)hn) == 0 && !head)
+        send_all(fd, body->data, body->len);
+}
+
+static void* metrics_main(void* arg)
+{
+    (void)arg;
+    Buf body = { 0 };
+    for (;;) {
+        /* g_wake stays readable once main writes it at shutdown */
+        struct pollfd pf[2] = { { g_metrics_fd, POLLIN, 0 }, { g_wake.fd, POLLIN, 0 } };
+        if (poll(pf, 2, -1) < 0 && errno != EINTR) break;
+        if (pf[1].revents) break;
+        if (!(pf[0].revents & POLLIN)) continue;
+        int fd = accept4(g_metrics_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        metrics_serve(fd, &body);
+        close(fd);
+    }
+    buf_free(&body);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Main                                                               */
+/* ------------------------------------------------------------------ */
+
+static void usage(void)
+{
+    fputs("usage: eht_server [-p port] [-b addr] [-u path] [-r port] [-R path]\n"
+          "                  [-a port] [-A path] [-t threads] [-S shards]\n"
+          "                  [-c capacity] [-m megabytes] [-l port] [-L path]\n"
+          "                  [-o host:port] [-O path] [-M port]\n"
+          "  -p/-u: binary protocol on TCP (-p 0 disables) / a Unix socket\n"
+          "  -r/-R: RESP (Redis protocol) on TCP / a Unix socket\n"
+          "  -a/-A: memcached text and meta protocol on TCP / a Unix socket\n"
+          "  -m:    memory for values, evicting LRU items past it (0: no cap)\n"
+          "  -l/-L: serve replicas on TCP / a Unix socket\n"
+          "  -o/-O: replicate from a primary's -l address / -L socket, read-only\n"
+          "  -M:    Prometheus metrics over HTTP on TCP, at /metrics\n",
+          stderr);
+    exit(2);
+}
+
+static int listen_tcp(const char* addr, int port)
+{
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_port   = htons((uint16_t)port);
+    if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+        fprintf(stderr, "eht_server: bad address %s\n", addr);
+        return -1;
+    }
+    int fd  = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&sa, sizeof sa) < 0 ||
+        listen(fd, 1024) < 0) {
+        perror("eht_server: tcp");
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_unix(const char* path)
+{
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof sa.sun_path) {
+        fprintf(stderr, "eht_server: socket path too long\n");
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&sa, sizeof sa) < 0 ||
+        listen(fd, 1024) < 0) {
+        perror("eht_server: unix");
+        return -1;
+    }
+    return fd;
+}
+
+/*  Opens a listener for proto on a TCP port or (path) a Unix socket. */
+static int add_listener(const char* addr, int port, const char* path,
+                        int proto)
+{
+    int fd = path ? listen_unix(path) : listen_tcp(addr, port);
+    if (fd < 0) return -1;
+    static const char* const names[] = { "binary", "resp", "memcached" };
+    g_listen[g_nlisten++] = (EvSource){ EV_LISTEN, fd, proto };
+    if (path) fprintf(stderr, ", %s unix %s", names[proto], path);
+    else      fprintf(stderr, ", %s tcp %s:%d", names[proto], addr, port);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* addr     = "127.0.0.1";
+    const char* upath    = NULL;
+    const char* rpath    = NULL;
+    const char* mpath    = NULL;
+    const char* lpath    = NULL;
+    const char* primary  = NULL;
+    int         ppath    = 0;
+    int         lport    = 0;
+    int         port     = 7070;
+    int         rport    = 0;
+    int         mport    = 0;
+    int         xport    = 0;
+    long        threads  = sysconf(_SC_NPROCESSORS_ONLN);
+    long        shards   = 0;
+    size_t      capacity = 1 << 16;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "p:b:u:r:R:a:A:t:S:c:m:l:L:o:O:M:")) != -1) {
+        switch (opt) {
+        case 'p': port     = atoi(optarg);               break;
+        case 'b': addr     = optarg;                     break;
+        case 'u': upath    = optarg;                     break;
+        case 'r': rport    = atoi(optarg);               break;
+        case 'R': rpath    = optarg;                     break;
+        case 'a': mport    = atoi(optarg);               break;
+        case 'A': mpath    = optarg;                     break;
+        case 't': threads  = atol(optarg);               break;
+        case 'S': shards   = atol(optarg);               break;
+        case 'c': capacity = (size_t)atoll(optarg);      break;
+        case 'm': g_mem_limit = (size_t)atoll(optarg) << 20; break;
+        case 'l': lport    = atoi(optarg);               break;
+        case 'L': lpath    = optarg;                     break;
+        case 'o': primary  = optarg; ppath = 0;          break;
+        case 'O': primary  = optarg; ppath = 1;          break;
+        case 'M': xport    = atoi(optarg);               break;
+        default:  usage();
+        }
+    }
+    if (optind != argc || threads < 1 || port < 0 || port > 65535 ||
+        rport < 0 || rport > 65535 || mport < 0 || mport > 65535 ||
+        lport < 0 || lport > 65535 || (lport && lpath) ||
+        xport < 0 || xport > 65535 ||
+        (!port && !upath && !rport && !rpath && !mport && !mpath))
+        usage();
+    if (shards <= 0) shards = 4 * threads;
+    unsigned nshards = 1;
+    while (nshards < (unsigned long)shards && nshards < 4096) nshards *= 2;
+
+    if (store_init(nshards, capacity) < 0) {
+        fputs("eht_server: out of memory\n", stderr);
+        return 1;
+    }
+    fprintf(stderr, "eht_server: %ld threads, %u shards", threads, nshards);
+    if ((port  && add_listener(addr, port, NULL, PROTO_BIN) < 0)   ||
+        (upath && add_listener(NULL, 0, upath, PROTO_BIN) < 0)     ||
+        (rport && add_listener(addr, rport, NULL, PROTO_RESP) < 0) ||
+        (rpath && add_listener(NULL, 0, rpath, PROTO_RESP) < 0)    ||
+        (mport && add_listener(addr, mport, NULL, PROTO_MC) < 0)   ||
+        (mpath && add_listener(NULL, 0, mpath, PROTO_MC) < 0))
+        return 1;
+    int lfd = -1;
+    if (lport || lpath) {
+        if ((lfd = lpath ? listen_unix(lpath) : listen_tcp(addr, lport)) < 0) return 1;
+        if (lpath) fprintf(stderr, ", replicas unix %s", lpath);
+        else       fprintf(stderr, ", replicas tcp %s:%d", addr, lport);
+    }
+    if (xport) {
+        if ((g_metrics_fd = listen_tcp(addr, xport)) < 0) return 1;
+        fprintf(stderr, ", metrics http://%s:%d/metrics", addr, xport);
+        g_metrics = 1;
+    }
+    if (primary) fprintf(stderr, ", replica of %s", primary);
+    fputs("\n", stderr);
+    g_wake = (EvSource){ EV_WAKE, eventfd(0, EFD_CLOEXEC), 0 };
+
+    /* Workers inherit a mask without SIGINT/SIGTERM; main waits for them */
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((lfd >= 0 && repl_start_primary(lfd) < 0) ||
+        (primary && repl_start_replica(primary, ppath) < 0)) {
+        fprintf(stderr, "eht_server: cannot replicate%s%s\n",
+                primary ? " from " : "", primary ? primary : "");
+        return 1;
+    }
+
+    g_workers  = (Worker*)calloc((size_t)threads, sizeof(Worker));
+    g_nworkers = threads;
+    for (long i = 0; i < threads; ++i) {
+        Worker* w = &g_workers[i];
+        w->ep = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event ev;
+        for (int l = 0; l < g_nlisten; ++l) {
+            ev.events   = EPOLLIN | EPOLLEXCLUSIVE;
+            ev.data.ptr = &g_listen[l];
+            epoll_ctl(w->ep, EPOLL_CTL_ADD, g_listen[l].fd, &ev);
+        }
+        ev.events   = EPOLLIN;
+        ev.data.ptr = &g_wake;
+        epoll_ctl(w->ep, EPOLL_CTL_ADD, g_wake.fd, &ev);
+        pthread_create(&w->th, NULL, worker_main, w);
+    }
+    if (g_metrics_fd >= 0) pthread_create(&g_metrics_th, NULL, metrics_main, NULL);
+    /* Main keeps the item clock while it waits for a signal */
+    struct timespec second = { 1, 0 };
+    while (sigtimedwait(&sigs, NULL, &second) < 0) clock_tick();
+
+    /* The eventfd stays readable, so every loop sees it and exits;
+     * connections still open are dropped with the process. */
+    uint64_t one = 1;
+    if (write(g_wake.fd, &one, sizeof one) < 0) perror("eht_server: wake");
+    if (g_metrics_fd >= 0) {
+        pthread_join(g_metrics_th, NULL);
+        close(g_metrics_fd);
+    }
+    for (long i = 0; i < threads; ++i) {
+        pthread_join(g_workers[i].th, NULL);
+        close(g_workers[i].ep);
+        buf_free(&g_workers[i].keys);
+        buf_free(&g_workers[i].scratch);
+        buf_free(&g_workers[i].vals);
+        buf_free(&g_workers[i].args);
+    }
+    free(g_workers);
+    repl_stop();
+    for (int l = 0; l < g_nlisten; ++l) close(g_listen[l].fd);
+    if (upath) unlink(upath);
+    if (rpath) unlink(rpath);
+    if (mpath) unlink(mpath);
+    if (lpath) unlink(lpath);
+    store_destroy();
+    return 0;
+}
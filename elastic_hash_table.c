@@ -8,36 +8,141 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define EHT_TINY_SSE2 1
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define EHT_X86 1
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#if defined(__GNUC__)
+#define EHT_PREFETCH(p) __builtin_prefetch((p), 0, 1)
+#else
+#define EHT_PREFETCH(p) ((void)(p))
+#endif
 
 /* ------------------------------------------------------------------ */
 /* Slot / SubArray definitions                                        */
 /* ------------------------------------------------------------------ */
 
-typedef enum { SLOT_EMPTY, SLOT_OCCUPIED, SLOT_TOMBSTONE } SlotState;
+/* Plain layout, split hot/cold: a probe reads one tag byte per slot
+ * and, on a tag match, the slot's full hash; the key/value reference
+ * is only touched once the key is all but certainly found. */
+#define TAG_EMPTY      0u
+#define TAG_TOMBSTONE  1u
+#define TAG_LIVE       0x80u    /* | top 7 bits of the hash */
 
 typedef struct {
     char*      key;         /* heap-allocated copy, NUL-terminated */
     void*      value;       /* heap-allocated copy                 */
     size_t     value_len;
-    SlotState  state;
-} Slot;
+} SlotRef;
+
+/* Ordered layout: entries live densely in insertion order and level
+ * slots hold only an index into them (see EHT_FLAG_ORDERED). */
+typedef struct {
+    uint64_t   hash;
+    char*      key;         /* NULL once the entry is deleted      */
+    void*      value;
+    size_t     value_len;
+} Entry;
+
+/* Compact storage: the entry is a 32-bit offset of a record in the
+ * table's arena, [varint key_len][key][NUL][varint value_len][value],
+ * plus the high half of its hash (see EHT_FLAG_COMPACT). */
+typedef struct {
+    uint32_t   ref;         /* REF_DEAD once the entry is deleted  */
+    uint32_t   tag;
+} CompactEntry;
+
+#define REF_DEAD       UINT32_MAX
+
+#define IDX_EMPTY      0u
+#define IDX_TOMBSTONE  1u
+#define IDX_BASE       2u   /* slot value = entry index + IDX_BASE */
+
+/* Set in t->flags by eht_freeze; never a create flag */
+#define EHT_FROZEN     0x80000000u
+
+/* eht_freeze_perfect keeps its minimal perfect hash in the same form
+ * as a generated static table (EHTStaticTable, see the header); the
+ * arrays are heap copies owned by the table. */
 
 typedef struct {
-    int     level;
-    size_t  capacity;
-    size_t  count;          /* live entries   */
-    size_t  tombstones;
-    Slot*   slots;
+    int       level;
+    uint64_t  salt1, salt2; /* per-level probe salts (dual_hash)   */
+    size_t    capacity;
+    size_t    count;        /* live entries   */
+    size_t    tombstones;
+    uint8_t*  tags;         /* plain layout: TAG_*                 */
+    uint64_t* hashes;       /* ... full hash of each live slot     */
+    SlotRef*  refs;         /* ... key/value, cold                 */
+    uint16_t* dist;         /* ... probe attempt it sits at (Robin
+                               Hood mode; kept on tombstones too)  */
+    uint16_t* hits;         /* ... lookup hits (adaptive mode)     */
+    uint32_t* index;        /* ordered layout                      */
+    CompactEntry* slots;    /* frozen layout: arena ref + hash tag,
+                               ref REF_DEAD when empty             */
+    size_t    bound;        /* ... longest probe run any entry needs */
+    uint64_t* occupied;     /* one bit per slot, set while live    */
 } SubArray;
 
+/* Tiny-table storage: parallel arrays in one allocation (see below) */
+typedef struct {
+    size_t    capacity;     /* multiple of EHT_TINY_LANES          */
+    char**    keys;
+    void**    values;
+    size_t*   value_lens;
+    uint32_t* tags;         /* high half of each key's hash        */
+} TinyTable;
+
 struct ElasticHashTable {
     size_t    total_capacity;
     size_t    count;              /* total live entries across all levels */
+    size_t    tombstones;         /* total tombstones across all levels   */
     size_t    num_levels;
     size_t    min_level_size;
     double    max_load;
     double    tombstone_ratio;
+    unsigned  flags;              /* EHT_FLAG_* given at create time      */
     SubArray* levels;
+    uint8_t*  hints;              /* per hash bucket: levels ever used    */
+    unsigned  hint_shift;         /* 64 - log2(number of hint buckets)    */
+    TinyTable* tiny;              /* non-NULL while still a tiny table    */
+    Entry*    entries;            /* ordered layout: dense, in order      */
+    CompactEntry* centries;       /* ... or these, in compact mode        */
+    size_t    n_entries;          /* used, including deleted ones         */
+    size_t    entries_cap;
+    uint8_t*  arena;              /* compact mode: key/value records      */
+    size_t    arena_len;
+    size_t    arena_cap;
+    size_t    arena_dead;         /* bytes held by deleted/stale records  */
+    EHTHashKind hash_kind;
+    EHTHashFn hash_fn;            /* NULL: FNV-1a                         */
+    void*     hash_ctx;
+    uint64_t  key_seed;           /* seeded mode: keys the wyhash         */
+    uint64_t  level_seed;         /* ... and the level salts; reseedable  */
+    size_t    watch_ops;          /* lookups in the current window        */
+    size_t    watch_long;         /* ... that probed EHT_LONG_PROBES+     */
+    size_t    watch_window;
+    size_t    watch_base;         /* usual long fraction, in 1/1024ths    */
+    int       watch_primed;       /* watch_base set since last rebuild   */
+    size_t    reseeds;
+    size_t    rebuilds;           /* eht_rebuild_stats                    */
+    uint64_t  rebuild_ns;
+    uint64_t  rebuild_max_ns;
+    size_t    reseed_floor;       /* count before another exhaustion reseed */
+    int       reseed_pending;
+    EHTStaticTable* perfect;        /* eht_freeze_perfect                   */
 };
 
 struct EHTIterator {
@@ -47,26 +152,43 @@ struct EHTIterator {
 };
 
 /* ------------------------------------------------------------------ */
-/* FNV-1a (64-bit) with salt — stable, deterministic hash             */
+/* Hashing: one FNV-1a pass per key, per-level probes derived by mix  */
 /* ------------------------------------------------------------------ */
 
-static uint64_t fnv1a_salted(const char* key, uint64_t salt)
+#define FNV_OFFSET UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME  UINT64_C(0x100000001b3)
+
+static uint64_t fnv1a(const char* key)
 {
-    uint64_t h = UINT64_C(0xcbf29ce484222325) ^ salt;
+    uint64_t h = FNV_OFFSET;
     for (const unsigned char* p = (const unsigned char*)key; *p; ++p) {
         h ^= (uint64_t)*p;
-        h *= UINT64_C(0x100000001b3);
+        h *= FNV_PRIME;
     }
     return h;
 }
 
-static void dual_hash(const char* key, int level,
+/* splitmix64 finaliser — spreads FNV's weak low bits across the word */
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30; x *= UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27; x *= UINT64_C(0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
+}
+
+/*  A level's probe sequence, from the key's one 64-bit hash.  Hashing the
+ *  key again per level, as the salted FNV passes once did, costs two passes
+ *  over the key for every level a lookup visits.  It also rules out stored
+ *  hashes, rebuilds that skip rehashing, and caller-supplied hashes.
+ *  mix64 makes each level's (h1, h2) depend on all 64 bits of h.  Without
+ *  it, keys whose hashes differ only in their high bits share probe
+ *  sequences. */
+static void dual_hash(uint64_t h, const SubArray* sub,
                        uint64_t* h1_out, uint64_t* h2_out)
 {
-    uint64_t salt1 = (uint64_t)level * UINT64_C(0x9E3779B97F4A7C15) + 0xA1;
-    uint64_t salt2 = (uint64_t)level * UINT64_C(0x517CC1B727220A95) + 0xB2;
-    *h1_out = fnv1a_salted(key, salt1);
-    *h2_out = fnv1a_salted(key, salt2) | 1;  /* odd → full period */
+    *h1_out = mix64(h ^ sub->salt1);
+    *h2_out = mix64(h ^ sub->salt2) | 1;  /* odd → full period */
 }
 
 static size_t probe_idx(uint64_t h1, uint64_t h2,
@@ -75,14 +197,467 @@ static size_t probe_idx(uint64_t h1, uint64_t h2,
     return (size_t)((h1 + attempt * h2) % capacity);
 }
 
+/* ------------------------------------------------------------------ */
+/* Batch hashing: FNV-1a over several keys at once, one key per SIMD  */
+/* lane, eight key bytes loaded per lane at a time.  Bit-identical to */
+/* fnv1a().  The kernel is picked once, among those the CPU supports, */
+/* by timing each: 64-bit vector multiplies are slow on some parts,   */
+/* where the scalar loop wins.                                        */
+/* ------------------------------------------------------------------ */
+
+typedef void (*HashManyFn)(const char* const* keys, size_t n, uint64_t* out);
+
+static void hash_many_scalar(const char* const* keys, size_t n, uint64_t* out)
+{
+    for (size_t i = 0; i < n; ++i) out[i] = fnv1a(keys[i]);
+}
+
+#ifdef EHT_X86
+
+/*  Key bytes [off, off + 8) as a little-endian word, zero past the end */
+static uint64_t key_word(const char* key, size_t len, size_t off)
+{
+    uint64_t w = 0;
+    if (off + 8 <= len) {
+        memcpy(&w, key + off, 8);
+    } else {
+        for (size_t j = off; j < len; ++j)
+            w |= (uint64_t)(unsigned char)key[j] << (8 * (j - off));
+    }
+    return w;
+}
+
+/*  x * FNV_PRIME mod 2^64 without a 64-bit vector multiply:
+ *  FNV_PRIME = 2^40 + 0x1b3, and x * 0x1b3 splits into 32-bit halves. */
+__attribute__((target("avx2")))
+static __m256i mul_fnv_prime_avx2(__m256i x)
+{
+    const __m256i lo = _mm256_set1_epi64x(0x1b3);
+    __m256i a = _mm256_slli_epi64(x, 40);
+    __m256i b = _mm256_mul_epu32(x, lo);
+    __m256i c = _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), lo), 32);
+    return _mm256_add_epi64(a, _mm256_add_epi64(b, c));
+}
+
+__attribute__((target("avx2")))
+static void hash_many_avx2(const char* const* keys, size_t n, uint64_t* out)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        size_t len[4], min = SIZE_MAX, max = 0, off = 0;
+        for (int l = 0; l < 4; ++l) {
+            len[l] = strlen(keys[i + l]);
+            if (len[l] < min) min = len[l];
+            if (len[l] > max) max = len[l];
+        }
+        const __m256i lens = _mm256_set_epi64x((long long)len[3], (long long)len[2],
+                                               (long long)len[1], (long long)len[0]);
+        const __m256i mask = _mm256_set1_epi64x(0xff);
+        __m256i h = _mm256_set1_epi64x((long long)FNV_OFFSET);
+
+        /* Whole words every lane has: no masking */
+        for (; off + 8 <= min; off += 8) {
+            __m256i w = _mm256_set_epi64x(
+                (long long)key_word(keys[i + 3], len[3], off),
+                (long long)key_word(keys[i + 2], len[2], off),
+                (long long)key_word(keys[i + 1], len[1], off),
+                (long long)key_word(keys[i + 0], len[0], off));
+            for (int k = 0; k < 8; ++k) {
+                h = mul_fnv_prime_avx2(
+                    _mm256_xor_si256(h, _mm256_and_si256(w, mask)));
+                w = _mm256_srli_epi64(w, 8);
+            }
+        }
+        /* Tails: lanes past their key's end keep their hash */
+        for (; off < max; off += 8) {
+            __m256i w = _mm256_set_epi64x(
+                (long long)key_word(keys[i + 3], len[3], off),
+                (long long)key_word(keys[i + 2], len[2], off),
+                (long long)key_word(keys[i + 1], len[1], off),
+                (long long)key_word(keys[i + 0], len[0], off));
+            for (size_t k = 0; k < 8 && off + k < max; ++k) {
+                __m256i pos  = _mm256_set1_epi64x((long long)(off + k));
+                __m256i live = _mm256_cmpgt_epi64(lens, pos);
+                __m256i next = mul_fnv_prime_avx2(
+                    _mm256_xor_si256(h, _mm256_and_si256(w, mask)));
+                h = _mm256_blendv_epi8(h, next, live);
+                w = _mm256_srli_epi64(w, 8);
+            }
+        }
+        _mm256_storeu_si256((__m256i*)(out + i), h);
+    }
+    hash_many_scalar(keys + i, n - i, out + i);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static void hash_many_avx512(const char* const* keys, size_t n, uint64_t* out)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t len[8], word[8];
+        size_t   min = SIZE_MAX, max = 0, off = 0;
+        for (int l = 0; l < 8; ++l) {
+            len[l] = strlen(keys[i + l]);
+            if (len[l] < min) min = len[l];
+            if (len[l] > max) max = len[l];
+        }
+        const __m512i lens  = _mm512_loadu_si512(len);
+        const __m512i prime = _mm512_set1_epi64((long long)FNV_PRIME);
+        const __m512i mask  = _mm512_set1_epi64(0xff);
+        __m512i h = _mm512_set1_epi64((long long)FNV_OFFSET);
+
+        for (; off + 8 <= min; off += 8) {
+            for (int l = 0; l < 8; ++l)
+                memcpy(&word[l], keys[i + l] + off, 8);
+            __m512i w = _mm512_loadu_si512(word);
+            for (int k = 0; k < 8; ++k) {
+                h = _mm512_mullo_epi64(
+                    _mm512_xor_si512(h, _mm512_and_si512(w, mask)), prime);
+                w = _mm512_srli_epi64(w, 8);
+            }
+        }
+        for (; off < max; off += 8) {
+            for (int l = 0; l < 8; ++l)
+                word[l] = key_word(keys[i + l], len[l], off);
+            __m512i w = _mm512_loadu_si512(word);
+            for (size_t k = 0; k < 8 && off + k < max; ++k) {
+                __mmask8 live = _mm512_cmpgt_epu64_mask(
+                    lens, _mm512_set1_epi64((long long)(off + k)));
+                __m512i next = _mm512_mullo_epi64(
+                    _mm512_xor_si512(h, _mm512_and_si512(w, mask)), prime);
+                h = _mm512_mask_mov_epi64(h, live, next);
+                w = _mm512_srli_epi64(w, 8);
+            }
+        }
+        _mm512_storeu_si512(out + i, h);
+    }
+    hash_many_avx2(keys + i, n - i, out + i);
+}
+
+#define EHT_CALIBRATE_KEYS 64
+
+/*  Best of three timings of fn over a fixed batch of 24-byte keys */
+static uint64_t hash_many_cycles(HashManyFn fn)
+{
+    char        buf[EHT_CALIBRATE_KEYS][25];
+    const char* keys[EHT_CALIBRATE_KEYS];
+    uint64_t    out[EHT_CALIBRATE_KEYS];
+    for (int i = 0; i < EHT_CALIBRATE_KEYS; ++i) {
+        for (int j = 0; j < 24; ++j) buf[i][j] = (char)('a' + (i + j) % 26);
+        buf[i][24] = '\0';
+        keys[i]    = buf[i];
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < 3; ++r) {
+        uint64_t t0 = __rdtsc();
+        fn(keys, EHT_CALIBRATE_KEYS, out);
+        uint64_t dt = __rdtsc() - t0;
+        if (dt < best) best = dt;
+    }
+    return best;
+}
+
+#endif /* EHT_X86 */
+
+static HashManyFn hash_many_pick(void)
+{
+    HashManyFn best = hash_many_scalar;
+#ifdef EHT_X86
+    HashManyFn cand[2];
+    int        n = 0;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+        cand[n++] = hash_many_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        cand[n++] = hash_many_avx2;
+
+    uint64_t best_cycles = hash_many_cycles(hash_many_scalar);
+    for (int i = 0; i < n; ++i) {
+        uint64_t c = hash_many_cycles(cand[i]);
+        if (c < best_cycles) { best = cand[i]; best_cycles = c; }
+    }
+#endif
+    return best;
+}
+
+static void hash_many(const char* const* keys, size_t n, uint64_t* out)
+{
+#if defined(__GNUC__)
+    /* Racing first calls may each time the kernels and choose
+     * differently; the first choice published is the one all use */
+    static HashManyFn impl;
+    HashManyFn f = __atomic_load_n(&impl, __ATOMIC_ACQUIRE);
+    if (!f) {
+        HashManyFn none = NULL;
+        f = hash_many_pick();
+        if (!__atomic_compare_exchange_n(&impl, &none, f, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            f = none;
+    }
+    f(keys, n, out);
+#else
+    hash_many_pick()(keys, n, out);   /* the scalar loop: nothing to time */
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/* Selectable key hashes (eht_create_with_hash)                       */
+/* ------------------------------------------------------------------ */
+
+static uint64_t read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static uint64_t read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+/*  64 x 64 → 128-bit multiply; *a gets the low half, *b the high */
+static void mul128(uint64_t* a, uint64_t* b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, la = (uint32_t)*a;
+    uint64_t hb = *b >> 32, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t  = rl + (rm0 << 32);
+    uint64_t c  = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t mul_fold(uint64_t a, uint64_t b)
+{
+    mul128(&a, &b);
+    return a ^ b;
+}
+
+/*  wyhash (Wang Yi's public-domain design, final version 4): 16 bytes
+ *  per 128-bit multiply, 48 per round of three on long keys. */
+static const uint64_t WY_SECRET[4] = {
+    UINT64_C(0x2d358dccaa6c78a5), UINT64_C(0x8bb84b93962eacc9),
+    UINT64_C(0x4b33a62ed433d4a3), UINT64_C(0x4d5a2da51de1aa47)
+};
+
+static uint64_t wyhash(const char* key, size_t len, void* ctx)
+{
+    const uint8_t*  p    = (const uint8_t*)key;
+    const uint64_t* s    = WY_SECRET;
+    uint64_t        seed = ctx ? *(const uint64_t*)ctx : 0;
+    seed = mul_fold(seed ^ s[0], s[1]);
+    uint64_t        a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t q = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + q);
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - q);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mul_fold(read64(p)      ^ s[1], read64(p + 8)  ^ seed);
+                see1 = mul_fold(read64(p + 16) ^ s[2], read64(p + 24) ^ see1);
+                see2 = mul_fold(read64(p + 32) ^ s[3], read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mul_fold(read64(p) ^ s[1], read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    a ^= s[1];
+    b ^= seed;
+    mul128(&a, &b);
+    return mul_fold(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+/*  CRC32C hash: two CRC32C streams over alternate 8-byte words (so the
+ *  hardware instruction's latency overlaps and the state is 64 bits),
+ *  tail bytes into the second, then the splitmix64 finaliser.  The
+ *  table-driven version computes the same function. */
+#define CRC32C_POLY 0x82F63B78u   /* reflected Castagnoli polynomial */
+
+/* crc32c_table[i]: i shifted through eight rounds of CRC32C_POLY.  A
+ * constant rather than built on first use, so no thread can read it
+ * half-filled. */
+static const uint32_t crc32c_table[256] = {
+    0x00000000u, 0xF26B8303u, 0xE13B70F7u, 0x1350F3F4u, 0xC79A971Fu, 0x35F1141Cu,
+    0x26A1E7E8u, 0xD4CA64EBu, 0x8AD958CFu, 0x78B2DBCCu, 0x6BE22838u, 0x9989AB3Bu,
+    0x4D43CFD0u, 0xBF284CD3u, 0xAC78BF27u, 0x5E133C24u, 0x105EC76Fu, 0xE235446Cu,
+    0xF165B798u, 0x030E349Bu, 0xD7C45070u, 0x25AFD373u, 0x36FF2087u, 0xC494A384u,
+    0x9A879FA0u, 0x68EC1CA3u, 0x7BBCEF57u, 0x89D76C54u, 0x5D1D08BFu, 0xAF768BBCu,
+    0xBC267848u, 0x4E4DFB4Bu, 0x20BD8EDEu, 0xD2D60DDDu, 0xC186FE29u, 0x33ED7D2Au,
+    0xE72719C1u, 0x154C9AC2u, 0x061C6936u, 0xF477EA35u, 0xAA64D611u, 0x580F5512u,
+    0x4B5FA6E6u, 0xB93425E5u, 0x6DFE410Eu, 0x9F95C20Du, 0x8CC531F9u, 0x7EAEB2FAu,
+    0x30E349B1u, 0xC288CAB2u, 0xD1D83946u, 0x23B3BA45u, 0xF779DEAEu, 0x05125DADu,
+    0x1642AE59u, 0xE4292D5Au, 0xBA3A117Eu, 0x4851927Du, 0x5B016189u, 0xA96AE28Au,
+    0x7DA08661u, 0x8FCB0562u, 0x9C9BF696u, 0x6EF07595u, 0x417B1DBCu, 0xB3109EBFu,
+    0xA0406D4Bu, 0x522BEE48u, 0x86E18AA3u, 0x748A09A0u, 0x67DAFA54u, 0x95B17957u,
+    0xCBA24573u, 0x39C9C670u, 0x2A993584u, 0xD8F2B687u, 0x0C38D26Cu, 0xFE53516Fu,
+    0xED03A29Bu, 0x1F682198u, 0x5125DAD3u, 0xA34E59D0u, 0xB01EAA24u, 0x42752927u,
+    0x96BF4DCCu, 0x64D4CECFu, 0x77843D3Bu, 0x85EFBE38u, 0xDBFC821Cu, 0x2997011Fu,
+    0x3AC7F2EBu, 0xC8AC71E8u, 0x1C661503u, 0xEE0D9600u, 0xFD5D65F4u, 0x0F36E6F7u,
+    0x61C69362u, 0x93AD1061u, 0x80FDE395u, 0x72966096u, 0xA65C047Du, 0x5437877Eu,
+    0x4767748Au, 0xB50CF789u, 0xEB1FCBADu, 0x197448AEu, 0x0A24BB5Au, 0xF84F3859u,
+    0x2C855CB2u, 0xDEEEDFB1u, 0xCDBE2C45u, 0x3FD5AF46u, 0x7198540Du, 0x83F3D70Eu,
+    0x90A324FAu, 0x62C8A7F9u, 0xB602C312u, 0x44694011u, 0x5739B3E5u, 0xA55230E6u,
+    0xFB410CC2u, 0x092A8FC1u, 0x1A7A7C35u, 0xE811FF36u, 0x3CDB9BDDu, 0xCEB018DEu,
+    0xDDE0EB2Au, 0x2F8B6829u, 0x82F63B78u, 0x709DB87Bu, 0x63CD4B8Fu, 0x91A6C88Cu,
+    0x456CAC67u, 0xB7072F64u, 0xA457DC90u, 0x563C5F93u, 0x082F63B7u, 0xFA44E0B4u,
+    0xE9141340u, 0x1B7F9043u, 0xCFB5F4A8u, 0x3DDE77ABu, 0x2E8E845Fu, 0xDCE5075Cu,
+    0x92A8FC17u, 0x60C37F14u, 0x73938CE0u, 0x81F80FE3u, 0x55326B08u, 0xA759E80Bu,
+    0xB4091BFFu, 0x466298FCu, 0x1871A4D8u, 0xEA1A27DBu, 0xF94AD42Fu, 0x0B21572Cu,
+    0xDFEB33C7u, 0x2D80B0C4u, 0x3ED04330u, 0xCCBBC033u, 0xA24BB5A6u, 0x502036A5u,
+    0x4370C551u, 0xB11B4652u, 0x65D122B9u, 0x97BAA1BAu, 0x84EA524Eu, 0x7681D14Du,
+    0x2892ED69u, 0xDAF96E6Au, 0xC9A99D9Eu, 0x3BC21E9Du, 0xEF087A76u, 0x1D63F975u,
+    0x0E330A81u, 0xFC588982u, 0xB21572C9u, 0x407EF1CAu, 0x532E023Eu, 0xA145813Du,
+    0x758FE5D6u, 0x87E466D5u, 0x94B49521u, 0x66DF1622u, 0x38CC2A06u, 0xCAA7A905u,
+    0xD9F75AF1u, 0x2B9CD9F2u, 0xFF56BD19u, 0x0D3D3E1Au, 0x1E6DCDEEu, 0xEC064EEDu,
+    0xC38D26C4u, 0x31E6A5C7u, 0x22B65633u, 0xD0DDD530u, 0x0417B1DBu, 0xF67C32D8u,
+    0xE52CC12Cu, 0x1747422Fu, 0x49547E0Bu, 0xBB3FFD08u, 0xA86F0EFCu, 0x5A048DFFu,
+    0x8ECEE914u, 0x7CA56A17u, 0x6FF599E3u, 0x9D9E1AE0u, 0xD3D3E1ABu, 0x21B862A8u,
+    0x32E8915Cu, 0xC083125Fu, 0x144976B4u, 0xE622F5B7u, 0xF5720643u, 0x07198540u,
+    0x590AB964u, 0xAB613A67u, 0xB831C993u, 0x4A5A4A90u, 0x9E902E7Bu, 0x6CFBAD78u,
+    0x7FAB5E8Cu, 0x8DC0DD8Fu, 0xE330A81Au, 0x115B2B19u, 0x020BD8EDu, 0xF0605BEEu,
+    0x24AA3F05u, 0xD6C1BC06u, 0xC5914FF2u, 0x37FACCF1u, 0x69E9F0D5u, 0x9B8273D6u,
+    0x88D28022u, 0x7AB90321u, 0xAE7367CAu, 0x5C18E4C9u, 0x4F48173Du, 0xBD23943Eu,
+    0xF36E6F75u, 0x0105EC76u, 0x12551F82u, 0xE03E9C81u, 0x34F4F86Au, 0xC69F7B69u,
+    0xD5CF889Du, 0x27A40B9Eu, 0x79B737BAu, 0x8BDCB4B9u, 0x988C474Du, 0x6AE7C44Eu,
+    0xBE2DA0A5u, 0x4C4623A6u, 0x5F16D052u, 0xAD7D5351u
+};
+
+static uint32_t crc32c_sw_bytes(uint32_t crc, const uint8_t* p, size_t n)
+{
+    while (n--) crc = (crc >> 8) ^ crc32c_table[(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+static uint64_t crc32c_finish(uint32_t a, uint32_t b, size_t len)
+{
+    return mix64((((uint64_t)a << 32) | b) ^ (uint64_t)len);
+}
+
+#define CRC32C_INIT_A 0xFFFFFFFFu
+#define CRC32C_INIT_B 0x9E3779B9u
+
+static uint64_t crc32c_sw(const char* key, size_t len, void* ctx)
+{
+    const uint8_t* p = (const uint8_t*)key;
+    uint32_t a = CRC32C_INIT_A, b = CRC32C_INIT_B;
+    size_t   i = 0;
+    (void)ctx;
+    for (; i + 16 <= len; i += 16) {
+        a = crc32c_sw_bytes(a, p + i,     8);
+        b = crc32c_sw_bytes(b, p + i + 8, 8);
+    }
+    if (i + 8 <= len) { a = crc32c_sw_bytes(a, p + i, 8); i += 8; }
+    b = crc32c_sw_bytes(b, p + i, len - i);
+    return crc32c_finish(a, b, len);
+}
+
+#if defined(EHT_X86) || defined(__ARM_FEATURE_CRC32)
+#define EHT_CRC32C_HW 1
+
+#if defined(EHT_X86)
+#define CRC_TARGET __attribute__((target("sse4.2")))
+#define CRC_U64(c, v) ((uint32_t)_mm_crc32_u64((c), (v)))
+#define CRC_U8(c, v)  _mm_crc32_u8((c), (v))
+#else
+#define CRC_TARGET
+#define CRC_U64(c, v) __crc32cd((c), (v))
+#define CRC_U8(c, v)  __crc32cb((c), (v))
+#endif
+
+CRC_TARGET
+static uint64_t crc32c_hw(const char* key, size_t len, void* ctx)
+{
+    const uint8_t* p = (const uint8_t*)key;
+    uint32_t a = CRC32C_INIT_A, b = CRC32C_INIT_B;
+    size_t   i = 0;
+    (void)ctx;
+    for (; i + 16 <= len; i += 16) {
+        a = CRC_U64(a, read64(p + i));
+        b = CRC_U64(b, read64(p + i + 8));
+    }
+    if (i + 8 <= len) { a = CRC_U64(a, read64(p + i)); i += 8; }
+    for (; i < len; ++i) b = CRC_U8(b, p[i]);
+    return crc32c_finish(a, b, len);
+}
+#endif /* EHT_CRC32C_HW */
+
+static EHTHashFn crc32c_pick(void)
+{
+#if defined(EHT_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) return crc32c_hw;
+#elif defined(EHT_CRC32C_HW)
+    return crc32c_hw;       /* compiled for ARMv8 with CRC extension */
+#endif
+    return crc32c_sw;
+}
+
+/*  crc32c_pick's choice, made once: eht_static_get, which may run on
+ *  any thread, calls this on every lookup. */
+static EHTHashFn crc32c_impl(void)
+{
+#if defined(__GNUC__)
+    /* Every pick gives the same answer, so racing stores agree */
+    static EHTHashFn impl;
+    EHTHashFn f = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+    if (!f) {
+        f = crc32c_pick();
+        __atomic_store_n(&impl, f, __ATOMIC_RELAXED);
+    }
+    return f;
+#else
+    return crc32c_pick();   /* no CPU check to repeat */
+#endif
+}
+
+static uint64_t key_hash(const ElasticHashTable* t, const char* key)
+{
+    if (!t->hash_fn) return fnv1a(key);
+    return t->hash_fn(key, strlen(key), t->hash_ctx);
+}
+
 /* ------------------------------------------------------------------ */
 /* Probe-budget: O(log²(1/ε))                                        */
 /* ------------------------------------------------------------------ */
 
+/*  Floor on ε.  Inserts fill a level until its budget runs out, and the
+ *  budget grows as the level fills, so without a floor a level is packed
+ *  to its last slot: the budget passes 370 probes with one free slot in
+ *  65536, and a full level is scanned end to end, on every miss and every
+ *  insert that passes through it.  At 1/64 no level's budget exceeds
+ *  3 + 3·ln²64, about 55 probes; past that fill, keys go to the next level.
+ *  The clamped budget is still non-decreasing in the level's fill, so a key
+ *  placed within the budget at insert time is always found within the
+ *  budget later.  Build with -DEHT_MIN_EPS=0 to compare without it. */
+#ifndef EHT_MIN_EPS
+#define EHT_MIN_EPS (1.0 / 64)
+#endif
+
 static size_t probe_budget(const SubArray* sub)
 {
     double used = (double)(sub->count + sub->tombstones);
     double eps  = 1.0 - used / (double)sub->capacity;
+    if (eps < EHT_MIN_EPS) eps = EHT_MIN_EPS;
     if (eps <= 0.0) return sub->capacity;
 
     double inv_eps = 1.0 / eps;
@@ -92,40 +667,364 @@ static size_t probe_budget(const SubArray* sub)
     return b < sub->capacity ? b : sub->capacity;
 }
 
+/* ------------------------------------------------------------------ */
+/* Level hints: one byte per bucket of high hash bits recording how   */
+/* many levels any key in the bucket has ever been placed into.       */
+/* Lookups stop there instead of probing every remaining level.       */
+/* ------------------------------------------------------------------ */
+
+#define EHT_SLOTS_PER_HINT 8
+
+static size_t hint_idx(const ElasticHashTable* t, uint64_t h)
+{
+    return (size_t)((h * UINT64_C(0x9E3779B97F4A7C15)) >> t->hint_shift);
+}
+
+static void raise_hint(ElasticHashTable* t, uint64_t h, size_t li)
+{
+    uint8_t* hint = &t->hints[hint_idx(t, h)];
+    if (*hint <= li) *hint = (uint8_t)(li + 1);
+}
+
+static int build_hints(ElasticHashTable* t, size_t capacity)
+{
+    unsigned bits = 0;
+    while (((size_t)1 << (bits + 1)) * EHT_SLOTS_PER_HINT <= capacity)
+        ++bits;
+    t->hint_shift = 64 - bits;
+    t->hints      = (uint8_t*)calloc((size_t)1 << bits, 1);
+    return t->hints ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Cross-level prefetch: a miss visits every hinted level in turn, so */
+/* with EHT_FLAG_PREFETCH each level's first probe is requested up    */
+/* front and the cache misses overlap instead of queueing.            */
+/* ------------------------------------------------------------------ */
+
+#define EHT_PREFETCH_LEVELS 16
+
+typedef struct { uint64_t h1, h2; } ProbeSeed;
+
+/*  Fills seeds[0..depth) and prefetches the first probe slot of each
+ *  non-empty level. */
+static void prefetch_probes(const ElasticHashTable* t, uint64_t h,
+                            size_t depth, ProbeSeed* seeds)
+{
+    for (size_t li = 0; li < depth; ++li) {
+        const SubArray* sub = &t->levels[li];
+        dual_hash(h, sub, &seeds[li].h1, &seeds[li].h2);
+        if (sub->count == 0) continue;
+        size_t idx = probe_idx(seeds[li].h1, seeds[li].h2, 0, sub->capacity);
+        if (sub->slots)      EHT_PREFETCH(&sub->slots[idx]);
+        else if (sub->index) EHT_PREFETCH(&sub->index[idx]);
+        else                 EHT_PREFETCH(&sub->tags[idx]);
+    }
+}
+
+/*  As prefetch_probes when the table is in prefetch mode; returns 0,
+ *  doing nothing, otherwise. */
+static int prefetch_levels(const ElasticHashTable* t, uint64_t h,
+                           size_t depth, ProbeSeed* seeds)
+{
+    if (!(t->flags & EHT_FLAG_PREFETCH) || depth > EHT_PREFETCH_LEVELS)
+        return 0;
+    prefetch_probes(t, h, depth, seeds);
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Seeded mode: random per-table seeds, and a watch on lookup probe   */
+/* lengths that schedules a rebuild under new level salts when too    */
+/* many lookups run long.                                             */
+/* ------------------------------------------------------------------ */
+
+#define EHT_LONG_PROBES   32        /* probes, over all levels, that
+                                       make a hit "long"                */
+#define EHT_WATCH_WINDOW  1024      /* hits per verdict; doubled after
+                                       each reseed                      */
+#define EHT_WATCH_MAX     ((size_t)1 << 24)
+
+/*  64 bits from /dev/urandom, stirred with the clock and an address so
+ *  two tables never share a seed even where the device is missing. */
+static uint64_t random_seed(void)
+{
+    static uint64_t counter;
+    uint64_t r = 0;
+    FILE*    f = fopen("/dev/urandom", "rb");
+    if (f) {
+        if (fread(&r, sizeof r, 1, f) != 1) r = 0;
+        fclose(f);
+    }
+    r ^= mix64((uint64_t)time(NULL) ^ ((uint64_t)clock() << 32));
+    r ^= mix64((uint64_t)(uintptr_t)&r + ++counter * FNV_PRIME);
+    return mix64(r);
+}
+
+/*  Records the probe count of one hit.  How many hits run long depends
+ *  on load and layout (Robin Hood evens displacement out to the budget),
+ *  so each window is judged against a running baseline of earlier ones;
+ *  the first window after a rebuild only sets the baseline.  Fractions
+ *  are in 1/1024ths. */
+static void watch_probes(ElasticHashTable* t, size_t probes)
+{
+    if ((t->flags & (EHT_FLAG_SEEDED | EHT_FROZEN)) != EHT_FLAG_SEEDED)
+        return;
+    t->watch_long += probes >= EHT_LONG_PROBES;
+    if (++t->watch_ops < t->watch_window) return;
+
+    size_t frac = t->watch_long * 1024 / t->watch_ops;
+    if (!t->watch_primed) {
+        t->watch_base   = frac;
+        t->watch_primed = 1;
+    } else if (frac > 4 * t->watch_base + 32) {
+        t->reseed_pending = 1;
+    } else {
+        t->watch_base = (3 * t->watch_base + frac) / 4;
+    }
+    t->watch_ops  = 0;
+    t->watch_long = 0;
+}
+
+/*  Draws new level salts for the next rebuild and backs the watch off,
+ *  so a key set that defeats every seed costs a bounded number of
+ *  rebuilds rather than one per window. */
+static void reseed_levels(ElasticHashTable* t)
+{
+    t->level_seed     = random_seed();
+    t->reseed_pending = 0;
+    t->reseeds++;
+    if (t->watch_window < EHT_WATCH_MAX) t->watch_window *= 2;
+    t->watch_ops  = 0;
+    t->watch_long = 0;
+}
+
+/*  Wall-clock nanoseconds; C11 has no monotonic clock, so a step in
+ *  the clock during a rebuild can skew (never negate) one sample. */
+static uint64_t clock_ns(void)
+{
+    struct timespec ts;
+    if (timespec_get(&ts, TIME_UTC) != TIME_UTC) return 0;
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*  Adds one rebuild, begun at t0, to eht_rebuild_stats. */
+static void note_rebuild(ElasticHashTable* t, uint64_t t0)
+{
+    uint64_t now = clock_ns();
+    uint64_t ns  = now > t0 ? now - t0 : 0;
+    t->rebuilds++;
+    t->rebuild_ns += ns;
+    if (ns > t->rebuild_max_ns) t->rebuild_max_ns = ns;
+}
+
+/*  Capacity to rebuild at when an insert has run out of probe budget on
+ *  every level.  That is expected near max_load; well below it, the
+ *  probe sequences are colliding, and a seeded table retries under new
+ *  salts before it grows (at most once per doubling of its count). */
+static size_t exhausted_capacity(ElasticHashTable* t)
+{
+    if ((t->flags & EHT_FLAG_SEEDED) && t->count < t->total_capacity / 2
+            && t->count >= t->reseed_floor) {
+        reseed_levels(t);
+        t->reseed_floor = 2 * t->count + 1;
+        return t->total_capacity;
+    }
+    return t->total_capacity * 2;
+}
+
+/* ------------------------------------------------------------------ */
+/* Adaptive promotion: hits on a deep entry before it is moved up     */
+/* ------------------------------------------------------------------ */
+
+#define EHT_PROMOTE_HITS 8
+
+/* ------------------------------------------------------------------ */
+/* Occupancy bitmaps: scans over a level (iteration, rebuild, destroy) */
+/* skip 64 non-live slots per word instead of reading each tag.        */
+/* ------------------------------------------------------------------ */
+
+static unsigned ctz64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    unsigned n = 0;
+    while (!(x & 1)) { x >>= 1; ++n; }
+    return n;
+#endif
+}
+
+static void occ_set(uint64_t* bits, size_t i)
+{
+    bits[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+static void occ_clear(uint64_t* bits, size_t i)
+{
+    bits[i >> 6] &= ~((uint64_t)1 << (i & 63));
+}
+
+/*  First live slot at or after i, or capacity if there is none. */
+static size_t occ_next(const uint64_t* bits, size_t i, size_t capacity)
+{
+    if (i >= capacity) return capacity;
+    size_t   w     = i >> 6;
+    size_t   words = (capacity + 63) >> 6;
+    uint64_t m     = bits[w] & (~(uint64_t)0 << (i & 63));
+    while (!m) {
+        if (++w == words) return capacity;
+        m = bits[w];
+    }
+    return (w << 6) + ctz64(m);
+}
+
 /* ------------------------------------------------------------------ */
 /* SubArray helpers                                                    */
 /* ------------------------------------------------------------------ */
 
-static int subarray_init(SubArray* sa, int level, size_t capacity)
+static uint8_t slot_tag(uint64_t h)
+{
+    return (uint8_t)(TAG_LIVE | (h >> 57));
+}
+
+/*  sa must be zeroed (build_levels callocs the level array). */
+static int subarray_init(SubArray* sa, int level, size_t capacity,
+                         unsigned flags, uint64_t seed)
 {
     sa->level     = level;
+    sa->salt1     = ((uint64_t)level * UINT64_C(0x9E3779B97F4A7C15) + 0xA1) ^ seed;
+    sa->salt2     = ((uint64_t)level * UINT64_C(0x517CC1B727220A95) + 0xB2)
+                  ^ mix64(seed);
     sa->capacity  = capacity;
-    sa->count     = 0;
-    sa->tombstones = 0;
-    sa->slots     = (Slot*)calloc(capacity, sizeof(Slot));
-    if (!sa->slots) return -1;
-    /* calloc zeroes everything; SLOT_EMPTY == 0 */
+    sa->occupied  = (uint64_t*)calloc((capacity + 63) >> 6, sizeof(uint64_t));
+    if (!sa->occupied) return -1;
+    /* calloc zeroes everything; TAG_EMPTY == IDX_EMPTY == 0 */
+    if (flags & EHT_FROZEN) {
+        sa->slots = (CompactEntry*)malloc(capacity * sizeof(CompactEntry));
+        if (!sa->slots) return -1;
+        memset(sa->slots, 0xFF, capacity * sizeof(CompactEntry));
+        return 0;
+    }
+    if (flags & EHT_FLAG_ORDERED) {
+        sa->index = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+        return sa->index ? 0 : -1;
+    }
+    sa->tags   = (uint8_t*)calloc(capacity, 1);
+    sa->hashes = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    sa->refs   = (SlotRef*)calloc(capacity, sizeof(SlotRef));
+    if (!sa->tags || !sa->hashes || !sa->refs) return -1;
+    if (flags & EHT_FLAG_ROBIN_HOOD) {
+        sa->dist = (uint16_t*)calloc(capacity, sizeof(uint16_t));
+        if (!sa->dist) return -1;
+    }
+    if (flags & EHT_FLAG_ADAPTIVE) {
+        sa->hits = (uint16_t*)calloc(capacity, sizeof(uint16_t));
+        if (!sa->hits) return -1;
+    }
     return 0;
 }
 
-static void slot_free_data(Slot* s)
+static void subarray_destroy(SubArray* sa)
 {
-    free(s->key);
-    free(s->value);
-    s->key       = NULL;
-    s->value     = NULL;
-    s->value_len = 0;
+    if (sa->refs) {
+        for (size_t i = occ_next(sa->occupied, 0, sa->capacity);
+             i < sa->capacity;
+             i = occ_next(sa->occupied, i + 1, sa->capacity)) {
+            free(sa->refs[i].key);
+            free(sa->refs[i].value);
+        }
+    }
+    free(sa->index);        /* ordered layout: entries own the data */
+    free(sa->slots);        /* frozen: the table's arena does      */
+    free(sa->tags);
+    free(sa->hashes);
+    free(sa->refs);
+    free(sa->dist);
+    free(sa->hits);
+    free(sa->occupied);
+    memset(sa, 0, sizeof(*sa));
 }
 
-static void subarray_destroy(SubArray* sa)
+/* ------------------------------------------------------------------ */
+/* Tiny tables: up to EHT_TINY_MAX entries live in a flat array that  */
+/* is scanned by 32-bit hash tag, four tags per SSE2 compare.  The    */
+/* table moves to the level layout when it outgrows that.             */
+/* ------------------------------------------------------------------ */
+
+#define EHT_TINY_MAX   16
+#define EHT_TINY_LANES 4
+
+static uint32_t tiny_tag(uint64_t h) { return (uint32_t)(h >> 32); }
+
+static TinyTable* tiny_create(size_t capacity)
+{
+    capacity = (capacity + EHT_TINY_LANES - 1) & ~(size_t)(EHT_TINY_LANES - 1);
+    if (capacity == 0) capacity = EHT_TINY_LANES;
+
+    size_t per_entry = sizeof(char*) + sizeof(void*) + sizeof(size_t)
+                     + sizeof(uint32_t);
+    TinyTable* tt = (TinyTable*)calloc(1, sizeof(*tt) + capacity * per_entry);
+    if (!tt) return NULL;
+    tt->capacity   = capacity;
+    tt->keys       = (char**)(tt + 1);
+    tt->values     = (void**)(tt->keys + capacity);
+    tt->value_lens = (size_t*)(tt->values + capacity);
+    tt->tags       = (uint32_t*)(tt->value_lens + capacity);
+    return tt;
+}
+
+static void tiny_destroy(TinyTable* tt, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        free(tt->keys[i]);
+        free(tt->values[i]);
+    }
+    free(tt);
+}
+
+/*  Returns the entry index of key, or -1. */
+static int tiny_find(const TinyTable* tt, size_t count,
+                     const char* key, uint64_t h)
 {
-    if (!sa->slots) return;
-    for (size_t i = 0; i < sa->capacity; ++i) {
-        if (sa->slots[i].state == SLOT_OCCUPIED)
-            slot_free_data(&sa->slots[i]);
+    uint32_t tag = tiny_tag(h);
+#ifdef EHT_TINY_SSE2
+    __m128i needle = _mm_set1_epi32((int)tag);
+    for (size_t i = 0; i < count; i += EHT_TINY_LANES) {
+        __m128i  lanes = _mm_loadu_si128((const __m128i*)&tt->tags[i]);
+        unsigned m     = (unsigned)_mm_movemask_ps(
+                             _mm_castsi128_ps(_mm_cmpeq_epi32(lanes, needle)));
+        while (m) {
+            size_t j = i + (size_t)__builtin_ctz(m);
+            if (j < count && strcmp(tt->keys[j], key) == 0) return (int)j;
+            m &= m - 1;
+        }
     }
-    free(sa->slots);
-    sa->slots = NULL;
+#else
+    for (size_t i = 0; i < count; ++i)
+        if (tt->tags[i] == tag && strcmp(tt->keys[i], key) == 0)
+            return (int)i;
+#endif
+    return -1;
+}
+
+/*  Doubles the tiny array.  Returns -1 if it is already at EHT_TINY_MAX
+ *  (time to promote) or on allocation failure. */
+static int tiny_grow(ElasticHashTable* t)
+{
+    TinyTable* old = t->tiny;
+    if (old->capacity >= EHT_TINY_MAX) return -1;
+
+    TinyTable* tt = tiny_create(old->capacity * 2);
+    if (!tt) return -1;
+    memcpy(tt->keys,       old->keys,       t->count * sizeof(char*));
+    memcpy(tt->values,     old->values,     t->count * sizeof(void*));
+    memcpy(tt->value_lens, old->value_lens, t->count * sizeof(size_t));
+    memcpy(tt->tags,       old->tags,       t->count * sizeof(uint32_t));
+    free(old);
+    t->tiny           = tt;
+    t->total_capacity = tt->capacity;
+    return 0;
 }
 
 /* ------------------------------------------------------------------ */
@@ -144,22 +1043,40 @@ static int build_levels(ElasticHashTable* t, size_t capacity)
     }
     ++n_levels; /* final remainder level */
 
-    t->levels = (SubArray*)malloc(n_levels * sizeof(SubArray));
+    /* New salts or sizes: probe lengths need a fresh baseline */
+    t->watch_primed = 0;
+    t->watch_ops    = 0;
+    t->watch_long   = 0;
+
+    t->levels = (SubArray*)calloc(n_levels, sizeof(SubArray));
     if (!t->levels) return -1;
     t->num_levels = n_levels;
 
     remaining = capacity;
     for (size_t i = 0; i < n_levels - 1; ++i) {
         size_t sz = remaining / 2;
-        if (subarray_init(&t->levels[i], (int)i, sz) < 0) return -1;
+        if (subarray_init(&t->levels[i], (int)i, sz, t->flags,
+                          t->level_seed) < 0) return -1;
         remaining -= sz;
     }
     /* Last level gets the remainder */
     if (subarray_init(&t->levels[n_levels - 1],
-                       (int)(n_levels - 1), remaining) < 0)
+                       (int)(n_levels - 1), remaining, t->flags,
+                       t->level_seed) < 0)
         return -1;
 
-    return 0;
+    return build_hints(t, capacity);
+}
+
+static void destroy_levels(ElasticHashTable* t)
+{
+    for (size_t i = 0; i < t->num_levels; ++i)
+        subarray_destroy(&t->levels[i]);
+    free(t->levels);
+    free(t->hints);
+    t->levels     = NULL;
+    t->hints      = NULL;
+    t->num_levels = 0;
 }
 
 /* ------------------------------------------------------------------ */
@@ -168,7 +1085,23 @@ static int build_levels(ElasticHashTable* t, size_t capacity)
 
 ElasticHashTable* eht_create(size_t total_capacity)
 {
-    if (total_capacity < 64) total_capacity = 64;
+    return eht_create_ex(total_capacity, 0);
+}
+
+ElasticHashTable* eht_create_ex(size_t total_capacity, unsigned flags)
+{
+    return eht_create_with_hash(total_capacity, flags, EHT_HASH_FNV1A,
+                                NULL, NULL);
+}
+
+ElasticHashTable* eht_create_with_hash(size_t total_capacity, unsigned flags,
+                                       EHTHashKind kind,
+                                       EHTHashFn fn, void* ctx)
+{
+    if (kind == EHT_HASH_CUSTOM && !fn) return NULL;
+
+    int tiny = total_capacity <= EHT_TINY_MAX;
+    if (!tiny && total_capacity < 64) total_capacity = 64;
 
     ElasticHashTable* t = (ElasticHashTable*)calloc(1, sizeof(*t));
     if (!t) return NULL;
@@ -178,6 +1111,51 @@ ElasticHashTable* eht_create(size_t total_capacity)
     t->min_level_size  = 16;
     t->max_load        = 0.90;
     t->tombstone_ratio = 0.15;
+    t->flags           = flags;
+
+    if (flags & EHT_FLAG_SEEDED) {
+        /* FNV-1a takes no key, so a seeded table defaults to wyhash */
+        if (kind == EHT_HASH_FNV1A) kind = EHT_HASH_WYHASH;
+        t->key_seed     = random_seed();
+        t->level_seed   = random_seed();
+        t->watch_window = EHT_WATCH_WINDOW;
+    }
+
+    t->hash_kind = kind;
+    switch (kind) {
+    case EHT_HASH_WYHASH:
+        t->hash_fn  = wyhash;
+        t->hash_ctx = &t->key_seed;
+        break;
+    case EHT_HASH_CRC32C: t->hash_fn = crc32c_impl(); break;
+    case EHT_HASH_CUSTOM: t->hash_fn = fn; t->hash_ctx = ctx; break;
+    default:              break;
+    }
+
+    if (flags & EHT_FLAG_COMPACT)
+        t->flags |= EHT_FLAG_ORDERED;
+
+    if (t->flags & EHT_FLAG_ORDERED) {
+        /* Four-byte index slots carry no per-slot metadata */
+        t->flags &= ~(EHT_FLAG_ADAPTIVE | EHT_FLAG_ROBIN_HOOD);
+    }
+
+    if (flags & EHT_FLAG_INSERT_ONLY) {
+        /* No tombstones ever: promotion would create them, and the
+         * headroom kept for tombstone churn can go to live entries. */
+        t->flags   &= ~EHT_FLAG_ADAPTIVE;
+        t->max_load = 0.95;
+    }
+
+    if (tiny) {
+        t->tiny = tiny_create(total_capacity);
+        if (!t->tiny) {
+            free(t);
+            return NULL;
+        }
+        t->total_capacity = t->tiny->capacity;
+        return t;
+    }
 
     if (build_levels(t, total_capacity) < 0) {
         free(t);
@@ -186,12 +1164,21 @@ ElasticHashTable* eht_create(size_t total_capacity)
     return t;
 }
 
+static void mph_destroy(EHTStaticTable* p);   /* perfect-hash layout */
+
 void eht_destroy(ElasticHashTable* t)
 {
     if (!t) return;
-    for (size_t i = 0; i < t->num_levels; ++i)
-        subarray_destroy(&t->levels[i]);
-    free(t->levels);
+    destroy_levels(t);
+    if (t->tiny) tiny_destroy(t->tiny, t->count);
+    for (size_t i = 0; t->entries && i < t->n_entries; ++i) {
+        free(t->entries[i].key);
+        free(t->entries[i].value);
+    }
+    free(t->entries);
+    free(t->centries);
+    free(t->arena);
+    mph_destroy(t->perfect);
     free(t);
 }
 
@@ -201,224 +1188,1615 @@ void eht_destroy(ElasticHashTable* t)
 
 typedef struct { int level_idx; size_t slot_idx; } FindResult;
 
-static FindResult find_key(ElasticHashTable* t, const char* key)
+/*  Adaptive mode: move the entry at (li, idx) into the first free slot of
+ *  its probe sequence in a shallower level.  The vacated slot becomes a
+ *  tombstone so probe chains running through it stay intact. */
+static FindResult promote(ElasticHashTable* t, uint64_t h,
+                           size_t li, size_t idx)
 {
-    FindResult r = { -1, 0 };
-    for (size_t li = 0; li < t->num_levels; ++li) {
-        SubArray* sub = &t->levels[li];
+    SubArray*  src = &t->levels[li];
+    FindResult r   = { (int)li, idx };
+    int        rh  = (t->flags & EHT_FLAG_ROBIN_HOOD) != 0;
+
+    for (size_t lj = 0; lj < li; ++lj) {
+        SubArray* sub = &t->levels[lj];
+        size_t budget = probe_budget(sub);
+        uint64_t h1, h2;
+        dual_hash(h, sub, &h1, &h2);
+
+        for (size_t a = 0; a < budget; ++a) {
+            size_t  j   = probe_idx(h1, h2, a, sub->capacity);
+            uint8_t tag = sub->tags[j];
+            if (tag & TAG_LIVE) {
+                /* Robin Hood: going further would need displacement */
+                if (rh && sub->dist[j] < a) break;
+                continue;
+            }
+            if (tag == TAG_TOMBSTONE) {
+                if (rh && a < sub->dist[j]) continue;
+                sub->tombstones--;
+                t->tombstones--;
+            }
+            sub->tags[j]   = src->tags[idx];
+            sub->hashes[j] = h;
+            sub->refs[j]   = src->refs[idx];
+            sub->hits[j]   = 0;
+            if (rh) sub->dist[j] = (uint16_t)a;
+            sub->count++;
+            occ_set(sub->occupied, j);
+
+            memset(&src->refs[idx], 0, sizeof(SlotRef));
+            src->tags[idx] = TAG_TOMBSTONE;
+            occ_clear(src->occupied, idx);
+            src->count--;
+            src->tombstones++;
+            t->tombstones++;
+
+            r.level_idx = (int)lj;
+            r.slot_idx  = j;
+            return r;
+        }
+    }
+    /* No room above — start counting again rather than retry every hit */
+    src->hits[idx] = 0;
+    return r;
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry storage (ordered layout): heap-allocated Entry, or compact   */
+/* arena records addressed by 32-bit offsets.                         */
+/* ------------------------------------------------------------------ */
+
+static size_t varint_put(uint8_t* p, size_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static size_t varint_get(const uint8_t* p, size_t* v)
+{
+    size_t n = 0;
+    unsigned shift = 0;
+    *v = 0;
+    do {
+        *v |= (size_t)(p[n] & 0x7f) << shift;
+        shift += 7;
+    } while (p[n++] & 0x80);
+    return n;
+}
+
+typedef struct {
+    const char*    key;
+    const uint8_t* value;
+    size_t         value_len;
+    size_t         size;    /* whole record, headers included */
+} Record;
+
+static Record record_at(const uint8_t* arena, uint32_t ref)
+{
+    const uint8_t* p = arena + ref;
+    size_t klen, vlen;
+    size_t n = varint_get(p, &klen);
+    Record r;
+    r.key       = (const char*)p + n;
+    n          += klen + 1;
+    n          += varint_get(p + n, &vlen);
+    r.value     = p + n;
+    r.value_len = vlen;
+    r.size      = n + vlen;
+    return r;
+}
+
+static Record arena_record(const ElasticHashTable* t, uint32_t ref)
+{
+    return record_at(t->arena, ref);
+}
+
+/*  Appends a record and returns its offset, or REF_DEAD if the arena
+ *  cannot grow (allocation failure or the 4 GiB offset limit). */
+static uint32_t arena_append(ElasticHashTable* t, const char* key,
+                             const void* value, size_t value_len)
+{
+    size_t klen = strlen(key);
+    size_t need = 10 + klen + 1 + 10 + value_len;   /* varints ≤ 10 bytes */
+
+    if (t->arena_len + need > t->arena_cap) {
+        size_t cap = t->arena_cap ? t->arena_cap : 256;
+        while (cap < t->arena_len + need) cap *= 2;
+        if (cap > REF_DEAD) cap = REF_DEAD;
+        if (cap < t->arena_len + need) return REF_DEAD;
+
+        /* key or value may point into the arena (an eht_get result) */
+        uintptr_t lo = (uintptr_t)t->arena, hi = lo + t->arena_len;
+        uintptr_t kp = (uintptr_t)key, vp = (uintptr_t)value;
+        int    key_in  = lo && kp >= lo && kp < hi;
+        int    val_in  = lo && vp >= lo && vp < hi;
+        size_t key_off = (size_t)(kp - lo), val_off = (size_t)(vp - lo);
+
+        uint8_t* grown = (uint8_t*)realloc(t->arena, cap);
+        if (!grown) return REF_DEAD;
+        t->arena     = grown;
+        t->arena_cap = cap;
+        if (key_in) key   = (const char*)grown + key_off;
+        if (val_in) value = grown + val_off;
+    }
+
+    uint32_t ref = (uint32_t)t->arena_len;
+    uint8_t* p   = t->arena + ref;
+    size_t   n   = varint_put(p, klen);
+    memcpy(p + n, key, klen + 1);
+    n += klen + 1;
+    n += varint_put(p + n, value_len);
+    if (value_len) memcpy(p + n, value, value_len);
+    t->arena_len += n + value_len;
+    return ref;
+}
+
+static int ent_live(const ElasticHashTable* t, size_t e)
+{
+    if (t->flags & EHT_FLAG_COMPACT) return t->centries[e].ref != REF_DEAD;
+    return t->entries[e].key != NULL;
+}
+
+/*  The stored hash (or its high half, in compact mode) is compared
+ *  first, so probes past other keys rarely touch the key bytes. */
+static int ent_match(const ElasticHashTable* t, size_t e,
+                     const char* key, uint64_t h)
+{
+    if (t->flags & EHT_FLAG_COMPACT) {
+        const CompactEntry* c = &t->centries[e];
+        return c->tag == (uint32_t)(h >> 32)
+            && strcmp(arena_record(t, c->ref).key, key) == 0;
+    }
+    return t->entries[e].hash == h && strcmp(t->entries[e].key, key) == 0;
+}
+
+static uint64_t ent_hash(const ElasticHashTable* t, size_t e)
+{
+    if (t->flags & EHT_FLAG_COMPACT)
+        return key_hash(t, arena_record(t, t->centries[e].ref).key);
+    return t->entries[e].hash;
+}
+
+static void ent_get(const ElasticHashTable* t, size_t e, const char** key_out,
+                    const void** value_out, size_t* len_out)
+{
+    if (t->flags & EHT_FLAG_COMPACT) {
+        Record r = arena_record(t, t->centries[e].ref);
+        *key_out   = r.key;
+        *value_out = r.value;
+        *len_out   = r.value_len;
+        return;
+    }
+    *key_out   = t->entries[e].key;
+    *value_out = t->entries[e].value;
+    *len_out   = t->entries[e].value_len;
+}
+
+static void ent_kill(ElasticHashTable* t, size_t e)
+{
+    if (t->flags & EHT_FLAG_COMPACT) {
+        t->arena_dead += arena_record(t, t->centries[e].ref).size;
+        t->centries[e].ref = REF_DEAD;
+        return;
+    }
+    free(t->entries[e].key);
+    free(t->entries[e].value);
+    t->entries[e].key   = NULL;
+    t->entries[e].value = NULL;
+}
+
+/*  Makes room for one more entry in whichever entry array is in use. */
+static int ent_reserve(ElasticHashTable* t)
+{
+    if (t->n_entries < t->entries_cap) return 0;
+
+    size_t max = (size_t)UINT32_MAX - IDX_BASE;
+    size_t cap = t->entries_cap ? t->entries_cap * 2 : 16;
+    if (cap > max) cap = max;
+    if (cap <= t->n_entries) return -1;
+
+    if (t->flags & EHT_FLAG_COMPACT) {
+        CompactEntry* grown = (CompactEntry*)realloc(t->centries,
+                                                     cap * sizeof(CompactEntry));
+        if (!grown) return -1;
+        t->centries = grown;
+    } else {
+        Entry* grown = (Entry*)realloc(t->entries, cap * sizeof(Entry));
+        if (!grown) return -1;
+        t->entries = grown;
+    }
+    t->entries_cap = cap;
+    return 0;
+}
+
+/*  Drops deleted entries, keeping insertion order, and in compact mode
+ *  rewrites the arena with only the live records. */
+static int ent_compact(ElasticHashTable* t)
+{
+    size_t live = 0;
+    if (!(t->flags & EHT_FLAG_COMPACT)) {
+        for (size_t i = 0; i < t->n_entries; ++i)
+            if (t->entries[i].key) t->entries[live++] = t->entries[i];
+        t->n_entries = live;
+        return 0;
+    }
+
+    uint8_t* fresh = (uint8_t*)malloc(t->arena_len - t->arena_dead + 1);
+    if (!fresh) return -1;
+    size_t len = 0;
+    for (size_t i = 0; i < t->n_entries; ++i) {
+        CompactEntry c = t->centries[i];
+        if (c.ref == REF_DEAD) continue;
+        Record r = arena_record(t, c.ref);
+        memcpy(fresh + len, t->arena + c.ref, r.size);
+        c.ref = (uint32_t)len;
+        len  += r.size;
+        t->centries[live++] = c;
+    }
+    free(t->arena);
+    t->arena      = fresh;
+    t->arena_len  = len;
+    t->arena_cap  = len + 1;
+    t->arena_dead = 0;
+    t->n_entries  = live;
+    return 0;
+}
+
+static FindResult ord_find(ElasticHashTable* t, const char* key, uint64_t h)
+{
+    FindResult r = { -1, 0 };
+    size_t    probes = 0;
+    size_t    depth = t->hints[hint_idx(t, h)];
+    ProbeSeed seeds[EHT_PREFETCH_LEVELS];
+    int       pre   = prefetch_levels(t, h, depth, seeds);
+    for (size_t li = 0; li < depth; ++li) {
+        SubArray* sub = &t->levels[li];
         if (sub->count == 0) continue;
 
         size_t budget = probe_budget(sub);
         uint64_t h1, h2;
-        dual_hash(key, sub->level, &h1, &h2);
+        if (pre) { h1 = seeds[li].h1; h2 = seeds[li].h2; }
+        else     dual_hash(h, sub, &h1, &h2);
 
         for (size_t a = 0; a < budget; ++a) {
-            size_t idx = probe_idx(h1, h2, a, sub->capacity);
-            Slot*  s   = &sub->slots[idx];
+            size_t   idx = probe_idx(h1, h2, a, sub->capacity);
+            uint32_t v   = sub->index[idx];
+
+            ++probes;
+            if (v == IDX_EMPTY) break;
+            if (v == IDX_TOMBSTONE) continue;
+            if (ent_match(t, v - IDX_BASE, key, h)) {
+                r.level_idx = (int)li;
+                r.slot_idx  = idx;
+                watch_probes(t, probes);
+                return r;
+            }
+        }
+    }
+    return r;
+}
+
+static FindResult find_hashed(ElasticHashTable* t, const char* key, uint64_t h)
+{
+    if (t->flags & EHT_FLAG_ORDERED) return ord_find(t, key, h);
+
+    FindResult r = { -1, 0 };
+    size_t  probes = 0;
+    int     rh    = (t->flags & EHT_FLAG_ROBIN_HOOD) != 0;
+    uint8_t want  = slot_tag(h);
+    size_t  depth = t->hints[hint_idx(t, h)];
+    ProbeSeed seeds[EHT_PREFETCH_LEVELS];
+    int     pre   = prefetch_levels(t, h, depth, seeds);
+    for (size_t li = 0; li < depth; ++li) {
+        SubArray* sub = &t->levels[li];
+        if (sub->count == 0) continue;
 
-            if (s->state == SLOT_OCCUPIED && strcmp(s->key, key) == 0) {
+        size_t budget = probe_budget(sub);
+        uint64_t h1, h2;
+        if (pre) { h1 = seeds[li].h1; h2 = seeds[li].h2; }
+        else     dual_hash(h, sub, &h1, &h2);
+
+        for (size_t a = 0; a < budget; ++a) {
+            size_t  idx = probe_idx(h1, h2, a, sub->capacity);
+            uint8_t tag = sub->tags[idx];
+
+            ++probes;
+            if (tag == want && sub->hashes[idx] == h
+                    && strcmp(sub->refs[idx].key, key) == 0) {
                 r.level_idx = (int)li;
                 r.slot_idx  = idx;
+                watch_probes(t, probes);
+                if ((t->flags & EHT_FLAG_ADAPTIVE) && li > 0
+                        && ++sub->hits[idx] >= EHT_PROMOTE_HITS)
+                    r = promote(t, h, li, idx);
                 return r;
             }
-            if (s->state == SLOT_EMPTY)
+            if (tag == TAG_EMPTY)
                 break;  /* not at this level; try next */
+            if (rh && sub->dist[idx] < a)
+                break;  /* would have displaced this one */
         }
     }
     return r;
 }
 
+static FindResult find_key(ElasticHashTable* t, const char* key)
+{
+    return find_hashed(t, key, key_hash(t, key));
+}
+
+/* ------------------------------------------------------------------ */
+/* Ordered layout: place / rebuild / insert                           */
+/* ------------------------------------------------------------------ */
+
+/*  Stores entry e in the first free slot of its probe sequence.
+ *  Returns -1 when every level's budget is exhausted. */
+static int ord_place(ElasticHashTable* t, uint32_t e, uint64_t h)
+{
+    for (size_t li = 0; li < t->num_levels; ++li) {
+        SubArray* sub = &t->levels[li];
+        size_t budget = probe_budget(sub);
+        uint64_t h1, h2;
+        dual_hash(h, sub, &h1, &h2);
+
+        for (size_t a = 0; a < budget; ++a) {
+            size_t    idx = probe_idx(h1, h2, a, sub->capacity);
+            uint32_t* v   = &sub->index[idx];
+            if (*v >= IDX_BASE) continue;
+
+            if (*v == IDX_TOMBSTONE) {
+                sub->tombstones--;
+                t->tombstones--;
+            }
+            *v = e + IDX_BASE;
+            sub->count++;
+            occ_set(sub->occupied, idx);
+            raise_hint(t, h, li);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*  Drops deleted entries (keeping insertion order) and places the rest
+ *  in fresh levels, from their stored hashes where there are any. */
+static int ord_relevel(ElasticHashTable* t, size_t new_capacity)
+{
+    if (ent_compact(t) < 0) return -1;
+    size_t live = t->n_entries;
+
+    for (;;) {
+        destroy_levels(t);
+        t->tombstones     = 0;
+        t->total_capacity = new_capacity;
+        if (build_levels(t, new_capacity) < 0) return -1;
+
+        size_t i = 0;
+        while (i < live && ord_place(t, (uint32_t)i, ent_hash(t, i)) == 0)
+            ++i;
+        if (i == live) return 0;
+        /* ran out of budget — retry under new salts, or grow */
+        t->total_capacity = new_capacity;
+        new_capacity = exhausted_capacity(t);
+    }
+}
+
+static int ord_rebuild(ElasticHashTable* t, size_t new_capacity)
+{
+    uint64_t t0 = clock_ns();
+    int      rc = ord_relevel(t, new_capacity);
+    note_rebuild(t, t0);
+    return rc;
+}
+
+/*  Places the entry just appended at index n_entries - 1. */
+static int ord_place_new(ElasticHashTable* t, uint64_t h)
+{
+    t->count++;
+    if (ord_place(t, (uint32_t)(t->n_entries - 1), h) == 0) return 0;
+    /* All levels exhausted — grow; the rebuild places it as well */
+    return ord_rebuild(t, exhausted_capacity(t));
+}
+
+/*  Compact mode: copies key and value into the arena. */
+static int cmp_insert(ElasticHashTable* t, const char* key, uint64_t h,
+                      const void* value, size_t value_len)
+{
+    if (ent_reserve(t) < 0) return -1;
+    uint32_t ref = arena_append(t, key, value, value_len);
+    if (ref == REF_DEAD) return -1;
+
+    CompactEntry* c = &t->centries[t->n_entries++];
+    c->ref = ref;
+    c->tag = (uint32_t)(h >> 32);
+    return ord_place_new(t, h);
+}
+
+/*  Compact mode: values are immutable records, so an update appends a
+ *  fresh one and retires the old. */
+static int cmp_update(ElasticHashTable* t, size_t e,
+                      const void* value, size_t value_len)
+{
+    uint32_t old = t->centries[e].ref;
+    uint32_t ref = arena_append(t, arena_record(t, old).key, value, value_len);
+    if (ref == REF_DEAD) return -1;
+    t->arena_dead      += arena_record(t, old).size;
+    t->centries[e].ref  = ref;
+    return 0;
+}
+
+/*  Appends an entry, taking ownership of key/value (freed on failure). */
+static int ord_insert(ElasticHashTable* t, char* key, uint64_t h,
+                       void* value, size_t value_len)
+{
+    if (t->flags & EHT_FLAG_COMPACT) {
+        int rc = cmp_insert(t, key, h, value, value_len);
+        free(key); free(value);
+        return rc;
+    }
+    if (ent_reserve(t) < 0) {
+        free(key); free(value);
+        return -1;
+    }
+
+    Entry* e = &t->entries[t->n_entries++];
+    e->hash      = h;
+    e->key       = key;
+    e->value     = value;
+    e->value_len = value_len;
+    return ord_place_new(t, h);
+}
+
+static size_t ord_entry(const ElasticHashTable* t, FindResult fr)
+{
+    return t->levels[fr.level_idx].index[fr.slot_idx] - IDX_BASE;
+}
+
+/* ------------------------------------------------------------------ */
+/* Frozen layout (eht_freeze): every record sits in one arena in      */
+/* iteration order, and each level slot is an 8-byte {arena offset,   */
+/* hash tag} pair, so a probe reads one slot and only a tag match     */
+/* touches the arena.  Levels are left half empty (eight more bytes   */
+/* per key buys short probe runs), and each stops after the longest   */
+/* run any of its entries needed.                                     */
+/* ------------------------------------------------------------------ */
+
+#define EHT_FROZEN_SLOTS 2      /* slots per key; grown by 1/8 while
+                                   placement fails                  */
+
+static size_t varint_len(size_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) { v >>= 7; ++n; }
+    return n;
+}
+
+static uint32_t frz_find(const ElasticHashTable* t, const char* key, uint64_t h)
+{
+    uint32_t  tag   = (uint32_t)(h >> 32);
+    size_t    depth = t->hints[hint_idx(t, h)];
+    ProbeSeed seeds[EHT_PREFETCH_LEVELS];
+    int       pre   = prefetch_levels(t, h, depth, seeds);
+    for (size_t li = 0; li < depth; ++li) {
+        const SubArray* sub = &t->levels[li];
+        uint64_t h1, h2;
+        if (pre) { h1 = seeds[li].h1; h2 = seeds[li].h2; }
+        else     dual_hash(h, sub, &h1, &h2);
+
+        for (size_t a = 0; a < sub->bound; ++a) {
+            CompactEntry s = sub->slots[probe_idx(h1, h2, a, sub->capacity)];
+            if (s.ref == REF_DEAD) break;
+            if (s.tag == tag && strcmp(arena_record(t, s.ref).key, key) == 0)
+                return s.ref;
+        }
+    }
+    return REF_DEAD;
+}
+
+/*  As ord_place, for the frozen layout; also records the level bound. */
+static int frz_place(ElasticHashTable* t, uint32_t ref, uint64_t h)
+{
+    for (size_t li = 0; li < t->num_levels; ++li) {
+        SubArray* sub = &t->levels[li];
+        size_t budget = probe_budget(sub);
+        uint64_t h1, h2;
+        dual_hash(h, sub, &h1, &h2);
+
+        for (size_t a = 0; a < budget; ++a) {
+            size_t        idx = probe_idx(h1, h2, a, sub->capacity);
+            CompactEntry* s   = &sub->slots[idx];
+            if (s->ref != REF_DEAD) continue;
+
+            s->ref = ref;
+            s->tag = (uint32_t)(h >> 32);
+            if (a >= sub->bound) sub->bound = a + 1;
+            sub->count++;
+            occ_set(sub->occupied, idx);
+            raise_hint(t, h, li);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Perfect-hash layout (eht_freeze_perfect), after PTHash: keys fall  */
+/* into buckets, 60% of them into the first 30% of buckets, and the   */
+/* buckets are placed largest first.  Each gets the smallest pilot    */
+/* that sends all of its keys to distinct free positions in [0, m),   */
+/* m ≈ n / 0.99; the few keys placed at n or above are remapped into  */
+/* the holes left below n.  A lookup hashes once, reads one pilot    */
+/* and one position, and compares one key.                            */
+/* ------------------------------------------------------------------ */
+
+#define MPH_KEYS_PER_BUCKET 6     /* 16-bit pilots: ~2.7 bits per key */
+#define MPH_PILOT_ESCAPE    UINT16_MAX
+#define MPH_MAX_PILOT       (1u << 24)  /* per bucket, before a new seed */
+#define MPH_SEEDS           8
+
+/*  x scaled into [0, range) by a multiply instead of a division */
+static size_t fastrange(uint64_t x, size_t range)
+{
+    uint64_t r = range;
+    mul128(&x, &r);
+    return (size_t)r;
+}
+
+static size_t mph_bucket(const EHTStaticTable* p, uint64_t h)
+{
+    uint64_t x = mix64(h ^ p->seed);
+    if ((x & 0xFFFF) < 39322)           /* 60% of 65536 */
+        return fastrange(x, p->dense);
+    return p->dense + fastrange(x, p->buckets - p->dense);
+}
+
+static size_t mph_pos(const EHTStaticTable* p, uint64_t h, uint64_t pilot)
+{
+    return fastrange(mix64(h ^ ~p->seed ^ ((pilot + 1) * FNV_PRIME)), p->m);
+}
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t mph_pilot(const EHTStaticTable* p, size_t b)
+{
+    uint64_t pilot = p->pilots[b];
+    if (pilot != MPH_PILOT_ESCAPE) return pilot;
+    size_t lo = 0, hi = p->n_big;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if ((p->big[mid] >> 32) < b) lo = mid + 1;
+        else                         hi = mid;
+    }
+    return (uint32_t)p->big[lo];
+}
+
+static void mph_destroy(EHTStaticTable* p)
+{
+    if (!p) return;
+    free((void*)p->pilots);
+    free((void*)p->big);
+    free((void*)p->remap);
+    free((void*)p->refs);
+    free(p);
+}
+
+static int bit_get(const uint64_t* bits, size_t i)
+{
+    return (int)((bits[i >> 6] >> (i & 63)) & 1);
+}
+
+/*  Builds the index for n keys with distinct hashes, refs[i] being the
+ *  record of the key hashed to hashes[i].  Returns NULL on allocation
+ *  failure or when some bucket finds no pilot under this seed. */
+static EHTStaticTable* mph_build(const uint32_t* refs, const uint64_t* hashes,
+                               size_t n, uint64_t seed)
+{
+    EHTStaticTable* p = (EHTStaticTable*)calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    p->seed    = seed;
+    p->n       = n;
+    p->m       = n + n / 99 + 1;
+    p->buckets = n / MPH_KEYS_PER_BUCKET + 2;
+    p->dense   = p->buckets * 3 / 10 + 1;
+
+    size_t    nb     = p->buckets;
+    size_t*   start  = (size_t*)calloc(nb + 1, sizeof(size_t));
+    size_t*   member = (size_t*)malloc((n + 1) * sizeof(size_t));
+    uint32_t* bof    = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    size_t*   order  = (size_t*)malloc(nb * sizeof(size_t));
+    uint64_t* taken  = (uint64_t*)calloc((p->m + 63) >> 6, sizeof(uint64_t));
+    size_t*   pos    = (size_t*)malloc((n + 1) * sizeof(size_t));
+    uint16_t* pilots = (uint16_t*)malloc(nb * sizeof(uint16_t));
+    uint32_t* prefs  = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    uint32_t* remap  = (uint32_t*)calloc(p->m - n, sizeof(uint32_t));
+    uint64_t* big    = NULL;
+    p->pilots = pilots;
+    p->refs   = prefs;
+    p->remap  = remap;
+    int ok = start && member && bof && order && taken && pos
+          && pilots && prefs && remap;
+
+    size_t max_size = 0;
+    if (ok) {
+        /* Group keys by bucket (counting sort) */
+        for (size_t i = 0; i < n; ++i) {
+            bof[i] = (uint32_t)mph_bucket(p, hashes[i]);
+            start[bof[i] + 1]++;
+        }
+        for (size_t b = 0; b < nb; ++b) {
+            if (start[b + 1] > max_size) max_size = start[b + 1];
+            start[b + 1] += start[b];
+        }
+        for (size_t i = 0; i < n; ++i) member[start[bof[i]]++] = i;
+        for (size_t b = nb; b > 0; --b) start[b] = start[b - 1];
+        start[0] = 0;
+
+        /* Buckets by size, largest first (counting sort again) */
+        size_t* cnt = (size_t*)calloc(max_size + 2, sizeof(size_t));
+        ok = cnt != NULL;
+        if (ok) {
+            for (size_t b = 0; b < nb; ++b) cnt[max_size - (start[b + 1] - start[b]) + 1]++;
+            for (size_t s = 0; s <= max_size; ++s) cnt[s + 1] += cnt[s];
+            for (size_t b = 0; b < nb; ++b)
+                order[cnt[max_size - (start[b + 1] - start[b])]++] = b;
+            free(cnt);
+        }
+    }
+
+    /* Pilot search */
+    for (size_t o = 0; ok && o < nb; ++o) {
+        size_t b = order[o], lo = start[b], sz = start[b + 1] - lo;
+        if (sz == 0) { pilots[b] = 0; continue; }
+
+        uint64_t pilot = 0;
+        for (;; ++pilot) {
+            if (pilot == MPH_MAX_PILOT) { ok = 0; break; }
+            size_t j = 0;
+            for (; j < sz; ++j) {
+                size_t q = mph_pos(p, hashes[member[lo + j]], pilot);
+                if (bit_get(taken, q)) break;
+                occ_set(taken, q);
+                pos[member[lo + j]] = q;
+            }
+            if (j == sz) break;
+            while (j-- > 0) occ_clear(taken, pos[member[lo + j]]);
+        }
+        if (!ok) break;
+
+        if (pilot >= MPH_PILOT_ESCAPE) {
+            uint64_t* grown = (uint64_t*)realloc(big,
+                                                 (p->n_big + 1) * sizeof(uint64_t));
+            if (!grown) { ok = 0; break; }
+            p->big = big = grown;
+            big[p->n_big++] = ((uint64_t)b << 32) | pilot;
+            pilots[b] = MPH_PILOT_ESCAPE;
+        } else {
+            pilots[b] = (uint16_t)pilot;
+        }
+    }
+
+    if (ok) {
+        if (p->n_big) qsort(big, p->n_big, sizeof(uint64_t), cmp_u64);
+
+        /* Positions at n and above take the holes below n, in order */
+        size_t hole = 0;
+        for (size_t q = n; q < p->m; ++q) {
+            if (!bit_get(taken, q)) continue;
+            while (bit_get(taken, hole)) ++hole;
+            remap[q - n] = (uint32_t)hole++;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            size_t q = pos[i];
+            if (q >= n) q = remap[q - n];
+            prefs[q] = refs[i];
+        }
+    }
+
+    free(start); free(member); free(bof); free(order); free(taken); free(pos);
+    if (!ok) { mph_destroy(p); return NULL; }
+    return p;
+}
+
+static uint32_t mph_find(const EHTStaticTable* p, const char* key, uint64_t h)
+{
+    if (p->n == 0) return REF_DEAD;
+    size_t q = mph_pos(p, h, mph_pilot(p, mph_bucket(p, h)));
+    if (q >= p->n) q = p->remap[q - p->n];
+    uint32_t ref = p->refs[q];
+    return strcmp(record_at(p->arena, ref).key, key) == 0 ? ref : REF_DEAD;
+}
+
+/*  The frozen layouts' lookup: arena offset of key's record, or
+ *  REF_DEAD. */
+static uint32_t frozen_find(const ElasticHashTable* t, const char* key,
+                            uint64_t h)
+{
+    return t->perfect ? mph_find(t->perfect, key, h) : frz_find(t, key, h);
+}
+
 /* ------------------------------------------------------------------ */
 /* Internal: insert taking ownership of key/value pointers            */
 /* ------------------------------------------------------------------ */
 
-static int insert_owned(ElasticHashTable* t,
-                         char* key, void* value, size_t value_len);
+static int insert_owned(ElasticHashTable* t, char* key, uint64_t h,
+                         void* value, size_t value_len);
 
 /* Forward-declared rebuild */
 static int rebuild(ElasticHashTable* t, size_t new_capacity);
 
-static int insert_owned(ElasticHashTable* t,
-                         char* key, void* value, size_t value_len)
+static int insert_owned(ElasticHashTable* t, char* key, uint64_t h,
+                         void* value, size_t value_len)
 {
+    if (t->flags & EHT_FLAG_ORDERED)
+        return ord_insert(t, key, h, value, value_len);
+
+    SlotRef  carry      = { key, value, value_len };
+    uint16_t carry_hits = 0;
+    int      rh         = (t->flags & EHT_FLAG_ROBIN_HOOD) != 0;
+    int      adaptive   = (t->flags & EHT_FLAG_ADAPTIVE) != 0;
+
     for (size_t li = 0; li < t->num_levels; ++li) {
         SubArray* sub = &t->levels[li];
         size_t budget = probe_budget(sub);
         uint64_t h1, h2;
-        dual_hash(key, sub->level, &h1, &h2);
+        dual_hash(h, sub, &h1, &h2);
+
+        for (size_t a = 0; a < budget; ++a) {
+            size_t  idx = probe_idx(h1, h2, a, sub->capacity);
+            uint8_t tag = sub->tags[idx];
+
+            if (tag & TAG_LIVE) {
+                if (!rh || sub->dist[idx] >= a) continue;
+
+                /* Robin Hood: the resident is nearer its first probe than
+                 * we are — take its slot and carry it on from its own
+                 * next probe position. */
+                SlotRef  ev_ref  = sub->refs[idx];
+                uint64_t ev_hash = sub->hashes[idx];
+                size_t   ev_dist = sub->dist[idx];
+                uint16_t ev_hits = adaptive ? sub->hits[idx] : 0;
+                sub->tags[idx]   = slot_tag(h);
+                sub->hashes[idx] = h;
+                sub->refs[idx]   = carry;
+                sub->dist[idx]   = (uint16_t)a;
+                if (adaptive) sub->hits[idx] = carry_hits;
+                raise_hint(t, h, li);
+
+                carry      = ev_ref;
+                carry_hits = ev_hits;
+                h          = ev_hash;
+                dual_hash(h, sub, &h1, &h2);
+                a          = ev_dist;
+                continue;
+            }
+            if (tag == TAG_TOMBSTONE) {
+                /* A tombstone keeps its old distance; filling it from
+                 * nearer in would break the cut-off for keys behind it. */
+                if (rh && a < sub->dist[idx]) continue;
+                sub->tombstones--;
+                t->tombstones--;
+            }
+
+            sub->tags[idx]   = slot_tag(h);
+            sub->hashes[idx] = h;
+            sub->refs[idx]   = carry;
+            if (rh)       sub->dist[idx] = (uint16_t)a;
+            if (adaptive) sub->hits[idx] = carry_hits;
+            sub->count++;
+            t->count++;
+            occ_set(sub->occupied, idx);
+            raise_hint(t, h, li);
+            return 0;
+        }
+    }
+    /* All levels exhausted — grow and retry */
+    if (rebuild(t, exhausted_capacity(t)) < 0) return -1;
+    return insert_owned(t, carry.key, h, carry.value, carry.value_len);
+}
+
+/* ------------------------------------------------------------------ */
+/* Rebuild / resize                                                   */
+/* ------------------------------------------------------------------ */
+
+static int plain_rebuild(ElasticHashTable* t, size_t new_capacity)
+{
+    /* 1. Collect live entries (steal pointers; hashes are kept) */
+    size_t    old_count = t->count;
+    size_t    alloc     = old_count ? old_count : 1;   /* malloc(0) may be NULL */
+    SlotRef*  refs      = (SlotRef*)malloc(alloc * sizeof(SlotRef));
+    uint64_t* hashes    = (uint64_t*)malloc(alloc * sizeof(uint64_t));
+    if (!refs || !hashes) {
+        free(refs); free(hashes);
+        return -1;
+    }
+
+    size_t ci = 0;
+    for (size_t li = 0; li < t->num_levels; ++li) {
+        SubArray* sub = &t->levels[li];
+        for (size_t si = occ_next(sub->occupied, 0, sub->capacity);
+             si < sub->capacity;
+             si = occ_next(sub->occupied, si + 1, sub->capacity)) {
+            refs[ci]   = sub->refs[si];
+            hashes[ci] = sub->hashes[si];
+            memset(&sub->refs[si], 0, sizeof(SlotRef));  /* no double-free */
+            ++ci;
+        }
+    }
+
+    /* 2. Destroy old levels */
+    destroy_levels(t);
+    t->count      = 0;
+    t->tombstones = 0;
+
+    /* 3. Build new levels */
+    t->total_capacity = new_capacity;
+    if (build_levels(t, new_capacity) < 0) {
+        /* catastrophic — free collected entries */
+        for (size_t i = 0; i < ci; ++i) { free(refs[i].key); free(refs[i].value); }
+        free(refs); free(hashes);
+        return -1;
+    }
+
+    /* 4. Re-insert (ownership transfer — no copies, no rehashing) */
+    for (size_t i = 0; i < ci; ++i)
+        insert_owned(t, refs[i].key, hashes[i], refs[i].value, refs[i].value_len);
+
+    free(refs);
+    free(hashes);
+    return 0;
+}
+
+static int rebuild(ElasticHashTable* t, size_t new_capacity)
+{
+    if (t->flags & EHT_FLAG_ORDERED)
+        return ord_rebuild(t, new_capacity);
+
+    uint64_t t0 = clock_ns();
+    int      rc = plain_rebuild(t, new_capacity);
+    note_rebuild(t, t0);
+    return rc;
+}
+
+/*  Moves a full tiny table onto freshly built levels. */
+static int tiny_promote(ElasticHashTable* t)
+{
+    TinyTable* tt = t->tiny;
+    size_t     n  = t->count;
+
+    if (build_levels(t, 4 * EHT_TINY_MAX) < 0) return -1;
+    t->total_capacity = 4 * EHT_TINY_MAX;
+    t->tiny  = NULL;
+    t->count = 0;
+    for (size_t i = 0; i < n; ++i)
+        insert_owned(t, tt->keys[i], key_hash(t, tt->keys[i]),
+                     tt->values[i], tt->value_lens[i]);
+    free(tt);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Public: insert                                                     */
+/* ------------------------------------------------------------------ */
+
+static int replace_value(void** value_slot, size_t* len_slot,
+                         const void* value, size_t value_len)
+{
+    void* new_val = malloc(value_len);
+    if (!new_val && value_len > 0) return -1;
+    memcpy(new_val, value, value_len);
+    free(*value_slot);
+    *value_slot = new_val;
+    *len_slot   = value_len;
+    return 0;
+}
+
+/*  Check load / tombstones / dead arena bytes → rebuild if needed.  A
+ *  grow also purges tombstones, so at most one rebuild is needed. */
+static int make_room(ElasticHashTable* t)
+{
+    if (t->reseed_pending && t->levels) {
+        /* Lookups have been running long: rebuild under new salts now,
+         * while no pointer from eht_get can be outstanding. */
+        reseed_levels(t);
+        if (t->count < (size_t)(t->total_capacity * t->max_load))
+            return rebuild(t, t->total_capacity);
+    }
+    if (t->count >= (size_t)(t->total_capacity * t->max_load))
+        return rebuild(t, t->total_capacity * 2);
+    if (!(t->flags & EHT_FLAG_INSERT_ONLY)
+            && t->tombstones >= (size_t)(t->total_capacity * t->tombstone_ratio))
+        return rebuild(t, t->total_capacity);
+    if (t->arena_dead > 4096 && t->arena_dead > t->arena_len / 2)
+        return rebuild(t, t->total_capacity);
+    return 0;
+}
+
+static int insert_hashed(ElasticHashTable* t, const char* key, uint64_t h,
+                         const void* value, size_t value_len)
+{
+    if (t->flags & EHT_FROZEN) return -1;
+
+    /* Update-in-place if already present */
+    if (t->tiny) {
+        TinyTable* tt = t->tiny;
+        int i = tiny_find(tt, t->count, key, h);
+        if (i >= 0)
+            return replace_value(&tt->values[i], &tt->value_lens[i],
+                                 value, value_len);
+    } else {
+        FindResult fr = find_hashed(t, key, h);
+        if (fr.level_idx >= 0 && (t->flags & EHT_FLAG_COMPACT))
+            return cmp_update(t, ord_entry(t, fr), value, value_len);
+        if (fr.level_idx >= 0 && (t->flags & EHT_FLAG_ORDERED)) {
+            Entry* e = &t->entries[ord_entry(t, fr)];
+            return replace_value(&e->value, &e->value_len, value, value_len);
+        }
+        if (fr.level_idx >= 0) {
+            SlotRef* s = &t->levels[fr.level_idx].refs[fr.slot_idx];
+            return replace_value(&s->value, &s->value_len, value, value_len);
+        }
+    }
+
+    if ((t->flags & EHT_FLAG_COMPACT) && !t->tiny) {
+        if (make_room(t) < 0) return -1;
+        return cmp_insert(t, key, h, value, value_len);
+    }
+
+    /* Copy key and value; both paths below take ownership */
+    size_t klen = strlen(key) + 1;
+    char*  kdup = (char*)malloc(klen);
+    void*  vdup = malloc(value_len);
+    if (!kdup || (!vdup && value_len > 0)) {
+        free(kdup); free(vdup);
+        return -1;
+    }
+    memcpy(kdup, key, klen);
+    memcpy(vdup, value, value_len);
+
+    if (t->tiny) {
+        if (t->count < t->tiny->capacity || tiny_grow(t) == 0) {
+            TinyTable* tt = t->tiny;
+            size_t     i  = t->count++;
+            tt->keys[i]       = kdup;
+            tt->values[i]     = vdup;
+            tt->value_lens[i] = value_len;
+            tt->tags[i]       = tiny_tag(h);
+            return 0;
+        }
+        if (tiny_promote(t) < 0) {
+            free(kdup); free(vdup);
+            return -1;
+        }
+    }
+
+    if (make_room(t) < 0) {
+        free(kdup); free(vdup);
+        return -1;
+    }
+
+    return insert_owned(t, kdup, h, vdup, value_len);
+}
+
+int eht_insert(ElasticHashTable* t,
+               const char* key,
+               const void* value, size_t value_len)
+{
+    return insert_hashed(t, key, key_hash(t, key), value, value_len);
+}
+
+int eht_insert_with_hash(ElasticHashTable* t,
+                         const char* key, uint64_t hash,
+                         const void* value, size_t value_len)
+{
+    return insert_hashed(t, key, hash, value, value_len);
+}
+
+int eht_reserve(ElasticHashTable* t, size_t n)
+{
+    if (t->flags & EHT_FROZEN) return -1;
+    if (t->tiny) {
+        if (n <= EHT_TINY_MAX) return 0;
+        if (tiny_promote(t) < 0) return -1;
+    }
+    /* make_room grows once count reaches capacity * max_load */
+    size_t cap = (size_t)((double)n / t->max_load) + 1;
+    if (cap <= t->total_capacity) return 0;
+    return rebuild(t, cap);
+}
+
+/* ------------------------------------------------------------------ */
+/* Public: get                                                        */
+/* ------------------------------------------------------------------ */
+
+static int get_hashed(ElasticHashTable* t, const char* key, uint64_t h,
+                      const void** value_out, size_t* len_out)
+{
+    if (t->tiny) {
+        int i = tiny_find(t->tiny, t->count, key, h);
+        if (i < 0) return 0;
+        *value_out = t->tiny->values[i];
+        *len_out   = t->tiny->value_lens[i];
+        return 1;
+    }
+
+    if (t->flags & EHT_FROZEN) {
+        uint32_t ref = frozen_find(t, key, h);
+        if (ref == REF_DEAD) return 0;
+        Record r = arena_record(t, ref);
+        *value_out = r.value;
+        *len_out   = r.value_len;
+        return 1;
+    }
+
+    FindResult fr = find_hashed(t, key, h);
+    if (fr.level_idx < 0) return 0;
+
+    if (t->flags & EHT_FLAG_ORDERED) {
+        const char* k;
+        ent_get(t, ord_entry(t, fr), &k, value_out, len_out);
+        return 1;
+    }
+
+    const SlotRef* s = &t->levels[fr.level_idx].refs[fr.slot_idx];
+    *value_out = s->value;
+    *len_out   = s->value_len;
+    return 1;
+}
+
+int eht_get(ElasticHashTable* t,
+            const char* key,
+            const void** value_out, size_t* len_out)
+{
+    return get_hashed(t, key, key_hash(t, key), value_out, len_out);
+}
+
+int eht_get_with_hash(ElasticHashTable* t,
+                      const char* key, uint64_t hash,
+                      const void** value_out, size_t* len_out)
+{
+    return get_hashed(t, key, hash, value_out, len_out);
+}
+
+/* ------------------------------------------------------------------ */
+/* Public: precomputed hashes                                         */
+/* ------------------------------------------------------------------ */
+
+uint64_t eht_hash(const char* key)
+{
+    return fnv1a(key);
+}
+
+uint64_t eht_table_hash(const ElasticHashTable* t, const char* key)
+{
+    return key_hash(t, key);
+}
+
+/* ------------------------------------------------------------------ */
+/* Public: pipelined lookups                                          */
+/* ------------------------------------------------------------------ */
+
+static void prefetch_key(const ElasticHashTable* t, uint64_t h)
+{
+    if (t->tiny) {
+        EHT_PREFETCH(t->tiny->tags);
+        return;
+    }
+    if (t->perfect) {
+        /* The position depends on the pilot, so only it can go early */
+        EHT_PREFETCH(&t->perfect->pilots[mph_bucket(t->perfect, h)]);
+        return;
+    }
+
+    ProbeSeed seeds[EHT_PREFETCH_LEVELS];
+    size_t    depth = t->hints[hint_idx(t, h)];
+    if (depth > EHT_PREFETCH_LEVELS) depth = EHT_PREFETCH_LEVELS;
+    prefetch_probes(t, h, depth, seeds);
+}
+
+uint64_t eht_prefetch(const ElasticHashTable* t, const char* key)
+{
+    uint64_t h = key_hash(t, key);
+    prefetch_key(t, h);
+    return h;
+}
+
+int eht_get_hashed(ElasticHashTable* t,
+                   const char* key, uint64_t token,
+                   const void** value_out, size_t* len_out)
+{
+    return get_hashed(t, key, token, value_out, len_out);
+}
+
+/* ------------------------------------------------------------------ */
+/* Public: batch operations                                           */
+/* ------------------------------------------------------------------ */
+
+#define EHT_BATCH 16    /* keys hashed (and prefetched) per block */
+
+void eht_hash_many(const char* const* keys, size_t n, uint64_t* hashes_out)
+{
+    hash_many(keys, n, hashes_out);
+}
+
+static void table_hash_many(const ElasticHashTable* t,
+                            const char* const* keys, size_t n, uint64_t* out)
+{
+    if (!t->hash_fn) {
+        hash_many(keys, n, out);
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) out[i] = key_hash(t, keys[i]);
+}
+
+size_t eht_get_many(ElasticHashTable* t,
+                    const char* const* keys, size_t n,
+                    const void** values_out, size_t* lens_out,
+                    int* found_out)
+{
+    uint64_t h[EHT_BATCH];
+    size_t   found = 0;
+    for (size_t b = 0; b < n; b += EHT_BATCH) {
+        size_t m = n - b < EHT_BATCH ? n - b : EHT_BATCH;
+        table_hash_many(t, keys + b, m, h);
+        if (t->flags & EHT_FLAG_PREFETCH)
+            for (size_t i = 0; i < m; ++i) prefetch_key(t, h[i]);
+        for (size_t i = 0; i < m; ++i) {
+            int f = get_hashed(t, keys[b + i], h[i],
+                               &values_out[b + i], &lens_out[b + i]);
+            if (!f) {
+                values_out[b + i] = NULL;
+                lens_out[b + i]   = 0;
+            }
+            found_out[b + i] = f;
+            found += (size_t)f;
+        }
+    }
+    return found;
+}
+
+int eht_insert_many(ElasticHashTable* t,
+                    const char* const* keys, size_t n,
+                    const void* const* values, const size_t* value_lens)
+{
+    uint64_t h[EHT_BATCH];
+    for (size_t b = 0; b < n; b += EHT_BATCH) {
+        size_t m = n - b < EHT_BATCH ? n - b : EHT_BATCH;
+        table_hash_many(t, keys + b, m, h);
+        for (size_t i = 0; i < m; ++i)
+            if (insert_hashed(t, keys[b + i], h[i],
+                              values[b + i], value_lens[b + i]) < 0)
+                return -1;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Public: delete                                                     */
+/* ------------------------------------------------------------------ */
+
+static int delete_hashed(ElasticHashTable* t, const char* key, uint64_t h)
+{
+    if (t->flags & (EHT_FLAG_INSERT_ONLY | EHT_FROZEN)) return -1;
+
+    if (t->tiny) {
+        TinyTable* tt = t->tiny;
+        int i = tiny_find(tt, t->count, key, h);
+        if (i < 0) return 0;
+        free(tt->keys[i]);
+        free(tt->values[i]);
+        size_t last = --t->count;
+        if (t->flags & EHT_FLAG_ORDERED) {
+            /* Close the gap so insertion order survives */
+            size_t n = last - (size_t)i;
+            memmove(&tt->keys[i],       &tt->keys[i + 1],       n * sizeof(char*));
+            memmove(&tt->values[i],     &tt->values[i + 1],     n * sizeof(void*));
+            memmove(&tt->value_lens[i], &tt->value_lens[i + 1], n * sizeof(size_t));
+            memmove(&tt->tags[i],       &tt->tags[i + 1],       n * sizeof(uint32_t));
+            return 1;
+        }
+        /* Swap-remove: move the last entry into the hole */
+        tt->keys[i]       = tt->keys[last];
+        tt->values[i]     = tt->values[last];
+        tt->value_lens[i] = tt->value_lens[last];
+        tt->tags[i]       = tt->tags[last];
+        return 1;
+    }
+
+    FindResult fr = find_hashed(t, key, h);
+    if (fr.level_idx < 0) return 0;
+
+    SubArray* sub = &t->levels[fr.level_idx];
+    if (t->flags & EHT_FLAG_ORDERED) {
+        ent_kill(t, ord_entry(t, fr));
+        sub->index[fr.slot_idx] = IDX_TOMBSTONE;
+        occ_clear(sub->occupied, fr.slot_idx);
+        sub->count--;
+        sub->tombstones++;
+        t->tombstones++;
+        t->count--;
+        return 1;
+    }
+
+    SlotRef*  s   = &sub->refs[fr.slot_idx];
+    free(s->key);
+    free(s->value);
+    memset(s, 0, sizeof(*s));
+    sub->tags[fr.slot_idx] = TAG_TOMBSTONE;
+    occ_clear(sub->occupied, fr.slot_idx);
+    sub->count--;
+    sub->tombstones++;
+    t->tombstones++;
+    t->count--;
+    return 1;
+}
+
+int eht_delete(ElasticHashTable* t, const char* key)
+{
+    return delete_hashed(t, key, key_hash(t, key));
+}
+
+int eht_delete_with_hash(ElasticHashTable* t, const char* key, uint64_t hash)
+{
+    return delete_hashed(t, key, hash);
+}
+
+/* ------------------------------------------------------------------ */
+/* Public: contains                                                   */
+/* ------------------------------------------------------------------ */
 
-        for (size_t a = 0; a < budget; ++a) {
-            size_t idx = probe_idx(h1, h2, a, sub->capacity);
-            Slot*  s   = &sub->slots[idx];
-
-            if (s->state == SLOT_EMPTY || s->state == SLOT_TOMBSTONE) {
-                if (s->state == SLOT_TOMBSTONE)
-                    sub->tombstones--;
-
-                s->key       = key;
-                s->value     = value;
-                s->value_len = value_len;
-                s->state     = SLOT_OCCUPIED;
-                sub->count++;
-                t->count++;
-                return 0;
-            }
-        }
-    }
-    /* All levels exhausted — grow and retry */
-    if (rebuild(t, t->total_capacity * 2) < 0) return -1;
-    return insert_owned(t, key, value, value_len);
+int eht_contains(ElasticHashTable* t, const char* key)
+{
+    if (t->tiny)
+        return tiny_find(t->tiny, t->count, key, key_hash(t, key)) >= 0 ? 1 : 0;
+    if (t->flags & EHT_FROZEN)
+        return frozen_find(t, key, key_hash(t, key)) != REF_DEAD ? 1 : 0;
+    return find_key(t, key).level_idx >= 0 ? 1 : 0;
 }
 
 /* ------------------------------------------------------------------ */
-/* Rebuild / resize                                                   */
+/* Public: freeze                                                     */
 /* ------------------------------------------------------------------ */
 
-static int rebuild(ElasticHashTable* t, size_t new_capacity)
+/*  Calls fn for every live entry with its stored (or, in compact mode,
+ *  recomputed) hash, in iteration order. */
+static void for_each_entry(const ElasticHashTable* t,
+                           void (*fn)(void* ctx, const char* key, uint64_t h,
+                                      const void* value, size_t value_len),
+                           void* ctx)
 {
-    /* 1. Collect live entries (steal pointers) */
-    size_t      old_count  = t->count;
-    char**      keys       = (char**)malloc(old_count * sizeof(char*));
-    void**      vals       = (void**)malloc(old_count * sizeof(void*));
-    size_t*     lens       = (size_t*)malloc(old_count * sizeof(size_t));
-    if (!keys || !vals || !lens) {
-        free(keys); free(vals); free(lens);
-        return -1;
+    if (t->flags & EHT_FLAG_ORDERED) {
+        for (size_t e = 0; e < t->n_entries; ++e) {
+            if (!ent_live(t, e)) continue;
+            const char* k; const void* v; size_t len;
+            ent_get(t, e, &k, &v, &len);
+            fn(ctx, k, ent_hash(t, e), v, len);
+        }
+        return;
     }
-
-    size_t ci = 0;
     for (size_t li = 0; li < t->num_levels; ++li) {
-        SubArray* sub = &t->levels[li];
-        for (size_t si = 0; si < sub->capacity; ++si) {
-            Slot* s = &sub->slots[si];
-            if (s->state == SLOT_OCCUPIED) {
-                keys[ci] = s->key;
-                vals[ci] = s->value;
-                lens[ci] = s->value_len;
-                s->key   = NULL;    /* prevent double-free */
-                s->value = NULL;
-                ++ci;
-            }
+        const SubArray* sub = &t->levels[li];
+        for (size_t si = occ_next(sub->occupied, 0, sub->capacity);
+             si < sub->capacity;
+             si = occ_next(sub->occupied, si + 1, sub->capacity)) {
+            const SlotRef* r = &sub->refs[si];
+            fn(ctx, r->key, sub->hashes[si], r->value, r->value_len);
         }
     }
+}
 
-    /* 2. Destroy old levels */
-    for (size_t i = 0; i < t->num_levels; ++i)
-        subarray_destroy(&t->levels[i]);
-    free(t->levels);
-    t->levels     = NULL;
-    t->num_levels = 0;
-    t->count      = 0;
+typedef struct {
+    size_t    n;
+    size_t    bytes;
+    uint8_t*  arena;
+    uint32_t* refs;
+    uint64_t* hashes;
+} FreezeBuf;
+
+static void freeze_measure(void* ctx, const char* key, uint64_t h,
+                           const void* value, size_t value_len)
+{
+    FreezeBuf* fb   = (FreezeBuf*)ctx;
+    size_t     klen = strlen(key);
+    (void)h; (void)value;
+    fb->bytes += varint_len(klen) + klen + 1 + varint_len(value_len) + value_len;
+    fb->n++;
+}
 
-    /* 3. Build new levels */
-    t->total_capacity = new_capacity;
-    if (build_levels(t, new_capacity) < 0) {
-        /* catastrophic — free collected entries */
-        for (size_t i = 0; i < ci; ++i) { free(keys[i]); free(vals[i]); }
-        free(keys); free(vals); free(lens);
+static void freeze_copy(void* ctx, const char* key, uint64_t h,
+                        const void* value, size_t value_len)
+{
+    FreezeBuf* fb   = (FreezeBuf*)ctx;
+    size_t     klen = strlen(key);
+    uint8_t*   p    = fb->arena + fb->bytes;
+    size_t     n    = varint_put(p, klen);
+    memcpy(p + n, key, klen + 1);
+    n += klen + 1;
+    n += varint_put(p + n, value_len);
+    if (value_len) memcpy(p + n, value, value_len);
+
+    fb->refs[fb->n]   = (uint32_t)fb->bytes;
+    fb->hashes[fb->n] = h;
+    fb->bytes += n + value_len;
+    fb->n++;
+}
+
+/*  Copies every live entry into one exactly sized arena. */
+static int freeze_collect(const ElasticHashTable* t, FreezeBuf* fb)
+{
+    memset(fb, 0, sizeof(*fb));
+    for_each_entry(t, freeze_measure, fb);
+    size_t n = fb->n;
+    if (fb->bytes >= REF_DEAD) return -1;
+    fb->arena  = (uint8_t*)malloc(fb->bytes + 1);
+    fb->refs   = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    fb->hashes = (uint64_t*)malloc((n + 1) * sizeof(uint64_t));
+    if (!fb->arena || !fb->refs || !fb->hashes) {
+        free(fb->arena); free(fb->refs); free(fb->hashes);
         return -1;
     }
-
-    /* 4. Re-insert (ownership transfer — no copies) */
-    for (size_t i = 0; i < ci; ++i)
-        insert_owned(t, keys[i], vals[i], lens[i]);
-
-    free(keys);
-    free(vals);
-    free(lens);
+    fb->n = fb->bytes = 0;
+    for_each_entry(t, freeze_copy, fb);
     return 0;
 }
 
-/* ------------------------------------------------------------------ */
-/* Public: insert                                                     */
-/* ------------------------------------------------------------------ */
+/*  Frees t's levels and whatever held its keys and values, and makes
+ *  arena (len bytes) its storage instead. */
+static void adopt_arena(ElasticHashTable* t, uint8_t* arena, size_t len)
+{
+    destroy_levels(t);      /* plain layout: frees keys and values too */
+    for (size_t i = 0; t->entries && i < t->n_entries; ++i) {
+        free(t->entries[i].key);
+        free(t->entries[i].value);
+    }
+    free(t->entries);
+    free(t->centries);
+    free(t->arena);
+    t->entries     = NULL;
+    t->centries    = NULL;
+    t->n_entries   = 0;
+    t->entries_cap = 0;
+    t->tombstones  = 0;
+    t->arena       = arena;
+    t->arena_len   = len;
+    t->arena_cap   = len + 1;
+    t->arena_dead  = 0;
+}
 
-int eht_insert(ElasticHashTable* t,
-               const char* key,
-               const void* value, size_t value_len)
+int eht_freeze(ElasticHashTable* t)
 {
-    /* Update-in-place if already present */
-    FindResult fr = find_key(t, key);
-    if (fr.level_idx >= 0) {
-        Slot* s = &t->levels[fr.level_idx].slots[fr.slot_idx];
-        void* new_val = malloc(value_len);
-        if (!new_val && value_len > 0) return -1;
-        memcpy(new_val, value, value_len);
-        free(s->value);
-        s->value     = new_val;
-        s->value_len = value_len;
+    if (t->flags & EHT_FROZEN) return 0;
+    if (t->tiny) {
+        /* Already a flat array; it only stops accepting changes */
+        t->flags |= EHT_FROZEN;
         return 0;
     }
 
-    /* Check load / tombstones → rebuild if needed */
-    if (t->count >= (size_t)(t->total_capacity * t->max_load))
-        if (rebuild(t, t->total_capacity * 2) < 0) return -1;
+    FreezeBuf fb;
+    if (freeze_collect(t, &fb) < 0) return -1;
+    size_t n = fb.n;
+
+    /* Place the entries in levels built beside the live ones, so a
+     * failure leaves t as it was */
+    ElasticHashTable f = *t;
+    f.flags |= EHT_FROZEN;
+    size_t cap = n * EHT_FROZEN_SLOTS;
+    if (cap < 64) cap = 64;
+    for (;;) {
+        f.levels = NULL; f.hints = NULL; f.num_levels = 0;
+        if (build_levels(&f, cap) < 0) {
+            destroy_levels(&f);
+            free(fb.arena); free(fb.refs); free(fb.hashes);
+            return -1;
+        }
+        size_t i = 0;
+        while (i < n && frz_place(&f, fb.refs[i], fb.hashes[i]) == 0)
+            ++i;
+        if (i == n) break;
+        destroy_levels(&f);
+        cap += cap / 8;
+    }
+    free(fb.refs);
+    free(fb.hashes);
+
+    adopt_arena(t, fb.arena, fb.bytes);
+    t->levels         = f.levels;
+    t->hints          = f.hints;
+    t->hint_shift     = f.hint_shift;
+    t->num_levels     = f.num_levels;
+    t->flags          = f.flags;
+    t->total_capacity = cap;
+    return 0;
+}
 
-    {
-        size_t total_ts = 0;
-        for (size_t i = 0; i < t->num_levels; ++i)
-            total_ts += t->levels[i].tombstones;
-        if (total_ts >= (size_t)(t->total_capacity * t->tombstone_ratio))
-            if (rebuild(t, t->total_capacity) < 0) return -1;
+int eht_freeze_perfect(ElasticHashTable* t)
+{
+    if (t->perfect) return 0;
+    if (t->tiny) return eht_freeze(t);
+
+    /* Records and hashes: from a frozen table's own arena, which is
+     * kept, or copied out as eht_freeze does.  Frozen slots keep only
+     * half of each hash, so there the key is rehashed, and a key the
+     * levels do not find under that hash (one stored through
+     * eht_insert_with_hash under another) fails the conversion rather
+     * than vanishing from it. */
+    FreezeBuf fb;
+    int       own = !(t->flags & EHT_FROZEN);
+    if (own) {
+        if (freeze_collect(t, &fb) < 0) return -1;
+    } else {
+        memset(&fb, 0, sizeof(fb));
+        fb.refs   = (uint32_t*)malloc((t->count + 1) * sizeof(uint32_t));
+        fb.hashes = (uint64_t*)malloc((t->count + 1) * sizeof(uint64_t));
+        if (!fb.refs || !fb.hashes) {
+            free(fb.refs); free(fb.hashes);
+            return -1;
+        }
+        for (size_t off = 0; off < t->arena_len; ++fb.n) {
+            Record r = arena_record(t, (uint32_t)off);
+            fb.refs[fb.n]   = (uint32_t)off;
+            fb.hashes[fb.n] = key_hash(t, r.key);
+            if (frz_find(t, r.key, fb.hashes[fb.n]) != (uint32_t)off) {
+                free(fb.refs); free(fb.hashes);
+                return -1;
+            }
+            off += r.size;
+        }
     }
 
-    /* Copy key and value, then insert with ownership transfer */
-    size_t klen = strlen(key) + 1;
-    char*  kdup = (char*)malloc(klen);
-    void*  vdup = malloc(value_len);
-    if (!kdup || (!vdup && value_len > 0)) {
-        free(kdup); free(vdup);
+    /* Keys with equal full hashes can never be told apart */
+    EHTStaticTable* p      = NULL;
+    uint64_t*     sorted = (uint64_t*)malloc((fb.n + 1) * sizeof(uint64_t));
+    int           dup    = 0;
+    if (sorted) {
+        memcpy(sorted, fb.hashes, fb.n * sizeof(uint64_t));
+        qsort(sorted, fb.n, sizeof(uint64_t), cmp_u64);
+        for (size_t i = 1; i < fb.n && !dup; ++i) dup = sorted[i] == sorted[i - 1];
+        free(sorted);
+        for (int s = 0; !dup && !p && s < MPH_SEEDS; ++s)
+            p = mph_build(fb.refs, fb.hashes, fb.n, mix64(FNV_OFFSET + (uint64_t)s));
+    }
+    free(fb.refs);
+    free(fb.hashes);
+    if (!p) {
+        if (own) free(fb.arena);
         return -1;
     }
-    memcpy(kdup, key, klen);
-    memcpy(vdup, value, value_len);
 
-    return insert_owned(t, kdup, vdup, value_len);
+    if (own) adopt_arena(t, fb.arena, fb.bytes);
+    else     destroy_levels(t);
+    p->hash_kind      = t->hash_kind;
+    p->key_seed       = t->key_seed;
+    p->arena          = t->arena;
+    t->perfect        = p;
+    t->flags         |= EHT_FROZEN;
+    t->total_capacity = p->n;
+    return 0;
 }
 
-/* ------------------------------------------------------------------ */
-/* Public: get                                                        */
-/* ------------------------------------------------------------------ */
-
-int eht_get(ElasticHashTable* t,
-            const char* key,
-            const void** value_out, size_t* len_out)
+int eht_is_frozen(const ElasticHashTable* t)
 {
-    FindResult fr = find_key(t, key);
-    if (fr.level_idx < 0) return 0;
+    return (t->flags & EHT_FROZEN) != 0;
+}
 
-    Slot* s   = &t->levels[fr.level_idx].slots[fr.slot_idx];
-    *value_out = s->value;
-    *len_out   = s->value_len;
-    return 1;
+size_t eht_perfect_index_bytes(const ElasticHashTable* t)
+{
+    const EHTStaticTable* p = t->perfect;
+    if (!p) return 0;
+    return p->buckets * sizeof(uint16_t) + p->n_big * sizeof(uint64_t)
+         + (p->m - p->n) * sizeof(uint32_t);
 }
 
 /* ------------------------------------------------------------------ */
-/* Public: delete                                                     */
+/* Public: static tables                                              */
 /* ------------------------------------------------------------------ */
 
-int eht_delete(ElasticHashTable* t, const char* key)
+static uint64_t static_hash(const EHTStaticTable* st, const char* key)
 {
-    FindResult fr = find_key(t, key);
-    if (fr.level_idx < 0) return 0;
+    switch (st->hash_kind) {
+    case EHT_HASH_WYHASH:
+        return wyhash(key, strlen(key), (void*)&st->key_seed);
+    case EHT_HASH_CRC32C:
+        return crc32c_impl()(key, strlen(key), NULL);
+    default:
+        return fnv1a(key);
+    }
+}
 
-    SubArray* sub = &t->levels[fr.level_idx];
-    Slot*     s   = &sub->slots[fr.slot_idx];
-    slot_free_data(s);
-    s->state = SLOT_TOMBSTONE;
-    sub->count--;
-    sub->tombstones++;
-    t->count--;
+int eht_static_get(const EHTStaticTable* st, const char* key,
+                   const void** value_out, size_t* len_out)
+{
+    uint32_t ref = mph_find(st, key, static_hash(st, key));
+    if (ref == REF_DEAD) return 0;
+    Record r = record_at(st->arena, ref);
+    *value_out = r.value;
+    *len_out   = r.value_len;
     return 1;
 }
 
-/* ------------------------------------------------------------------ */
-/* Public: contains                                                   */
-/* ------------------------------------------------------------------ */
+static void write_ints(FILE* f, const char* type, const char* name,
+                       const char* part, const void* data, size_t width,
+                       size_t n)
+{
+    fprintf(f, "static const %s %s_%s[%zu] = {", type, name, part,
+            n ? n : 1);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t v;
+        if (width == 2)      v = ((const uint16_t*)data)[i];
+        else if (width == 4) v = ((const uint32_t*)data)[i];
+        else                 v = ((const uint64_t*)data)[i];
+        if (i % 8 == 0) fputs("\n   ", f);
+        fprintf(f, " 0x%llx,", (unsigned long long)v);
+    }
+    fputs(n ? "\n};\n\n" : " 0 };\n\n", f);
+}
 
-int eht_contains(ElasticHashTable* t, const char* key)
+int eht_write_c(ElasticHashTable* t, const char* path, const char* name)
 {
-    return find_key(t, key).level_idx >= 0 ? 1 : 0;
+    if (t->hash_kind == EHT_HASH_CUSTOM) return -1;
+    if (t->tiny) {
+        /* Tiny tables stay tiny when frozen, so the index is built in a
+         * promoted copy; a failure leaves t as it was */
+        ElasticHashTable* c = eht_create_with_hash(4 * EHT_TINY_MAX,
+                                                   t->flags & ~EHT_FROZEN,
+                                                   t->hash_kind, NULL, NULL);
+        int rc = c ? 0 : -1;
+        if (c) c->key_seed = t->key_seed;
+        for (size_t i = 0; rc == 0 && i < t->count; ++i)
+            rc = eht_insert(c, t->tiny->keys[i], t->tiny->values[i],
+                            t->tiny->value_lens[i]);
+        if (rc == 0) rc = eht_write_c(c, path, name);
+        if (c) eht_destroy(c);
+        return rc < 0 ? -1 : eht_freeze(t);
+    }
+    if (eht_freeze_perfect(t) < 0) return -1;
+
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+
+    const EHTStaticTable* p = t->perfect;
+    fprintf(f, "/* Generated by eht_write_c: %zu keys.  Do not edit. */\n\n"
+               "#include \"elastic_hash_table.h\"\n\n", p->n);
+    write_ints(f, "uint16_t", name, "pilots", p->pilots, 2, p->buckets);
+    write_ints(f, "uint64_t", name, "big",    p->big,    8, p->n_big);
+    write_ints(f, "uint32_t", name, "remap",  p->remap,  4, p->m - p->n);
+    write_ints(f, "uint32_t", name, "refs",   p->refs,   4, p->n);
+
+    /* The arena goes out as a string literal, which compilers take far
+     * faster than a brace list; octal escapes are always three digits so
+     * a following digit cannot extend them. */
+    fprintf(f, "static const uint8_t %s_arena[%zu] =", name,
+            t->arena_len ? t->arena_len : 1);
+    for (size_t i = 0; i < t->arena_len; ++i) {
+        uint8_t c = t->arena[i];
+        if (i % 64 == 0) fputs(i ? "\"\n    \"" : "\n    \"", f);
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\' && c != '?')
+            fputc(c, f);
+        else
+            fprintf(f, "\\%03o", c);
+    }
+    fputs(t->arena_len ? "\";\n\n" : " { 0 };\n\n", f);
+
+    fprintf(f, "const EHTStaticTable %s = {\n"
+               "    (EHTHashKind)%d, 0x%llxull, 0x%llxull,\n"
+               "    %zu, %zu, %zu, %zu,\n"
+               "    %s_pilots, %s_big, %zu, %s_remap, %s_refs, %s_arena\n"
+               "};\n",
+            name, (int)p->hash_kind, (unsigned long long)p->key_seed,
+            (unsigned long long)p->seed, p->n, p->m, p->buckets, p->dense,
+            name, name, p->n_big, name, name, name);
+    int err = ferror(f);
+    if (fclose(f) != 0) err = 1;
+    return err ? -1 : 0;
 }
 
 /* ------------------------------------------------------------------ */
@@ -428,6 +2806,14 @@ int eht_contains(ElasticHashTable* t, const char* key)
 size_t eht_len(const ElasticHashTable* t)        { return t->count; }
 size_t eht_capacity(const ElasticHashTable* t)    { return t->total_capacity; }
 size_t eht_num_levels(const ElasticHashTable* t)  { return t->num_levels; }
+size_t eht_reseed_count(const ElasticHashTable* t) { return t->reseeds; }
+
+void eht_rebuild_stats(const ElasticHashTable* t, EHTRebuildStats* out)
+{
+    out->count    = t->rebuilds;
+    out->total_ns = t->rebuild_ns;
+    out->max_ns   = t->rebuild_max_ns;
+}
 
 void eht_level_stats(const ElasticHashTable* t,
                       EHTLevelInfo* out, size_t max_levels)
@@ -441,6 +2827,123 @@ void eht_level_stats(const ElasticHashTable* t,
     }
 }
 
+/*  Probes a lookup of the entry at levels[level], slot, makes: find_hashed
+ *  or ord_find without the key compares, which only ever end a probe
+ *  run at the entry itself. */
+static size_t probe_length(const ElasticHashTable* t, uint64_t h,
+                           size_t level, size_t slot)
+{
+    int    ord    = (t->flags & EHT_FLAG_ORDERED) != 0;
+    int    rh     = (t->flags & EHT_FLAG_ROBIN_HOOD) != 0;
+    size_t probes = 0;
+    for (size_t li = 0; li <= level; ++li) {
+        const SubArray* sub = &t->levels[li];
+        if (sub->count == 0) continue;
+
+        size_t budget = probe_budget(sub);
+        uint64_t h1, h2;
+        dual_hash(h, sub, &h1, &h2);
+
+        for (size_t a = 0; a < budget; ++a) {
+            size_t idx = probe_idx(h1, h2, a, sub->capacity);
+            ++probes;
+            if (li == level && idx == slot) return probes;
+            if (ord ? sub->index[idx] == IDX_EMPTY
+                    : sub->tags[idx] == TAG_EMPTY)
+                break;
+            if (!ord && rh && sub->dist[idx] < a) break;
+        }
+    }
+    return probes;
+}
+
+/*  The cursor counts slots over all levels in order. */
+uint64_t eht_probe_histogram_step(const ElasticHashTable* t, uint64_t cursor,
+                                  size_t max_slots, size_t* hist, size_t n)
+{
+    if (n == 0 || t->tiny || (t->flags & EHT_FROZEN)) return 0;
+    if (max_slots == 0) max_slots = 1;
+
+    uint64_t base = 0;
+    for (size_t li = 0; li < t->num_levels; ++li) {
+        const SubArray* sub = &t->levels[li];
+        if (cursor >= base + sub->capacity) {
+            base += sub->capacity;
+            continue;
+        }
+        size_t si  = (size_t)(cursor - base);
+        size_t end = sub->capacity - si > max_slots ? si + max_slots : sub->capacity;
+        for (si = occ_next(sub->occupied, si, end); si < end;
+             si = occ_next(sub->occupied, si + 1, end)) {
+            uint64_t h = t->flags & EHT_FLAG_ORDERED
+                       ? ent_hash(t, sub->index[si] - IDX_BASE)
+                       : sub->hashes[si];
+            size_t   p = probe_length(t, h, li, si);
+            hist[p <= n ? p - 1 : n - 1]++;
+        }
+        if (end < sub->capacity) return base + end;
+        max_slots -= end - (size_t)(cursor - base);
+        base      += sub->capacity;
+        cursor     = base;
+        if (max_slots == 0) return li + 1 < t->num_levels ? cursor : 0;
+    }
+    return 0;
+}
+
+size_t eht_probe_histogram(const ElasticHashTable* t, size_t* hist, size_t n)
+{
+    size_t seen = 0;
+    memset(hist, 0, n * sizeof *hist);
+    eht_probe_histogram_step(t, 0, SIZE_MAX, hist, n);
+    for (size_t i = 0; i < n; ++i) seen += hist[i];
+    return seen;
+}
+
+/*  find_hashed or ord_find's walk, without promotion or the probe watch,
+ *  counting probes and the levels they touch. */
+size_t eht_lookup_probes(const ElasticHashTable* t, const char* key,
+                         size_t* levels_out)
+{
+    size_t probes = 0, levels = 0;
+    if (t->tiny || (t->flags & EHT_FROZEN)) goto done;
+
+    uint64_t h     = key_hash(t, key);
+    int      ord   = (t->flags & EHT_FLAG_ORDERED) != 0;
+    int      rh    = (t->flags & EHT_FLAG_ROBIN_HOOD) != 0;
+    uint8_t  want  = slot_tag(h);
+    size_t   depth = t->hints[hint_idx(t, h)];
+    for (size_t li = 0; li < depth; ++li) {
+        const SubArray* sub = &t->levels[li];
+        if (sub->count == 0) continue;
+
+        size_t budget = probe_budget(sub);
+        uint64_t h1, h2;
+        dual_hash(h, sub, &h1, &h2);
+        ++levels;
+
+        for (size_t a = 0; a < budget; ++a) {
+            size_t idx = probe_idx(h1, h2, a, sub->capacity);
+            ++probes;
+            if (ord) {
+                uint32_t v = sub->index[idx];
+                if (v == IDX_EMPTY) break;
+                if (v != IDX_TOMBSTONE && ent_match(t, v - IDX_BASE, key, h))
+                    goto done;
+                continue;
+            }
+            uint8_t tag = sub->tags[idx];
+            if (tag == want && sub->hashes[idx] == h
+                    && strcmp(sub->refs[idx].key, key) == 0)
+                goto done;
+            if (tag == TAG_EMPTY) break;
+            if (rh && sub->dist[idx] < a) break;
+        }
+    }
+done:
+    if (levels_out) *levels_out = levels;
+    return probes;
+}
+
 /* ------------------------------------------------------------------ */
 /* Public: iteration                                                  */
 /* ------------------------------------------------------------------ */
@@ -461,25 +2964,471 @@ int eht_iter_next(EHTIterator* it,
                   size_t* len_out)
 {
     ElasticHashTable* t = it->table;
-    while (it->level_idx < t->num_levels) {
-        SubArray* sub = &t->levels[it->level_idx];
-        while (it->slot_idx < sub->capacity) {
-            Slot* s = &sub->slots[it->slot_idx];
-            it->slot_idx++;
-            if (s->state == SLOT_OCCUPIED) {
-                *key_out   = s->key;
-                *value_out = s->value;
-                *len_out   = s->value_len;
+    if (t->tiny) {
+        if (it->slot_idx >= t->count) return 0;
+        *key_out   = t->tiny->keys[it->slot_idx];
+        *value_out = t->tiny->values[it->slot_idx];
+        *len_out   = t->tiny->value_lens[it->slot_idx];
+        it->slot_idx++;
+        return 1;
+    }
+    if (t->flags & EHT_FROZEN) {
+        /* slot_idx walks the arena, whose records are all live */
+        if (it->slot_idx >= t->arena_len) return 0;
+        Record r = arena_record(t, (uint32_t)it->slot_idx);
+        *key_out   = r.key;
+        *value_out = r.value;
+        *len_out   = r.value_len;
+        it->slot_idx += r.size;
+        return 1;
+    }
+    if (t->flags & EHT_FLAG_ORDERED) {
+        while (it->slot_idx < t->n_entries) {
+            size_t e = it->slot_idx++;
+            if (ent_live(t, e)) {
+                ent_get(t, e, key_out, value_out, len_out);
                 return 1;
             }
         }
+        return 0;
+    }
+    while (it->level_idx < t->num_levels) {
+        SubArray* sub = &t->levels[it->level_idx];
+        size_t    i   = occ_next(sub->occupied, it->slot_idx, sub->capacity);
+        if (i < sub->capacity) {
+            const SlotRef* s = &sub->refs[i];
+            it->slot_idx = i + 1;
+            *key_out   = s->key;
+            *value_out = s->value;
+            *len_out   = s->value_len;
+            return 1;
+        }
         it->level_idx++;
         it->slot_idx = 0;
     }
     return 0;
 }
 
+/* level_idx above bit 40, slot_idx below: 0 is a fresh iterator */
+#define EHT_CURSOR_SLOT_BITS 40
+
+uint64_t eht_iter_cursor(const EHTIterator* it)
+{
+    return (uint64_t)it->level_idx << EHT_CURSOR_SLOT_BITS |
+           (uint64_t)it->slot_idx;
+}
+
+void eht_iter_seek(EHTIterator* it, uint64_t cursor)
+{
+    it->level_idx = (size_t)(cursor >> EHT_CURSOR_SLOT_BITS);
+    it->slot_idx  = (size_t)(cursor & ((UINT64_C(1) << EHT_CURSOR_SLOT_BITS) - 1));
+}
+
 void eht_iter_destroy(EHTIterator* it)
 {
     free(it);
 }
+
+/* ------------------------------------------------------------------ */
+/* Public: hash join                                                  */
+/* ------------------------------------------------------------------ */
+
+/* The build side is radix-partitioned by key hash into 1 << bits
+ * tables, one per partition, each mapping a key to the first
+ * build row holding it; further rows with the key are chained through
+ * next[].  A probe partitions its keys the same way, so each partition
+ * is built and probed by one thread against a table a fraction of the
+ * size, and no table is shared between threads.  Every pass is split
+ * into phases: hash and count, scatter, then work on whole partitions
+ * handed out one at a time. */
+
+#define EHT_JOIN_END       SIZE_MAX
+#define EHT_JOIN_MAX_BITS  8            /* at most 256 partitions          */
+#define EHT_JOIN_MIN_ROWS  ((size_t)1 << 14)  /* rows per extra thread    */
+
+struct EHTJoin {
+    unsigned           bits;
+    ElasticHashTable** parts;   /* key -> first build row (a size_t)     */
+    size_t*            next;    /* build row -> next row with its key    */
+    size_t             n;
+};
+
+typedef struct JoinRun JoinRun;
+typedef void (*JoinPhase)(JoinRun* r, unsigned id);
+
+struct JoinRun {
+    const char* const* keys;
+    size_t        n;
+    unsigned      threads;
+    unsigned      bits;
+    uint64_t*     hashes;
+    size_t*       offs;        /* [thread][partition]: counts, then
+                                  scatter cursors                        */
+    size_t*       start;       /* partition p: rows[start[p]..start[p+1]) */
+    size_t*       rows;        /* row numbers grouped by partition; NULL
+                                  for one partition, where row k is k    */
+    unsigned      claimed;     /* partitions handed out (atomic)         */
+    int           failed;      /* an allocation failed (atomic)          */
+    EHTJoin*      join;
+    size_t*       tail;        /* build: last row of each chain, by head */
+    EHTJoinPairs* out;         /* probe: one buffer per thread           */
+};
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#include <pthread.h>
+#define EHT_JOIN_THREADS 1
+#define JOIN_CLAIM(r)   __atomic_fetch_add(&(r)->claimed, 1, __ATOMIC_RELAXED)
+#define JOIN_FAIL(r)    __atomic_store_n(&(r)->failed, 1, __ATOMIC_RELAXED)
+#else
+#define EHT_JOIN_THREADS 0
+#define JOIN_CLAIM(r)   ((r)->claimed++)
+#define JOIN_FAIL(r)    ((r)->failed = 1)
+#endif
+
+typedef struct {
+    JoinRun*  run;
+    JoinPhase phase;
+    unsigned  id;
+} JoinTask;
+
+#if EHT_JOIN_THREADS
+static void* join_task_main(void* arg)
+{
+    JoinTask* task = (JoinTask*)arg;
+    task->phase(task->run, task->id);
+    return NULL;
+}
+#endif
+
+/*  Runs phase(r, id) for every id < r->threads and waits for them all;
+ *  the caller's thread takes id 0.  Where a thread cannot be started
+ *  (or there are no threads) its share runs here too. */
+static void join_phase(JoinRun* r, JoinPhase phase)
+{
+    unsigned n = r->threads;
+#if EHT_JOIN_THREADS
+    enum { MAXT = 256 };
+    pthread_t th[MAXT];
+    JoinTask  task[MAXT];
+    int       started[MAXT];
+    for (unsigned id = 1; id < n; ++id) {
+        task[id]    = (JoinTask){ r, phase, id };
+        started[id] = pthread_create(&th[id], NULL, join_task_main, &task[id]) == 0;
+    }
+    phase(r, 0);
+    for (unsigned id = 1; id < n; ++id) {
+        if (started[id]) pthread_join(th[id], NULL);
+        else             phase(r, id);
+    }
+#else
+    for (unsigned id = 0; id < n; ++id) phase(r, id);
+#endif
+}
+
+static unsigned join_part(uint64_t h, unsigned bits)
+{
+    /* High bits of a multiple: the tables take their tags from the top
+     * of h itself, which must stay varied within a partition */
+    return bits ? (unsigned)((h * UINT64_C(0xD6E8FEB86659FD93)) >> (64 - bits)) : 0;
+}
+
+/*  Thread id's share of [0, n). */
+static void join_range(const JoinRun* r, unsigned id, size_t* lo, size_t* hi)
+{
+    size_t per = r->n / r->threads, extra = r->n % r->threads;
+    *lo = id * per + (id < extra ? id : extra);
+    *hi = *lo + per + (id < extra);
+}
+
+static void join_hash_phase(JoinRun* r, unsigned id)
+{
+    size_t lo, hi;
+    join_range(r, id, &lo, &hi);
+    hash_many(r->keys + lo, hi - lo, r->hashes + lo);
+    if (!r->rows) return;
+    size_t* count = r->offs + ((size_t)id << r->bits);
+    for (size_t i = lo; i < hi; ++i) count[join_part(r->hashes[i], r->bits)]++;
+}
+
+static void join_scatter_phase(JoinRun* r, unsigned id)
+{
+    size_t lo, hi;
+    join_range(r, id, &lo, &hi);
+    size_t* at = r->offs + ((size_t)id << r->bits);
+    for (size_t i = lo; i < hi; ++i) r->rows[at[join_part(r->hashes[i], r->bits)]++] = i;
+}
+
+/*  Hashes r->keys and groups their row numbers by partition, stably:
+ *  each partition's rows stay in ascending order.  Returns -1 if out
+ *  of memory. */
+static int join_partition(JoinRun* r)
+{
+    size_t parts = (size_t)1 << r->bits;
+    r->hashes = (uint64_t*)malloc((r->n ? r->n : 1) * sizeof(uint64_t));
+    r->start  = (size_t*)calloc(parts + 1, sizeof(size_t));
+    if (r->bits) {
+        r->offs = (size_t*)calloc((size_t)r->threads << r->bits, sizeof(size_t));
+        r->rows = (size_t*)malloc((r->n ? r->n : 1) * sizeof(size_t));
+    }
+    if (!r->hashes || !r->start || (r->bits && (!r->offs || !r->rows))) return -1;
+
+    join_phase(r, join_hash_phase);
+    if (!r->rows) {
+        r->start[1] = r->n;
+        return 0;
+    }
+    /* Partition-major, thread-minor prefix sums keep each partition's
+     * rows in order */
+    size_t at = 0;
+    for (size_t p = 0; p < parts; ++p) {
+        r->start[p] = at;
+        for (unsigned id = 0; id < r->threads; ++id) {
+            size_t* c = &r->offs[((size_t)id << r->bits) + p];
+            size_t  k = *c;
+            *c  = at;
+            at += k;
+        }
+    }
+    r->start[parts] = at;
+    join_phase(r, join_scatter_phase);
+    return 0;
+}
+
+static void join_run_free(JoinRun* r)
+{
+    free(r->hashes);
+    free(r->start);
+    free(r->offs);
+    free(r->rows);
+}
+
+/*  Threads for n rows: at most the partitions, and none idle on tiny
+ *  inputs. */
+static unsigned join_threads(unsigned threads, size_t n, unsigned bits)
+{
+    size_t most = n / EHT_JOIN_MIN_ROWS + 1;
+    if (threads < 1) threads = 1;
+    if (threads > most) threads = (unsigned)most;
+    if (threads > (1u << bits)) threads = 1u << bits;
+    return threads;
+}
+
+/*  Adds key -> row to t, which must not hold key: insert_hashed would
+ *  look for it a second time. */
+static int join_insert(ElasticHashTable* t, const char* key, uint64_t h,
+                       size_t row)
+{
+    size_t  klen = strlen(key) + 1;
+    char*   kdup = (char*)malloc(klen);
+    size_t* vdup = (size_t*)malloc(sizeof row);
+    if (!kdup || !vdup || make_room(t) < 0) {
+        free(kdup); free(vdup);
+        return -1;
+    }
+    memcpy(kdup, key, klen);
+    *vdup = row;
+    return insert_owned(t, kdup, h, vdup, sizeof row);
+}
+
+static void join_build_phase(JoinRun* r, unsigned id)
+{
+    (void)id;
+    EHTJoin* j     = r->join;
+    unsigned parts = 1u << r->bits;
+    for (unsigned p; (p = JOIN_CLAIM(r)) < parts;) {
+        size_t lo = r->start[p], m = r->start[p + 1] - lo;
+        /* Plain layout: a compact table's arena makes each probe's key
+         * compare a second miss.  Sized to be at most half full, where
+         * a miss ends its probe runs soonest. */
+        ElasticHashTable* t = eht_create_ex(
+            64, EHT_FLAG_PREFETCH | EHT_FLAG_INSERT_ONLY);
+        j->parts[p] = t;
+        if (!t || eht_reserve(t, 2 * m) < 0) {
+            JOIN_FAIL(r);
+            return;
+        }
+        for (size_t b = 0; b < m; b += EHT_BATCH) {
+            size_t k = m - b < EHT_BATCH ? m - b : EHT_BATCH;
+            for (size_t i = 0; i < k; ++i) {
+                size_t row = r->rows ? r->rows[lo + b + i] : lo + b + i;
+                prefetch_key(t, r->hashes[row]);
+            }
+            for (size_t i = 0; i < k; ++i) {
+                size_t      row = r->rows ? r->rows[lo + b + i] : lo + b + i;
+                const void* v;
+                size_t      len, head;
+                j->next[row] = EHT_JOIN_END;
+                if (get_hashed(t, r->keys[row], r->hashes[row], &v, &len)) {
+                    memcpy(&head, v, sizeof head);
+                    j->next[r->tail[head]] = row;
+                    r->tail[head] = row;
+                } else if (join_insert(t, r->keys[row], r->hashes[row], row) < 0) {
+                    JOIN_FAIL(r);
+                    return;
+                } else {
+                    r->tail[row] = row;
+                }
+            }
+        }
+    }
+}
+
+EHTJoin* eht_join_build(const char* const* keys, size_t n, unsigned threads)
+{
+    /* Enough partitions for two or more per thread to even the load */
+    unsigned bits = 0;
+    threads = join_threads(threads, n, EHT_JOIN_MAX_BITS);
+    while (threads > 1 && (1u << bits) < 2 * threads && bits < EHT_JOIN_MAX_BITS)
+        ++bits;
+    EHTJoin* j = (EHTJoin*)calloc(1, sizeof(*j));
+    if (!j) return NULL;
+    j->bits  = bits;
+    j->n     = n;
+    j->parts = (ElasticHashTable**)calloc((size_t)1 << bits, sizeof(ElasticHashTable*));
+    j->next  = (size_t*)malloc((n ? n : 1) * sizeof(size_t));
+
+    JoinRun r;
+    memset(&r, 0, sizeof r);
+    r.keys    = keys;
+    r.n       = n;
+    r.threads = threads;
+    r.bits    = bits;
+    r.join    = j;
+    r.tail    = (size_t*)malloc((n ? n : 1) * sizeof(size_t));
+    if (!j->parts || !j->next || !r.tail || join_partition(&r) < 0) {
+        r.failed = 1;
+    } else {
+        r.claimed = 0;
+        join_phase(&r, join_build_phase);
+    }
+    free(r.tail);
+    join_run_free(&r);
+    if (r.failed) {
+        eht_join_destroy(j);
+        return NULL;
+    }
+    return j;
+}
+
+/*  Appends one pair to p; -1 if out of memory. */
+static int pairs_push(EHTJoinPairs* p, size_t build, size_t probe)
+{
+    if (p->n == p->cap) {
+        size_t  cap = p->cap ? p->cap * 2 : 1024;
+        size_t* b   = (size_t*)realloc(p->build, cap * sizeof(size_t));
+        if (!b) return -1;
+        p->build = b;
+        size_t* q = (size_t*)realloc(p->probe, cap * sizeof(size_t));
+        if (!q) return -1;
+        p->probe = q;
+        p->cap   = cap;
+    }
+    p->build[p->n] = build;
+    p->probe[p->n] = probe;
+    p->n++;
+    return 0;
+}
+
+static void join_probe_phase(JoinRun* r, unsigned id)
+{
+    const EHTJoin* j     = r->join;
+    EHTJoinPairs*  out   = &r->out[id];
+    unsigned       parts = 1u << r->bits;
+    for (unsigned p; (p = JOIN_CLAIM(r)) < parts;) {
+        ElasticHashTable* t  = j->parts[p];
+        size_t            lo = r->start[p], m = r->start[p + 1] - lo;
+        for (size_t b = 0; b < m; b += EHT_BATCH) {
+            size_t k = m - b < EHT_BATCH ? m - b : EHT_BATCH;
+            for (size_t i = 0; i < k; ++i) {
+                size_t row = r->rows ? r->rows[lo + b + i] : lo + b + i;
+                prefetch_key(t, r->hashes[row]);
+            }
+            for (size_t i = 0; i < k; ++i) {
+                size_t      row = r->rows ? r->rows[lo + b + i] : lo + b + i;
+                const void* v;
+                size_t      len, build;
+                if (!get_hashed(t, r->keys[row], r->hashes[row], &v, &len))
+                    continue;
+                memcpy(&build, v, sizeof build);
+                for (; build != EHT_JOIN_END; build = j->next[build]) {
+                    if (pairs_push(out, build, row) < 0) {
+                        JOIN_FAIL(r);
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+int eht_join_probe(const EHTJoin* j, const char* const* keys, size_t n,
+                   unsigned threads, EHTJoinPairs* out)
+{
+    JoinRun r;
+    size_t  before = out->n;
+    memset(&r, 0, sizeof r);
+    r.keys    = keys;
+    r.n       = n;
+    r.threads = join_threads(threads, n, j->bits);
+    r.bits    = j->bits;
+    r.join    = (EHTJoin*)j;
+    r.out     = (EHTJoinPairs*)calloc(r.threads, sizeof(EHTJoinPairs));
+    if (!r.out || join_partition(&r) < 0) {
+        r.failed = 1;
+    } else {
+        /* Thread 0 appends straight to out; the others' pairs follow */
+        r.out[0] = *out;
+        join_phase(&r, join_probe_phase);
+        *out = r.out[0];
+    }
+
+    size_t total = out->n;
+    for (unsigned id = 1; r.out && id < r.threads; ++id) total += r.out[id].n;
+    if (!r.failed && total > out->cap) {
+        size_t* b = (size_t*)realloc(out->build, total * sizeof(size_t));
+        if (b) out->build = b;
+        size_t* q = b ? (size_t*)realloc(out->probe, total * sizeof(size_t)) : NULL;
+        if (q) out->probe = q;
+        if (!b || !q) r.failed = 1;
+        else          out->cap = total;
+    }
+    for (unsigned id = 1; r.out && id < r.threads; ++id) {
+        EHTJoinPairs* p = &r.out[id];
+        if (!r.failed) {
+            memcpy(out->build + out->n, p->build, p->n * sizeof(size_t));
+            memcpy(out->probe + out->n, p->probe, p->n * sizeof(size_t));
+            out->n += p->n;
+        }
+        eht_join_pairs_free(p);
+    }
+    free(r.out);
+    join_run_free(&r);
+    if (r.failed) out->n = before;
+    return r.failed ? -1 : 0;
+}
+
+size_t eht_join_keys(const EHTJoin* j)
+{
+    size_t n = 0;
+    for (size_t p = 0; p < (size_t)1 << j->bits; ++p) n += eht_len(j->parts[p]);
+    return n;
+}
+
+void eht_join_destroy(EHTJoin* j)
+{
+    if (!j) return;
+    if (j->parts)
+        for (size_t p = 0; p < (size_t)1 << j->bits; ++p)
+            if (j->parts[p]) eht_destroy(j->parts[p]);
+    free(j->parts);
+    free(j->next);
+    free(j);
+}
+
+void eht_join_pairs_free(EHTJoinPairs* p)
+{
+    free(p->build);
+    free(p->probe);
+    p->build = p->probe = NULL;
+    p->n = p->cap = 0;
+}
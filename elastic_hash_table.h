@@ -31,12 +31,109 @@ typedef struct {
     size_t   tombstones;
 } EHTLevelInfo;
 
+/* Rebuilds (growth, shrinking, tombstone purges, reseeds) so far */
+typedef struct {
+    size_t   count;
+    uint64_t total_ns;    /* time spent in them    */
+    uint64_t max_ns;      /* the longest one       */
+} EHTRebuildStats;
+
 /* Opaque iterator */
 typedef struct EHTIterator EHTIterator;
 
+/* ---------- Create-time flags (eht_create_ex) ---------- */
+
+/*  Adaptive mode: lookups count hits on entries stored below level 0 and
+ *  relocate hot entries into a free slot earlier in their own probe
+ *  sequence.  Only the promoted entry moves; cold entries are never
+ *  reordered.  Because lookups may move entries, do not call eht_get /
+ *  eht_contains on an adaptive table while an iterator is live.  For
+ *  locking, every lookup on an adaptive table (eht_get and its
+ *  _with_hash, _hashed and _many forms, and eht_contains) is a write:
+ *  it updates hit counters and may move an entry, so lookups sharing
+ *  the table need the exclusive side of a reader/writer lock, not the
+ *  shared one. */
+#define EHT_FLAG_ADAPTIVE     0x01u
+
+/*  Robin Hood mode: within a level, an insert takes the slot of any
+ *  resident that sits at an earlier attempt of its own probe sequence
+ *  than the inserter, and the resident continues probing from there.
+ *  Lookups then stop at the first slot whose resident is nearer home
+ *  than the current attempt, so inserts cost more and lookups (misses
+ *  especially) get shorter and less variable. */
+#define EHT_FLAG_ROBIN_HOOD   0x02u
+
+/*  Insert-only mode: eht_delete is rejected, so the table never holds
+ *  tombstones and skips all tombstone bookkeeping.  Levels are packed to
+ *  a 95% load before growing instead of 90%.  Overrides
+ *  EHT_FLAG_ADAPTIVE, whose promotions leave tombstones behind. */
+#define EHT_FLAG_INSERT_ONLY  0x04u
+
+/*  Ordered layout: entries are kept in a dense array in insertion order
+ *  and level slots hold only a 4-byte index into it, instead of a
+ *  32-byte slot.  Iteration yields entries in insertion order and costs
+ *  O(live entries).  Overrides EHT_FLAG_ADAPTIVE and EHT_FLAG_ROBIN_HOOD,
+ *  which need per-slot metadata.  Limited to 2^32 - 3 entries. */
+#define EHT_FLAG_ORDERED      0x08u
+
+/*  Compact mode (implies EHT_FLAG_ORDERED): keys and values are copied
+ *  into one per-table arena as [varint key_len][key][NUL][varint
+ *  value_len][value] records and each entry is a 32-bit arena offset
+ *  plus a 32-bit hash tag, so a live entry costs about 12 bytes of table
+ *  structure and no per-key heap allocations.  Value pointers returned
+ *  by eht_get are not aligned.  The arena is limited to 4 GiB. */
+#define EHT_FLAG_COMPACT      0x10u
+
+/*  Prefetch mode: a lookup first requests the initial probe slot of
+ *  every level it may have to visit, so on a miss the per-level cache
+ *  misses overlap rather than happening one after another.  Helps
+ *  miss-heavy workloads on tables larger than the caches; costs some
+ *  memory bandwidth on hits, which usually end at level 0. */
+#define EHT_FLAG_PREFETCH     0x20u
+
+/*  Seeded mode, for tables keyed by untrusted input: the key hash is
+ *  keyed with a random per-table seed (FNV-1a, which takes none, is
+ *  replaced by wyhash; CRC32C and custom hashes stay unkeyed) and the
+ *  per-level salts with a second one.  If too many hits run deep, or an
+ *  insert exhausts every level well below max_load, the next insert
+ *  rebuilds under fresh level salts; repeated reseeds back off.  Key
+ *  hashes, and so tokens and *_with_hash values, never change.  Hits
+ *  update the probe-length watch, so as in adaptive mode, lookups are
+ *  writes for locking. */
+#define EHT_FLAG_SEEDED       0x40u
+
+/* ---------- Hash functions ---------- */
+
+/*  Key hash used by a table, chosen at create time. */
+typedef enum {
+    EHT_HASH_FNV1A  = 0,    /* default; the hash eht_hash() computes     */
+    EHT_HASH_WYHASH = 1,    /* wyhash: 16 key bytes per 128-bit multiply */
+    EHT_HASH_CRC32C = 2,    /* two CRC32C streams + finaliser, on SSE4.2
+                               / ARMv8 CRC instructions where present    */
+    EHT_HASH_CUSTOM = 3     /* the caller's EHTHashFn                    */
+} EHTHashKind;
+
+/*  A caller-supplied key hash.  It must return the same value for the
+ *  same key for the table's lifetime.  The table remixes it per level,
+ *  but keys whose full 64-bit hashes collide always share probe paths. */
+typedef uint64_t (*EHTHashFn)(const char* key, size_t key_len, void* ctx);
+
 /* ---------- Lifecycle ---------- */
 
+/*  A capacity of 16 or less creates a tiny table: a flat array of up to
+ *  16 entries scanned by hash tag, which moves to the level layout
+ *  (64 slots) when it outgrows that.  Larger capacities are rounded up
+ *  to at least 64 slots.  While tiny, eht_num_levels() is 0. */
+
 ElasticHashTable* eht_create(size_t total_capacity);
+ElasticHashTable* eht_create_ex(size_t total_capacity, unsigned flags);
+/*  eht_create_ex with a selected hash.  fn and ctx are only used (and
+ *  fn is required) for EHT_HASH_CUSTOM.  EHT_HASH_CRC32C picks its
+ *  hardware or table-driven implementation from the CPU at this call;
+ *  both compute the same hash. */
+ElasticHashTable* eht_create_with_hash(size_t total_capacity, unsigned flags,
+                                       EHTHashKind kind,
+                                       EHTHashFn fn, void* ctx);
 void              eht_destroy(ElasticHashTable* t);
 
 /* ---------- Core operations ---------- */
@@ -53,19 +150,180 @@ int  eht_get(ElasticHashTable* t,
              const char* key,
              const void** value_out, size_t* len_out);
 
-/*  Returns 1 if key was present and deleted, 0 if not found. */
+/*  Returns 1 if key was present and deleted, 0 if not found, -1 if the
+ *  table was created with EHT_FLAG_INSERT_ONLY. */
 int  eht_delete(ElasticHashTable* t, const char* key);
 
 /*  Returns 1 if key is present, 0 otherwise. */
 int  eht_contains(ElasticHashTable* t, const char* key);
 
+/*  Grows t, in one rebuild, to hold n entries in all without growing
+ *  again, so a bulk load of known size skips the doublings on the way.
+ *  Never shrinks.  Returns 0, or -1 on allocation failure or if t is
+ *  frozen. */
+int  eht_reserve(ElasticHashTable* t, size_t n);
+
+/* ---------- Precomputed hashes ---------- */
+
+/*  The default (FNV-1a) hash of key.  It does not depend on the table,
+ *  so one eht_hash result can be reused across default-hash tables or
+ *  carried from upstream (e.g. a shard router) to the *_with_hash
+ *  calls, which then skip hashing. */
+uint64_t eht_hash(const char* key);
+
+/*  The hash t uses for key (eht_hash(key) unless t was created with
+ *  another EHTHashKind or EHT_FLAG_SEEDED). */
+uint64_t eht_table_hash(const ElasticHashTable* t, const char* key);
+
+/*  eht_insert, eht_get and eht_delete with the key's hash supplied.
+ *  hash must be eht_table_hash(t, key): the tiny, compact and frozen
+ *  layouts keep only part of it and rehash the key when they rebuild,
+ *  so a key stored under any other hash can be lost while eht_len
+ *  still counts it. */
+int      eht_insert_with_hash(ElasticHashTable* t,
+                              const char* key, uint64_t hash,
+                              const void* value, size_t value_len);
+int      eht_get_with_hash(ElasticHashTable* t,
+                           const char* key, uint64_t hash,
+                           const void** value_out, size_t* len_out);
+int      eht_delete_with_hash(ElasticHashTable* t,
+                              const char* key, uint64_t hash);
+
+/* ---------- Pipelined lookups ---------- */
+
+/*  Hashes key and prefetches the first probe slot of every level a
+ *  lookup of it may visit, returning the hash as a token.  Call it as
+ *  soon as the key is known and pass the token to eht_get_hashed when
+ *  the value is needed.  The token stays valid for this table across
+ *  inserts, deletes and resizes. */
+uint64_t eht_prefetch(const ElasticHashTable* t, const char* key);
+
+/*  eht_get for a key whose token came from eht_prefetch, without
+ *  hashing it again.  The token is eht_table_hash(t, key), so this is
+ *  the same call as eht_get_with_hash. */
+int      eht_get_hashed(ElasticHashTable* t,
+                        const char* key, uint64_t token,
+                        const void** value_out, size_t* len_out);
+
+/* ---------- Batch operations ---------- */
+
+/*  hashes_out[i] = eht_hash(keys[i]) for i < n, several keys at a time
+ *  using AVX2 or AVX-512 where the CPU has them (checked at run time). */
+void   eht_hash_many(const char* const* keys, size_t n, uint64_t* hashes_out);
+
+/*  eht_get for each of keys[0..n): found_out[i] is 1 or 0, and
+ *  values_out[i] / lens_out[i] are set as eht_get would (NULL / 0 when
+ *  not found).  Keys are hashed in blocks of 16; in prefetch mode the
+ *  probe slots of a whole block are prefetched before any of it is
+ *  looked up.  Returns the number of keys found. */
+size_t eht_get_many(ElasticHashTable* t,
+                    const char* const* keys, size_t n,
+                    const void** values_out, size_t* lens_out,
+                    int* found_out);
+
+/*  eht_insert for each pair in order (a repeated key keeps the last
+ *  value).  Returns 0, or -1 on allocation failure, in which case the
+ *  pairs before the failing one have been inserted. */
+int    eht_insert_many(ElasticHashTable* t,
+                       const char* const* keys, size_t n,
+                       const void* const* values, const size_t* value_lens);
+
+/* ---------- Freezing ---------- */
+
+/*  Repacks t for read-only serving.  Live keys and values are copied
+ *  into one exactly sized arena (the compact layout's records), deleted
+ *  entries and tombstones are dropped, and the levels are rebuilt with
+ *  8-byte {record offset, hash tag} slots at half load, each level's
+ *  probe bound cut to the longest run it actually holds: a probe reads
+ *  one slot, and only a tag match touches the arena.  Afterwards
+ *  inserts and deletes return -1, and lookups and iteration never write
+ *  to the table, so any number of threads may read it concurrently
+ *  without locking.  Iteration keeps its order from before the freeze.
+ *  Returns 0, or -1 on allocation failure, in which case t is
+ *  unchanged.  Freezing a frozen table is a no-op. */
+int    eht_freeze(ElasticHashTable* t);
+
+/*  eht_freeze with a minimal perfect hash (PTHash-style) in place of
+ *  the levels: every key maps to its own position in [0, n), so a
+ *  lookup reads one 16-bit pilot and one 4-byte record offset and
+ *  compares one key, hit or miss.  The index costs about 3 bits per
+ *  key on top of those offsets and the arena.  Works on a frozen table
+ *  too, reusing its arena.  Building is linear in practice but slower
+ *  than eht_freeze.  Returns -1 on allocation failure, when two keys
+ *  have the same full hash (only possible with a custom EHTHashFn), or,
+ *  on a frozen table, when a key was stored under a hash other than
+ *  eht_table_hash(t, key); t is then unchanged. */
+int    eht_freeze_perfect(ElasticHashTable* t);
+int    eht_is_frozen(const ElasticHashTable* t);
+/*  Bytes in the perfect-hash index (pilots and remap table); 0 unless
+ *  t was frozen with eht_freeze_perfect. */
+size_t eht_perfect_index_bytes(const ElasticHashTable* t);
+
+/* ---------- Static tables ---------- */
+
+/*  A perfect-hash table laid out entirely in const arrays, as written
+ *  by eht_write_c (or the eht_codegen tool): it needs no construction
+ *  at run time and, being read-only data, its pages are shared by every
+ *  process that maps the same binary.  The fields are for generated
+ *  code; treat them as opaque. */
+typedef struct {
+    EHTHashKind     hash_kind;  /* FNV1A, WYHASH or CRC32C             */
+    uint64_t        key_seed;   /* wyhash key (seeded tables)          */
+    uint64_t        seed;       /* bucket / position hash seed         */
+    size_t          n;          /* keys                                */
+    size_t          m;
+    size_t          buckets;
+    size_t          dense;
+    const uint16_t* pilots;
+    const uint64_t* big;
+    size_t          n_big;
+    const uint32_t* remap;
+    const uint32_t* refs;       /* per position: offset into arena     */
+    const uint8_t*  arena;      /* eht_freeze's record format          */
+} EHTStaticTable;
+
+/*  eht_get on a static table.  Thread-safe; never allocates. */
+int eht_static_get(const EHTStaticTable* st, const char* key,
+                   const void** value_out, size_t* len_out);
+
+/*  Writes t as a C source file defining `const EHTStaticTable name`
+ *  (declare it `extern const EHTStaticTable name;` to use it), freezing
+ *  t with eht_freeze_perfect first if it is not already.  A tiny table
+ *  is written from a promoted copy and only frozen with eht_freeze,
+ *  once the file is written.  Returns 0, or -1 if t uses a custom hash,
+ *  cannot be frozen, or path cannot be written. */
+int eht_write_c(ElasticHashTable* t, const char* path, const char* name);
+
 /* ---------- Metadata ---------- */
 
 size_t eht_len(const ElasticHashTable* t);
 size_t eht_capacity(const ElasticHashTable* t);
 size_t eht_num_levels(const ElasticHashTable* t);
+/*  Rebuilds under new level salts so far (EHT_FLAG_SEEDED). */
+size_t eht_reseed_count(const ElasticHashTable* t);
 void   eht_level_stats(const ElasticHashTable* t,
                         EHTLevelInfo* out, size_t max_levels);
+void   eht_rebuild_stats(const ElasticHashTable* t, EHTRebuildStats* out);
+/*  Counts live entries by the probes a lookup of each makes, over all
+ *  levels: hist[i] is the number taking i + 1, and hist[n - 1] also
+ *  takes the longer ones.  Walks the whole table, so it is for
+ *  diagnostics rather than hot paths.  Returns the entries counted,
+ *  0 for a tiny or frozen table (no probe sequences). */
+size_t eht_probe_histogram(const ElasticHashTable* t, size_t* hist, size_t n);
+/*  The same walk a piece at a time, for tables behind a lock: adds the
+ *  entries in up to max_slots slots from cursor on to hist (without
+ *  clearing it) and returns the cursor to go on from, 0 when done.
+ *  Start from 0.  Entries moved between calls may be counted twice or
+ *  missed. */
+uint64_t eht_probe_histogram_step(const ElasticHashTable* t, uint64_t cursor,
+                                  size_t max_slots, size_t* hist, size_t n);
+/*  Probes a lookup of key makes, hit or miss, and in *levels_out (if
+ *  non-NULL) how many levels it probes.  Level hints end a miss after
+ *  the deepest level its bucket has used, not the last level.  Does not
+ *  count towards adaptive promotion or seeded mode's watch.  0 for a
+ *  tiny or frozen table. */
+size_t eht_lookup_probes(const ElasticHashTable* t, const char* key,
+                         size_t* levels_out);
 
 /* ---------- Iteration ---------- */
 
@@ -76,8 +334,56 @@ int          eht_iter_next(EHTIterator* it,
                            const char** key_out,
                            const void** value_out,
                            size_t* len_out);
+/*  The iterator's position as a number, and a jump back to one, so a
+ *  walk can be resumed with a fresh iterator (e.g. a SCAN cursor).
+ *  Entries present throughout are seen exactly once unless entries
+ *  move in between: growth, rebuilds, freezing, deletes from a tiny
+ *  table, Robin Hood inserts and adaptive promotions all move them.
+ *  Entries inserted meanwhile may or may not be seen.  Cursor 0 is the
+ *  start.  Only seek to cursors from eht_iter_cursor on the same
+ *  table. */
+uint64_t     eht_iter_cursor(const EHTIterator* it);
+void         eht_iter_seek(EHTIterator* it, uint64_t cursor);
 void         eht_iter_destroy(EHTIterator* it);
 
+/* ---------- Hash join ---------- */
+
+/*  An equi-join's build side: the row numbers of a key column, radix-
+ *  partitioned by key hash into elastic tables (see README).  Read-only
+ *  once built, so any number of threads may probe it at once. */
+typedef struct EHTJoin EHTJoin;
+
+/*  Matches found by eht_join_probe, as two parallel columns: build[i]
+ *  and probe[i] are the row numbers of the i-th matching pair.  Zero-
+ *  initialise it; set n to 0 to reuse the buffers for another batch. */
+typedef struct {
+    size_t  n;
+    size_t  cap;
+    size_t* build;
+    size_t* probe;
+} EHTJoinPairs;
+
+/*  Builds from keys[0..n), row i being keys[i]; a key may repeat.  With
+ *  threads > 1 (capped so each has 16K rows or more) the rows are split
+ *  into partitions built in parallel, each table pre-sized by
+ *  eht_reserve.  Returns NULL on allocation failure. */
+EHTJoin* eht_join_build(const char* const* keys, size_t n, unsigned threads);
+
+/*  Appends to out a pair (b, p) for every build row b whose key equals
+ *  probe key keys[p], looking up each partition's keys in prefetched
+ *  blocks of 16 on up to threads threads (at most one per partition).
+ *  With one partition the pairs come in probe-row order; otherwise
+ *  grouped by partition, in probe-row order within each.  The build
+ *  rows of one probe row are always in ascending order.  Returns 0, or
+ *  -1 on allocation failure, with out->n restored (the buffers may have
+ *  grown). */
+int      eht_join_probe(const EHTJoin* j, const char* const* keys, size_t n,
+                        unsigned threads, EHTJoinPairs* out);
+/*  Distinct keys on the build side. */
+size_t   eht_join_keys(const EHTJoin* j);
+void     eht_join_destroy(EHTJoin* j);
+void     eht_join_pairs_free(EHTJoinPairs* p);
+
 #ifdef __cplusplus
 }
 #endif
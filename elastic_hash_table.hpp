@@ -0,0 +1,231 @@
+/*
+ * elastic_hash_table.hpp — C++ interface to the Elastic Hash Table
+ *
+ * Includes the C API and adds eht::StaticTable, an elastic table that a
+ * C++20 compiler builds entirely at compile time: levels live in a
+ * std::array and the hash is constexpr.  A lookup in a constant
+ * expression is a constant; elsewhere a literal key's hash still folds,
+ * leaving only the probe.  Nothing is constructed at startup and
+ * nothing is allocated.
+ *
+ *     constexpr auto ports = eht::make_static_table<int>({
+ *         {"http", 80}, {"https", 443}, {"ssh", 22},
+ *     });
+ *     static_assert(ports.at("https") == 443);
+ *     if (const int* p = ports.find(name)) ...
+ *
+ * Keys:   std::string_view, which must outlive the table (string
+ *         literals do)
+ * Values: any literal type that is default-constructible and copyable
+ */
+
+#ifndef ELASTIC_HASH_TABLE_HPP
+#define ELASTIC_HASH_TABLE_HPP
+
+#include "elastic_hash_table.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace eht {
+
+namespace detail {
+
+/* The C library's FNV-1a and mix64: for keys without NUL bytes, a
+ * StaticTable probes the same slots as an unseeded C table would. */
+constexpr std::uint64_t fnv1a(std::string_view key)
+{
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : key) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+constexpr std::uint64_t mix64(std::uint64_t x)
+{
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27; x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+/* std::log is not constexpr: halve into [1, 2], then the atanh series */
+constexpr double ln(double x)
+{
+    double k = 0;
+    while (x > 2) { x /= 2; k += 1; }
+    double y = (x - 1) / (x + 1), y2 = y * y, term = y, sum = 0;
+    for (int i = 1; i < 40; i += 2) {
+        sum  += term / i;
+        term *= y2;
+    }
+    return k * 0.6931471805599453 + 2 * sum;
+}
+
+/* probe_budget() from the C library: 3 + 3 ln^2(1/eps), eps >= 1/64 */
+constexpr std::size_t probe_budget(std::size_t count, std::size_t capacity)
+{
+    double eps = 1.0 - static_cast<double>(count) / static_cast<double>(capacity);
+    if (eps < 1.0 / 64) eps = 1.0 / 64;
+    double      l = ln(1 / eps);
+    std::size_t b = static_cast<std::size_t>(3.0 + 3.0 * l * l) + 1;
+    return b < capacity ? b : capacity;
+}
+
+/* At most 90% full, rounded up to a power of two so that every level is
+ * one too and an odd probe step visits all of a level's slots. */
+constexpr std::size_t capacity_for(std::size_t n)
+{
+    std::size_t want = n + n / 9 + 1, cap = 32;
+    while (cap < want) cap *= 2;
+    return cap;
+}
+
+/* build_levels() with min_level_size 16: halve down to a final level */
+constexpr std::size_t levels_for(std::size_t capacity)
+{
+    std::size_t n = 1;
+    while (capacity > 32) {
+        capacity -= capacity / 2;
+        ++n;
+    }
+    return n;
+}
+
+} // namespace detail
+
+template <typename V, std::size_t N>
+class StaticTable {
+public:
+    static constexpr std::size_t capacity   = detail::capacity_for(N);
+    static constexpr std::size_t num_levels = detail::levels_for(capacity);
+
+    /*  Builds the table from items; a key given twice keeps its last
+     *  value.  Used in a constexpr context, this runs in the compiler. */
+    constexpr explicit StaticTable(const std::pair<std::string_view, V> (&items)[N])
+    {
+        std::size_t base = 0, remaining = capacity;
+        for (std::size_t i = 0; i < num_levels; ++i) {
+            Level& lv = levels_[i];
+            lv.base     = base;
+            lv.capacity = i + 1 < num_levels ? remaining / 2 : remaining;
+            lv.salt1    = static_cast<std::uint64_t>(i) * 0x9E3779B97F4A7C15ull + 0xA1;
+            lv.salt2    = (static_cast<std::uint64_t>(i) * 0x517CC1B727220A95ull + 0xB2)
+                        ^ detail::mix64(0);
+            base      += lv.capacity;
+            remaining -= lv.capacity;
+        }
+        for (const auto& item : items) insert(item.first, item.second);
+    }
+
+    /*  Pointer to key's value, or nullptr. */
+    constexpr const V* find(std::string_view key) const
+    {
+        std::size_t i = index_of(key);
+        return i != capacity ? &slots_[i].value : nullptr;
+    }
+
+    constexpr bool contains(std::string_view key) const { return find(key) != nullptr; }
+
+    /*  key's value; throws std::out_of_range (a compile error in a
+     *  constant expression) if it is absent. */
+    constexpr const V& at(std::string_view key) const
+    {
+        const V* v = find(key);
+        if (!v) throw std::out_of_range("eht::StaticTable::at: no such key");
+        return *v;
+    }
+
+    constexpr std::size_t size() const { return count_; }
+
+    /*  Calls f(key, value) for every entry, in slot order. */
+    template <typename F>
+    constexpr void for_each(F&& f) const
+    {
+        for (const Slot& s : slots_)
+            if (s.used) f(s.key, s.value);
+    }
+
+private:
+    struct Slot {
+        std::string_view key{};
+        V                value{};
+        bool             used = false;
+    };
+    struct Level {
+        std::size_t   base = 0, capacity = 0, count = 0;
+        std::size_t   bound = 0;  /* longest probe run any key here needed */
+        std::uint64_t salt1 = 0, salt2 = 0;
+    };
+
+    /*  Slot holding key, or capacity. */
+    constexpr std::size_t index_of(std::string_view key) const
+    {
+        std::uint64_t h = detail::fnv1a(key);
+        for (const Level& lv : levels_) {
+            std::uint64_t h1 = detail::mix64(h ^ lv.salt1);
+            std::uint64_t h2 = detail::mix64(h ^ lv.salt2) | 1;
+            for (std::size_t a = 0; a < lv.bound; ++a) {
+                const Slot& s = slots_[lv.base + ((h1 + a * h2) & (lv.capacity - 1))];
+                /* No deletes: every key passed only full slots on its way in */
+                if (!s.used) break;
+                if (s.key == key) return static_cast<std::size_t>(&s - slots_.data());
+            }
+        }
+        return capacity;
+    }
+
+    constexpr void insert(std::string_view key, const V& value)
+    {
+        std::size_t old = index_of(key);
+        if (old != capacity) {
+            slots_[old].value = value;
+            return;
+        }
+        std::uint64_t h = detail::fnv1a(key);
+        /* First pass: each level's elastic probe budget, as in the C
+         * library; the second pass probes whole levels and always finds
+         * a slot because the table is never more than 90% full. */
+        for (int pass = 0; pass < 2; ++pass) {
+            for (Level& lv : levels_) {
+                std::uint64_t h1 = detail::mix64(h ^ lv.salt1);
+                std::uint64_t h2 = detail::mix64(h ^ lv.salt2) | 1;
+                std::size_t   budget = pass ? lv.capacity
+                                            : detail::probe_budget(lv.count, lv.capacity);
+                for (std::size_t a = 0; a < budget; ++a) {
+                    Slot& s = slots_[lv.base + ((h1 + a * h2) & (lv.capacity - 1))];
+                    if (s.used) continue;
+                    s.key   = key;
+                    s.value = value;
+                    s.used  = true;
+                    ++lv.count;
+                    ++count_;
+                    if (a + 1 > lv.bound) lv.bound = a + 1;
+                    return;
+                }
+            }
+        }
+    }
+
+    std::array<Slot, capacity>    slots_{};
+    std::array<Level, num_levels> levels_{};
+    std::size_t                   count_ = 0;
+};
+
+/*  Deduces N from a braced list:
+ *      constexpr auto t = eht::make_static_table<int>({{"a", 1}, {"b", 2}}); */
+template <typename V, std::size_t N>
+constexpr StaticTable<V, N> make_static_table(const std::pair<std::string_view, V> (&items)[N])
+{
+    return StaticTable<V, N>(items);
+}
+
+} // namespace eht
+
+#endif /* ELASTIC_HASH_TABLE_HPP */
@@ -25,7 +25,7 @@ import platform
 import struct
 import sys
 from pathlib import Path
-from typing import Any, Iterator, Optional, Tuple
+from typing import Any, Iterable, Iterator, List, Optional, Tuple
 
 
 # -------------------------------------------------------------------
@@ -62,6 +62,27 @@ _lib = _find_library()
 # C type declarations
 # -------------------------------------------------------------------
 
+# Create-time flags (mirror elastic_hash_table.h)
+EHT_FLAG_ADAPTIVE   = 0x01
+EHT_FLAG_ROBIN_HOOD = 0x02
+EHT_FLAG_INSERT_ONLY = 0x04
+EHT_FLAG_ORDERED    = 0x08
+EHT_FLAG_COMPACT    = 0x10
+EHT_FLAG_PREFETCH   = 0x20
+EHT_FLAG_SEEDED     = 0x40
+
+# Hash selection (EHTHashKind)
+EHT_HASH_FNV1A  = 0
+EHT_HASH_WYHASH = 1
+EHT_HASH_CRC32C = 2
+EHT_HASH_CUSTOM = 3
+
+_HASH_KINDS = {"fnv1a": EHT_HASH_FNV1A, "wyhash": EHT_HASH_WYHASH,
+               "crc32c": EHT_HASH_CRC32C}
+
+_EHTHashFn = ctypes.CFUNCTYPE(ctypes.c_uint64, ctypes.c_void_p,
+                              ctypes.c_size_t, ctypes.c_void_p)
+
 class _EHTLevelInfo(ctypes.Structure):
     _fields_ = [
         ("level",      ctypes.c_int),
@@ -71,10 +92,35 @@ class _EHTLevelInfo(ctypes.Structure):
     ]
 
 
+class _EHTRebuildStats(ctypes.Structure):
+    _fields_ = [
+        ("count",    ctypes.c_size_t),
+        ("total_ns", ctypes.c_uint64),
+        ("max_ns",   ctypes.c_uint64),
+    ]
+
+
+class _EHTJoinPairs(ctypes.Structure):
+    _fields_ = [
+        ("n",     ctypes.c_size_t),
+        ("cap",   ctypes.c_size_t),
+        ("build", ctypes.POINTER(ctypes.c_size_t)),
+        ("probe", ctypes.POINTER(ctypes.c_size_t)),
+    ]
+
+
 # -- Lifecycle --
 _lib.eht_create.argtypes  = [ctypes.c_size_t]
 _lib.eht_create.restype   = ctypes.c_void_p
 
+_lib.eht_create_ex.argtypes = [ctypes.c_size_t, ctypes.c_uint]
+_lib.eht_create_ex.restype  = ctypes.c_void_p
+
+_lib.eht_create_with_hash.argtypes = [ctypes.c_size_t, ctypes.c_uint,
+                                      ctypes.c_int, _EHTHashFn,
+                                      ctypes.c_void_p]
+_lib.eht_create_with_hash.restype  = ctypes.c_void_p
+
 _lib.eht_destroy.argtypes = [ctypes.c_void_p]
 _lib.eht_destroy.restype  = None
 
@@ -88,12 +134,65 @@ _lib.eht_get.argtypes     = [ctypes.c_void_p, ctypes.c_char_p,
                               ctypes.POINTER(ctypes.c_size_t)]
 _lib.eht_get.restype      = ctypes.c_int
 
+_lib.eht_hash.argtypes = [ctypes.c_char_p]
+_lib.eht_hash.restype  = ctypes.c_uint64
+
+_lib.eht_table_hash.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.eht_table_hash.restype  = ctypes.c_uint64
+
+_lib.eht_insert_with_hash.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                      ctypes.c_uint64,
+                                      ctypes.c_void_p, ctypes.c_size_t]
+_lib.eht_insert_with_hash.restype  = ctypes.c_int
+
+_lib.eht_get_with_hash.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                   ctypes.c_uint64,
+                                   ctypes.POINTER(ctypes.c_void_p),
+                                   ctypes.POINTER(ctypes.c_size_t)]
+_lib.eht_get_with_hash.restype  = ctypes.c_int
+
+_lib.eht_delete_with_hash.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                      ctypes.c_uint64]
+_lib.eht_delete_with_hash.restype  = ctypes.c_int
+
+_lib.eht_hash_many.argtypes = [ctypes.POINTER(ctypes.c_char_p),
+                               ctypes.c_size_t,
+                               ctypes.POINTER(ctypes.c_uint64)]
+_lib.eht_hash_many.restype  = None
+
+_lib.eht_get_many.argtypes = [ctypes.c_void_p,
+                              ctypes.POINTER(ctypes.c_char_p),
+                              ctypes.c_size_t,
+                              ctypes.POINTER(ctypes.c_void_p),
+                              ctypes.POINTER(ctypes.c_size_t),
+                              ctypes.POINTER(ctypes.c_int)]
+_lib.eht_get_many.restype  = ctypes.c_size_t
+
+_lib.eht_insert_many.argtypes = [ctypes.c_void_p,
+                                 ctypes.POINTER(ctypes.c_char_p),
+                                 ctypes.c_size_t,
+                                 ctypes.POINTER(ctypes.c_void_p),
+                                 ctypes.POINTER(ctypes.c_size_t)]
+_lib.eht_insert_many.restype  = ctypes.c_int
+
+_lib.eht_prefetch.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.eht_prefetch.restype  = ctypes.c_uint64
+
+_lib.eht_get_hashed.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                ctypes.c_uint64,
+                                ctypes.POINTER(ctypes.c_void_p),
+                                ctypes.POINTER(ctypes.c_size_t)]
+_lib.eht_get_hashed.restype  = ctypes.c_int
+
 _lib.eht_delete.argtypes  = [ctypes.c_void_p, ctypes.c_char_p]
 _lib.eht_delete.restype   = ctypes.c_int
 
 _lib.eht_contains.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
 _lib.eht_contains.restype  = ctypes.c_int
 
+_lib.eht_reserve.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+_lib.eht_reserve.restype  = ctypes.c_int
+
 # -- Metadata --
 _lib.eht_len.argtypes        = [ctypes.c_void_p]
 _lib.eht_len.restype         = ctypes.c_size_t
@@ -104,11 +203,48 @@ _lib.eht_capacity.restype    = ctypes.c_size_t
 _lib.eht_num_levels.argtypes = [ctypes.c_void_p]
 _lib.eht_num_levels.restype  = ctypes.c_size_t
 
+_lib.eht_freeze.argtypes = [ctypes.c_void_p]
+_lib.eht_freeze.restype  = ctypes.c_int
+
+_lib.eht_freeze_perfect.argtypes = [ctypes.c_void_p]
+_lib.eht_freeze_perfect.restype  = ctypes.c_int
+
+_lib.eht_perfect_index_bytes.argtypes = [ctypes.c_void_p]
+_lib.eht_perfect_index_bytes.restype  = ctypes.c_size_t
+
+_lib.eht_write_c.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+_lib.eht_write_c.restype  = ctypes.c_int
+
+_lib.eht_is_frozen.argtypes = [ctypes.c_void_p]
+_lib.eht_is_frozen.restype  = ctypes.c_int
+
+_lib.eht_reseed_count.argtypes = [ctypes.c_void_p]
+_lib.eht_reseed_count.restype  = ctypes.c_size_t
+
 _lib.eht_level_stats.argtypes = [ctypes.c_void_p,
                                   ctypes.POINTER(_EHTLevelInfo),
                                   ctypes.c_size_t]
 _lib.eht_level_stats.restype  = None
 
+_lib.eht_rebuild_stats.argtypes = [ctypes.c_void_p,
+                                    ctypes.POINTER(_EHTRebuildStats)]
+_lib.eht_rebuild_stats.restype  = None
+
+_lib.eht_probe_histogram.argtypes = [ctypes.c_void_p,
+                                      ctypes.POINTER(ctypes.c_size_t),
+                                      ctypes.c_size_t]
+_lib.eht_probe_histogram.restype  = ctypes.c_size_t
+
+_lib.eht_probe_histogram_step.argtypes = [ctypes.c_void_p, ctypes.c_uint64,
+                                           ctypes.c_size_t,
+                                           ctypes.POINTER(ctypes.c_size_t),
+                                           ctypes.c_size_t]
+_lib.eht_probe_histogram_step.restype  = ctypes.c_uint64
+
+_lib.eht_lookup_probes.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                    ctypes.POINTER(ctypes.c_size_t)]
+_lib.eht_lookup_probes.restype  = ctypes.c_size_t
+
 # -- Iteration --
 _lib.eht_iter_create.argtypes  = [ctypes.c_void_p]
 _lib.eht_iter_create.restype   = ctypes.c_void_p
@@ -122,6 +258,26 @@ _lib.eht_iter_next.restype     = ctypes.c_int
 _lib.eht_iter_destroy.argtypes = [ctypes.c_void_p]
 _lib.eht_iter_destroy.restype  = None
 
+# -- Hash join --
+_lib.eht_join_build.argtypes = [ctypes.POINTER(ctypes.c_char_p),
+                                ctypes.c_size_t, ctypes.c_uint]
+_lib.eht_join_build.restype  = ctypes.c_void_p
+
+_lib.eht_join_probe.argtypes = [ctypes.c_void_p,
+                                ctypes.POINTER(ctypes.c_char_p),
+                                ctypes.c_size_t, ctypes.c_uint,
+                                ctypes.POINTER(_EHTJoinPairs)]
+_lib.eht_join_probe.restype  = ctypes.c_int
+
+_lib.eht_join_keys.argtypes = [ctypes.c_void_p]
+_lib.eht_join_keys.restype  = ctypes.c_size_t
+
+_lib.eht_join_destroy.argtypes = [ctypes.c_void_p]
+_lib.eht_join_destroy.restype  = None
+
+_lib.eht_join_pairs_free.argtypes = [ctypes.POINTER(_EHTJoinPairs)]
+_lib.eht_join_pairs_free.restype  = None
+
 
 # -------------------------------------------------------------------
 # Serialisation helpers
@@ -156,13 +312,72 @@ class ElasticHashTable:
     Parameters
     ----------
     capacity : int
-        Initial total slot count across all geometric levels.
+        Initial total slot count across all geometric levels.  Sixteen or
+        fewer starts a compact tiny table that grows into levels on demand.
+    adaptive : bool
+        Promote frequently read keys from deep levels to shallower ones.
+    robin_hood : bool
+        Robin Hood displacement within each level: slower inserts,
+        shorter and less variable lookups.
+    insert_only : bool
+        Reject deletes so the table carries no tombstone bookkeeping and
+        packs levels tighter before growing.
+    ordered : bool
+        Dense insertion-ordered entry array with 4-byte index slots, like
+        CPython's dict.  Iteration follows insertion order.
+    compact : bool
+        Ordered layout whose keys and values live in one arena addressed
+        by 32-bit offsets (implies ``ordered``).
+    prefetch : bool
+        Prefetch the first probe slot of every level a lookup may visit,
+        overlapping the cache misses of miss-heavy workloads.
+    seeded : bool
+        Random per-table hash seeds, with a rebuild under new seeds when
+        probe lengths look adversarial.  ``"fnv1a"`` becomes ``"wyhash"``.
+    hash : str or callable
+        Key hash: ``"fnv1a"`` (default), ``"wyhash"``, ``"crc32c"``, or a
+        function mapping the key's UTF-8 bytes to an int (taken mod 2**64).
     """
 
-    __slots__ = ("_handle",)
-
-    def __init__(self, capacity: int = 1024) -> None:
-        self._handle = _lib.eht_create(max(capacity, 64))
+    __slots__ = ("_handle", "_hash_cb")
+
+    def __init__(self, capacity: int = 1024, *,
+                 adaptive: bool = False,
+                 robin_hood: bool = False,
+                 insert_only: bool = False,
+                 ordered: bool = False,
+                 compact: bool = False,
+                 prefetch: bool = False,
+                 seeded: bool = False,
+                 hash: Any = "fnv1a") -> None:
+        self._handle = None
+        flags = 0
+        if adaptive:
+            flags |= EHT_FLAG_ADAPTIVE
+        if robin_hood:
+            flags |= EHT_FLAG_ROBIN_HOOD
+        if insert_only:
+            flags |= EHT_FLAG_INSERT_ONLY
+        if ordered:
+            flags |= EHT_FLAG_ORDERED
+        if compact:
+            flags |= EHT_FLAG_COMPACT
+        if prefetch:
+            flags |= EHT_FLAG_PREFETCH
+        if seeded:
+            flags |= EHT_FLAG_SEEDED
+        if callable(hash):
+            fn = hash
+            self._hash_cb = _EHTHashFn(
+                lambda k, n, ctx: fn(ctypes.string_at(k, n)) & 0xFFFFFFFFFFFFFFFF)
+            kind = EHT_HASH_CUSTOM
+        else:
+            if hash not in _HASH_KINDS:
+                raise ValueError(f"unknown hash {hash!r}")
+            self._hash_cb = _EHTHashFn(0)
+            kind = _HASH_KINDS[hash]
+        self._handle = _lib.eht_create_with_hash(max(capacity, 0), flags,
+                                                 kind, self._hash_cb, None)
         if not self._handle:
             raise MemoryError("Failed to allocate ElasticHashTable")
 
@@ -179,6 +394,7 @@ class ElasticHashTable:
         vb = _ser_value(value)
         rc = _lib.eht_insert(self._handle, kb, vb, len(vb))
         if rc < 0:
+            self._check_mutable()
             raise MemoryError("eht_insert failed (allocation error)")
 
     def get(self, key: Any, default: Any = None) -> Any:
@@ -194,10 +410,147 @@ class ElasticHashTable:
         buf = (ctypes.c_char * val_len.value).from_address(val_ptr.value)
         return _de_value(bytes(buf))
 
+    # ---- Precomputed hashes ------------------------------------------
+
+    @staticmethod
+    def hash_key(key: Any) -> int:
+        """The default FNV-1a hash of *key* (``eht_hash``): what tables
+        on the default hash use, but not wyhash, CRC32C, callback or
+        seeded tables (see :meth:`table_hash`)."""
+        return _lib.eht_hash(_key_to_bytes(key))
+
+    def insert_with_hash(self, key: Any, h: int, value: Any) -> None:
+        """Like :meth:`insert`, with *h* from :meth:`table_hash`."""
+        vb = _ser_value(value)
+        rc = _lib.eht_insert_with_hash(self._handle, _key_to_bytes(key), h,
+                                       vb, len(vb))
+        if rc < 0:
+            self._check_mutable()
+            raise MemoryError("eht_insert failed (allocation error)")
+
+    def get_with_hash(self, key: Any, h: int, default: Any = None) -> Any:
+        """Like :meth:`get`, with *h* from :meth:`table_hash`."""
+        return self.get_hashed(key, h, default)
+
+    def delete_with_hash(self, key: Any, h: int) -> bool:
+        """Like :meth:`delete`, with *h* from :meth:`table_hash`."""
+        rc = _lib.eht_delete_with_hash(self._handle, _key_to_bytes(key), h)
+        if rc < 0:
+            self._check_mutable()
+            raise TypeError("table is insert-only; deletion not supported")
+        return bool(rc)
+
+    @staticmethod
+    def hash_keys(keys: Iterable[Any]) -> List[int]:
+        """``hash_key`` for many keys at once (``eht_hash_many``)."""
+        kbs = [_key_to_bytes(k) for k in keys]
+        n = len(kbs)
+        out = (ctypes.c_uint64 * n)()
+        _lib.eht_hash_many((ctypes.c_char_p * n)(*kbs), n, out)
+        return list(out)
+
+    def table_hash(self, key: Any) -> int:
+        """The hash this table uses for *key* (``eht_table_hash``)."""
+        return _lib.eht_table_hash(self._handle, _key_to_bytes(key))
+
+    # ---- Batch operations --------------------------------------------
+
+    def insert_many(self, items: Iterable[Tuple[Any, Any]]) -> None:
+        """Insert or update every (key, value) pair, in order."""
+        pairs = [(_key_to_bytes(k), _ser_value(v)) for k, v in items]
+        n = len(pairs)
+        keys = (ctypes.c_char_p * n)(*(k for k, _ in pairs))
+        vals = (ctypes.c_void_p * n)(
+            *(ctypes.cast(ctypes.c_char_p(v), ctypes.c_void_p) for _, v in pairs))
+        lens = (ctypes.c_size_t * n)(*(len(v) for _, v in pairs))
+        if _lib.eht_insert_many(self._handle, keys, n, vals, lens) < 0:
+            self._check_mutable()
+            raise MemoryError("eht_insert_many failed (allocation error)")
+
+    def get_many(self, keys: Iterable[Any], default: Any = None) -> List[Any]:
+        """Values for *keys*, with *default* for the missing ones."""
+        kbs = [_key_to_bytes(k) for k in keys]
+        n = len(kbs)
+        vals = (ctypes.c_void_p * n)()
+        lens = (ctypes.c_size_t * n)()
+        found = (ctypes.c_int * n)()
+        _lib.eht_get_many(self._handle, (ctypes.c_char_p * n)(*kbs), n,
+                          vals, lens, found)
+        return [_de_value(ctypes.string_at(vals[i], lens[i])) if found[i]
+                else default for i in range(n)]
+
+    # ---- Pipelined lookups -------------------------------------------
+
+    def prefetch(self, key: Any) -> int:
+        """Start fetching *key*'s probe slots; returns a token for
+        :meth:`get_hashed`."""
+        return _lib.eht_prefetch(self._handle, _key_to_bytes(key))
+
+    def get_hashed(self, key: Any, token: int, default: Any = None) -> Any:
+        """Like :meth:`get`, reusing the hash from :meth:`prefetch` or
+        :meth:`table_hash`."""
+        kb = _key_to_bytes(key)
+        val_ptr = ctypes.c_void_p()
+        val_len = ctypes.c_size_t()
+        found = _lib.eht_get_hashed(self._handle, kb, token,
+                                     ctypes.byref(val_ptr),
+                                     ctypes.byref(val_len))
+        if not found:
+            return default
+        buf = (ctypes.c_char * val_len.value).from_address(val_ptr.value)
+        return _de_value(bytes(buf))
+
     def delete(self, key: Any) -> bool:
         """Remove *key*.  Returns True if it was present."""
         kb = _key_to_bytes(key)
-        return bool(_lib.eht_delete(self._handle, kb))
+        rc = _lib.eht_delete(self._handle, kb)
+        if rc < 0:
+            self._check_mutable()
+            raise TypeError("table is insert-only; deletion not supported")
+        return bool(rc)
+
+    def reserve(self, n: int) -> None:
+        """Grow, in one rebuild, to hold *n* keys without another."""
+        if _lib.eht_reserve(self._handle, max(n, 0)) < 0:
+            self._check_mutable()
+            raise MemoryError("eht_reserve failed (allocation error)")
+
+    # ---- Freezing ----------------------------------------------------
+
+    def freeze(self, perfect: bool = False) -> None:
+        """Repack into the read-only layout (``eht_freeze``), or with
+        *perfect* behind a minimal perfect hash (``eht_freeze_perfect``);
+        later inserts and deletes raise TypeError."""
+        if not perfect:
+            if _lib.eht_freeze(self._handle) < 0:
+                raise MemoryError("eht_freeze failed (allocation error)")
+        elif _lib.eht_freeze_perfect(self._handle) < 0:
+            raise MemoryError("eht_freeze_perfect failed (allocation error, "
+                              "keys with equal hashes, or keys stored "
+                              "under another hash)")
+
+    @property
+    def perfect_index_bytes(self) -> int:
+        """Size of the perfect-hash index; 0 unless frozen perfect."""
+        return _lib.eht_perfect_index_bytes(self._handle)
+
+    def write_c(self, path: Any, name: str) -> None:
+        """Write the table as C source defining ``const EHTStaticTable
+        name`` (``eht_write_c``); freezes it perfect first, or, if it is
+        tiny, writes a promoted copy and only freezes it.  Values are
+        stored pickled."""
+        if _lib.eht_write_c(self._handle, os.fsencode(path),
+                            name.encode()) < 0:
+            raise OSError(f"eht_write_c failed for {path!s} (custom hash, "
+                          f"allocation error or unwritable path)")
+
+    @property
+    def frozen(self) -> bool:
+        return bool(_lib.eht_is_frozen(self._handle))
+
+    def _check_mutable(self) -> None:
+        if self.frozen:
+            raise TypeError("table is frozen")
 
     # ---- Dict interface ----------------------------------------------
 
@@ -304,6 +657,11 @@ class ElasticHashTable:
     def num_levels(self) -> int:
         return _lib.eht_num_levels(self._handle)
 
+    @property
+    def reseed_count(self) -> int:
+        """Rebuilds under new level salts so far (``seeded`` tables)."""
+        return _lib.eht_reseed_count(self._handle)
+
     @property
     def load_factor(self) -> float:
         cap = self.capacity
@@ -326,6 +684,37 @@ class ElasticHashTable:
             for i in range(n)
         ]
 
+    def rebuild_stats(self) -> dict:
+        """Rebuilds so far: count, total and longest time in seconds."""
+        st = _EHTRebuildStats()
+        _lib.eht_rebuild_stats(self._handle, ctypes.byref(st))
+        return {"count": st.count,
+                "total": st.total_ns / 1e9,
+                "max":   st.max_ns / 1e9}
+
+    def probe_histogram(self, n: int = 32, chunk: int = 0) -> list[int]:
+        """Live entries by lookup probe count: item i counts those
+        taking i + 1 probes, the last item also the longer ones.  Empty
+        counts for tiny and frozen tables.  With chunk, the table is
+        walked that many slots at a time."""
+        arr = (ctypes.c_size_t * n)()
+        if not chunk:
+            _lib.eht_probe_histogram(self._handle, arr, n)
+            return list(arr)
+        cursor = _lib.eht_probe_histogram_step(self._handle, 0, chunk, arr, n)
+        while cursor:
+            cursor = _lib.eht_probe_histogram_step(self._handle, cursor, chunk,
+                                                   arr, n)
+        return list(arr)
+
+    def lookup_probes(self, key: Any) -> tuple[int, int]:
+        """(probes, levels probed) of a lookup of key, hit or miss,
+        without side effects.  (0, 0) for tiny and frozen tables."""
+        levels = ctypes.c_size_t()
+        probes = _lib.eht_lookup_probes(self._handle, _key_to_bytes(key),
+                                        ctypes.byref(levels))
+        return probes, levels.value
+
     def print_stats(self) -> None:
         """Print a full diagnostic summary."""
         count = len(self)
@@ -340,3 +729,53 @@ class ElasticHashTable:
                   f"{s['count']:>8,} live ({s['load']:5.1%}) | "
                   f"{tomb:>5,} tombstones")
         print(f"{'=' * 64}")
+
+
+# -------------------------------------------------------------------
+# Hash join
+# -------------------------------------------------------------------
+
+class HashJoin:
+    """The build side of an equi-join on a key column (``eht_join_*``).
+
+    >>> j = HashJoin(["a", "b", "a"])
+    >>> j.probe(["a", "c"])
+    ([0, 2], [0, 0])
+
+    Rows are list positions; gather payload columns by those indices.
+    """
+
+    def __init__(self, build_keys: Iterable[Any], threads: int = 1) -> None:
+        kbs = [_key_to_bytes(k) for k in build_keys]
+        n = len(kbs)
+        self._handle = _lib.eht_join_build((ctypes.c_char_p * n)(*kbs), n,
+                                           max(threads, 1))
+        if not self._handle:
+            raise MemoryError("eht_join_build failed (allocation error)")
+
+    def probe(self, keys: Iterable[Any],
+              threads: int = 1) -> Tuple[List[int], List[int]]:
+        """(build_rows, probe_rows): one entry per matching pair."""
+        kbs = [_key_to_bytes(k) for k in keys]
+        n = len(kbs)
+        pairs = _EHTJoinPairs()
+        try:
+            if _lib.eht_join_probe(self._handle, (ctypes.c_char_p * n)(*kbs),
+                                   n, max(threads, 1),
+                                   ctypes.byref(pairs)) < 0:
+                raise MemoryError("eht_join_probe failed (allocation error)")
+            return pairs.build[:pairs.n], pairs.probe[:pairs.n]
+        finally:
+            _lib.eht_join_pairs_free(ctypes.byref(pairs))
+
+    @property
+    def keys(self) -> int:
+        """Distinct keys on the build side."""
+        return _lib.eht_join_keys(self._handle)
+
+    def close(self) -> None:
+        if getattr(self, "_handle", None):
+            _lib.eht_join_destroy(self._handle)
+            self._handle = None
+
+    __del__ = close
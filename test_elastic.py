@@ -4,10 +4,17 @@ Test suite for the Elastic Hash Table (C + Python ctypes).
 
 Run:  python test_elastic.py
 """
+import os
+import pickle
+import random
+import shutil
+import struct
+import subprocess
+import tempfile
 import time
 import sys
 
-from elastic_hash_table import ElasticHashTable
+from elastic_hash_table import ElasticHashTable, HashJoin
 
 
 def test_basic_insert_get():
@@ -163,8 +170,14 @@ def test_geometric_distribution(t):
     loads = [s["load"] for s in stats]
     assert loads[0] >= loads[-1], \
         f"Level 0 ({loads[0]:.1%}) should be >= last level ({loads[-1]:.1%})"
+    # The ε floor caps each level's probe budget at 3 + 3·ln²64 ≈ 55,
+    # however full the level
+    used = sum(1 for s in stats if s["count"])
+    hist = t.probe_histogram(55 * used + 1)
+    assert hist[-1] == 0, f"a hit took over 55 probes per level ({used} levels)"
     t.print_stats()
-    print("[PASS] Geometric load distribution (level 0 densest)")
+    print("[PASS] Geometric load distribution (level 0 densest, "
+          "≤ 55 probes per level)")
 
 
 def test_auto_resize():
@@ -199,6 +212,1182 @@ def test_large_values():
     print("[PASS] Large value (10 k element list)")
 
 
+def test_adaptive_promotion():
+    t = ElasticHashTable(2048, adaptive=True)
+    n = int(2048 * 0.85)
+    for i in range(n):
+        t[f"hot_{i}"] = i
+    # Free up slots in the shallow levels so hot keys have somewhere to go
+    for i in range(0, n, 3):
+        del t[f"hot_{i}"]
+    live = [i for i in range(n) if i % 3]
+    deep_before = sum(s["count"] for s in t.level_stats()[1:])
+
+    for _ in range(10):
+        for i in live:
+            assert t[f"hot_{i}"] == i
+    deep_after = sum(s["count"] for s in t.level_stats()[1:])
+
+    assert len(t) == len(live)
+    assert deep_after < deep_before, (deep_before, deep_after)
+    assert dict(t.items()) == {f"hot_{i}": i for i in live}
+    print(f"[PASS] Adaptive promotion: {deep_before:,} → {deep_after:,} "
+          f"entries below level 0")
+
+
+def test_robin_hood():
+    for adaptive in (False, True):
+        t = ElasticHashTable(1024, robin_hood=True, adaptive=adaptive)
+        expected = {}
+        for i in range(3000):
+            t[f"rh_{i}"] = i
+            expected[f"rh_{i}"] = i
+        for i in range(0, 3000, 4):
+            del t[f"rh_{i}"]
+            del expected[f"rh_{i}"]
+        for i in range(0, 3000, 8):
+            t[f"rh_{i}"] = -i
+            expected[f"rh_{i}"] = -i
+        for _ in range(3):
+            for k, v in expected.items():
+                assert t[k] == v, k
+        for i in range(3000, 3500):
+            assert f"rh_{i}" not in t
+        assert len(t) == len(expected)
+        assert dict(t.items()) == expected
+    print("[PASS] Robin Hood mode (insert / delete / re-insert / adaptive)")
+
+
+def test_insert_only():
+    t = ElasticHashTable(1000, insert_only=True)
+    for i in range(940):
+        t[f"io_{i}"] = i
+    assert t.capacity == 1000, "insert-only tables pack to 95% before growing"
+    t["io_0"] = "updated"
+    assert t["io_0"] == "updated"
+
+    raised = False
+    try:
+        del t["io_1"]
+    except TypeError:
+        raised = True
+    assert raised and t["io_1"] == 1
+    assert all(s["tombstones"] == 0 for s in t.level_stats())
+
+    for i in range(940, 3000):
+        t[f"io_{i}"] = i
+    assert len(t) == 3000 and t.capacity > 1000
+    assert t["io_2999"] == 2999
+    print("[PASS] Insert-only mode (tighter packing, delete rejected)")
+
+
+def test_tiny_table():
+    t = ElasticHashTable(4)
+    assert t.num_levels == 0 and t.capacity == 4
+    for i in range(16):
+        t[f"tiny_{i}"] = i
+    assert t.num_levels == 0 and t.capacity == 16
+    assert all(t[f"tiny_{i}"] == i for i in range(16))
+
+    del t["tiny_3"]
+    assert "tiny_3" not in t and len(t) == 15
+    t["tiny_0"] = "updated"
+    assert t["tiny_0"] == "updated"
+    assert set(t) == {f"tiny_{i}" for i in range(16) if i != 3}
+
+    for i in range(16, 100):
+        t[f"tiny_{i}"] = i
+    assert t.num_levels > 0 and t.capacity >= 64
+    assert len(t) == 99 and t["tiny_0"] == "updated"
+    assert all(t[f"tiny_{i}"] == i for i in range(1, 100) if i != 3)
+    print(f"[PASS] Tiny table: 4 → 16 flat slots, promoted to "
+          f"{t.num_levels} levels at {t.capacity} slots")
+
+
+def test_ordered_layout():
+    for cap in (8, 256):
+        t = ElasticHashTable(cap, ordered=True)
+        expected = {}
+        for i in range(2000):
+            t[f"ord_{i}"] = i
+            expected[f"ord_{i}"] = i
+        for i in range(0, 2000, 3):
+            del t[f"ord_{i}"]
+            del expected[f"ord_{i}"]
+        t["ord_1"] = "updated"          # update keeps position
+        expected["ord_1"] = "updated"
+        t["ord_0"] = "back"             # re-insert goes to the end
+        expected["ord_0"] = "back"
+
+        assert len(t) == len(expected)
+        assert list(t.items()) == list(expected.items())
+        assert all(t[k] == v for k, v in expected.items())
+        assert "ord_3" not in t
+    print("[PASS] Ordered layout (insertion-order iteration)")
+
+
+def test_compact_layout():
+    t = ElasticHashTable(8, compact=True)
+    expected = {}
+    for i in range(3000):
+        t[f"cmp_{i}"] = "v" * (i % 300)     # varint lengths past 127
+        expected[f"cmp_{i}"] = "v" * (i % 300)
+    for i in range(0, 3000, 2):
+        del t[f"cmp_{i}"]
+        del expected[f"cmp_{i}"]
+    for _ in range(5):                      # stale records force compaction
+        for i in range(1, 3000, 4):
+            t[f"cmp_{i}"] = [i, "x" * 50]
+            expected[f"cmp_{i}"] = [i, "x" * 50]
+    t[""] = b"\x00\x01"                    # empty key, binary value
+    expected[""] = b"\x00\x01"
+
+    assert len(t) == len(expected)
+    assert list(t.items()) == list(expected.items())
+    assert "cmp_0" not in t
+    print("[PASS] Compact layout (arena records, 32-bit references)")
+
+
+def test_prefetch_mode():
+    for ordered in (False, True):
+        t = ElasticHashTable(64, prefetch=True, ordered=ordered)
+        for i in range(5000):
+            t[f"pf_{i}"] = i
+        for i in range(0, 5000, 5):
+            del t[f"pf_{i}"]
+        assert len(t) == 4000
+        assert all(t[f"pf_{i}"] == i for i in range(1, 5000, 5))
+        assert not any(f"pf_miss_{i}" in t for i in range(2000))
+        assert "pf_0" not in t
+    print("[PASS] Prefetch mode (hits and misses across levels)")
+
+
+def test_prefetch_tokens():
+    for cap in (8, 1024):
+        t = ElasticHashTable(cap)
+        tokens = {}
+        for i in range(12):                     # issued while still tiny
+            t[f"tok_{i}"] = i
+            tokens[f"tok_{i}"] = t.prefetch(f"tok_{i}")
+        for i in range(12, 3000):
+            t[f"tok_{i}"] = i
+        tokens["tok_absent"] = t.prefetch("tok_absent")
+        # Tokens survive the resizes in between
+        assert all(t.get_hashed(k, tok) == int(k[4:])
+                   for k, tok in tokens.items() if k != "tok_absent")
+        assert t.get_hashed("tok_absent", tokens["tok_absent"], "none") == "none"
+        assert t.prefetch("tok_5") == tokens["tok_5"]
+    print("[PASS] eht_prefetch / eht_get_hashed tokens")
+
+
+def test_precomputed_hash():
+    a = ElasticHashTable(8)
+    b = ElasticHashTable(256, robin_hood=True)
+    hashes = {f"ph_{i}": ElasticHashTable.hash_key(f"ph_{i}")
+              for i in range(2000)}
+    for k, h in hashes.items():                 # one hash, two tables
+        a.insert_with_hash(k, h, k)
+        b.insert_with_hash(k, h, k.upper())
+    assert a["ph_7"] == "ph_7" and b["ph_7"] == "PH_7"
+    assert all(a.get_with_hash(k, h) == k for k, h in hashes.items())
+    assert a.prefetch("ph_9") == hashes["ph_9"]
+    for i in range(0, 2000, 2):
+        assert b.delete_with_hash(f"ph_{i}", hashes[f"ph_{i}"])
+    assert len(b) == 1000 and "ph_0" not in b and b["ph_1"] == "PH_1"
+
+    # The table's own hash, whatever the layout: keys survive compact
+    # rebuilds, tiny-table promotion and both freezes
+    for kw in ({"compact": True}, {"hash": "wyhash"},
+               {"compact": True, "seeded": True}):
+        d = ElasticHashTable(8, **kw)           # starts tiny
+        hs = {f"pt_{i}": d.table_hash(f"pt_{i}") for i in range(3000)}
+        for k, h in hs.items():
+            d.insert_with_hash(k, h, k)
+        for i in range(0, 3000, 3):
+            assert d.delete_with_hash(f"pt_{i}", hs.pop(f"pt_{i}"))
+        for perfect in (None, False, True):
+            if perfect is not None:
+                d.freeze(perfect=perfect)
+            assert len(d) == len(hs), (kw, perfect)
+            assert all(d.get_with_hash(k, h) == k == d[k]
+                       for k, h in hs.items()), (kw, perfect)
+
+    # Levels mix the whole hash: hashes differing only in their high bits
+    # place as well as FNV's
+    means = []
+    for hash in ("fnv1a", lambda kb: int(kb[3:]) << 40):
+        c = ElasticHashTable(4096, hash=hash)
+        for i in range(3500):
+            c.insert_with_hash(f"hb_{i}", c.table_hash(f"hb_{i}"), i)
+        assert all(c[f"hb_{i}"] == i for i in range(3500))
+        hist = c.probe_histogram(64)
+        means.append(sum((j + 1) * n for j, n in enumerate(hist)) / len(c))
+    assert means[1] < 1.25 * means[0], means
+    print("[PASS] Precomputed hashes (eht_hash + *_with_hash)")
+
+
+def test_batch_operations():
+    rng = random.Random(88)
+    keys = ["".join(chr(rng.randint(1, 0x2FF)) for _ in range(rng.randint(0, 70)))
+            for _ in range(1000)]
+    # Every batch size and key length hashes exactly like eht_hash
+    for n in (0, 1, 3, 4, 7, 8, 15, 16, 17, len(keys)):
+        assert ElasticHashTable.hash_keys(keys[:n]) == \
+            [ElasticHashTable.hash_key(k) for k in keys[:n]]
+
+    t = ElasticHashTable(8)
+    t.insert_many((f"bm_{i}", i) for i in range(3000))
+    t.insert_many([("bm_5", "last"), ("bm_5", "wins")])
+    assert len(t) == 3000 and t["bm_5"] == "wins"
+    got = t.get_many([f"bm_{i}" for i in range(0, 3100, 7)], default="-")
+    assert got == [i if i < 3000 else "-" for i in range(0, 3100, 7)]
+    assert t.get_many([]) == []
+    print("[PASS] Batch operations (eht_hash_many / get_many / insert_many)")
+
+
+def test_hash_selection():
+    seen = []
+    def bucketed(kb):                           # heavy collisions on purpose
+        seen.append(kb)
+        return int(kb[3:]) % 97 if kb[3:].isdigit() else len(kb)
+
+    for h in ("fnv1a", "wyhash", "crc32c", bucketed):
+        t = ElasticHashTable(64, hash=h)
+        for i in range(2000):
+            t[f"hs_{i}"] = i
+        for i in range(0, 2000, 3):
+            del t[f"hs_{i}"]
+        assert len(t) == 1333
+        assert all(t[f"hs_{i}"] == i for i in range(1, 2000, 3))
+        assert "hs_0" not in t and "hs_x" not in t
+        # Precomputed-hash calls take the table's own hash
+        hk = t.table_hash("hs_1")
+        assert t.get_with_hash("hs_1", hk) == 1
+        assert t.prefetch("hs_1") == hk
+    assert seen and seen[0] == b"hs_0"
+    assert ElasticHashTable(8, hash="wyhash").table_hash("abc") != \
+        ElasticHashTable.hash_key("abc")
+    print("[PASS] Hash selection (fnv1a / wyhash / crc32c / callback)")
+
+
+def test_seeded_tables():
+    a = ElasticHashTable(64, seeded=True)
+    b = ElasticHashTable(64, seeded=True)
+    assert a.table_hash("sd") != b.table_hash("sd")
+    assert a.table_hash("sd") == a.table_hash("sd")
+
+    # A hash with few distinct values defeats every seed: the table must
+    # give up reseeding after a bounded number of tries and stay correct.
+    for kw in ({}, {"ordered": True}, {"robin_hood": True}):
+        t = ElasticHashTable(64, seeded=True, hash=lambda kb: int(kb[3:]) % 61,
+                             **kw)
+        for i in range(3000):
+            t[f"sd_{i}"] = i
+        for i in range(0, 3000, 2):
+            del t[f"sd_{i}"]
+        assert len(t) == 1500
+        assert all(t[f"sd_{i}"] == i for i in range(1, 3000, 2))
+        hk = t.table_hash("sd_1")
+        assert t.get_with_hash("sd_1", hk) == 1
+        assert 0 < t.reseed_count <= 16, t.reseed_count
+    assert ElasticHashTable(64).reseed_count == 0
+    print("[PASS] Seeded tables (random seeds, bounded reseeding)")
+
+
+def test_table_diagnostics():
+    for kw in ({}, {"robin_hood": True}, {"ordered": True},
+               {"compact": True}):
+        t = ElasticHashTable(64, **kw)
+        for i in range(5000):
+            t[f"dg_{i}"] = i
+        for i in range(0, 5000, 3):
+            del t[f"dg_{i}"]
+        hist = t.probe_histogram(64)
+        assert sum(hist) == len(t), kw
+        if not kw.get("robin_hood"):    # which evens runs out to the budget
+            assert hist[0] == max(hist), (kw, hist[:8])
+        rb = t.rebuild_stats()
+        assert rb["count"] > 0 and rb["total"] >= rb["max"] > 0, (kw, rb)
+        assert t.probe_histogram(4)[3] == sum(hist[3:])
+        assert t.probe_histogram(64, chunk=100) == hist
+
+    tiny = ElasticHashTable(4)
+    tiny["a"] = 1
+    assert tiny.probe_histogram() == [0] * 32
+    assert tiny.rebuild_stats()["count"] == 0
+    print(f"[PASS] Diagnostics: probe histogram, rebuild times "
+          f"({rb['count']} rebuilds, longest {rb['max'] * 1e3:.2f} ms)")
+
+
+def test_level_hints():
+    worst = (0.0, 0, 0.0)
+    for kw in ({}, {"robin_hood": True}, {"adaptive": True},
+               {"robin_hood": True, "adaptive": True}):
+        t = ElasticHashTable(8192, **kw)
+        live = {}
+        for i in range(7300):
+            t[f"lh_{i}"] = live[f"lh_{i}"] = i
+        for i in range(0, 7300, 4):
+            del t[f"lh_{i}"], live[f"lh_{i}"]
+        deep = [k for k in live if t.lookup_probes(k)[1] > 1]
+        for _ in range(10):                 # promotes them when adaptive
+            for k in deep:
+                assert t[k] == live[k], (kw, k)
+        after = sum(1 for k in deep if t.lookup_probes(k)[1] > 1)
+        if kw.get("adaptive"):
+            assert after < len(deep), (kw, len(deep), after)
+        # The refills land in tombstones, and in Robin Hood mode displace
+        # residents to deeper levels
+        for i in range(7300, 9125):
+            t[f"lh_{i}"] = live[f"lh_{i}"] = i
+
+        assert len(t) == len(live) and dict(t.items()) == live, kw
+        assert all(t[k] == v for k, v in live.items()), kw
+
+        # Without hints every miss probes every level in use
+        used = sum(1 for s in t.level_stats() if s["count"])
+        levels = [t.lookup_probes(f"nx_{i}")[1] for i in range(4000)]
+        mean = sum(levels) / len(levels)
+        to_last = sum(1 for n in levels if n == used) / len(levels)
+        assert used >= 4, (kw, used)
+        assert mean < used - 1 and to_last < 0.25, (kw, used, mean, to_last)
+        worst = max(worst, (mean, used, to_last))
+
+    tiny = ElasticHashTable(4)
+    tiny["a"] = 1
+    assert tiny.lookup_probes("a") == tiny.lookup_probes("b") == (0, 0)
+    print(f"[PASS] Level hints: misses probe at most {worst[0]:.2f} of "
+          f"{worst[1]} levels, {worst[2]:.0%} reach the last; no key lost")
+
+
+def test_hash_join():
+    t = ElasticHashTable(64)
+    t.reserve(10000)
+    cap, rebuilds = t.capacity, t.rebuild_stats()["count"]
+    assert cap >= 10000 and rebuilds == 1
+    for i in range(10000):
+        t[f"rs_{i}"] = i
+    assert t.capacity == cap and t.rebuild_stats()["count"] == rebuilds
+    t.reserve(100)                               # never shrinks
+    assert t.capacity == cap
+
+    rng = random.Random(7)
+    build = [rng.randrange(30000) for _ in range(60000)]
+    probe = [rng.randrange(40000) for _ in range(50000)]
+    rows = {}
+    for b, k in enumerate(build):
+        rows.setdefault(k, []).append(b)
+    want = sorted((b, p) for p, k in enumerate(probe) for b in rows.get(k, ()))
+    for threads in (1, 4):
+        j = HashJoin(build, threads)
+        assert j.keys == len(rows)
+        bs, ps = j.probe(probe, threads)
+        assert sorted(zip(bs, ps)) == want, threads
+        for i in range(1, len(ps)):             # build rows ascending
+            assert ps[i] != ps[i - 1] or bs[i] > bs[i - 1]
+        if threads == 1:
+            assert ps == sorted(ps)
+        j.close()
+
+    assert HashJoin([]).probe(["x"]) == ([], [])
+    assert HashJoin(["a", "b", "a"]).probe(["a", "c", "b"]) == \
+        ([0, 2, 1], [0, 0, 2])
+    print(f"[PASS] Hash join: {len(want):,} pairs at 1 and 4 threads, "
+          f"reserve")
+
+
+def test_freeze():
+    for kw in ({}, {"robin_hood": True}, {"ordered": True}, {"compact": True},
+               {"seeded": True}, {"hash": "crc32c"}):
+        t = ElasticHashTable(64, **kw)
+        for i in range(3000):
+            t[f"fz_{i}"] = {"i": i}
+        for i in range(0, 3000, 4):
+            del t[f"fz_{i}"]
+        before = list(t.keys())
+        t.freeze()
+        assert t.frozen and len(t) == 2250
+        assert list(t.keys()) == before         # iteration order kept
+        assert all(t[f"fz_{i}"] == {"i": i} for i in range(1, 3000, 4))
+        assert "fz_0" not in t and t.get("fz_4") is None
+        assert t.get_many(["fz_1", "fz_0"]) == [{"i": 1}, None]
+        assert t.get_with_hash("fz_2", t.table_hash("fz_2")) == {"i": 2}
+        for mutate in (lambda: t.insert("fz_1", 0), lambda: t.delete("fz_1"),
+                       lambda: t.insert_many([("x", 1)])):
+            try:
+                mutate()
+                assert False, "frozen table accepted a change"
+            except TypeError:
+                pass
+        assert t["fz_1"] == {"i": 1}
+        t.freeze()                              # no-op
+        assert len(t) == 2250
+
+    tiny = ElasticHashTable(8)
+    tiny["a"] = 1
+    tiny.freeze()
+    assert tiny.frozen and tiny["a"] == 1
+    try:
+        tiny["b"] = 2
+        assert False
+    except TypeError:
+        pass
+    print("[PASS] eht_freeze (packed read-only layout)")
+
+
+def test_freeze_perfect():
+    for kw, first in (({}, False), ({"ordered": True}, False),
+                      ({"hash": "wyhash"}, True), ({"compact": True}, True)):
+        t = ElasticHashTable(64, **kw)
+        for i in range(5000):
+            t[f"mp_{i}"] = i
+        for i in range(0, 5000, 5):
+            del t[f"mp_{i}"]
+        before = list(t.keys())
+        if first:
+            t.freeze()                          # perfect from frozen, too
+        t.freeze(perfect=True)
+        assert t.frozen and len(t) == 4000 and list(t.keys()) == before
+        assert all(t[f"mp_{i}"] == i for i in range(1, 5000, 5))
+        assert "mp_0" not in t and t.get("nope") is None
+        assert t.get_hashed("mp_3", t.prefetch("mp_3")) == 3
+        bits = 8 * t.perfect_index_bytes / len(t)
+        assert 0 < bits < 4, bits
+        try:
+            t["mp_1"] = 0
+            assert False
+        except TypeError:
+            pass
+
+    # Equal full hashes cannot be separated; the table is left as it was
+    t = ElasticHashTable(64, hash=lambda kb: 7 if kb in (b"a", b"b") else len(kb))
+    t["a"], t["b"], t["cc"] = 1, 2, 3
+    try:
+        t.freeze(perfect=True)
+        assert False
+    except MemoryError:
+        pass
+    assert not t.frozen and t["b"] == 2 and t.perfect_index_bytes == 0
+    t["d"] = 4
+
+    # Frozen slots keep half of each hash, so a frozen table rehashes its
+    # keys; keys stored under another hash refuse the conversion instead
+    # of getting lost in it
+    t = ElasticHashTable(64)
+    for i in range(1999):
+        t.insert_with_hash(f"fh_{i}", i << 40, i)
+    t.freeze()
+    try:
+        t.freeze(perfect=True)
+        assert False
+    except MemoryError:
+        pass
+    assert t.frozen and t.perfect_index_bytes == 0
+    assert all(t.get_with_hash(f"fh_{i}", i << 40) == i for i in range(1999))
+    print("[PASS] eht_freeze_perfect (minimal perfect hash)")
+
+
+STATIC_DRIVER = r"""
+#include "elastic_hash_table.h"
+#include <stdio.h>
+extern const EHTStaticTable TABLE;
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        const void* v; size_t n;
+        if (!eht_static_get(&TABLE, argv[i], &v, &n)) { puts("-"); continue; }
+        for (size_t j = 0; j < n; ++j) printf("%02x", ((const unsigned char*)v)[j]);
+        putchar('\n');
+    }
+    return 0;
+}
+"""
+
+
+def test_static_codegen():
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if not cc:
+        print("[SKIP] eht_write_c / eht_codegen (no C compiler)")
+        return
+    here = os.path.dirname(os.path.abspath(__file__))
+    lib = os.path.join(here, "elastic_hash_table.c")
+    with tempfile.TemporaryDirectory() as d:
+        def build(out, *srcs, table):
+            drv = os.path.join(d, "driver.c")
+            with open(drv, "w") as f:
+                f.write(STATIC_DRIVER.replace("TABLE", table))
+            subprocess.run([cc, "-O1", "-I", here, "-o", out, drv, *srcs, lib,
+                            "-lm"], check=True)
+
+        # From Python: values come back as the pickles the table stored
+        t = ElasticHashTable(64, hash="wyhash")
+        for i in range(3000):
+            t[f"st_{i}"] = i * 7
+        del t["st_5"]
+        t.write_c(os.path.join(d, "tab.c"), "py_tab")
+        assert t.frozen and t["st_6"] == 42
+        exe = os.path.join(d, "py")
+        build(exe, os.path.join(d, "tab.c"), table="py_tab")
+        keys = ["st_0", "st_5", "st_2999", "nope"]
+        out = subprocess.run([exe, *keys], check=True, capture_output=True,
+                             text=True).stdout.split()
+        assert pickle.loads(bytes.fromhex(out[0])) == 0
+        assert out[1] == "-" and out[3] == "-"
+        assert pickle.loads(bytes.fromhex(out[2])) == 2999 * 7
+
+        try:
+            u = ElasticHashTable(8, hash=lambda kb: len(kb))
+            u["a"] = 1
+            u.write_c(os.path.join(d, "no.c"), "no")
+            assert False
+        except OSError:
+            pass
+
+        # A tiny table is written from a promoted copy, so it stays tiny,
+        # and a frozen one stays frozen when the write fails
+        v = ElasticHashTable(8)
+        v["a"], v["b"] = 1, 2
+        v.freeze()
+        try:
+            v.write_c(d, "dir")                 # a directory: unwritable
+            assert False
+        except OSError:
+            pass
+        assert v.frozen and v.capacity <= 16 and v["b"] == 2
+        v.write_c(os.path.join(d, "tiny.c"), "tiny_tab")
+        assert v.frozen and v.capacity <= 16 and v.perfect_index_bytes == 0
+        exe = os.path.join(d, "tiny")
+        build(exe, os.path.join(d, "tiny.c"), table="tiny_tab")
+        out = subprocess.run([exe, "a", "b", "c"], check=True,
+                             capture_output=True, text=True).stdout.split()
+        assert [pickle.loads(bytes.fromhex(x)) for x in out[:2]] == [1, 2]
+        assert out[2] == "-"
+
+        # The command-line tool: later lines win, -z adds a NUL
+        tool = os.path.join(d, "eht_codegen")
+        subprocess.run([cc, "-O1", "-I", here, "-o", tool,
+                        os.path.join(here, "eht_codegen.c"), lib, "-lm"],
+                       check=True)
+        with open(os.path.join(d, "kv.txt"), "w") as f:
+            f.write("alpha\t1\r\nbeta\ttwo\nbare\nalpha\tone\n")
+        subprocess.run([tool, "-z", "-H", "crc32c", "-n", "kv",
+                        "-o", os.path.join(d, "kv.c"),
+                        os.path.join(d, "kv.txt")],
+                       check=True, capture_output=True)
+        exe = os.path.join(d, "kv")
+        build(exe, os.path.join(d, "kv.c"), table="kv")
+        out = subprocess.run([exe, "alpha", "beta", "bare", "gamma"],
+                             check=True, capture_output=True,
+                             text=True).stdout.split()
+        assert [bytes.fromhex(v) if v != "-" else None for v in out] == \
+            [b"one\0", b"two\0", b"\0", None], out
+    print("[PASS] eht_write_c / eht_codegen (static C tables)")
+
+
+CONSTEXPR_PROGRAM = r"""
+#include "elastic_hash_table.hpp"
+#include <cstdio>
+
+constexpr auto ports = eht::make_static_table<int>({
+    {"http", 80}, {"https", 443}, {"ssh", 22}, {"http", 8080},
+});
+static_assert(ports.size() == 3 && ports.at("http") == 8080);
+static_assert(ports.contains("ssh") && !ports.contains("ftp"));
+
+constexpr char K[] = "kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk"
+                     "kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk"
+                     "kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk";
+template <std::size_t... I>
+constexpr auto prefixes(std::index_sequence<I...>)
+{
+    return eht::make_static_table<int>({{std::string_view(K, I + 1), int(I)}...});
+}
+constexpr auto many = prefixes(std::make_index_sequence<180>{});
+static_assert(many.size() == 180 && many.num_levels > 1);
+static_assert(many.at(std::string_view(K, 100)) == 99);
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        const int* p = ports.find(argv[i]);
+        std::printf("%d\n", p ? *p : -1);
+    }
+    int n = 0;
+    many.for_each([&](std::string_view k, int v) { n += many.at(k) == v; });
+    return n == 180 ? 0 : 1;
+}
+"""
+
+
+def test_constexpr_table():
+    cxx = shutil.which("c++") or shutil.which("g++") or shutil.which("clang++")
+    if not cxx:
+        print("[SKIP] eht::StaticTable (no C++ compiler)")
+        return
+    here = os.path.dirname(os.path.abspath(__file__))
+    with tempfile.TemporaryDirectory() as d:
+        src, exe = os.path.join(d, "cx.cpp"), os.path.join(d, "cx")
+        with open(src, "w") as f:
+            f.write(CONSTEXPR_PROGRAM)
+        r = subprocess.run([cxx, "-std=c++20", "-O1", "-I", here, "-o", exe,
+                            src], capture_output=True, text=True)
+        if r.returncode and "c++20" in r.stderr:
+            print("[SKIP] eht::StaticTable (compiler lacks C++20)")
+            return
+        assert r.returncode == 0, r.stderr[-2000:]
+        out = subprocess.run([exe, "https", "http", "gopher"], check=True,
+                             capture_output=True, text=True).stdout.split()
+        assert out == ["443", "8080", "-1"], out
+    print("[PASS] eht::StaticTable (C++20 constexpr table)")
+
+
+def build_tools(d, *names):
+    """Compile the named eht_*.c tools (with the library) into d; returns
+    their paths, or None when there is no C compiler or no Linux."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if not cc or not sys.platform.startswith("linux"):
+        return None
+    here = os.path.dirname(os.path.abspath(__file__))
+    out = []
+    for name in names:
+        exe = os.path.join(d, name)
+        subprocess.run([cc, "-O1", "-pthread", "-I", here, "-o", exe,
+                        os.path.join(here, name + ".c"),
+                        os.path.join(here, "elastic_hash_table.c"), "-lm"],
+                       check=True)
+        out.append(exe)
+    return out
+
+
+def start_server(exe, *args):
+    """Run eht_server with args and wait until its Unix sockets are up."""
+    paths = [args[i + 1] for i, a in enumerate(args) if a in ("-u", "-R", "-A", "-L")]
+    proc = subprocess.Popen([exe, *args], stderr=subprocess.DEVNULL)
+    for _ in range(200):
+        if all(os.path.exists(p) for p in paths):
+            return proc
+        time.sleep(0.01)
+    proc.kill()
+    raise AssertionError("eht_server did not start")
+
+
+class BinClient:
+    def __init__(self, path):
+        import socket
+        self.s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.s.connect(path)
+        self.f = self.s.makefile("rb")
+
+    @staticmethod
+    def frame(op, body=b""):
+        return struct.pack("<IB", len(body) + 1, op) + body
+
+    def read(self):
+        n, status = struct.unpack("<IB", self.f.read(5))
+        return status, self.f.read(n - 1)
+
+    def call(self, op, body=b""):
+        self.s.sendall(self.frame(op, body))
+        return self.read()
+
+    def close(self):
+        self.f.close()
+        self.s.close()
+
+
+def test_server():
+    with tempfile.TemporaryDirectory() as d:
+        tools = build_tools(d, "eht_server", "eht_loadgen")
+        if not tools:
+            print("[SKIP] eht_server (needs Linux and a C compiler)")
+            return
+        server, loadgen = tools
+        sock = os.path.join(d, "eht.sock")
+        proc = start_server(server, "-p", "0", "-u", sock, "-t", "2", "-S", "4")
+        try:
+            c = BinClient(sock)
+            GET, SET, DEL, MGET, LEN, PING = range(1, 7)
+            kv = lambda k, v: struct.pack("<I", len(k)) + k + v
+            assert c.call(PING, b"hi") == (0, b"hi")
+            assert c.call(SET, kv(b"alpha", b"\x00\x01value")) == (0, b"")
+            assert c.call(GET, b"alpha") == (0, b"\x00\x01value")
+            assert c.call(GET, b"beta") == (1, b"")
+            assert c.call(DEL, b"alpha") == (0, b"")
+            assert c.call(DEL, b"alpha") == (1, b"")
+            assert c.call(GET, b"bad\x00key")[0] == 2
+            assert c.call(99)[0] == 2
+
+            # Pipelined: 500 SETs in one write, then all the replies
+            c.s.sendall(b"".join(c.frame(SET, kv(b"k%d" % i, b"v%d" % i))
+                                 for i in range(500)))
+            assert all(c.read() == (0, b"") for _ in range(500))
+            assert c.call(LEN) == (0, struct.pack("<Q", 500))
+
+            keys = [b"k7", b"nope", b"k499", b"k0"]
+            st, body = c.call(MGET, b"".join(struct.pack("<I", len(k)) + k
+                                             for k in keys))
+            vals, off = [], 0
+            while off < len(body):
+                (n,) = struct.unpack_from("<I", body, off)
+                off += 4
+                if n == 0xFFFFFFFF:
+                    vals.append(None)
+                else:
+                    vals.append(body[off:off + n])
+                    off += n
+            assert st == 0 and vals == [b"v7", None, b"v499", b"v0"], vals
+            c.close()
+
+            for extra in ([], ["-b", "8"]):
+                r = subprocess.run([loadgen, "-u", sock, "-c", "2", "-n", "4000",
+                                    "-k", "1000", "-P", "16", "-l", *extra],
+                                   check=True, capture_output=True, text=True)
+                stats = dict(f.split("=") for f in r.stdout.split())
+                assert stats["requests"] == "4000" and stats["errors"] == "0"
+                assert int(stats["hits"]) > 0 and stats["misses"] == "0", stats
+        finally:
+            proc.terminate()
+            assert proc.wait(timeout=10) == 0
+        assert not os.path.exists(sock)
+    print("[PASS] eht_server binary protocol + eht_loadgen")
+
+
+def resp_encode(*args):
+    return b"*%d\r\n" % len(args) + b"".join(
+        b"$%d\r\n%s\r\n" % (len(a), a) for a in args)
+
+
+def resp_read(f):
+    """One RESP2/RESP3 reply from file f; errors come back as Exception."""
+    line = f.readline()[:-2]
+    t, rest = line[:1], line[1:]
+    if t == b"+":
+        return rest.decode()
+    if t == b"-":
+        return Exception(rest.decode())
+    if t == b":":
+        return int(rest)
+    if t == b"_":
+        return None
+    if t == b"$":
+        n = int(rest)
+        return None if n < 0 else f.read(n + 2)[:-2]
+    if t in (b"*", b"%"):
+        n = int(rest) * (2 if t == b"%" else 1)
+        return [resp_read(f) for _ in range(n)]
+    raise AssertionError(line)
+
+
+def test_resp_server():
+    import socket
+    with tempfile.TemporaryDirectory() as d:
+        tools = build_tools(d, "eht_server", "eht_loadgen")
+        if not tools:
+            print("[SKIP] eht_server RESP (needs Linux and a C compiler)")
+            return
+        server, loadgen = tools
+        sock = os.path.join(d, "resp.sock")
+        proc = start_server(server, "-p", "0", "-R", sock, "-t", "2", "-S", "4",
+                            "-c", "256")
+        try:
+            s = socket.socket(socket.AF_UNIX)
+            s.connect(sock)
+            f = s.makefile("rb")
+
+            def call(*args):
+                s.sendall(resp_encode(*args))
+                return resp_read(f)
+
+            assert call(b"PING") == "PONG"
+            assert call(b"SET", b"a", b"1") == "OK"
+            assert call(b"get", b"a") == b"1"
+            assert call(b"GET", b"missing") is None
+            assert call(b"INCR", b"a") == 2 and call(b"DECRBY", b"n", b"5") == -5
+            assert call(b"SET", b"ab", b"x") == "OK"
+            assert isinstance(call(b"INCR", b"ab"), Exception)
+            assert call(b"SET", b"a", b"v", b"NX") is None
+            assert call(b"SET", b"a", b"v", b"XX", b"GET") == b"2"
+            assert call(b"SET", b"z", b"v", b"XX") is None
+            assert call(b"SET", b"e", b"v", b"EX", b"100") == "OK"
+            assert 99 <= call(b"TTL", b"e") <= 100 and call(b"TTL", b"a") == -1
+            assert call(b"SET", b"e", b"w", b"KEEPTTL") == "OK" and call(b"TTL", b"e") > 0
+            assert call(b"EXPIRE", b"e", b"0") == 1 and call(b"TTL", b"e") == -2
+            assert isinstance(call(b"SET", b"a", b"v", b"EX", b"0"), Exception)
+            assert call(b"MSET", b"x", b"1", b"y", b"2", b"x", b"3") == "OK"
+            assert call(b"MGET", b"x", b"nope", b"y") == [b"3", None, b"2"]
+            assert call(b"EXISTS", b"x", b"x", b"nope") == 2
+            assert call(b"DEL", b"x", b"nope") == 1
+            assert isinstance(call(b"NOSUCH"), Exception)
+
+            # Pipelined inline and multibulk commands, answered in order
+            s.sendall(b"PING hi\r\n" + resp_encode(b"DBSIZE") +
+                      b"".join(resp_encode(b"SET", b"k%d" % i, b"v")
+                               for i in range(300)))
+            assert resp_read(f) == b"hi" and resp_read(f) == 4
+            assert all(resp_read(f) == "OK" for _ in range(300))
+            assert call(b"DBSIZE") == 304
+
+            seen, cursor, calls = [], b"0", 0
+            while True:
+                cursor, keys = call(b"SCAN", cursor, b"MATCH", b"k*",
+                                    b"COUNT", b"25")
+                seen += keys
+                calls += 1
+                if cursor == b"0":
+                    break
+            assert sorted(seen) == sorted(b"k%d" % i for i in range(300))
+            assert calls > 5
+
+            # Rebuilds mid-scan compact the shards: keys present throughout
+            # still come back
+            cursor, first = call(b"SCAN", b"0", b"MATCH", b"k*", b"COUNT", b"25")
+            assert call(b"DEL", *first) == len(first)
+            s.sendall(b"".join(resp_encode(b"SET", b"g%d" % i, b"v")
+                               for i in range(3000)))
+            assert all(resp_read(f) == "OK" for _ in range(3000))
+            seen = set()
+            while cursor != b"0":
+                cursor, keys = call(b"SCAN", cursor, b"MATCH", b"k*",
+                                    b"COUNT", b"25")
+                seen.update(keys)
+            assert seen == {b"k%d" % i for i in range(300)} - set(first)
+            call(b"MSET", *[x for k in first for x in (k, b"v")])
+
+            # A pattern with many stars costs no more than one with one
+            assert call(b"SET", b"k" * 300, b"v") == "OK"
+            t0 = time.time()
+            cursor, keys = call(b"SCAN", b"0", b"MATCH", b"*k" * 40 + b"z",
+                                b"COUNT", b"10000")
+            assert keys == [] and time.time() - t0 < 1
+            assert call(b"DEL", b"k" * 300) == 1
+            for i in range(3000):
+                s.sendall(resp_encode(b"DEL", b"g%d" % i))
+            assert all(resp_read(f) == 1 for _ in range(3000))
+
+            info = call(b"INFO").decode()
+            assert "db0:keys=304" in info and "level0:capacity=" in info
+
+            hello = call(b"HELLO", b"3")
+            assert dict(zip(hello[::2], hello[1::2]))[b"proto"] == 3
+            s.sendall(resp_encode(b"GET", b"missing"))
+            assert f.readline() == b"_\r\n"
+            assert call(b"QUIT") == "OK" and f.read() == b""
+            f.close()
+            s.close()
+
+            r = subprocess.run([loadgen, "-u", sock, "-R", "-c", "2", "-n", "3000",
+                                "-k", "500", "-l", "-b", "4"],
+                               check=True, capture_output=True, text=True)
+            stats = dict(kv.split("=") for kv in r.stdout.split())
+            assert stats["errors"] == "0" and stats["misses"] == "0", stats
+        finally:
+            proc.terminate()
+            assert proc.wait(timeout=10) == 0
+    print("[PASS] eht_server RESP front-end")
+
+
+def test_memcached_server():
+    import socket
+    with tempfile.TemporaryDirectory() as d:
+        tools = build_tools(d, "eht_server", "eht_loadgen")
+        if not tools:
+            print("[SKIP] eht_server memcached (needs Linux and a C compiler)")
+            return
+        server, loadgen = tools
+        sock = os.path.join(d, "mc.sock")
+        rsock = os.path.join(d, "resp.sock")
+        proc = start_server(server, "-p", "0", "-A", sock, "-R", rsock,
+                            "-t", "2", "-S", "4", "-m", "4")
+        try:
+            s = socket.socket(socket.AF_UNIX)
+            s.connect(sock)
+            f = s.makefile("rb")
+
+            def call(line, data=None, lines=1):
+                s.sendall(line + b"\r\n" + (data + b"\r\n" if data is not None else b""))
+                return b"".join(f.readline() for _ in range(lines))
+
+            assert call(b"set a 5 0 3", b"abc") == b"STORED\r\n"
+            assert call(b"get a nope", lines=3) == b"VALUE a 5 3\r\nabc\r\nEND\r\n"
+            assert call(b"add a 0 0 1", b"x") == b"NOT_STORED\r\n"
+            assert call(b"replace z 0 0 1", b"x") == b"NOT_STORED\r\n"
+            assert call(b"append a 0 0 2", b"de") == b"STORED\r\n"
+            assert call(b"prepend a 0 0 1", b">") == b"STORED\r\n"
+            head = call(b"gets a", lines=3).split(b"\r\n")
+            assert head[0].startswith(b"VALUE a 5 6 ") and head[1] == b">abcde"
+            cas = head[0].split()[4]
+            assert call(b"cas a 0 0 1 " + cas, b"y") == b"STORED\r\n"
+            assert call(b"cas a 0 0 1 " + cas, b"z") == b"EXISTS\r\n"
+            # Values stop at 64 MiB, however they are built up
+            huge = b"h" * (64 << 20)
+            assert call(b"append a 0 0 %d" % len(huge), huge) == \
+                b"SERVER_ERROR object too large for cache\r\n"
+            assert call(b"get a", lines=3) == b"VALUE a 0 1\r\ny\r\nEND\r\n"
+            del huge
+            assert call(b"set n 0 0 2", b"10") == b"STORED\r\n"
+            assert call(b"incr n 5") == b"15\r\n" and call(b"decr n 20") == b"0\r\n"
+            assert call(b"incr a 1").startswith(b"CLIENT_ERROR")
+            assert call(b"delete n") == b"DELETED\r\n"
+            assert call(b"delete n") == b"NOT_FOUND\r\n"
+            assert call(b"bogus").startswith(b"ERROR")
+
+            # Meta commands; the quiet flag leaves only the mn marker
+            assert call(b"ms m 2 T0 F7 c", b"hi").startswith(b"HD c")
+            assert call(b"mg m v f k", lines=2) == b"VA 2 f7 km\r\nhi\r\n"
+            assert call(b"mg none v q\r\nmg m s q\r\nmn", lines=2) == b"HD s2\r\nMN\r\n"
+            assert call(b"ma m").startswith(b"CLIENT_ERROR")
+            assert call(b"ma c N0 J4 v", lines=2) == b"VA 1\r\n4\r\n"
+            assert call(b"ma c MI D3 v", lines=2) == b"VA 1\r\n7\r\n"
+            assert call(b"md c q\r\nmg c") == b"EN\r\n"
+
+            # Expiry and the RESP view of the same store
+            assert call(b"set t 0 1 1", b"x") == b"STORED\r\n"
+            r = socket.socket(socket.AF_UNIX)
+            r.connect(rsock)
+            rf = r.makefile("rb")
+            r.sendall(resp_encode(b"GET", b"a") + resp_encode(b"TTL", b"t"))
+            assert resp_read(rf) == b"y" and resp_read(rf) in (1, 0)
+            time.sleep(2.2)
+            assert call(b"get t", lines=1) == b"END\r\n"
+
+            # 4 MB holds about 40 of these: older ones are evicted
+            big = b"v" * 100000
+            for i in range(200):
+                assert call(b"set big%d 0 0 %d" % (i, len(big)), big) == b"STORED\r\n"
+            assert call(b"get big0", lines=1) == b"END\r\n"
+            assert call(b"get big199", lines=3) == b"VALUE big199 0 %d\r\n" % len(big) + big + b"\r\nEND\r\n"
+            s.sendall(b"stats\r\n")
+            stats = dict(iter(lambda: f.readline().split()[1:], []))
+            assert int(stats[b"evictions"]) > 100 and int(stats[b"reclaimed"]) == 1
+            assert int(stats[b"total_malloced"]) <= 4 << 20
+            r.sendall(resp_encode(b"INFO"))
+            assert "evicted_keys:" in resp_read(rf).decode()
+            rf.close()
+            r.close()
+
+            assert call(b"flush_all") == b"OK\r\n"
+            assert call(b"get a", lines=1) == b"END\r\n"
+            f.close()
+            s.close()
+
+            r = subprocess.run([loadgen, "-u", sock, "-M", "-c", "2", "-n", "3000",
+                                "-k", "500", "-l", "-b", "4"],
+                               check=True, capture_output=True, text=True)
+            stats = dict(kv.split("=") for kv in r.stdout.split())
+            assert stats["errors"] == "0" and stats["misses"] == "0", stats
+        finally:
+            proc.terminate()
+            assert proc.wait(timeout=10) == 0
+    print("[PASS] eht_server memcached front-end")
+
+
+def test_replication():
+    import socket
+    with tempfile.TemporaryDirectory() as d:
+        tools = build_tools(d, "eht_server")
+        if not tools:
+            print("[SKIP] eht_server replication (needs Linux and a C compiler)")
+            return
+        server, = tools
+        path = lambda name: os.path.join(d, name)
+
+        def resp(sock):
+            s = socket.socket(socket.AF_UNIX)
+            s.connect(sock)
+            f = s.makefile("rb")
+
+            def call(*args):
+                s.sendall(resp_encode(*args))
+                return resp_read(f)
+            return call
+
+        def info(call):
+            return dict(l.split(":", 1) for l in call(b"INFO").decode().split("\r\n")
+                        if ":" in l)
+
+        def wait_for(cond):
+            for _ in range(500):
+                if cond():
+                    return
+                time.sleep(0.01)
+            raise AssertionError("replica did not catch up")
+
+        primary = start_server(server, "-p", "0", "-R", path("p.sock"),
+                               "-A", path("pmc.sock"), "-L", path("repl.sock"))
+        replica = None
+        try:
+            P = resp(path("p.sock"))
+            for i in range(500):
+                assert P(b"SET", b"k%d" % i, b"v%d" % i) == "OK"
+            assert P(b"SET", b"t", b"x", b"EX", b"100") == "OK"
+            mc = socket.socket(socket.AF_UNIX)
+            mc.connect(path("pmc.sock"))
+            mc.sendall(b"set f 42 0 2\r\nhi\r\n")
+            assert mc.makefile("rb").readline() == b"STORED\r\n"
+
+            # Initial sync from the snapshot
+            replica = start_server(server, "-p", "0", "-R", path("r.sock"),
+                                   "-A", path("rmc.sock"), "-O", path("repl.sock"))
+            R = resp(path("r.sock"))
+            wait_for(lambda: info(R)["master_link_status"] == "up")
+            assert R(b"DBSIZE") == 502 and R(b"GET", b"k7") == b"v7"
+            assert 98 <= R(b"TTL", b"t") <= 100
+
+            # The log: writes on the primary are applied as they happen
+            P(b"DEL", b"k1")
+            P(b"INCRBY", b"n", b"5")
+            P(b"EXPIRE", b"k2", b"0")
+            P(b"MSET", b"a", b"1", b"b", b"2")
+            # Order is kept per key: wait for the last write to each
+            wait_for(lambda: R(b"MGET", b"k1", b"k2", b"n", b"a", b"b") ==
+                     [None, None, b"5", b"1", b"2"])
+            assert R(b"DBSIZE") == 503
+
+            # A value as long as a RESP bulk string makes a record longer
+            # than one, which the replica still takes
+            huge = b"h" * (64 << 20)
+            assert P(b"SET", b"huge", huge) == "OK"
+            P(b"SET", b"after", b"1")
+            wait_for(lambda: R(b"GET", b"after") == b"1")
+            assert R(b"GET", b"huge") == huge
+            assert info(R)["master_link_status"] == "up"
+            P(b"DEL", b"huge")
+            del huge
+
+            # Replicas refuse writes in every protocol
+            assert str(R(b"SET", b"a", b"9")).startswith("READONLY")
+            assert str(R(b"INCR", b"n")).startswith("READONLY")
+            assert R(b"GET", b"a") == b"1"
+            rmc = socket.socket(socket.AF_UNIX)
+            rmc.connect(path("rmc.sock"))
+            rmc.sendall(b"mg f f v\r\nset f 0 0 1\r\nx\r\nmg f T10\r\n")
+            rf = rmc.makefile("rb")
+            assert rf.readline() == b"VA 2 f42\r\n" and rf.readline() == b"hi\r\n"
+            assert rf.readline() == rf.readline() == b"SERVER_ERROR read-only replica\r\n"
+            rmc.close()
+
+            # Lag: both ends agree on the offset once the log is applied
+            wait_for(lambda: info(P)["slave0"].endswith("lag_bytes=0"))
+            pi, ri = info(P), info(R)
+            assert pi["role"] == "master" and pi["connected_slaves"] == "1"
+            assert ri["role"] == "slave" and ri["slave_read_only"] == "1"
+            assert "state=online" in pi["slave0"]
+            assert int(pi["master_repl_offset"]) >= int(ri["slave_repl_offset"]) > 0
+
+            # A restarted replica resyncs in full
+            replica.terminate()
+            assert replica.wait(timeout=10) == 0
+            P(b"SET", b"later", b"yes")
+            replica = start_server(server, "-p", "0", "-R", path("r.sock"),
+                                   "-O", path("repl.sock"))
+            R = resp(path("r.sock"))
+            wait_for(lambda: R(b"GET", b"later") == b"yes")
+            wait_for(lambda: info(P)["connected_slaves"] == "1")
+
+            # Promotion: the replica stops following and takes writes
+            assert R(b"REPLICAOF", b"NO", b"ONE") == "OK"
+            assert R(b"SET", b"a", b"9") == "OK" and info(R)["role"] == "master"
+            wait_for(lambda: info(P)["connected_slaves"] == "0")
+            assert P(b"GET", b"a") == b"1"
+        finally:
+            for proc in (replica, primary):
+                if proc:
+                    proc.terminate()
+                    assert proc.wait(timeout=10) == 0
+    print("[PASS] eht_server primary/replica replication")
+
+
+def test_metrics_server():
+    import socket
+    import urllib.error
+    import urllib.request
+    with tempfile.TemporaryDirectory() as d:
+        tools = build_tools(d, "eht_server")
+        if not tools:
+            print("[SKIP] eht_server metrics (needs Linux and a C compiler)")
+            return
+        server, = tools
+        path = lambda name: os.path.join(d, name)
+        with socket.socket() as s:          # a free port for -M
+            s.bind(("127.0.0.1", 0))
+            port = s.getsockname()[1]
+        proc = start_server(server, "-p", "0", "-u", path("b.sock"),
+                            "-R", path("r.sock"), "-A", path("m.sock"),
+                            "-M", str(port), "-S", "4", "-c", "64")
+        url = f"http://127.0.0.1:{port}"
+
+        def scrape():
+            with urllib.request.urlopen(url + "/metrics", timeout=5) as r:
+                assert r.headers["Content-Type"].startswith("text/plain; version=0.0.4")
+                text = r.read().decode()
+            samples = {}
+            for line in text.splitlines():
+                if line and not line.startswith("#"):
+                    name, value = line.rsplit(" ", 1)
+                    samples[name] = float(value)
+            return samples
+
+        try:
+            for _ in range(200):
+                try:
+                    m = scrape()
+                    break
+                except OSError:
+                    time.sleep(0.01)
+            assert m["eht_items"] == 0 and m["eht_shards"] == 4
+
+            r = socket.socket(socket.AF_UNIX)
+            r.connect(path("r.sock"))
+            r.sendall(b"".join(resp_encode(b"SET", b"k%d" % i, b"v") for i in range(3000)))
+            r.sendall(resp_encode(b"GET", b"k1") + resp_encode(b"NOSUCH"))
+            rf = r.makefile("rb")
+            replies = [resp_read(rf) for _ in range(3002)]
+            assert replies[-2] == b"v" and isinstance(replies[-1], Exception)
+            mc = socket.socket(socket.AF_UNIX)
+            mc.connect(path("m.sock"))
+            mc.sendall(b"get k1 k2\r\nmn\r\n")
+            mf = mc.makefile("rb")
+            while mf.readline() != b"MN\r\n":
+                pass
+            b = BinClient(path("b.sock"))
+            assert b.call(1, b"k5") == (0, b"v")
+
+            m = scrape()
+            assert m["eht_items"] == 3000
+            levels = [v for k, v in m.items() if k.startswith("eht_level_count{")]
+            assert sum(levels) == 3000 and m['eht_level_count{level="0"}'] > 0
+            assert m["eht_probe_length_count"] == 3000
+            assert m['eht_probe_length_bucket{le="1"}'] > 0
+            assert m['eht_probe_length_bucket{le="+Inf"}'] == 3000
+            assert m["eht_rebuilds_total"] > 0        # the 4 shards grew
+            assert m["eht_rebuild_seconds_total"] >= m["eht_rebuild_seconds_max"] > 0
+            assert m["eht_keyspace_hits_total"] == 4
+
+            count = lambda proto, cmd: m.get(
+                f'eht_command_duration_seconds_count{{proto="{proto}",command="{cmd}"}}')
+            assert count("resp", "set") == 3000 and count("resp", "get") == 1
+            assert count("resp", "other") == 1
+            assert count("memcached", "get") == count("memcached", "mn") == 1
+            assert count("binary", "get") == 1 and count("binary", "set") is None
+            buckets = [v for k, v in m.items() if k.startswith(
+                'eht_command_duration_seconds_bucket{proto="resp",command="set"')]
+            assert buckets == sorted(buckets) and buckets[-1] == 3000
+            assert 0 < m['eht_command_duration_seconds_sum{proto="resp",command="set"}'] < 10
+
+            try:
+                urllib.request.urlopen(url + "/", timeout=5)
+                raise AssertionError("expected 404")
+            except urllib.error.HTTPError as e:
+                assert e.code == 404
+            for sock in (r, mc):
+                sock.close()
+            b.close()
+        finally:
+            proc.terminate()
+            assert proc.wait(timeout=10) == 0
+    print("[PASS] eht_server Prometheus metrics endpoint")
+
+
 def main():
     print("=" * 64)
     print("Elastic Hash Table — Python + C Test Suite")
@@ -217,10 +1406,34 @@ def main():
     test_auto_resize()
     test_numeric_string_keys()
     test_large_values()
+    test_adaptive_promotion()
+    test_robin_hood()
+    test_insert_only()
+    test_tiny_table()
+    test_ordered_layout()
+    test_compact_layout()
+    test_prefetch_mode()
+    test_prefetch_tokens()
+    test_precomputed_hash()
+    test_batch_operations()
+    test_hash_selection()
+    test_seeded_tables()
+    test_table_diagnostics()
+    test_level_hints()
+    test_hash_join()
+    test_freeze()
+    test_freeze_perfect()
+    test_static_codegen()
+    test_constexpr_table()
+    test_server()
+    test_resp_server()
+    test_memcached_server()
+    test_replication()
+    test_metrics_server()
 
     print()
     print("=" * 64)
-    print(f"All 13 tests passed.")
+    print(f"All 37 tests passed.")
     print("=" * 64)
 
 